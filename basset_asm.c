@@ -77,6 +77,12 @@ static const OpcodeEntry opcode_table[] = {
     {"STR_ARRAY_SET_1D", OP_STR_ARRAY_SET_1D},
     {"STR_ARRAY_GET_2D", OP_STR_ARRAY_GET_2D},
     {"STR_ARRAY_SET_2D", OP_STR_ARRAY_SET_2D},
+    {"ARRAY_LOAD_1D", OP_ARRAY_LOAD_1D},
+    {"ARRAY_STORE_1D", OP_ARRAY_STORE_1D},
+    {"ARRAY_LOAD_2D", OP_ARRAY_LOAD_2D},
+    {"ARRAY_STORE_2D", OP_ARRAY_STORE_2D},
+    {"ARRAY_ADDR_2D", OP_ARRAY_ADDR_2D},
+    {"ARRAY_STORE_ADDR", OP_ARRAY_STORE_ADDR},
     {"JUMP", OP_JUMP},
     {"JUMP_IF_FALSE", OP_JUMP_IF_FALSE},
     {"JUMP_IF_TRUE", OP_JUMP_IF_TRUE},
@@ -88,6 +94,10 @@ static const OpcodeEntry opcode_table[] = {
     {"ON_GOSUB", OP_ON_GOSUB},
     {"FOR_INIT", OP_FOR_INIT},
     {"FOR_NEXT", OP_FOR_NEXT},
+    {"FOR_INIT_INT", OP_FOR_INIT_INT},
+    {"FOR_NEXT_INT", OP_FOR_NEXT_INT},
+    {"FOR_ENTER", OP_FOR_ENTER},
+    {"FOR_LOOP", OP_FOR_LOOP},
     {"PRINT_NUM", OP_PRINT_NUM},
     {"PRINT_STR", OP_PRINT_STR},
     {"PRINT_NEWLINE", OP_PRINT_NEWLINE},
@@ -126,6 +136,51 @@ static const OpcodeEntry opcode_table[] = {
     {"RANDOMIZE", OP_RANDOMIZE},
     {"NOP", OP_NOP},
     {"HALT", OP_HALT},
+    {"VAR_ADD_CONST_POP", OP_VAR_ADD_CONST_POP},
+    {"VAR_SUB_CONST_POP", OP_VAR_SUB_CONST_POP},
+    {"VAR_MUL_VAR", OP_VAR_MUL_VAR},
+    {"VAR_ARRAY_GET_1D", OP_VAR_ARRAY_GET_1D},
+    {"JNLT", OP_JNLT},
+    {"JNLE", OP_JNLE},
+    {"JNGT", OP_JNGT},
+    {"JNGE", OP_JNGE},
+    {"JNEQ", OP_JNEQ},
+    {"JNNE", OP_JNNE},
+    {"R_MOV", OP_R_MOV},
+    {"R_ADD", OP_R_ADD},
+    {"R_SUB", OP_R_SUB},
+    {"R_MUL", OP_R_MUL},
+    {"R_DIV", OP_R_DIV},
+    {"R_POW", OP_R_POW},
+    {"R_NEG", OP_R_NEG},
+    {"R_PUSH", OP_R_PUSH},
+    {"R_POP", OP_R_POP},
+    {"R_JNLT", OP_R_JNLT},
+    {"R_JNLE", OP_R_JNLE},
+    {"R_JNGT", OP_R_JNGT},
+    {"R_JNGE", OP_R_JNGE},
+    {"R_JNEQ", OP_R_JNEQ},
+    {"R_JNNE", OP_R_JNNE},
+    {"N_PUSH_CONST", OP_N_PUSH_CONST},
+    {"N_PUSH_VAR", OP_N_PUSH_VAR},
+    {"N_POP_VAR", OP_N_POP_VAR},
+    {"N_ADD", OP_N_ADD},
+    {"N_SUB", OP_N_SUB},
+    {"N_MUL", OP_N_MUL},
+    {"N_DIV", OP_N_DIV},
+    {"N_POW", OP_N_POW},
+    {"N_NEG", OP_N_NEG},
+    {"N_EQ", OP_N_EQ},
+    {"N_NE", OP_N_NE},
+    {"N_LT", OP_N_LT},
+    {"N_LE", OP_N_LE},
+    {"N_GT", OP_N_GT},
+    {"N_GE", OP_N_GE},
+    {"N_AND", OP_N_AND},
+    {"N_OR", OP_N_OR},
+    {"N_NOT", OP_N_NOT},
+    {"N_BOX", OP_N_BOX},
+    {"N_VAR_MUL_VAR", OP_N_VAR_MUL_VAR},
     {NULL, 0}
 };
 
@@ -200,6 +255,24 @@ int main(int argc, char **argv) {
         /* Skip empty lines and comments */
         if (*p == 0 || *p == ';') continue;
         
+        /* Instruction set directive: .ISA reg <temporaries> */
+        if (strncmp(p, ".ISA", 4) == 0) {
+            char isa_name[16];
+            unsigned temps = 0;
+            if (sscanf(p, ".ISA %15s %u", isa_name, &temps) >= 1) {
+                if (strcmp(isa_name, "reg") == 0) {
+                    prog->isa = ISA_REG;
+                    prog->reg_temps = (uint8_t)temps;
+                } else if (strcmp(isa_name, "stack") == 0) {
+                    prog->isa = ISA_STACK;
+                } else {
+                    fprintf(stderr, "Warning line %d: Unknown ISA '%s'\n",
+                            line_num, isa_name);
+                }
+            }
+            continue;
+        }
+        
         /* Check for section headers */
         if (strcmp(p, ".CONST_POOL") == 0) {
             section = SECTION_CONST;
@@ -6,6 +6,7 @@
 #include "parser.h"
 #include "compiler.h"
 #include "bytecode_file.h"
+#include "emit_c.h"
 #include "syntax_tables.h"
 #include "keyword_hash.h"
 
@@ -43,36 +44,74 @@ static char* read_file(const char *filename) {
     return buffer;
 }
 
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-O] [--isa=stack|reg] [--emit-c] <source.bas> [output]\n", prog);
+    fprintf(stderr, "  Compiles BASIC source to binary bytecode\n");
+    fprintf(stderr, "  Default output: source.abc (source.c with --emit-c)\n");
+    fprintf(stderr, "  -O           Thread jumps and drop redundant instructions\n");
+    fprintf(stderr, "  --isa=stack  Stack machine instructions (default)\n");
+    fprintf(stderr, "  --isa=reg    Register instructions for numeric arithmetic\n");
+    fprintf(stderr, "  --emit-c     Write a C program to link with libbasset_rt.a\n");
+}
+
 int main(int argc, char **argv) {
     char *source;
-    char *output_file;
+    char *source_file = NULL;
+    char *output_file = NULL;
+    int output_allocated = 0;
+    int emit_c = 0;
+    int i;
     Tokenizer tokenizer;
     Parser *parser;
     ParseNode *program;
     CompiledProgram *compiled;
+    CompilerOptions options;
+    
+    compiler_options_init(&options);
+    
+    /* Parse arguments */
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-O") == 0) {
+            options.optimize = 1;
+        } else if (strcmp(argv[i], "--isa=stack") == 0) {
+            options.isa = ISA_STACK;
+        } else if (strcmp(argv[i], "--isa=reg") == 0) {
+            options.isa = ISA_REG;
+        } else if (strcmp(argv[i], "--emit-c") == 0) {
+            emit_c = 1;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            usage(argv[0]);
+            return 1;
+        } else if (!source_file) {
+            source_file = argv[i];
+        } else if (!output_file) {
+            output_file = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
     
-    /* Check arguments */
-    if (argc < 2 || argc > 3) {
-        fprintf(stderr, "Usage: %s <source.bas> [output.abc]\n", argv[0]);
-        fprintf(stderr, "  Compiles BASIC source to binary bytecode\n");
-        fprintf(stderr, "  Default output: source.abc\n");
+    if (!source_file) {
+        usage(argv[0]);
         return 1;
     }
     
     /* Determine output file */
-    if (argc == 3) {
-        output_file = argv[2];
-    } else {
-        /* Generate output filename: replace .bas with .abc */
-        size_t len = strlen(argv[1]);
+    if (!output_file) {
+        /* Generate output filename: replace .bas with .abc (or .c) */
+        const char *ext = emit_c ? ".c" : ".abc";
+        size_t len = strlen(source_file);
         output_file = malloc(len + 5);
-        strcpy(output_file, argv[1]);
+        output_allocated = 1;
+        strcpy(output_file, source_file);
         
         /* Replace extension */
         if (len > 4 && strcmp(output_file + len - 4, ".bas") == 0) {
-            strcpy(output_file + len - 4, ".abc");
+            strcpy(output_file + len - 4, ext);
         } else {
-            strcat(output_file, ".abc");
+            strcat(output_file, ext);
         }
     }
     
@@ -83,9 +122,9 @@ int main(int argc, char **argv) {
     keyword_hash_init();
     
     /* Read source file */
-    source = read_file(argv[1]);
+    source = read_file(source_file);
     if (!source) {
-        if (argc == 2) free(output_file);
+        if (output_allocated) free(output_file);
         return 1;
     }
     
@@ -102,36 +141,52 @@ int main(int argc, char **argv) {
         parser_free(parser);
         tokenizer_free(&tokenizer);
         free(source);
-        if (argc == 2) free(output_file);
+        if (output_allocated) free(output_file);
         return 1;
     }
     
     /* Compile to bytecode */
-    compiled = compiler_compile(program);
+    compiled = compiler_compile_with_options(program, &options);
     if (!compiled) {
         fprintf(stderr, "Compilation failed\n");
         parser_free(parser);
         tokenizer_free(&tokenizer);
         free(source);
-        if (argc == 2) free(output_file);
+        if (output_allocated) free(output_file);
         return 1;
     }
     
     /* Save to file */
-    printf("Compiling %s -> %s\n", argv[1], output_file);
+    printf("Compiling %s -> %s\n", source_file, output_file);
+    if (compiled->isa == ISA_REG) {
+        printf("  register ISA, %u temporaries\n", (unsigned)compiled->reg_temps);
+    }
     printf("  %lu instructions\n", (unsigned long)compiled->code_len);
     printf("  %lu constants\n", (unsigned long)compiled->const_count);
     printf("  %lu strings\n", (unsigned long)compiled->string_count);
     printf("  %lu variables\n", (unsigned long)compiled->var_count);
     printf("  %lu lines\n", (unsigned long)compiled->line_count);
     
-    if (!bytecode_file_save(output_file, compiled)) {
+    if (emit_c) {
+        FILE *out = fopen(output_file, "w");
+        int ok = out && emit_c_program(out, compiled, source_file);
+        if (out && fclose(out) != 0) ok = 0;
+        if (!ok) {
+            fprintf(stderr, "Failed to write C file\n");
+            compiled_program_free(compiled);
+            parser_free(parser);
+            tokenizer_free(&tokenizer);
+            free(source);
+            if (output_allocated) free(output_file);
+            return 1;
+        }
+    } else if (!bytecode_file_save(output_file, compiled)) {
         fprintf(stderr, "Failed to save bytecode file\n");
         compiled_program_free(compiled);
         parser_free(parser);
         tokenizer_free(&tokenizer);
         free(source);
-        if (argc == 2) free(output_file);
+        if (output_allocated) free(output_file);
         return 1;
     }
     
@@ -142,7 +197,7 @@ int main(int argc, char **argv) {
     parser_free(parser);
     tokenizer_free(&tokenizer);
     free(source);
-    if (argc == 2) free(output_file);
+    if (output_allocated) free(output_file);
     
     return 0;
 }
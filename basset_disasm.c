@@ -17,15 +17,22 @@ static const char* opcode_names[] = {
     /* 0x30 */ "STR_PUSH", "STR_CONCAT", "STR_LEN", "STR_VAL", "STR_CHR", "STR_STR", "STR_ASC", "STR_LEFT",
     /* 0x38 */ "STR_RIGHT", "STR_MID", "STR_MID_2", NULL, NULL, NULL, NULL, NULL,
     /* 0x40 */ "ARRAY_GET_1D", "ARRAY_SET_1D", "ARRAY_GET_2D", "ARRAY_SET_2D", "DIM_1D", "DIM_2D", "STR_ARRAY_GET_1D", "STR_ARRAY_SET_1D",
-    /* 0x48 */ "STR_ARRAY_GET_2D", "STR_ARRAY_SET_2D", NULL, NULL, NULL, NULL, NULL, NULL,
+    /* 0x48 */ "STR_ARRAY_GET_2D", "STR_ARRAY_SET_2D", "ARRAY_LOAD_1D", "ARRAY_STORE_1D", "ARRAY_LOAD_2D", "ARRAY_STORE_2D", "ARRAY_ADDR_2D", "ARRAY_STORE_ADDR",
     /* 0x50 */ "JUMP", "JUMP_IF_FALSE", "JUMP_IF_TRUE", "JUMP_LINE", "GOSUB", "GOSUB_LINE", "RETURN", "ON_GOTO",
-    /* 0x58 */ "ON_GOSUB", "FOR_INIT", "FOR_NEXT", NULL, NULL, NULL, NULL, NULL,
+    /* 0x58 */ "ON_GOSUB", "FOR_INIT", "FOR_NEXT", "FOR_INIT_INT", "FOR_NEXT_INT", "FOR_ENTER", "FOR_LOOP", NULL,
     /* 0x60 */ "PRINT_NUM", "PRINT_STR", "PRINT_NEWLINE", "PRINT_SPACE", "PRINT_TAB", "PRINT_NOSEP", "INPUT_NUM", "INPUT_STR",
     /* 0x68 */ "INPUT_PROMPT", "OPEN", "CLOSE", "GET", "PUT", "NOTE", "POINT", "STATUS",
     /* 0x70 */ "XIO", "DATA_READ_NUM", "DATA_READ_STR", "SET_PRINT_CHANNEL", "FUNC_SIN", "FUNC_COS", "FUNC_TAN", "FUNC_ATN",
     /* 0x78 */ "FUNC_EXP", "FUNC_LOG", "FUNC_CLOG", "FUNC_SQR", "FUNC_ABS", "FUNC_INT", "FUNC_RND", "FUNC_SGN",
     /* 0x80 */ NULL, "TRAP", "TRAP_DISABLE", "END", "STOP", "RESTORE", "RESTORE_LINE", "DEG",
     /* 0x88 */ "RAD", "RANDOMIZE", "CLR", "POP_GOSUB", "NOP", "HALT", "FUNC_PEEK", NULL,
+    /* 0x90 */ "VAR_ADD_CONST_POP", "VAR_SUB_CONST_POP", "VAR_MUL_VAR", "VAR_ARRAY_GET_1D", "JNLT", "JNLE", "JNGT", "JNGE",
+    /* 0x98 */ "JNEQ", "JNNE", NULL, NULL, NULL, NULL, NULL, NULL,
+    /* 0xA0 */ "R_MOV", "R_ADD", "R_SUB", "R_MUL", "R_DIV", "R_POW", "R_NEG", "R_PUSH",
+    /* 0xA8 */ "R_POP", "R_JNLT", "R_JNLE", "R_JNGT", "R_JNGE", "R_JNEQ", "R_JNNE", NULL,
+    /* 0xB0 */ "N_PUSH_CONST", "N_PUSH_VAR", "N_POP_VAR", "N_ADD", "N_SUB", "N_MUL", "N_DIV", "N_POW",
+    /* 0xB8 */ "N_NEG", "N_EQ", "N_NE", "N_LT", "N_LE", "N_GT", "N_GE", "N_AND",
+    /* 0xC0 */ "N_OR", "N_NOT", "N_BOX", "N_VAR_MUL_VAR",
 };
 
 /* Get opcode name */
@@ -85,6 +92,7 @@ static int has_operand(uint8_t opcode) {
         case OP_STR_ARRAY_SET_1D:
         case OP_STR_ARRAY_GET_2D:
         case OP_STR_ARRAY_SET_2D:
+        case OP_ARRAY_STORE_ADDR:
         case OP_JUMP:
         case OP_JUMP_IF_FALSE:
         case OP_JUMP_IF_TRUE:
@@ -95,6 +103,10 @@ static int has_operand(uint8_t opcode) {
         case OP_ON_GOSUB:
         case OP_FOR_INIT:
         case OP_FOR_NEXT:
+        case OP_FOR_INIT_INT:
+        case OP_FOR_NEXT_INT:
+        case OP_FOR_ENTER:
+        case OP_FOR_LOOP:
         case OP_PRINT_TAB:
         case OP_INPUT_NUM:
         case OP_INPUT_STR:
@@ -107,12 +119,155 @@ static int has_operand(uint8_t opcode) {
         case OP_FUNC_PEEK:
         case OP_TRAP:
         case OP_RESTORE_LINE:
+        case OP_VAR_ADD_CONST_POP:
+        case OP_VAR_SUB_CONST_POP:
+        case OP_VAR_MUL_VAR:
+        case OP_VAR_ARRAY_GET_1D:
+        case OP_JNLT:
+        case OP_JNLE:
+        case OP_JNGT:
+        case OP_JNGE:
+        case OP_JNEQ:
+        case OP_JNNE:
+        case OP_N_PUSH_CONST:
+        case OP_N_PUSH_VAR:
+        case OP_N_POP_VAR:
+        case OP_N_VAR_MUL_VAR:
             return 1;
         default:
             return 0;
     }
 }
 
+/* Format a tagged register operand: variable name, tN or #constant */
+static void format_register(CompiledProgram *prog, uint16_t reg, char *buf, size_t size) {
+    unsigned index = reg & REG_INDEX_MASK;
+    size_t j;
+    
+    switch (reg & REG_CLASS_MASK) {
+        case REG_VAR:
+            for (j = 0; j < prog->var_count; j++) {
+                if (prog->var_table[j].slot == index) {
+                    sprintf(buf, "%.*s", (int)(size - 1), prog->var_table[j].name);
+                    return;
+                }
+            }
+            sprintf(buf, "v%u", index);
+            return;
+        case REG_TEMP:
+            sprintf(buf, "t%u", index);
+            return;
+        case REG_CONST:
+            if (index < prog->const_count) {
+                sprintf(buf, "#%.15g", prog->const_pool[index]);
+            } else {
+                sprintf(buf, "#?%u", index);
+            }
+            return;
+        default:
+            sprintf(buf, "?%04X", (unsigned)reg);
+            return;
+    }
+}
+
+/* Print a register instruction and its operand words */
+static void print_register_instruction(FILE *out, CompiledProgram *prog, size_t pc) {
+    uint8_t opcode = prog->code[pc].opcode;
+    size_t words = REG_INSTRUCTION_WORDS(opcode);
+    char r[3][64];
+    size_t k, j;
+    
+    for (k = 0; k < words; k++) {
+        format_register(prog, prog->code[pc + k].operand, r[k], sizeof(r[k]));
+    }
+    
+    fprintf(out, "%04lu: %-18s%d  ; ", (unsigned long)pc,
+            get_opcode_name(opcode), prog->code[pc].operand);
+    switch (opcode) {
+        case OP_R_MOV:  fprintf(out, "%s <- %s", r[0], r[1]); break;
+        case OP_R_ADD:  fprintf(out, "%s <- %s + %s", r[0], r[1], r[2]); break;
+        case OP_R_SUB:  fprintf(out, "%s <- %s - %s", r[0], r[1], r[2]); break;
+        case OP_R_MUL:  fprintf(out, "%s <- %s * %s", r[0], r[1], r[2]); break;
+        case OP_R_DIV:  fprintf(out, "%s <- %s / %s", r[0], r[1], r[2]); break;
+        case OP_R_POW:  fprintf(out, "%s <- %s ^ %s", r[0], r[1], r[2]); break;
+        case OP_R_NEG:  fprintf(out, "%s <- -%s", r[0], r[1]); break;
+        case OP_R_PUSH: fprintf(out, "push %s", r[0]); break;
+        case OP_R_POP:  fprintf(out, "%s <- pop", r[0]); break;
+        default: {
+            static const char *relations[] = { "<", "<=", ">", ">=", "=", "<>" };
+            fprintf(out, "unless %s %s %s", r[1], relations[opcode - OP_R_JNLT], r[2]);
+            for (j = 0; j < prog->line_count; j++) {
+                if (prog->line_map[j].pc_offset == prog->code[pc].operand) {
+                    fprintf(out, " -> Line %d", prog->line_map[j].line_number);
+                    break;
+                }
+            }
+            break;
+        }
+    }
+    fprintf(out, "\n");
+    
+    /* Operand words, in a form basset_asm reads back */
+    for (k = 1; k < words; k++) {
+        fprintf(out, "%04lu: %-18s%d  ; %s\n", (unsigned long)(pc + k),
+                "NOP", prog->code[pc + k].operand, r[k]);
+    }
+}
+
+/* Name of variable slot, or "?" */
+static const char* variable_name(CompiledProgram *prog, uint16_t slot) {
+    size_t j;
+    
+    for (j = 0; j < prog->var_count; j++) {
+        if (prog->var_table[j].slot == slot) return prog->var_table[j].name;
+    }
+    return "?";
+}
+
+/* Print a statically paired FOR/NEXT instruction and its operand words */
+static void print_loop_instruction(FILE *out, CompiledProgram *prog, size_t pc) {
+    uint8_t opcode = prog->code[pc].opcode;
+    uint16_t slots = prog->code[pc + 1].operand;
+    size_t words = (opcode == OP_FOR_ENTER) ? FOR_ENTER_WORDS : FOR_LOOP_WORDS;
+    size_t k;
+    
+    fprintf(out, "%04lu: %-18s%d  ; %s", (unsigned long)pc, get_opcode_name(opcode),
+            prog->code[pc].operand, variable_name(prog, prog->code[pc].operand));
+    if (opcode == OP_FOR_LOOP) {
+        fprintf(out, " -> %04u", (unsigned)prog->code[pc + 2].operand);
+    }
+    fprintf(out, "\n");
+    
+    /* Operand words, in a form basset_asm reads back */
+    fprintf(out, "%04lu: %-18s%d  ; %s, %s\n", (unsigned long)(pc + 1), "NOP", slots,
+            variable_name(prog, slots), variable_name(prog, (uint16_t)(slots + 1)));
+    for (k = 2; k < words; k++) {
+        fprintf(out, "%04lu: %-18s%d\n", (unsigned long)(pc + k), "NOP",
+                prog->code[pc + k].operand);
+    }
+}
+
+/* Print an array access with proven subscripts and its operand words */
+static void print_indexed_instruction(FILE *out, CompiledProgram *prog, size_t pc) {
+    uint8_t opcode = prog->code[pc].opcode;
+    size_t words = ARRAY_INDEXED_WORDS(opcode);
+    size_t k;
+    
+    fprintf(out, "%04lu: %-18s%d  ; %s(%s", (unsigned long)pc, get_opcode_name(opcode),
+            prog->code[pc].operand, variable_name(prog, prog->code[pc].operand),
+            variable_name(prog, prog->code[pc + 1].operand));
+    if (words == 3) {
+        fprintf(out, ",%s", variable_name(prog, prog->code[pc + 2].operand));
+    }
+    fprintf(out, ")\n");
+    
+    /* Operand words, in a form basset_asm reads back */
+    for (k = 1; k < words; k++) {
+        fprintf(out, "%04lu: %-18s%d  ; %s\n", (unsigned long)(pc + k), "NOP",
+                prog->code[pc + k].operand, variable_name(prog, prog->code[pc + k].operand));
+    }
+}
+
 int main(int argc, char **argv) {
     CompiledProgram *prog;
     FILE *out;
@@ -153,6 +308,11 @@ int main(int argc, char **argv) {
     fprintf(out, "; Lines: %lu\n", (unsigned long)prog->line_count);
     fprintf(out, ";\n");
     
+    /* Instruction set (stack programs omit the directive) */
+    if (prog->isa == ISA_REG) {
+        fprintf(out, ".ISA reg %u\n", (unsigned)prog->reg_temps);
+    }
+    
     /* Validate opcode table */
     validate_opcodes(out);
     fprintf(out, "\n");
@@ -238,13 +398,34 @@ int main(int argc, char **argv) {
             }
         }
         
+        /* Register instructions carry their operands in the following words */
+        if (OP_IS_REGISTER(inst.opcode) &&
+            i + REG_INSTRUCTION_WORDS(inst.opcode) <= prog->code_len) {
+            print_register_instruction(out, prog, i);
+            i += REG_INSTRUCTION_WORDS(inst.opcode) - 1;
+            continue;
+        }
+        if ((inst.opcode == OP_FOR_ENTER && i + FOR_ENTER_WORDS <= prog->code_len) ||
+            (inst.opcode == OP_FOR_LOOP && i + FOR_LOOP_WORDS <= prog->code_len)) {
+            print_loop_instruction(out, prog, i);
+            i += (inst.opcode == OP_FOR_ENTER ? FOR_ENTER_WORDS : FOR_LOOP_WORDS) - 1;
+            continue;
+        }
+        if (OP_IS_ARRAY_INDEXED(inst.opcode) &&
+            i + ARRAY_INDEXED_WORDS(inst.opcode) <= prog->code_len) {
+            print_indexed_instruction(out, prog, i);
+            i += ARRAY_INDEXED_WORDS(inst.opcode) - 1;
+            continue;
+        }
+        
         /* Print instruction */
-        fprintf(out, "%04lu: %-16s", (unsigned long)i, name);
+        fprintf(out, "%04lu: %-18s", (unsigned long)i, name);
         
         if (has_operand(inst.opcode)) {
             /* Add context for operand */
             switch (inst.opcode) {
                 case OP_PUSH_CONST:
+                case OP_N_PUSH_CONST:
                     if (inst.operand < prog->const_count) {
                         fprintf(out, "%d  ; %.15g", inst.operand, 
                                 prog->const_pool[inst.operand]);
@@ -279,8 +460,18 @@ int main(int argc, char **argv) {
                 case OP_STR_ARRAY_SET_1D:
                 case OP_STR_ARRAY_GET_2D:
                 case OP_STR_ARRAY_SET_2D:
+                case OP_ARRAY_STORE_ADDR:
                 case OP_FOR_INIT:
                 case OP_FOR_NEXT:
+                case OP_FOR_INIT_INT:
+                case OP_FOR_NEXT_INT:
+                case OP_VAR_ADD_CONST_POP:
+                case OP_VAR_SUB_CONST_POP:
+                case OP_VAR_MUL_VAR:
+                case OP_VAR_ARRAY_GET_1D:
+                case OP_N_PUSH_VAR:
+                case OP_N_POP_VAR:
+                case OP_N_VAR_MUL_VAR:
                     /* Find variable name */
                     for (j = 0; j < prog->var_count; j++) {
                         if (prog->var_table[j].slot == inst.operand) {
@@ -298,6 +489,12 @@ int main(int argc, char **argv) {
                 case OP_JUMP_IF_FALSE:
                 case OP_JUMP_IF_TRUE:
                 case OP_GOSUB:
+                case OP_JNLT:
+                case OP_JNLE:
+                case OP_JNGT:
+                case OP_JNGE:
+                case OP_JNEQ:
+                case OP_JNNE:
                     /* Find target line */
                     for (j = 0; j < prog->line_count; j++) {
                         if (prog->line_map[j].pc_offset == inst.operand) {
@@ -1,22 +1,102 @@
 /* basset_vm.c - Standalone VM for executing bytecode files */
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "vm.h"
+#include "jit.h"
 #include "bytecode_file.h"
 
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] <program.abc>\n", prog);
+    fprintf(stderr, "  Executes compiled BASIC bytecode\n");
+    fprintf(stderr, "  --jit-threshold=N     Compile a line range to native code after N visits\n");
+    fprintf(stderr, "                        (default %d, 0 = interpret only; JIT builds only)\n",
+            JIT_DEFAULT_THRESHOLD);
+    fprintf(stderr, "  --max-instructions=N  Stop a program that runs for about N instructions\n");
+    fprintf(stderr, "  --slice=N             Run in slices of about N instructions\n");
+}
+
+/* The VM that Ctrl-C stops at its next safepoint */
+static VMState *break_vm = NULL;
+
+static void on_interrupt(int sig) {
+    (void)sig;
+    if (break_vm) break_vm->break_flag = 1;
+}
+
+/* Parse a positive count option value; 0 if invalid */
+static int parse_count(const char *text, unsigned long *value) {
+    char *end;
+    *value = strtoul(text, &end, 10);
+    return *end == '\0' && end != text && *value > 0 && text[0] != '-';
+}
+
+/* Line number of the statement holding pc */
+static unsigned stopped_line(const VMState *vm) {
+    const CompiledProgram *prog = vm->program;
+    unsigned line = 0;
+    uint32_t best = 0;
+    size_t i;
+    
+    for (i = 0; i < prog->line_count; i++) {
+        uint32_t start = prog->line_map[i].pc_offset;
+        if (start <= vm->pc && (start >= best || line == 0)) {
+            best = start;
+            line = prog->line_map[i].line_number;
+        }
+    }
+    return line;
+}
+
 int main(int argc, char **argv) {
     CompiledProgram *prog;
     VMState *vm;
+    const char *program_file = NULL;
+    long jit_threshold = -1;
+    unsigned long max_instructions = 0, slice = 0;
+    uint64_t used = 0;
+    VMRunStatus status;
+    int i, result = 0;
+    
+    /* Parse arguments */
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--jit-threshold=", 16) == 0) {
+            char *end;
+            jit_threshold = strtol(argv[i] + 16, &end, 10);
+            if (*end != '\0' || end == argv[i] + 16 || jit_threshold < 0) {
+                fprintf(stderr, "Error: Invalid JIT threshold '%s'\n", argv[i] + 16);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--max-instructions=", 19) == 0) {
+            if (!parse_count(argv[i] + 19, &max_instructions)) {
+                fprintf(stderr, "Error: Invalid instruction limit '%s'\n", argv[i] + 19);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--slice=", 8) == 0) {
+            if (!parse_count(argv[i] + 8, &slice)) {
+                fprintf(stderr, "Error: Invalid slice '%s'\n", argv[i] + 8);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            usage(argv[0]);
+            return 1;
+        } else if (!program_file) {
+            program_file = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
     
-    /* Check arguments */
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <program.abc>\n", argv[0]);
-        fprintf(stderr, "  Executes compiled BASIC bytecode\n");
+    if (!program_file) {
+        usage(argv[0]);
         return 1;
     }
     
     /* Load bytecode file */
-    prog = bytecode_file_load(argv[1]);
+    prog = bytecode_file_load(program_file);
     if (!prog) {
         fprintf(stderr, "Failed to load bytecode file\n");
         return 1;
@@ -30,12 +110,33 @@ int main(int argc, char **argv) {
         return 1;
     }
     
-    /* Execute */
-    vm_execute(vm);
+    if (jit_threshold >= 0) {
+        vm_set_jit_threshold(vm, (unsigned)jit_threshold);
+    }
+    
+    /* Execute, a slice at a time up to the limit; Ctrl-C stops the program */
+    break_vm = vm;
+    signal(SIGINT, on_interrupt);
+    do {
+        uint64_t budget = slice ? slice : VM_RUN_UNLIMITED;
+        if (max_instructions && max_instructions - used < budget) budget = max_instructions - used;
+        status = vm_run(vm, budget);
+        used += budget - vm->budget;
+    } while (status == VM_RUN_BUDGET && (!max_instructions || used < max_instructions));
+    signal(SIGINT, SIG_DFL);
+    break_vm = NULL;
+    
+    if (status == VM_RUN_BUDGET) {
+        fprintf(stderr, "STOPPED AT LINE %u: INSTRUCTION LIMIT\n", stopped_line(vm));
+        result = 2;
+    } else if (status == VM_RUN_BREAK) {
+        fprintf(stderr, "STOPPED AT LINE %u\n", stopped_line(vm));
+        result = 130;
+    }
     
     /* Cleanup */
     vm_free(vm);
     compiled_program_free(prog);
     
-    return 0;
+    return result;
 }
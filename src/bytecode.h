@@ -11,6 +11,9 @@ typedef struct {
     uint16_t operand;    /* Immediate value, offset, or slot number */
 } Instruction;
 
+/* Instruction flags (set by the verifier on load, see verify.h) */
+#define INST_FLAG_VERIFIED 0x01  /* Stack operands proven present and of the types popped */
+
 /* Stack Operations */
 #define OP_PUSH_CONST   0x00
 #define OP_PUSH_VAR     0x01
@@ -68,6 +71,36 @@ typedef struct {
 #define OP_STR_ARRAY_GET_2D 0x48
 #define OP_STR_ARRAY_SET_2D 0x49
 
+/* Numeric array access subscripted by variables
+ *
+ * The compiler emits these for A(I) and A(I,J) inside FOR loops when
+ * verify_subscripts() (see verify.h) proves the subscripts always lie
+ * within A's DIM. Word 0's operand is the array; the subscript variables
+ * follow in raw operand words. Flagged instructions run without the
+ * auto-dimension and range checks; unflagged ones check as usual.
+ */
+#define OP_ARRAY_LOAD_1D  0x4A  /* Push arr(v)                   (2 words: arr, v) */
+#define OP_ARRAY_STORE_1D 0x4B  /* Pop value into arr(v)         (2 words: arr, v) */
+#define OP_ARRAY_LOAD_2D  0x4C  /* Push arr(v1, v2)              (3 words: arr, v1, v2) */
+#define OP_ARRAY_STORE_2D 0x4D  /* Pop value into arr(v1, v2)    (3 words: arr, v1, v2) */
+
+/* Read-modify-write of one element
+ *
+ * With -O, A(I,J)=A(I,J)+... reads the element with OP_ARRAY_ADDR_2D, which
+ * also records which element it was (VMState addr_array, addr_index), and
+ * stores the result with OP_ARRAY_STORE_ADDR, which writes that element
+ * again without looking at the subscripts. DIM and CLR forget the record;
+ * a store to any other array raises ARRAY BOUNDS ERROR.
+ */
+#define OP_ARRAY_ADDR_2D  0x4E  /* Push arr(v1, v2), remember it (3 words: arr, v1, v2) */
+#define OP_ARRAY_STORE_ADDR 0x4F  /* Pop value into the element remembered for arr */
+
+#define OP_IS_ARRAY_INDEXED(op) ((op) >= OP_ARRAY_LOAD_1D && (op) <= OP_ARRAY_ADDR_2D)
+
+/* Total words of an OP_ARRAY_LOAD, OP_ARRAY_STORE or OP_ARRAY_ADDR instruction */
+#define ARRAY_INDEXED_WORDS(op) \
+    (((op) == OP_ARRAY_LOAD_1D || (op) == OP_ARRAY_STORE_1D) ? 2 : 3)
+
 /* Control Flow */
 #define OP_JUMP         0x50
 #define OP_JUMP_IF_FALSE 0x51
@@ -80,6 +113,21 @@ typedef struct {
 #define OP_ON_GOSUB     0x58
 #define OP_FOR_INIT     0x59
 #define OP_FOR_NEXT     0x5A
+#define OP_FOR_INIT_INT 0x5B    /* FOR_INIT that counts in int64 when start, limit, step are integers */
+#define OP_FOR_NEXT_INT 0x5C    /* FOR_NEXT for a loop the compiler began with FOR_INIT_INT */
+
+/* Statically paired FOR/NEXT
+ *
+ * When the compiler can pair a NEXT with its FOR (see compiler_pair_loops),
+ * the loop keeps its limit and step in two hidden variable slots, limit
+ * first, instead of on the VM's FOR stack. Word 0's operand is the loop
+ * variable; the hidden slot and the body start follow in raw operand words.
+ */
+#define OP_FOR_ENTER    0x5D    /* Pop start, limit, step; var <- start  (2 words: var, slots) */
+#define OP_FOR_LOOP     0x5E    /* var += step; jump to body unless past limit  (3 words: var, slots, body) */
+
+#define FOR_ENTER_WORDS 2
+#define FOR_LOOP_WORDS  3
 
 /* I/O Operations */
 #define OP_PRINT_NUM    0x60
@@ -135,4 +183,103 @@ typedef struct {
 #define OP_FUNC_PEEK    0x8E  /* PEEK memory function */
 #define OP_POKE         0x8F  /* POKE memory statement */
 
+/* Superinstructions
+ *
+ * Written over the first instruction of a common sequence by the compiler's
+ * fusion pass. The rest of the sequence is left in place: its words carry
+ * the remaining operands and stay valid targets, and the fused handler
+ * skips over them. The sequence each opcode replaces is shown below.
+ */
+#define OP_VAR_ADD_CONST_POP 0x90  /* PUSH_VAR a; PUSH_CONST c; ADD; POP_VAR d (or N_ forms) */
+#define OP_VAR_SUB_CONST_POP 0x91  /* PUSH_VAR a; PUSH_CONST c; SUB; POP_VAR d (or N_ forms) */
+#define OP_VAR_MUL_VAR  0x92  /* PUSH_VAR a; PUSH_VAR b; MUL */
+#define OP_VAR_ARRAY_GET_1D 0x93  /* PUSH_VAR i; ARRAY_GET_1D arr */
+
+/* Fused compare-and-branch (numeric operands only)
+ * Pop b, pop a, and jump to the operand when the comparison is false,
+ * i.e. a relational operator followed by JUMP_IF_FALSE. NaN operands
+ * compare false, as in the unfused sequence.
+ */
+#define OP_JNLT         0x94  /* Jump unless a < b */
+#define OP_JNLE         0x95  /* Jump unless a <= b */
+#define OP_JNGT         0x96  /* Jump unless a > b */
+#define OP_JNGE         0x97  /* Jump unless a >= b */
+#define OP_JNEQ         0x98  /* Jump unless a = b */
+#define OP_JNNE         0x99  /* Jump unless a <> b */
+
+/* Number stack instructions
+ *
+ * Where the compiler proves an expression numeric (see compiler.c), it is
+ * evaluated on the VM's number stack, which holds bare doubles: no type
+ * tag is read or written until N_BOX moves the result to the expression
+ * stack. Operands and operators match the untyped instructions above.
+ * Number stack entries never outlive a statement.
+ */
+#define OP_N_PUSH_CONST 0xB0  /* Push constant from pool */
+#define OP_N_PUSH_VAR   0xB1  /* Push numeric variable */
+#define OP_N_POP_VAR    0xB2  /* Pop into numeric variable */
+#define OP_N_ADD        0xB3
+#define OP_N_SUB        0xB4
+#define OP_N_MUL        0xB5
+#define OP_N_DIV        0xB6  /* Error if the divisor is 0 */
+#define OP_N_POW        0xB7
+#define OP_N_NEG        0xB8
+#define OP_N_EQ         0xB9  /* Relations push 1 or 0 */
+#define OP_N_NE         0xBA
+#define OP_N_LT         0xBB
+#define OP_N_LE         0xBC
+#define OP_N_GT         0xBD
+#define OP_N_GE         0xBE
+#define OP_N_AND        0xBF
+#define OP_N_OR         0xC0
+#define OP_N_NOT        0xC1
+#define OP_N_BOX        0xC2  /* Move the top number to the expression stack */
+#define OP_N_VAR_MUL_VAR 0xC3 /* Superinstruction: N_PUSH_VAR a; N_PUSH_VAR b; N_MUL */
+
+#define OP_IS_NUMBER_STACK(op) ((op) >= OP_N_PUSH_CONST && (op) <= OP_N_VAR_MUL_VAR)
+
+/* Instruction set architectures (recorded in the .abc header) */
+#define ISA_STACK       0     /* Stack machine (default) */
+#define ISA_REG         1     /* Stack machine plus register instructions */
+
+/* Register Instructions (ISA_REG only)
+ *
+ * Three-address arithmetic over a flat register file of doubles. Word 0's
+ * operand is the destination register (the jump target for R_JN*); source
+ * registers follow in raw operand words, as in the ON...GOTO tables.
+ * Register operands are tagged with their class and resolved to register
+ * file indices when the VM pre-decodes the program.
+ */
+#define OP_R_MOV        0xA0  /* dst <- a                        (2 words) */
+#define OP_R_ADD        0xA1  /* dst <- a + b                    (3 words) */
+#define OP_R_SUB        0xA2  /* dst <- a - b                    (3 words) */
+#define OP_R_MUL        0xA3  /* dst <- a * b                    (3 words) */
+#define OP_R_DIV        0xA4  /* dst <- a / b, error if b = 0    (3 words) */
+#define OP_R_POW        0xA5  /* dst <- a ^ b                    (3 words) */
+#define OP_R_NEG        0xA6  /* dst <- -a                       (2 words) */
+#define OP_R_PUSH       0xA7  /* Push register a onto the stack  (1 word) */
+#define OP_R_POP        0xA8  /* dst <- number popped from stack (1 word) */
+#define OP_R_JNLT       0xA9  /* Jump unless a < b               (3 words) */
+#define OP_R_JNLE       0xAA  /* Jump unless a <= b              (3 words) */
+#define OP_R_JNGT       0xAB  /* Jump unless a > b               (3 words) */
+#define OP_R_JNGE       0xAC  /* Jump unless a >= b              (3 words) */
+#define OP_R_JNEQ       0xAD  /* Jump unless a = b               (3 words) */
+#define OP_R_JNNE       0xAE  /* Jump unless a <> b              (3 words) */
+
+#define OP_IS_REGISTER(op)  ((op) >= OP_R_MOV && (op) <= OP_R_JNNE)
+#define OP_IS_REG_BRANCH(op) ((op) >= OP_R_JNLT && (op) <= OP_R_JNNE)
+
+/* Total words (opcode word plus operand words) of a register instruction */
+#define REG_INSTRUCTION_WORDS(op) \
+    (((op) == OP_R_PUSH || (op) == OP_R_POP) ? 1 : \
+     ((op) == OP_R_MOV || (op) == OP_R_NEG) ? 2 : 3)
+
+/* Register operand encoding: 2-bit class + 14-bit index */
+#define REG_CLASS_MASK  0xC000
+#define REG_INDEX_MASK  0x3FFF
+#define REG_VAR         0x0000  /* Variable slot */
+#define REG_TEMP        0x4000  /* Expression temporary */
+#define REG_CONST       0x8000  /* Constant pool entry */
+#define REG_TEMP_MAX    255     /* Temporaries per program (header field is 8 bits) */
+
 #endif /* BYTECODE_H */
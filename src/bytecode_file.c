@@ -1,6 +1,7 @@
 /* bytecode_file.c - Binary bytecode file I/O */
 #include "bytecode_file.h"
 #include "bytecode.h"
+#include "verify.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -79,7 +80,8 @@ int bytecode_file_save(const char *filename, CompiledProgram *prog) {
     /* Write header */
     memcpy(header.magic, ABC_MAGIC, 4);
     header.version = ABC_VERSION;
-    header.reserved = 0;
+    header.isa = prog->isa;
+    header.reg_temps = prog->reg_temps;
     
     if (fwrite(&header, sizeof(ABCHeader), 1, f) != 1) {
         fprintf(stderr, "Error: Failed to write header\n");
@@ -169,6 +171,7 @@ CompiledProgram* bytecode_file_load(const char *filename) {
     FILE *f;
     ABCHeader header;
     CompiledProgram *prog;
+    char verify_error[160];
     size_t i;
     
     f = fopen(filename, "rb");
@@ -192,7 +195,14 @@ CompiledProgram* bytecode_file_load(const char *filename) {
     }
     
     if (header.version != ABC_VERSION) {
-        fprintf(stderr, "Error: Unsupported file version %d\n", header.version);
+        fprintf(stderr, "Error: Unsupported file version %d (expected %d); recompile the program\n",
+                header.version, ABC_VERSION);
+        fclose(f);
+        return NULL;
+    }
+    
+    if (header.isa != ISA_STACK && header.isa != ISA_REG) {
+        fprintf(stderr, "Error: Unsupported instruction set %d\n", header.isa);
         fclose(f);
         return NULL;
     }
@@ -204,6 +214,8 @@ CompiledProgram* bytecode_file_load(const char *filename) {
         fclose(f);
         return NULL;
     }
+    prog->isa = header.isa;
+    prog->reg_temps = header.reg_temps;
     
     /* Section 1: Bytecode instructions */
     if (!read_count(f, &prog->code_len)) goto error;
@@ -316,6 +328,13 @@ CompiledProgram* bytecode_file_load(const char *filename) {
     }
     
     fclose(f);
+    
+    /* Reject anything the VM could not run safely */
+    if (!verify_program(prog, verify_error, sizeof(verify_error))) {
+        fprintf(stderr, "Error: Invalid bytecode: %s\n", verify_error);
+        compiled_program_free(prog);
+        return NULL;
+    }
     return prog;
     
 error:
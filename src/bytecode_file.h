@@ -10,7 +10,8 @@
  * Header:
  *   Magic: "ABC\0" (4 bytes)
  *   Version: uint16_t (2 bytes)
- *   Reserved: uint16_t (2 bytes)
+ *   ISA: uint8_t (1 byte) - ISA_STACK or ISA_REG (see bytecode.h)
+ *   Register temporaries: uint8_t (1 byte) - ISA_REG only
  * 
  * Sections (each with count + data):
  *   1. Bytecode instructions
@@ -21,16 +22,23 @@
  *   6. DATA numeric pool
  *   7. DATA string pool
  *   8. DATA entries
+ *
+ * bytecode_file_load() verifies the code before returning it (see verify.h)
+ * and rejects files that fail.
  */
 
 #define ABC_MAGIC "ABC"
-#define ABC_VERSION 1
+/* 2: the header's ISA and register temporaries, the register, fused */
+/* branch, FOR_ENTER/FOR_LOOP, number stack and indexed array opcodes. */
+/* Files of any other version are rejected */
+#define ABC_VERSION 2
 
 /* File header */
 typedef struct {
     char magic[4];        /* "ABC\0" */
     uint16_t version;     /* File format version */
-    uint16_t reserved;    /* Reserved for future use */
+    uint8_t isa;          /* Instruction set, ISA_STACK or ISA_REG */
+    uint8_t reg_temps;    /* Register temporaries used by ISA_REG code */
 } ABCHeader;
 
 /* Save compiled program to binary file */
@@ -0,0 +1,293 @@
+/* cfg.c - Control-flow graph over compiled bytecode */
+#include "cfg.h"
+#include "bytecode.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Words from the instruction at inst to the next one in program order */
+static size_t cfg_instruction_words(const Instruction *inst) {
+    if (inst->opcode == OP_ON_GOTO || inst->opcode == OP_ON_GOSUB) {
+        return (size_t)inst->operand + 1;
+    }
+    if (OP_IS_REGISTER(inst->opcode)) {
+        return REG_INSTRUCTION_WORDS(inst->opcode);
+    }
+    if (inst->opcode == OP_FOR_ENTER) return FOR_ENTER_WORDS;
+    if (inst->opcode == OP_FOR_LOOP) return FOR_LOOP_WORDS;
+    if (OP_IS_ARRAY_INDEXED(inst->opcode)) return ARRAY_INDEXED_WORDS(inst->opcode);
+    return 1;
+}
+
+/* True if the instruction ends its block: it jumps, calls, returns or halts */
+static int cfg_ends_block(uint8_t op) {
+    switch (op) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP_LINE:
+        case OP_GOSUB:
+        case OP_GOSUB_LINE:
+        case OP_RETURN:
+        case OP_ON_GOTO:
+        case OP_ON_GOSUB:
+        case OP_FOR_LOOP:
+        case OP_FOR_NEXT:
+        case OP_FOR_NEXT_INT:
+        case OP_TRAP:
+        case OP_END:
+        case OP_STOP:
+        case OP_JNLT: case OP_JNLE: case OP_JNGT:
+        case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+            return 1;
+        default:
+            return OP_IS_REG_BRANCH(op);
+    }
+}
+
+/* Edge list under construction; seen[] stamps the successors of one block */
+typedef struct {
+    ControlFlowGraph *cfg;
+    uint32_t *from;
+    size_t capacity;
+    uint32_t *seen;
+    int failed;
+} EdgeBuilder;
+
+/* Add an edge from block to the block starting at (or holding) pc */
+static void cfg_add_edge(EdgeBuilder *eb, uint32_t block, size_t pc) {
+    ControlFlowGraph *cfg = eb->cfg;
+    uint32_t to;
+
+    if (pc >= cfg->code_len || eb->failed) return;
+    to = cfg->block_of[pc];
+    if (eb->seen[to] == block + 1) return;
+    eb->seen[to] = block + 1;
+
+    if (cfg->succ_count >= eb->capacity) {
+        size_t capacity = eb->capacity * 2;
+        uint32_t *succ = realloc(cfg->succ, sizeof(uint32_t) * capacity);
+        uint32_t *from = realloc(eb->from, sizeof(uint32_t) * capacity);
+
+        if (succ) cfg->succ = succ;
+        if (from) eb->from = from;
+        if (!succ || !from) {
+            eb->failed = 1;
+            return;
+        }
+        eb->capacity = capacity;
+    }
+    eb->from[cfg->succ_count] = block;
+    cfg->succ[cfg->succ_count++] = to;
+}
+
+void cfg_free(ControlFlowGraph *cfg) {
+    if (!cfg) return;
+    free(cfg->blocks);
+    free(cfg->block_of);
+    free(cfg->succ);
+    free(cfg->pred);
+    free(cfg);
+}
+
+ControlFlowGraph *cfg_build(const CompiledProgram *prog) {
+    const Instruction *code = prog->code;
+    size_t len = prog->code_len;
+    ControlFlowGraph *cfg;
+    EdgeBuilder eb;
+    uint8_t *leader = NULL;
+    uint32_t *loop_body = NULL;
+    uint32_t *last_init = NULL;
+    uint32_t *last_pc = NULL;
+    uint32_t *work = NULL;
+    uint32_t any_init = CFG_NO_BLOCK;
+    size_t pc, words, k, b, work_len;
+
+    cfg = calloc(1, sizeof(ControlFlowGraph));
+    if (!cfg) return NULL;
+    cfg->code_len = len;
+    memset(&eb, 0, sizeof(eb));
+
+    leader = calloc(len + 1, 1);
+    loop_body = malloc(sizeof(uint32_t) * (len + 1));
+    last_init = malloc(sizeof(uint32_t) * (prog->var_count + 1));
+    cfg->block_of = malloc(sizeof(uint32_t) * (len + 1));
+    if (!leader || !loop_body || !last_init || !cfg->block_of) goto error;
+    for (k = 0; k <= prog->var_count; k++) last_init[k] = CFG_NO_BLOCK;
+
+    /* Leaders, and the body each NEXT goes back to (that of the nearest */
+    /* FOR_INIT before it for its variable) */
+    leader[0] = 1;
+    for (k = 0; k < prog->line_count; k++) {
+        if (prog->line_map[k].pc_offset < len) leader[prog->line_map[k].pc_offset] = 1;
+    }
+    for (pc = 0; pc < len; pc += words) {
+        const Instruction *inst = &code[pc];
+
+        words = cfg_instruction_words(inst);
+        loop_body[pc] = CFG_NO_BLOCK;
+        switch (inst->opcode) {
+            case OP_ON_GOTO:
+            case OP_ON_GOSUB:
+                for (k = 1; k < words && pc + k < len; k++) {
+                    if (code[pc + k].operand < len) leader[code[pc + k].operand] = 1;
+                }
+                break;
+            case OP_FOR_LOOP:
+                if (pc + 2 < len && code[pc + 2].operand < len) leader[code[pc + 2].operand] = 1;
+                break;
+            case OP_FOR_INIT:
+            case OP_FOR_INIT_INT:
+                if (inst->operand < prog->var_count) last_init[inst->operand] = (uint32_t)pc + 1;
+                any_init = (uint32_t)pc + 1;
+                if (pc + 1 < len) leader[pc + 1] = 1;
+                break;
+            case OP_FOR_NEXT:
+            case OP_FOR_NEXT_INT:
+                loop_body[pc] = (inst->operand == 0xFFFF) ? any_init :
+                    (inst->operand < prog->var_count) ? last_init[inst->operand] : CFG_NO_BLOCK;
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_GOSUB:
+            case OP_TRAP:
+            case OP_JNLT: case OP_JNLE: case OP_JNGT:
+            case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+                if (inst->operand < len) leader[inst->operand] = 1;
+                break;
+            default:
+                if (OP_IS_REG_BRANCH(inst->opcode) && inst->operand < len) {
+                    leader[inst->operand] = 1;
+                }
+                break;
+        }
+        if (cfg_ends_block(inst->opcode) && pc + words <= len) leader[pc + words] = 1;
+    }
+
+    /* Blocks; a leader inside an operand word (a bad target) is ignored */
+    for (pc = 0; pc < len; pc += words) {
+        words = cfg_instruction_words(&code[pc]);
+        if (leader[pc]) cfg->block_count++;
+    }
+    cfg->blocks = calloc(cfg->block_count + 1, sizeof(BasicBlock));
+    last_pc = malloc(sizeof(uint32_t) * (cfg->block_count + 1));
+    if (!cfg->blocks || !last_pc) goto error;
+    b = 0;
+    for (pc = 0; pc < len; pc += words) {
+        words = cfg_instruction_words(&code[pc]);
+        if (leader[pc] && pc > 0) b++;
+        if (leader[pc]) cfg->blocks[b].first = (uint32_t)pc;
+        cfg->blocks[b].end = (uint32_t)((pc + words < len) ? pc + words : len);
+        last_pc[b] = (uint32_t)pc;
+        for (k = pc; k < pc + words && k < len; k++) cfg->block_of[k] = (uint32_t)b;
+    }
+
+    /* Successors, grouped by block since blocks are visited in order */
+    eb.cfg = cfg;
+    eb.capacity = cfg->block_count * 2 + 16;
+    cfg->succ = malloc(sizeof(uint32_t) * eb.capacity);
+    eb.from = malloc(sizeof(uint32_t) * eb.capacity);
+    eb.seen = calloc(cfg->block_count + 1, sizeof(uint32_t));
+    if (!cfg->succ || !eb.from || !eb.seen) goto error;
+    for (b = 0; b < cfg->block_count; b++) {
+        uint32_t at = last_pc[b];
+        const Instruction *inst = &code[at];
+        size_t next = cfg->blocks[b].end;
+
+        cfg->blocks[b].succ = (uint32_t)cfg->succ_count;
+        switch (inst->opcode) {
+            case OP_RETURN:
+            case OP_END:
+            case OP_STOP:
+                break;
+            case OP_JUMP:
+                cfg_add_edge(&eb, (uint32_t)b, inst->operand);
+                break;
+            case OP_JUMP_LINE:
+            case OP_GOSUB_LINE:
+                for (k = 0; k < prog->line_count; k++) {
+                    cfg_add_edge(&eb, (uint32_t)b, prog->line_map[k].pc_offset);
+                }
+                if (inst->opcode == OP_GOSUB_LINE) cfg_add_edge(&eb, (uint32_t)b, next);
+                break;
+            case OP_ON_GOTO:
+            case OP_ON_GOSUB:
+                for (k = 1; k <= inst->operand && at + k < len; k++) {
+                    cfg_add_edge(&eb, (uint32_t)b, code[at + k].operand);
+                }
+                cfg_add_edge(&eb, (uint32_t)b, next);
+                break;
+            case OP_FOR_LOOP:
+                if (at + 2 < len) cfg_add_edge(&eb, (uint32_t)b, code[at + 2].operand);
+                cfg_add_edge(&eb, (uint32_t)b, next);
+                break;
+            case OP_FOR_NEXT:
+            case OP_FOR_NEXT_INT:
+                if (loop_body[at] != CFG_NO_BLOCK) cfg_add_edge(&eb, (uint32_t)b, loop_body[at]);
+                cfg_add_edge(&eb, (uint32_t)b, next);
+                break;
+            default:
+                if (cfg_ends_block(inst->opcode)) {
+                    /* JUMP_IF_*, JN*, R_JN*, GOSUB and TRAP */
+                    cfg_add_edge(&eb, (uint32_t)b, inst->operand);
+                }
+                cfg_add_edge(&eb, (uint32_t)b, next);
+                break;
+        }
+        cfg->blocks[b].succ_count = (uint32_t)(cfg->succ_count - cfg->blocks[b].succ);
+    }
+    if (eb.failed) goto error;
+
+    /* Predecessors, by counting */
+    cfg->pred_count = cfg->succ_count;
+    cfg->pred = malloc(sizeof(uint32_t) * (cfg->pred_count + 1));
+    if (!cfg->pred) goto error;
+    for (k = 0; k < cfg->succ_count; k++) cfg->blocks[cfg->succ[k]].pred_count++;
+    for (b = 0, k = 0; b < cfg->block_count; b++) {
+        cfg->blocks[b].pred = (uint32_t)k;
+        k += cfg->blocks[b].pred_count;
+        cfg->blocks[b].pred_count = 0;
+    }
+    for (k = 0; k < cfg->succ_count; k++) {
+        BasicBlock *to = &cfg->blocks[cfg->succ[k]];
+        cfg->pred[to->pred + to->pred_count++] = eb.from[k];
+    }
+
+    /* Reachability from pc 0 */
+    work = malloc(sizeof(uint32_t) * (cfg->block_count + 1));
+    if (!work) goto error;
+    work_len = 0;
+    if (cfg->block_count > 0) {
+        cfg->blocks[0].reachable = 1;
+        work[work_len++] = 0;
+    }
+    while (work_len > 0) {
+        const BasicBlock *block = &cfg->blocks[work[--work_len]];
+        for (k = block->succ; k < block->succ + block->succ_count; k++) {
+            BasicBlock *to = &cfg->blocks[cfg->succ[k]];
+            if (!to->reachable) {
+                to->reachable = 1;
+                work[work_len++] = cfg->succ[k];
+            }
+        }
+    }
+    free(leader);
+    free(loop_body);
+    free(last_init);
+    free(last_pc);
+    free(work);
+    free(eb.from);
+    free(eb.seen);
+    return cfg;
+
+error:
+    free(leader);
+    free(loop_body);
+    free(last_init);
+    free(last_pc);
+    free(work);
+    free(eb.from);
+    free(eb.seen);
+    cfg_free(cfg);
+    return NULL;
+}
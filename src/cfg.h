@@ -0,0 +1,62 @@
+/* cfg.h - Control-flow graph over compiled bytecode */
+#ifndef CFG_H
+#define CFG_H
+
+#include "compiler.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * cfg_build() splits a compiled program into basic blocks once every jump
+ * is resolved. A block starts at pc 0, at every line start, at every jump,
+ * GOSUB, ON and TRAP target and FOR loop body, and after every instruction
+ * that can transfer control; ON tables and other operand words belong to
+ * the instruction that owns them.
+ *
+ * Edges follow what the VM can do next:
+ *
+ *   JUMP                  the target
+ *   conditional jumps     the target and the next instruction
+ *   GOSUB, ON...GOSUB     the targets and the return point after them
+ *   ON...GOTO             the targets and the instruction after the table
+ *   FOR_LOOP              the body and the instruction after the loop
+ *   FOR_NEXT              the body of the FOR_INIT it closes, and onwards
+ *   TRAP                  the TRAP line (an error may go there later)
+ *   JUMP_LINE,            every line start, since GOTO expr can name any
+ *   GOSUB_LINE              line (and GOSUB_LINE returns too)
+ *   RETURN, END, STOP     nothing; a RETURN comes back through the
+ *                         GOSUB's return point edge
+ *
+ * and every other instruction falls through. Running off the end of the
+ * code halts. A block is reachable if some path from pc 0 gets to it.
+ */
+
+#define CFG_NO_BLOCK 0xFFFFFFFFu
+
+typedef struct {
+    uint32_t first;              /* PC of the first instruction */
+    uint32_t end;                /* PC after the last word */
+    uint32_t succ;               /* First successor in cfg->succ */
+    uint32_t succ_count;
+    uint32_t pred;               /* First predecessor in cfg->pred */
+    uint32_t pred_count;
+    uint8_t reachable;           /* On some path from pc 0 */
+} BasicBlock;
+
+typedef struct {
+    BasicBlock *blocks;          /* In program order; blocks[0] starts at 0 */
+    size_t block_count;
+    uint32_t *block_of;          /* Block of each code word */
+    size_t code_len;
+
+    uint32_t *succ;              /* Block indexes, per block from its succ */
+    size_t succ_count;
+    uint32_t *pred;              /* Block indexes, per block from its pred */
+    size_t pred_count;
+} ControlFlowGraph;
+
+/* Build the graph of prog; NULL if out of memory */
+ControlFlowGraph *cfg_build(const CompiledProgram *prog);
+void cfg_free(ControlFlowGraph *cfg);
+
+#endif /* CFG_H */
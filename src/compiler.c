@@ -1,8 +1,11 @@
 /* compiler.c - Bytecode compiler implementation */
 #define _POSIX_C_SOURCE 200112L  /* Enable snprintf */
 #include "compiler.h"
+#include "cfg.h"
+#include "ir.h"
 #include "tokenizer.h"
 #include "util.h"
+#include "verify.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -52,6 +55,21 @@ CompilerState* compiler_state_new(void) {
     cs->fixup_capacity = 64;
     cs->jump_fixups = malloc(sizeof(JumpFixup) * cs->fixup_capacity);
     
+    cs->loop_capacity = 16;
+    cs->loops = malloc(sizeof(LoopRecord) * cs->loop_capacity);
+    
+    cs->array_site_capacity = 16;
+    cs->array_sites = malloc(sizeof(ArraySite) * cs->array_site_capacity);
+    
+    cs->subroutine_capacity = 16;
+    cs->subroutines = malloc(sizeof(Subroutine) * cs->subroutine_capacity);
+    
+    cs->hoisted_capacity = 16;
+    cs->hoisted = malloc(sizeof(HoistedExpression) * cs->hoisted_capacity);
+    
+    cs->power_temp = -1;
+    cs->rmw_array = -1;
+    
     return cs;
 }
 
@@ -60,6 +78,20 @@ void compiler_state_free(CompilerState *cs) {
     if (!cs) return;
     
     if (cs->jump_fixups) free(cs->jump_fixups);
+    if (cs->loops) free(cs->loops);
+    if (cs->array_sites) free(cs->array_sites);
+    if (cs->subroutines) free(cs->subroutines);
+    if (cs->hoisted) {
+        size_t i;
+        for (i = 0; i < cs->hoisted_count; i++) node_free(cs->hoisted[i].expr);
+        free(cs->hoisted);
+    }
+    if (cs->lowered) {
+        size_t i;
+        for (i = 0; i < cs->lowered_count; i++) node_free(cs->lowered[i].expr);
+        free(cs->lowered);
+    }
+    if (cs->lowered_lines) free(cs->lowered_lines);
     
     /* Don't free program - it's returned to caller */
     free(cs);
@@ -178,9 +210,9 @@ int compiler_add_variable(CompilerState *cs, const char *name, VarType type) {
 uint16_t compiler_add_const(CompilerState *cs, double value) {
     size_t i;
     
-    /* Check if constant already exists */
+    /* Check if constant already exists (bit for bit: -0 is not 0) */
     for (i = 0; i < cs->program->const_count; i++) {
-        if (cs->program->const_pool[i] == value) {
+        if (memcmp(&cs->program->const_pool[i], &value, sizeof(value)) == 0) {
             return i;
         }
     }
@@ -263,6 +295,12 @@ void compiler_emit_raw(CompilerState *cs, uint16_t operand) {
 void compiler_add_line_mapping(CompilerState *cs, uint16_t line, uint32_t pc) {
     LineMapping *map;
     
+    /* A line with several statements starts at the first */
+    if (cs->program->line_count > 0 &&
+        cs->program->line_map[cs->program->line_count - 1].line_number == line) {
+        return;
+    }
+    
     /* Expand if needed */
     if (cs->program->line_count >= cs->program->line_capacity) {
         cs->program->line_capacity *= 2;
@@ -332,10 +370,648 @@ void compiler_resolve_jumps(CompilerState *cs) {
     }
 }
 
+/* Words from the instruction at pc to the next one in program order */
+static size_t compiler_instruction_words(const Instruction *inst) {
+    switch (inst->opcode) {
+        case OP_ON_GOTO:
+        case OP_ON_GOSUB:
+            return (size_t)inst->operand + 1;
+        case OP_FOR_ENTER:
+            return FOR_ENTER_WORDS;
+        case OP_FOR_LOOP:
+            return FOR_LOOP_WORDS;
+        default:
+            if (OP_IS_ARRAY_INDEXED(inst->opcode)) return ARRAY_INDEXED_WORDS(inst->opcode);
+            return OP_IS_REGISTER(inst->opcode) ? REG_INSTRUCTION_WORDS(inst->opcode) : 1;
+    }
+}
+
+/* Helper: true if a transfer from pc to target enters the body [first, last] */
+/* from outside, or (unless it is a call, which returns) leaves it */
+static int loop_transfer_escapes(size_t first, size_t last, size_t pc, size_t target, int call) {
+    int from_body = (pc >= first && pc <= last);
+    int to_body = (target >= first && target <= last);
+    
+    return (to_body && !from_body) || (from_body && !to_body && !call);
+}
+
+/* Helper: true if control can enter or leave the loop's body other than */
+/* through its FOR and NEXT, or the body calls a subroutine while calls */
+/* might meet a NEXT that uses the FOR stack */
+static int loop_is_unstructured(CompilerState *cs, const LoopRecord *loop, int dynamic_next) {
+    const Instruction *code = cs->program->code;
+    size_t len = cs->program->code_len;
+    size_t first = loop->for_pc + FOR_ENTER_WORDS;
+    size_t last = loop->next_pc;
+    size_t pc, words, k;
+    
+    for (pc = 0; pc < len; pc += words) {
+        const Instruction *inst = &code[pc];
+        int in_body = (pc >= first && pc <= last);
+        
+        words = compiler_instruction_words(inst);
+        switch (inst->opcode) {
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_JNLT: case OP_JNLE: case OP_JNGT:
+            case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+                if (loop_transfer_escapes(first, last, pc, inst->operand, 0)) return 1;
+                break;
+            case OP_GOSUB:
+                if (in_body && dynamic_next) return 1;
+                if (loop_transfer_escapes(first, last, pc, inst->operand, 1)) return 1;
+                break;
+            case OP_ON_GOTO:
+            case OP_ON_GOSUB:
+                if (in_body && dynamic_next && inst->opcode == OP_ON_GOSUB) return 1;
+                for (k = 1; k < words && pc + k < len; k++) {
+                    if (loop_transfer_escapes(first, last, pc, code[pc + k].operand,
+                                              inst->opcode == OP_ON_GOSUB)) return 1;
+                }
+                break;
+            case OP_FOR_LOOP:
+                if (pc + 2 < len &&
+                    loop_transfer_escapes(first, last, pc, code[pc + 2].operand, 0)) return 1;
+                break;
+            case OP_RETURN:
+                if (in_body) return 1;
+                break;
+            default:
+                if (OP_IS_REG_BRANCH(inst->opcode) &&
+                    loop_transfer_escapes(first, last, pc, inst->operand, 0)) return 1;
+                break;
+        }
+    }
+    return 0;
+}
+
+/* Helper: true if the loop's body holds the FOR of a loop on the FOR stack, */
+/* whose frame its FOR_LOOP would leave behind */
+static int loop_holds_dynamic(CompilerState *cs, const LoopRecord *loop) {
+    size_t first = loop->for_pc + FOR_ENTER_WORDS;
+    size_t last = loop->next_pc;
+    size_t i;
+    
+    for (i = 0; i < cs->loop_count; i++) {
+        const LoopRecord *inner = &cs->loops[i];
+        if (inner->state == LOOP_DYNAMIC && inner->for_pc >= first && inner->for_pc <= last) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Helper: a numeric variable the compiler uses internally. Hidden slots */
+/* do not count against MAX_NUMERIC_VARS */
+static uint16_t compiler_add_hidden_variable(CompilerState *cs, const char *name) {
+    CompiledProgram *prog = cs->program;
+    VariableInfo *var;
+    
+    if (prog->var_count >= prog->var_capacity) {
+        prog->var_capacity *= 2;
+        prog->var_table = realloc(prog->var_table, sizeof(VariableInfo) * prog->var_capacity);
+    }
+    var = &prog->var_table[prog->var_count];
+    var->name = basset_strdup(name);
+    var->slot = (uint16_t)prog->var_count;
+    var->type = VAR_NUMERIC;
+    var->array_dim1 = 0;
+    var->array_dim2 = 0;
+    return (uint16_t)prog->var_count++;
+}
+
+/* Helper: hidden slot pair (limit, step) for a paired loop */
+static uint16_t compiler_add_loop_slots(CompilerState *cs, const LoopRecord *loop, size_t index) {
+    const char *var_name = cs->program->var_table[loop->var_slot].name;
+    uint16_t slot = (uint16_t)cs->program->var_count;
+    int k;
+    
+    for (k = 0; k < 2; k++) {
+        char name[64];
+        
+        snprintf(name, sizeof(name), "%.40s.%s%lu", var_name, k ? "STEP" : "TO",
+                 (unsigned long)index);
+        compiler_add_hidden_variable(cs, name);
+    }
+    return slot;
+}
+
+/* Pair FOR and NEXT statically where the program's structure allows
+ *
+ * compile_for() emits OP_FOR_ENTER and compile_next() pairs each NEXT with
+ * the innermost open FOR of its variable, emitting OP_FOR_LOOP. Once every
+ * jump target is known, a pair keeps that form only if its body is entered
+ * solely through the FOR and left solely through the NEXT, so nothing can
+ * tell that the loop is missing from the VM's FOR stack. Anything else -
+ * a GOTO out of or into the body, a RETURN inside it, a NEXT the compiler
+ * could not pair, a dynamic loop inside it, or a program with TRAP, CLR
+ * or computed GOTO/GOSUB - falls back to FOR_INIT/FOR_NEXT in the same
+ * words:
+ *
+ *   FOR_ENTER v; slots          ->  NOP; FOR_INIT v
+ *   FOR_LOOP v; slots; body     ->  FOR_NEXT v; JUMP past; NOP
+ */
+void compiler_pair_loops(CompilerState *cs) {
+    Instruction *code = cs->program->code;
+    size_t len = cs->program->code_len;
+    size_t pc, i;
+    int unstructured = 0;
+    int dynamic_next = 0;
+    int changed;
+    
+    for (pc = 0; pc < len; pc += compiler_instruction_words(&code[pc])) {
+        switch (code[pc].opcode) {
+            case OP_TRAP:
+            case OP_CLR:
+            case OP_JUMP_LINE:
+            case OP_GOSUB_LINE:
+                unstructured = 1;
+                break;
+            case OP_FOR_NEXT:
+                dynamic_next = 1;
+                break;
+        }
+    }
+    
+    /* Jumps first; a dynamic loop's NEXT then rules out calls from the rest, */
+    /* and a dynamic loop rules out pairing the loops around it. Each loop */
+    /* that falls back can take others with it, so repeat until none does */
+    for (i = 0; i < cs->loop_count; i++) {
+        LoopRecord *loop = &cs->loops[i];
+        if (loop->state == LOOP_OPEN ||
+            (loop->state == LOOP_PAIRED && (unstructured || loop_is_unstructured(cs, loop, 0)))) {
+            loop->state = LOOP_DYNAMIC;
+        }
+        if (loop->state == LOOP_DYNAMIC) dynamic_next = 1;
+    }
+    do {
+        changed = 0;
+        for (i = 0; dynamic_next && i < cs->loop_count; i++) {
+            LoopRecord *loop = &cs->loops[i];
+            if (loop->state == LOOP_PAIRED &&
+                (loop_holds_dynamic(cs, loop) || loop_is_unstructured(cs, loop, 1))) {
+                loop->state = LOOP_DYNAMIC;
+                changed = 1;
+            }
+        }
+    } while (changed);
+    
+    for (i = 0; i < cs->loop_count; i++) {
+        LoopRecord *loop = &cs->loops[i];
+        uint32_t f = loop->for_pc;
+        uint32_t n = loop->next_pc;
+        
+        if (loop->state == LOOP_PAIRED) {
+            uint16_t slots = compiler_add_loop_slots(cs, loop, i);
+            code[f + 1].operand = slots;
+            code[n + 1].operand = slots;
+            continue;
+        }
+        
+        code[f].opcode = OP_NOP;
+        code[f].operand = 0;
+        code[f + 1].opcode = loop->int_loop ? OP_FOR_INIT_INT : OP_FOR_INIT;
+        code[f + 1].operand = loop->var_slot;
+        if (n != LOOP_NO_PC) {
+            code[n].opcode = (loop->int_loop && loop->next_operand != 0xFFFF) ?
+                OP_FOR_NEXT_INT : OP_FOR_NEXT;
+            code[n].operand = loop->next_operand;
+            code[n + 1].opcode = OP_JUMP;
+            code[n + 1].operand = (uint16_t)(n + FOR_LOOP_WORDS);
+            code[n + 2].opcode = OP_NOP;
+            code[n + 2].operand = 0;
+        }
+    }
+}
+
+/* Drop the subscript checks of array accesses proven in range
+ *
+ * compile_expression() and compile_assignment() record each numeric array
+ * access whose subscripts compiled to single PUSH_VARs. Where
+ * verify_subscripts() proves those variables inside the array's DIM for
+ * every execution (a FOR loop over a DIMmed array, see verify.c), the
+ * access takes its subscripts from operand words instead:
+ *
+ *   PUSH_VAR i; ARRAY_GET_1D a              ->  ARRAY_LOAD_1D a; i
+ *   PUSH_VAR i; value...; ARRAY_SET_1D a    ->  value...; ARRAY_STORE_1D a; i
+ *
+ * and likewise with two subscripts. Moving the value ahead of the PUSH_VARs
+ * changes nothing it computes, and the statement's first word, which the
+ * line map points at, is still its first. Sites are rewritten in the order
+ * they were compiled, so an access inside a stored value is rewritten
+ * before the value moves.
+ */
+void compiler_eliminate_bounds_checks(CompilerState *cs) {
+    Instruction *code = cs->program->code;
+    size_t i;
+    
+    for (i = 0; i < cs->array_site_count; i++) {
+        const ArraySite *site = &cs->array_sites[i];
+        uint32_t first = site->index_pc;
+        uint32_t op = site->op_pc;
+        int dims = site->dims;
+        int store = (code[op].opcode == OP_ARRAY_SET_1D || code[op].opcode == OP_ARRAY_SET_2D);
+        uint16_t array = code[op].operand;
+        uint16_t vars[2];
+        int k;
+        
+        for (k = 0; k < dims; k++) {
+            if (code[first + k].opcode != OP_PUSH_VAR) break;
+            vars[k] = code[first + k].operand;
+        }
+        if (k < dims || !verify_subscripts(cs->program, op, array, vars, dims)) continue;
+        
+        if (store) {
+            memmove(&code[first], &code[first + dims],
+                    sizeof(Instruction) * (op - first - (uint32_t)dims));
+        }
+        op -= (uint32_t)dims;
+        code[op].opcode = (dims == 1) ? (store ? OP_ARRAY_STORE_1D : OP_ARRAY_LOAD_1D) :
+                                        (store ? OP_ARRAY_STORE_2D : OP_ARRAY_LOAD_2D);
+        code[op].flags = 0;
+        code[op].operand = array;
+        for (k = 0; k < dims; k++) {
+            code[op + 1 + k].opcode = OP_NOP;
+            code[op + 1 + k].flags = 0;
+            code[op + 1 + k].operand = vars[k];
+        }
+    }
+}
+
+/* Record the numeric array access just emitted if its dims subscripts, */
+/* compiled from index_pc, are single PUSH_VARs (by_var) */
+static void compiler_add_array_site(CompilerState *cs, size_t index_pc, int dims, int by_var) {
+    const Instruction *code = cs->program->code;
+    ArraySite *site;
+    int k;
+    
+    if (!by_var) return;
+    for (k = 0; k < dims; k++) {
+        if (code[index_pc + k].opcode != OP_PUSH_VAR) return;
+    }
+    
+    if (cs->array_site_count >= cs->array_site_capacity) {
+        cs->array_site_capacity *= 2;
+        cs->array_sites = realloc(cs->array_sites, sizeof(ArraySite) * cs->array_site_capacity);
+    }
+    site = &cs->array_sites[cs->array_site_count++];
+    site->index_pc = (uint32_t)index_pc;
+    site->op_pc = (uint32_t)cs->program->code_len - 1;
+    site->dims = (uint8_t)dims;
+}
+
+/* Helper: true if the instruction's operand is a pc (see compiler_peephole) */
+static int peephole_jumps(uint8_t op) {
+    switch (op) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_GOSUB:
+        case OP_JNLT: case OP_JNLE: case OP_JNGT:
+        case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+            return 1;
+        default:
+            return OP_IS_REG_BRANCH(op);
+    }
+}
+
+/* Helper: the first word at or after pc that is kept */
+static size_t peephole_next_kept(const uint8_t *removed, size_t pc, size_t len) {
+    while (pc < len && removed[pc]) pc++;
+    return pc;
+}
+
+/* Helper: true if PUSH then POP at pc leave everything as it was */
+static int peephole_push_pop(const Instruction *code, size_t pc) {
+    uint8_t push = code[pc].opcode;
+    uint8_t pop = code[pc + 1].opcode;
+    
+    if (pop == OP_POP) {
+        return push == OP_PUSH_CONST || push == OP_PUSH_VAR ||
+               push == OP_STR_PUSH || push == OP_STR_PUSH_VAR;
+    }
+    if (code[pc].operand != code[pc + 1].operand) return 0;
+    return (push == OP_PUSH_VAR && pop == OP_POP_VAR) ||
+           (push == OP_N_PUSH_VAR && pop == OP_N_POP_VAR) ||
+           (push == OP_STR_PUSH_VAR && pop == OP_STR_POP_VAR);
+}
+
+/* Helper: drop the words marked in removed (all of an instruction's or */
+/* none), moving the rest down and renumbering every pc in the program. */
+/* A pc that pointed at a dropped word moves to the next word kept */
+static void compiler_compact(CompilerState *cs, const uint8_t *removed) {
+    CompiledProgram *prog = cs->program;
+    Instruction *code = prog->code;
+    size_t len = prog->code_len;
+    size_t *new_pc;
+    size_t pc, words, k, out;
+    
+    new_pc = malloc(sizeof(size_t) * (len + 1));
+    if (!new_pc) return;
+    for (pc = 0, out = 0; pc <= len; pc++) {
+        new_pc[pc] = out;
+        if (pc < len && !removed[pc]) out++;
+    }
+    for (pc = 0; pc < len; pc += words) {
+        uint8_t op = code[pc].opcode;
+        
+        words = compiler_instruction_words(&code[pc]);
+        if (removed[pc]) continue;
+        if (peephole_jumps(op) || op == OP_TRAP) {
+            if (code[pc].operand <= len) code[pc].operand = (uint16_t)new_pc[code[pc].operand];
+        } else if (op == OP_ON_GOTO || op == OP_ON_GOSUB) {
+            for (k = 1; k < words && pc + k < len; k++) {
+                if (code[pc + k].operand <= len) {
+                    code[pc + k].operand = (uint16_t)new_pc[code[pc + k].operand];
+                }
+            }
+        } else if (op == OP_FOR_LOOP && pc + 2 < len) {
+            if (code[pc + 2].operand <= len) {
+                code[pc + 2].operand = (uint16_t)new_pc[code[pc + 2].operand];
+            }
+        }
+    }
+    for (k = 0; k < prog->line_count; k++) {
+        if (prog->line_map[k].pc_offset <= len) {
+            prog->line_map[k].pc_offset = (uint32_t)new_pc[prog->line_map[k].pc_offset];
+        }
+    }
+    for (pc = 0; pc < len; pc++) {
+        if (!removed[pc]) code[new_pc[pc]] = code[pc];
+    }
+    prog->code_len = out;
+    free(new_pc);
+}
+
+/* Remove the code no path from pc 0 reaches (basset_compile -O)
+ *
+ * cfg_build() follows every jump, call, ON table, TRAP target and loop
+ * back edge, and every line start once the program has a computed GOTO or
+ * GOSUB (see cfg.h). Blocks it never reaches - lines nothing jumps to
+ * after a GOTO or END, subroutines whose every GOSUB was inlined, the rest
+ * of a line after its GOTO - are dropped, along with the line map entries
+ * of lines left without code. DATA is unaffected: READ takes its values
+ * from the data pools, not from the code.
+ */
+void compiler_eliminate_dead_code(CompilerState *cs) {
+    CompiledProgram *prog = cs->program;
+    size_t len = prog->code_len;
+    ControlFlowGraph *cfg;
+    uint8_t *removed;
+    size_t b, pc, k, out;
+    int any = 0;
+    
+    if (len == 0) return;
+    cfg = cfg_build(prog);
+    removed = calloc(len + 1, 1);
+    if (!cfg || !removed) {
+        cfg_free(cfg);
+        free(removed);
+        return;
+    }
+    
+    for (b = 0; b < cfg->block_count; b++) {
+        if (cfg->blocks[b].reachable) continue;
+        for (pc = cfg->blocks[b].first; pc < cfg->blocks[b].end; pc++) removed[pc] = 1;
+        any = 1;
+    }
+    
+    if (any) {
+        /* A line keeps its entry if any of its words is kept */
+        for (k = 0, out = 0; k < prog->line_count; k++) {
+            size_t first = prog->line_map[k].pc_offset;
+            size_t end = len;
+            size_t next;
+            
+            for (next = k + 1; next < prog->line_count; next++) {
+                if (prog->line_map[next].pc_offset > first) {
+                    end = prog->line_map[next].pc_offset;
+                    break;
+                }
+            }
+            pc = first;
+            while (pc < end && removed[pc]) pc++;
+            if (first >= len || pc < end) prog->line_map[out++] = prog->line_map[k];
+        }
+        prog->line_count = out;
+        compiler_compact(cs, removed);
+    }
+    
+    cfg_free(cfg);
+    free(removed);
+}
+
+/* Peephole optimization and compaction (basset_compile -O)
+ *
+ * Runs once every jump is resolved. A jump to an unconditional JUMP is
+ * sent straight to its final target; then these are dropped:
+ *
+ *   NOP                                (the unpaired FOR forms leave these)
+ *   JUMP L; L:                         (a jump to the next instruction)
+ *   PUSH_VAR x; POP_VAR x              (X = X, and the N_ and STR_ forms)
+ *   PUSH...; POP
+ *   JNEQ L1; JUMP L2; L1:          ->  JNNE L2      (and JNNE, R_JNEQ, R_JNNE)
+ *
+ * A pair goes only if nothing jumps to its second word. Only = and <> are
+ * inverted, being exact complements even for NaN. The kept words then move
+ * down over the gaps and every pc - jump, GOSUB, ON and TRAP targets, the
+ * FOR_LOOP body and the line map - is renumbered; a pc that pointed at a
+ * dropped word moves to the next word kept. Operand words (ON tables,
+ * loop and register operands) are stepped over, never examined.
+ */
+void compiler_peephole(CompilerState *cs) {
+    CompiledProgram *prog = cs->program;
+    Instruction *code = prog->code;
+    size_t len = prog->code_len;
+    uint8_t *target, *removed;
+    size_t pc, words, k;
+    
+    if (len == 0) return;
+    target = calloc(len + 1, 1);
+    removed = calloc(len + 1, 1);
+    if (!target || !removed) {
+        free(target);
+        free(removed);
+        return;
+    }
+    
+    /* Thread jumps to jumps; the hop limit stops at a cycle */
+    for (pc = 0; pc < len; pc += compiler_instruction_words(&code[pc])) {
+        if (peephole_jumps(code[pc].opcode)) {
+            int hops = 0;
+            uint16_t to = code[pc].operand;
+            while (to < len && code[to].opcode == OP_JUMP &&
+                   code[to].operand != to && hops++ < 64) {
+                to = code[to].operand;
+            }
+            code[pc].operand = to;
+        }
+    }
+    
+    /* Words something can transfer to, other than by falling through */
+    for (k = 0; k < prog->line_count; k++) {
+        if (prog->line_map[k].pc_offset <= len) target[prog->line_map[k].pc_offset] = 1;
+    }
+    for (pc = 0; pc < len; pc += words) {
+        uint8_t op = code[pc].opcode;
+        
+        words = compiler_instruction_words(&code[pc]);
+        if (peephole_jumps(op) || op == OP_TRAP) {
+            if (code[pc].operand <= len) target[code[pc].operand] = 1;
+        } else if (op == OP_ON_GOTO || op == OP_ON_GOSUB) {
+            for (k = 1; k < words && pc + k < len; k++) {
+                if (code[pc + k].operand <= len) target[code[pc + k].operand] = 1;
+            }
+        } else if (op == OP_FOR_LOOP && pc + 2 < len) {
+            if (code[pc + 2].operand <= len) target[code[pc + 2].operand] = 1;
+        }
+    }
+    
+    /* NOPs and do-nothing pairs */
+    for (pc = 0; pc < len; pc += words) {
+        words = compiler_instruction_words(&code[pc]);
+        if (code[pc].opcode == OP_NOP) {
+            removed[pc] = 1;
+        } else if (words == 1 && pc + 1 < len && !target[pc + 1] &&
+                   peephole_push_pop(code, pc)) {
+            removed[pc] = removed[pc + 1] = 1;
+            words = 2;
+        }
+    }
+    
+    /* Branches over a JUMP, and JUMPs to where they would fall through */
+    for (pc = 0; pc < len; pc += words) {
+        uint8_t op = code[pc].opcode;
+        size_t next;
+        
+        words = compiler_instruction_words(&code[pc]);
+        if (removed[pc]) continue;
+        next = peephole_next_kept(removed, pc + words, len);
+        if ((op == OP_JNEQ || op == OP_JNNE || op == OP_R_JNEQ || op == OP_R_JNNE) &&
+            next < len && code[next].opcode == OP_JUMP && !target[next] &&
+            peephole_next_kept(removed, code[pc].operand, len) ==
+            peephole_next_kept(removed, next + 1, len)) {
+            switch (op) {
+                case OP_JNEQ: code[pc].opcode = OP_JNNE; break;
+                case OP_JNNE: code[pc].opcode = OP_JNEQ; break;
+                case OP_R_JNEQ: code[pc].opcode = OP_R_JNNE; break;
+                default: code[pc].opcode = OP_R_JNEQ; break;
+            }
+            code[pc].operand = code[next].operand;
+            removed[next] = 1;
+        } else if (op == OP_JUMP && code[pc].operand > pc &&
+                   peephole_next_kept(removed, code[pc].operand, len) == next) {
+            removed[pc] = 1;
+        }
+    }
+    
+    compiler_compact(cs, removed);
+    
+    free(target);
+    free(removed);
+}
+
+/* Rewrite common instruction sequences into superinstructions
+ *
+ * Only the first instruction of a sequence is replaced; the words after it
+ * stay as they are and supply the fused handler's remaining operands (see
+ * bytecode.h). Jump targets, the line map and TRAP addresses therefore
+ * stay valid, and a jump into the middle of a sequence still runs the
+ * original instructions from that point.
+ */
+void compiler_fuse_superinstructions(CompilerState *cs) {
+    Instruction *code = cs->program->code;
+    size_t len = cs->program->code_len;
+    size_t pc = 0;
+    
+    while (pc < len) {
+        uint8_t op = code[pc].opcode;
+        
+        /* Skip ON...GOTO/GOSUB address tables */
+        if (op == OP_ON_GOTO || op == OP_ON_GOSUB) {
+            pc += code[pc].operand + 1;
+            continue;
+        }
+        
+        /* Skip register, loop and subscripted array instructions and their */
+        /* operand words */
+        if (OP_IS_REGISTER(op) || op == OP_FOR_ENTER || op == OP_FOR_LOOP ||
+            OP_IS_ARRAY_INDEXED(op)) {
+            pc += compiler_instruction_words(&code[pc]);
+            continue;
+        }
+        
+        /* N_PUSH_VAR a; N_PUSH_CONST c; N_ADD|N_SUB; N_POP_VAR d (e.g. I=I+1) */
+        if (op == OP_N_PUSH_VAR && pc + 3 < len &&
+            code[pc + 1].opcode == OP_N_PUSH_CONST &&
+            (code[pc + 2].opcode == OP_N_ADD || code[pc + 2].opcode == OP_N_SUB) &&
+            code[pc + 3].opcode == OP_N_POP_VAR) {
+            code[pc].opcode = (code[pc + 2].opcode == OP_N_ADD) ?
+                OP_VAR_ADD_CONST_POP : OP_VAR_SUB_CONST_POP;
+            pc += 4;
+            continue;
+        }
+        
+        /* N_PUSH_VAR a; N_PUSH_VAR b; N_MUL */
+        if (op == OP_N_PUSH_VAR && pc + 2 < len &&
+            code[pc + 1].opcode == OP_N_PUSH_VAR &&
+            code[pc + 2].opcode == OP_N_MUL) {
+            code[pc].opcode = OP_N_VAR_MUL_VAR;
+            pc += 3;
+            continue;
+        }
+        
+        if (op != OP_PUSH_VAR) {
+            pc++;
+            continue;
+        }
+        
+        /* PUSH_VAR a; PUSH_CONST c; ADD|SUB; POP_VAR d */
+        if (pc + 3 < len &&
+            code[pc + 1].opcode == OP_PUSH_CONST &&
+            (code[pc + 2].opcode == OP_ADD || code[pc + 2].opcode == OP_SUB) &&
+            code[pc + 3].opcode == OP_POP_VAR) {
+            code[pc].opcode = (code[pc + 2].opcode == OP_ADD) ?
+                OP_VAR_ADD_CONST_POP : OP_VAR_SUB_CONST_POP;
+            pc += 4;
+            continue;
+        }
+        
+        /* PUSH_VAR i; ARRAY_GET_1D arr */
+        if (pc + 1 < len && code[pc + 1].opcode == OP_ARRAY_GET_1D) {
+            code[pc].opcode = OP_VAR_ARRAY_GET_1D;
+            pc += 2;
+            continue;
+        }
+        
+        /* PUSH_VAR a; PUSH_VAR b; MUL */
+        if (pc + 2 < len &&
+            code[pc + 1].opcode == OP_PUSH_VAR &&
+            code[pc + 2].opcode == OP_MUL) {
+            code[pc].opcode = OP_VAR_MUL_VAR;
+            pc += 3;
+            continue;
+        }
+        
+        pc++;
+    }
+}
+
 /* Forward declarations for compilation functions */
 static void compile_statement(CompilerState *cs, ParseNode *stmt);
 static void compile_expression(CompilerState *cs, ParseNode *expr);
 static void discover_variables_in_tree(CompilerState *cs, ParseNode *node);
+static ParseNode* unwrap_expression(ParseNode *expr);
+static uint8_t reg_arith_opcode(ParseNode *expr);
+static uint16_t compile_reg_operand(CompilerState *cs, ParseNode *expr);
+static int reg_temps_needed(CompilerState *cs, ParseNode *expr, int operand);
+static int reg_fits(CompilerState *cs, ParseNode *expr, int operand);
+static int number_stack_operators(ParseNode *expr);
+static void compile_number_stack(CompilerState *cs, ParseNode *expr);
+static int power_reduced_exponent(const CompilerState *cs, ParseNode *expr);
+static void compile_power_stack(CompilerState *cs, ParseNode *base, int n);
+static int element_updated(CompilerState *cs, ParseNode *element, int slot);
 
 /* Determine variable type from name */
 static VarType get_var_type(const char *name) {
@@ -390,6 +1066,22 @@ static void compile_expression(CompilerState *cs, ParseNode *expr) {
         return;
     }
     
+    /* Register ISA: evaluate arithmetic in registers and push the result */
+    if (cs->isa == ISA_REG && reg_arith_opcode(unwrap_expression(expr)) && reg_fits(cs, expr, 1)) {
+        uint16_t mark = cs->reg_next_temp;
+        compiler_emit(cs, OP_R_PUSH, compile_reg_operand(cs, expr));
+        cs->reg_next_temp = mark;
+        return;
+    }
+    
+    /* Numeric operator trees with more than one operator: evaluate on the */
+    /* number stack and box the result (one operator gains nothing) */
+    if (number_stack_operators(expr) >= 2) {
+        compile_number_stack(cs, expr);
+        compiler_emit_no_operand(cs, OP_N_BOX);
+        return;
+    }
+    
     switch (expr->type) {
         case NODE_CONSTANT:
             /* Check if it's a string constant */
@@ -416,14 +1108,29 @@ static void compile_expression(CompilerState *cs, ParseNode *expr) {
             if (expr->child_count > 0) {
                 /* Array access */
                 int is_string = strchr(expr->text, '$') != NULL;
+                size_t index_pc = cs->program->code_len;
+                int by_var;
+                
+                /* The element the statement writes back (compile_element_update) */
+                if (element_updated(cs, expr, slot)) {
+                    compiler_emit(cs, OP_ARRAY_ADDR_2D, (uint16_t)slot);
+                    compiler_emit_raw(cs, cs->rmw_vars[0]);
+                    compiler_emit_raw(cs, cs->rmw_vars[1]);
+                    cs->rmw_array = -1;
+                    break;
+                }
+                
                 compile_expression(cs, expr->children[0]);  /* Index */
+                by_var = (cs->program->code_len == index_pc + 1);
                 if (expr->child_count > 1) {
                     /* 2D array */
                     compile_expression(cs, expr->children[1]);
+                    by_var = by_var && (cs->program->code_len == index_pc + 2);
                     if (is_string) {
                         compiler_emit(cs, OP_STR_ARRAY_GET_2D, slot);
                     } else {
                         compiler_emit(cs, OP_ARRAY_GET_2D, slot);
+                        compiler_add_array_site(cs, index_pc, 2, by_var);
                     }
                 } else {
                     /* 1D array */
@@ -431,6 +1138,7 @@ static void compile_expression(CompilerState *cs, ParseNode *expr) {
                         compiler_emit(cs, OP_STR_ARRAY_GET_1D, slot);
                     } else {
                         compiler_emit(cs, OP_ARRAY_GET_1D, slot);
+                        compiler_add_array_site(cs, index_pc, 1, by_var);
                     }
                 }
             } else {
@@ -449,6 +1157,14 @@ static void compile_expression(CompilerState *cs, ParseNode *expr) {
         case NODE_OPERATOR:
             /* Binary or unary operator - compile operands first (postfix) */
             if (expr->child_count >= 2) {
+                int n = power_reduced_exponent(cs, expr);
+                
+                /* X^n by multiplying (see compile_power_stack) */
+                if (n) {
+                    compile_power_stack(cs, expr->children[0], n);
+                    break;
+                }
+                
                 /* Binary operator */
                 compile_expression(cs, expr->children[0]);  /* Left */
                 compile_expression(cs, expr->children[1]);  /* Right */
@@ -571,42 +1287,781 @@ static void compile_expression(CompilerState *cs, ParseNode *expr) {
     }
 }
 
-/* Helper: recursively find first NODE_VARIABLE or NODE_CONSTANT in tree */
-static ParseNode* find_leaf_node(ParseNode *node, NodeType target_type) {
-    int i;
-    if (!node) return NULL;
-    if (node->type == target_type) return node;
-    
-    for (i = 0; i < node->child_count; i++) {
-        ParseNode *result = find_leaf_node(node->children[i], target_type);
-        if (result) return result;
+/* Helper: strip single-child EXPRESSION wrappers */
+static ParseNode* unwrap_expression(ParseNode *expr) {
+    while (expr && expr->type == NODE_EXPRESSION && expr->child_count == 1) {
+        expr = expr->children[0];
     }
-    return NULL;
+    return expr;
 }
 
-/* Compile assignment statement */
-static void compile_assignment(CompilerState *cs, ParseNode *stmt) {
-    ParseNode *var_node, *expr_node;
-    ParseNode *actual_var, *actual_const;
-    int slot;
-    
-    
-    if (stmt->child_count < 2) return;
-    
-    var_node = stmt->children[0];
-    expr_node = stmt->children[1];
+/*
+ * Static types
+ *
+ * The type of a BASIC expression follows from its syntax: a $ suffix makes
+ * a variable a string, operators yield numbers, and each built-in function
+ * has a fixed result type. expression_type() reads it off the parse tree;
+ * PRINT uses it to pick PRINT_NUM or PRINT_STR and the code generators use
+ * it to find arithmetic that can skip the tagged expression stack.
+ */
+
+typedef enum {
+    EXPR_UNKNOWN,                /* Not determined (malformed tree) */
+    EXPR_NUMERIC,
+    EXPR_STRING
+} ExprType;
+
+/* Helper: the node compile_expression() compiles for expr - single-child */
+/* wrappers stripped, and the operator of a multi-child EXPRESSION */
+static ParseNode* expression_node(ParseNode *expr) {
+    size_t i;
     
+    expr = unwrap_expression(expr);
+    if (expr && expr->type == NODE_EXPRESSION && expr->child_count > 1) {
+        for (i = 0; i < expr->child_count; i++) {
+            if (expr->children[i] && expr->children[i]->type == NODE_OPERATOR) {
+                return unwrap_expression(expr->children[i]);
+            }
+        }
+    }
+    return expr;
+}
+
+static ExprType expression_type(ParseNode *expr) {
+    expr = expression_node(expr);
+    if (!expr) return EXPR_UNKNOWN;
     
-    /* Find the actual variable node (might be wrapped in EXPRESSION nodes) */
-    actual_var = find_leaf_node(var_node, NODE_VARIABLE);
-    if (!actual_var || !actual_var->text) {
-        return;
+    switch (expr->type) {
+        case NODE_CONSTANT:
+            return expr->token == TOK_STRING ? EXPR_STRING : EXPR_NUMERIC;
+            
+        case NODE_VARIABLE:
+            return strchr(expr->text, '$') ? EXPR_STRING : EXPR_NUMERIC;
+            
+        case NODE_OPERATOR:
+            /* Arithmetic, relational and logical operators all push numbers */
+            return EXPR_NUMERIC;
+            
+        case NODE_EXPRESSION:
+            /* Operands without an operator: the first one decides */
+            return expr->child_count > 0 ? expression_type(expr->children[0]) : EXPR_UNKNOWN;
+            
+        case NODE_FUNCTION_CALL:
+            switch (expr->token) {
+                case TOK_CSIN: case TOK_CCOS: case TOK_CATN: case TOK_CEXP_F:
+                case TOK_CLOG: case TOK_CCLOG: case TOK_CSQR: case TOK_CABS:
+                case TOK_CINT: case TOK_CRND: case TOK_CSGN: case TOK_CPEEK:
+                case TOK_CLEN: case TOK_CASC: case TOK_CVAL: case TOK_CERR:
+                    return EXPR_NUMERIC;
+                case TOK_CLEFT: case TOK_CRIGHT: case TOK_CMID:
+                case TOK_CCHR: case TOK_CSTR:
+                    return EXPR_STRING;
+                default:
+                    return EXPR_UNKNOWN;
+            }
+            
+        default:
+            return EXPR_UNKNOWN;
     }
+}
+
+/* Helper: true if the expression is known at compile time to yield a number */
+static int expression_is_numeric(ParseNode *expr) {
+    return expression_type(expr) == EXPR_NUMERIC;
+}
+
+/* Helper: true if expr is a numeric constant (or a negated one), in *value */
+static int expression_constant(ParseNode *expr, double *value) {
+    expr = expression_node(expr);
+    if (!expr) return 0;
     
+    if (expr->type == NODE_CONSTANT && expr->token != TOK_STRING) {
+        *value = expr->value;
+        return 1;
+    }
+    if (expr->type == NODE_OPERATOR && expr->child_count == 1 &&
+        (expr->token == TOK_CMINUS || expr->token == TOK_CUMINUS) &&
+        expression_constant(expr->children[0], value)) {
+        *value = -*value;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Constant folding
+ *
+ * Before any code is generated, compiler_fold_constants() replaces each
+ * operator or built-in function whose operands are all constants by the
+ * constant it evaluates to, so a negated literal, 2*3.14159 or CHR$(65)
+ * costs one push instead of several pushes and an operation on every run.
+ * The arithmetic is the VM's own C arithmetic on doubles, so the result
+ * is exactly what the program would have computed. Operations that can
+ * raise an error (division by zero, SQR or LOG out of range) or depend on
+ * run-time state (RND, PEEK, ERR, and SIN/COS/ATN under DEG) are left for
+ * the VM. GOTO, GOSUB, ON, TRAP and RESTORE keep their operands as written:
+ * a constant target is resolved, and rejected if missing, at compile time.
+ *
+ * It also drops operations that return their numeric operand unchanged -
+ * X*1, 1*X, X/1, X-0 and X^1 - and NOT NOT of a relational or logical
+ * result, which is already 0 or 1. X+0 is kept: it turns -0 into 0, and
+ * PRINT shows the difference. Division by a constant power of two, X/4,
+ * becomes multiplication by its reciprocal, X*0.25, which scales by the
+ * same power of two and so gives the identical result more cheaply.
+ */
+
+/* Free node's children and text, leaving an empty node */
+static void fold_clear(ParseNode *node) {
+    int i;
     
-    slot = compiler_find_variable(cs, actual_var->text);
-    if (slot < 0) {
-        slot = compiler_add_variable(cs, actual_var->text, get_var_type(actual_var->text));
+    for (i = 0; i < node->child_count; i++) {
+        node_free(node->children[i]);
+    }
+    free(node->children);
+    free(node->text);
+    node->children = NULL;
+    node->child_count = 0;
+    node->child_capacity = 0;
+    node->text = NULL;
+}
+
+static void fold_to_number(ParseNode *node, double value) {
+    fold_clear(node);
+    node->type = NODE_CONSTANT;
+    node->token = TOK_NUMBER;
+    node->value = value;
+}
+
+static void fold_to_string(ParseNode *node, const char *text) {
+    char *copy = basset_strdup(text);
+    
+    fold_clear(node);
+    node->type = NODE_CONSTANT;
+    node->token = TOK_STRING;
+    node->text = copy;
+}
+
+/* Replace node by the descendant in *slot */
+static void fold_to_operand(ParseNode *node, ParseNode **slot) {
+    ParseNode *keep = *slot;
+    
+    *slot = NULL;
+    fold_clear(node);
+    *node = *keep;
+    free(keep);
+}
+
+/* Helper: true if expr is the constant value, in the same sign for zero */
+static int fold_is_constant(ParseNode *expr, double value) {
+    double constant;
+    
+    if (!expression_constant(expr, &constant) || constant != value) return 0;
+    return value != 0.0 || 1.0 / constant > 0.0;
+}
+
+/* Helper: true if expr yields only 0 or 1 */
+static int fold_is_truth_value(ParseNode *expr) {
+    expr = expression_node(expr);
+    if (!expr || expr->type != NODE_OPERATOR) return 0;
+    
+    switch (expr->token) {
+        case TOK_CEQ: case TOK_CNE: case TOK_CLT: case TOK_CLE:
+        case TOK_CGT: case TOK_CGE: case TOK_CAND: case TOK_COR:
+            return expr->child_count == 2;
+        case TOK_CNOT:
+            return expr->child_count == 1;
+        default:
+            return 0;
+    }
+}
+
+/* a <op> b as the VM computes it; 0 if it would raise an error */
+static int fold_binary(unsigned char op, double a, double b, double *result) {
+    switch (op) {
+        case TOK_CPLUS:  *result = a + b; return 1;
+        case TOK_CMINUS: *result = a - b; return 1;
+        case TOK_CMUL:   *result = a * b; return 1;
+        case TOK_CDIV:
+            if (b == 0.0) return 0;
+            *result = a / b;
+            return 1;
+        case TOK_CEXP:   *result = pow(a, b); return 1;
+        case TOK_CEQ:    *result = (a == b) ? 1.0 : 0.0; return 1;
+        case TOK_CNE:    *result = (a != b) ? 1.0 : 0.0; return 1;
+        case TOK_CLT:    *result = (a < b) ? 1.0 : 0.0; return 1;
+        case TOK_CLE:    *result = (a <= b) ? 1.0 : 0.0; return 1;
+        case TOK_CGT:    *result = (a > b) ? 1.0 : 0.0; return 1;
+        case TOK_CGE:    *result = (a >= b) ? 1.0 : 0.0; return 1;
+        case TOK_CAND:   *result = (a != 0.0 && b != 0.0) ? 1.0 : 0.0; return 1;
+        case TOK_COR:    *result = (a != 0.0 || b != 0.0) ? 1.0 : 0.0; return 1;
+        default:         return 0;
+    }
+}
+
+/* Helper: true if expr is a constant power of two, +/-2^k, whose */
+/* reciprocal is a normal double too, in *value */
+static int fold_power_of_two(ParseNode *expr, double *value) {
+    int exponent;
+    
+    if (!expression_constant(expr, value) || *value == 0) return 0;
+    return frexp(fabs(*value), &exponent) == 0.5 && exponent > -1000 && exponent < 1000;
+}
+
+/* Fold a call of a pure built-in with constant arguments */
+static void fold_function(ParseNode *node) {
+    ParseNode *arg;
+    double x;
+    char buffer[64];
+    
+    if (node->child_count != 1) return;
+    arg = expression_node(node->children[0]);
+    if (!arg || arg->type != NODE_CONSTANT) return;
+    
+    if (arg->token == TOK_STRING) {
+        const char *s = arg->text ? arg->text : "";
+        switch (node->token) {
+            case TOK_CLEN: fold_to_number(node, (double)strlen(s)); break;
+            case TOK_CASC: fold_to_number(node, s[0] ? (double)(unsigned char)s[0] : 0.0); break;
+            case TOK_CVAL: fold_to_number(node, atof(s)); break;
+            default: break;
+        }
+        return;
+    }
+    
+    x = arg->value;
+    switch (node->token) {
+        case TOK_CABS: fold_to_number(node, fabs(x)); break;
+        case TOK_CINT: fold_to_number(node, floor(x)); break;
+        case TOK_CSGN: fold_to_number(node, (x > 0) ? 1.0 : (x < 0) ? -1.0 : 0.0); break;
+        case TOK_CEXP_F: fold_to_number(node, exp(x)); break;
+        case TOK_CSQR: if (x >= 0) fold_to_number(node, sqrt(x)); break;
+        case TOK_CLOG: if (x > 0) fold_to_number(node, log(x)); break;
+        case TOK_CCLOG: if (x > 0) fold_to_number(node, log10(x)); break;
+        case TOK_CSTR:
+            sprintf(buffer, "%g", x);
+            fold_to_string(node, buffer);
+            break;
+        case TOK_CCHR:
+            if (x > -1.0 && x < 256.0) {
+                buffer[0] = (char)(int)x;
+                buffer[1] = '\0';
+                fold_to_string(node, buffer);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* Fold an operator node whose operands have been folded */
+static void fold_operator(ParseNode *node) {
+    double a, b, result;
+    
+    if (node->child_count == 1) {
+        ParseNode *inner;
+        
+        if (expression_constant(node->children[0], &a) &&
+            expression_node(node->children[0])->type == NODE_CONSTANT) {
+            if (node->token == TOK_CMINUS || node->token == TOK_CUMINUS) {
+                fold_to_number(node, -a);
+            } else if (node->token == TOK_CNOT) {
+                fold_to_number(node, (a == 0.0) ? 1.0 : 0.0);
+            }
+            return;
+        }
+        /* NOT NOT X is X when X is already 0 or 1 */
+        inner = expression_node(node->children[0]);
+        if (node->token == TOK_CNOT && inner && inner->type == NODE_OPERATOR &&
+            inner->token == TOK_CNOT && inner->child_count == 1 &&
+            fold_is_truth_value(inner->children[0])) {
+            fold_to_operand(node, &inner->children[0]);
+        }
+        return;
+    }
+    if (node->child_count != 2) return;
+    
+    if (expression_constant(node->children[0], &a) &&
+        expression_constant(node->children[1], &b)) {
+        if (fold_binary(node->token, a, b, &result)) fold_to_number(node, result);
+        return;
+    }
+    
+    /* Identities, for numeric operands only: A$*1 is still a type mismatch */
+    if (!expression_is_numeric(node->children[0]) || !expression_is_numeric(node->children[1])) {
+        return;
+    }
+    switch (node->token) {
+        case TOK_CMUL:
+            if (fold_is_constant(node->children[1], 1.0)) {
+                fold_to_operand(node, &node->children[0]);
+            } else if (fold_is_constant(node->children[0], 1.0)) {
+                fold_to_operand(node, &node->children[1]);
+            }
+            break;
+        case TOK_CDIV:
+            if (fold_is_constant(node->children[1], 1.0)) {
+                fold_to_operand(node, &node->children[0]);
+            } else if (fold_power_of_two(node->children[1], &b)) {
+                /* X/4 is exactly X*0.25, and a multiply is cheaper */
+                node->token = TOK_CMUL;
+                fold_to_number(node->children[1], 1.0 / b);
+            }
+            break;
+        case TOK_CEXP:
+            if (fold_is_constant(node->children[1], 1.0)) {
+                fold_to_operand(node, &node->children[0]);
+            }
+            break;
+        case TOK_CMINUS:
+            if (fold_is_constant(node->children[1], 0.0)) {
+                fold_to_operand(node, &node->children[0]);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* Fold the expressions under node, bottom up */
+static void compiler_fold_constants(ParseNode *node) {
+    int i;
+    
+    if (!node) return;
+    
+    if (node->type == NODE_STATEMENT) {
+        switch (node->token) {
+            case TOK_GOTO: case TOK_CGTO:
+            case TOK_GOSUB_S: case TOK_CGS:
+            case TOK_ON: case TOK_TRAP: case TOK_RESTORE:
+            case TOK_DATA: case TOK_INPUT:
+                return;
+            default:
+                break;
+        }
+    }
+    
+    for (i = 0; i < node->child_count; i++) {
+        compiler_fold_constants(node->children[i]);
+    }
+    
+    if (node->type == NODE_OPERATOR) {
+        fold_operator(node);
+    } else if (node->type == NODE_FUNCTION_CALL) {
+        fold_function(node);
+    }
+}
+
+/*
+ * Strength reduction of powers
+ *
+ * OP_POW calls pow() even for X^2, which costs many times a multiply. A
+ * power with a small constant integer exponent is compiled as multiplies
+ * of its base, evaluated once:
+ *
+ *   X^2         PUSH_VAR X; PUSH_VAR X; MUL      (fused to VAR_MUL_VAR)
+ *   (A-B)^2     A-B; DUP; MUL
+ *   (A-B)^3     A-B; DUP; DUP; MUL; MUL
+ *   X^4         X*X; DUP; MUL
+ *
+ * The number stack has no DUP, so there a base that is not a variable or
+ * constant goes through a hidden variable (N_POP_VAR t; N_PUSH_VAR t;
+ * N_PUSH_VAR t; N_MUL), and registers just name the base twice. X*X is
+ * exactly what pow(X,2) returns; X^3 and X^4 round twice and may differ
+ * from pow() in the last bit, so only -O reduces them.
+ */
+
+/* Helper: n if the power node expr compiles to multiplies, otherwise 0 */
+static int power_reduced_exponent(const CompilerState *cs, ParseNode *expr) {
+    double value;
+    
+    if (!expr || expr->type != NODE_OPERATOR || expr->token != TOK_CEXP ||
+        expr->child_count != 2 || !expression_is_numeric(expr->children[0]) ||
+        !expression_constant(expr->children[1], &value)) return 0;
+    
+    if (value == 2.0) return 2;
+    if (cs->optimize && (value == 3.0 || value == 4.0)) return (int)value;
+    return 0;
+}
+
+/* Compile base^n, n from power_reduced_exponent(), on the expression stack */
+static void compile_power_stack(CompilerState *cs, ParseNode *base, int n) {
+    compile_expression(cs, base);
+    if (number_stack_operators(base) == 0) {
+        /* A variable or constant: pushing it again is as cheap as DUP */
+        compile_expression(cs, base);
+        compiler_emit_no_operand(cs, OP_MUL);
+        if (n == 3) {
+            compile_expression(cs, base);
+            compiler_emit_no_operand(cs, OP_MUL);
+        }
+    } else {
+        compiler_emit_no_operand(cs, OP_DUP);
+        if (n == 3) compiler_emit_no_operand(cs, OP_DUP);
+        compiler_emit_no_operand(cs, OP_MUL);
+        if (n == 3) compiler_emit_no_operand(cs, OP_MUL);
+    }
+    if (n == 4) {
+        compiler_emit_no_operand(cs, OP_DUP);
+        compiler_emit_no_operand(cs, OP_MUL);
+    }
+}
+
+/* Compile base^n on the number stack */
+static void compile_power_number_stack(CompilerState *cs, ParseNode *base, int n) {
+    int leaf = number_stack_operators(base) == 0;
+    int squarings = (n == 4) ? 2 : 1;
+    int k;
+    
+    compile_number_stack(cs, base);
+    for (k = 0; k < squarings; k++) {
+        if (leaf && k == 0) {
+            compile_number_stack(cs, base);
+        } else {
+            /* Nothing else runs between the store and the loads */
+            if (cs->power_temp < 0) cs->power_temp = compiler_add_hidden_variable(cs, "POW.T");
+            compiler_emit(cs, OP_N_POP_VAR, (uint16_t)cs->power_temp);
+            compiler_emit(cs, OP_N_PUSH_VAR, (uint16_t)cs->power_temp);
+            compiler_emit(cs, OP_N_PUSH_VAR, (uint16_t)cs->power_temp);
+        }
+        compiler_emit_no_operand(cs, OP_N_MUL);
+    }
+    if (n == 3) {
+        if (leaf) {
+            compile_number_stack(cs, base);
+        } else {
+            compiler_emit(cs, OP_N_PUSH_VAR, (uint16_t)cs->power_temp);
+        }
+        compiler_emit_no_operand(cs, OP_N_MUL);
+    }
+}
+
+/* Helper: number stack opcode for an operator node, or 0 */
+static uint8_t number_stack_opcode(ParseNode *expr) {
+    if (expr->child_count == 1) {
+        if (expr->token == TOK_CMINUS || expr->token == TOK_CUMINUS) return OP_N_NEG;
+        if (expr->token == TOK_CNOT) return OP_N_NOT;
+        return 0;
+    }
+    if (expr->child_count != 2) return 0;
+    
+    switch (expr->token) {
+        case TOK_CPLUS:  return OP_N_ADD;
+        case TOK_CMINUS: return OP_N_SUB;
+        case TOK_CMUL:   return OP_N_MUL;
+        case TOK_CDIV:   return OP_N_DIV;
+        case TOK_CEXP:   return OP_N_POW;
+        case TOK_CEQ:    return OP_N_EQ;
+        case TOK_CNE:    return OP_N_NE;
+        case TOK_CLT:    return OP_N_LT;
+        case TOK_CLE:    return OP_N_LE;
+        case TOK_CGT:    return OP_N_GT;
+        case TOK_CGE:    return OP_N_GE;
+        case TOK_CAND:   return OP_N_AND;
+        case TOK_COR:    return OP_N_OR;
+        default:         return 0;
+    }
+}
+
+/* Number of operators in expr if it can be evaluated on the number stack: */
+/* every leaf a numeric constant or scalar, every operator one with a number */
+/* stack instruction. -1 if it cannot */
+static int number_stack_operators(ParseNode *expr) {
+    int count = 1;
+    size_t i;
+    
+    expr = expression_node(expr);
+    if (!expr) return -1;
+    
+    switch (expr->type) {
+        case NODE_CONSTANT:
+            return expr->token == TOK_STRING ? -1 : 0;
+            
+        case NODE_VARIABLE:
+            return (expr->child_count == 0 && !strchr(expr->text, '$')) ? 0 : -1;
+            
+        case NODE_OPERATOR:
+            if (!number_stack_opcode(expr)) return -1;
+            for (i = 0; i < expr->child_count; i++) {
+                int operand = number_stack_operators(expr->children[i]);
+                if (operand < 0) return -1;
+                count += operand;
+            }
+            return count;
+            
+        default:
+            return -1;
+    }
+}
+
+/* Compile an expression number_stack_operators() accepts onto the number stack */
+static void compile_number_stack(CompilerState *cs, ParseNode *expr) {
+    int slot;
+    size_t i;
+    
+    expr = expression_node(expr);
+    
+    switch (expr->type) {
+        case NODE_CONSTANT:
+            compiler_emit(cs, OP_N_PUSH_CONST, compiler_add_const(cs, expr->value));
+            break;
+            
+        case NODE_VARIABLE:
+            slot = compiler_find_variable(cs, expr->text);
+            if (slot < 0) {
+                slot = compiler_add_variable(cs, expr->text, VAR_NUMERIC);
+            }
+            compiler_emit(cs, OP_N_PUSH_VAR, (uint16_t)slot);
+            break;
+            
+        default:
+            if (power_reduced_exponent(cs, expr)) {
+                compile_power_number_stack(cs, expr->children[0], power_reduced_exponent(cs, expr));
+                break;
+            }
+            for (i = 0; i < expr->child_count; i++) {
+                compile_number_stack(cs, expr->children[i]);
+            }
+            compiler_emit_no_operand(cs, number_stack_opcode(expr));
+            break;
+    }
+}
+
+/* Helper: fused "jump if comparison false" opcode for a relational node */
+/* comparing two numeric operands, or 0 if the condition does not qualify */
+static uint8_t compare_branch_opcode(ParseNode *cond) {
+    cond = unwrap_expression(cond);
+    if (!cond || cond->type != NODE_OPERATOR || cond->child_count != 2) return 0;
+    if (!expression_is_numeric(cond->children[0]) ||
+        !expression_is_numeric(cond->children[1])) return 0;
+    
+    switch (cond->token) {
+        case TOK_CLT: return OP_JNLT;
+        case TOK_CLE: return OP_JNLE;
+        case TOK_CGT: return OP_JNGT;
+        case TOK_CGE: return OP_JNGE;
+        case TOK_CEQ: return OP_JNEQ;
+        case TOK_CNE: return OP_JNNE;
+        default:      return 0;
+    }
+}
+
+/*
+ * Register code generation (ISA_REG)
+ *
+ * Numeric arithmetic is compiled to three-address register instructions.
+ * Constants and scalar variables are used in place as registers; every
+ * intermediate result gets a temporary, and temporaries are released in
+ * stack order once the instruction consuming them has been emitted.
+ * Anything the register instructions cannot express is compiled as stack
+ * code and popped into a register with OP_R_POP.
+ */
+
+/* Helper: register opcode for an arithmetic node on numeric operands, or 0 */
+static uint8_t reg_arith_opcode(ParseNode *expr) {
+    if (!expr || expr->type != NODE_OPERATOR) return 0;
+    
+    if (expr->child_count == 1) {
+        if ((expr->token == TOK_CMINUS || expr->token == TOK_CUMINUS) &&
+            expression_is_numeric(expr->children[0])) {
+            return OP_R_NEG;
+        }
+        return 0;
+    }
+    
+    if (expr->child_count < 2 ||
+        !expression_is_numeric(expr->children[0]) ||
+        !expression_is_numeric(expr->children[1])) return 0;
+    
+    switch (expr->token) {
+        case TOK_CPLUS:  return OP_R_ADD;
+        case TOK_CMINUS: return OP_R_SUB;
+        case TOK_CMUL:   return OP_R_MUL;
+        case TOK_CDIV:   return OP_R_DIV;
+        case TOK_CEXP:   return OP_R_POW;
+        default:         return 0;
+    }
+}
+
+/* Helper: allocate an expression temporary */
+static uint16_t reg_alloc_temp(CompilerState *cs) {
+    if (cs->reg_next_temp >= REG_TEMP_MAX) {
+        if (!cs->has_error) {
+            snprintf(cs->error_msg, sizeof(cs->error_msg),
+                "Expression too complex for register code at line %d", cs->current_line);
+            cs->has_error = 1;
+        }
+        return REG_TEMP;
+    }
+    
+    cs->reg_next_temp++;
+    if (cs->reg_next_temp > cs->program->reg_temps) {
+        cs->program->reg_temps = (uint8_t)cs->reg_next_temp;
+    }
+    return REG_TEMP | (cs->reg_next_temp - 1);
+}
+
+/* Helper: register holding the constant or scalar variable, or 0xFFFF */
+static uint16_t reg_leaf(CompilerState *cs, ParseNode *expr) {
+    if (expr->type == NODE_CONSTANT && expr->token != TOK_STRING) {
+        uint16_t idx = compiler_add_const(cs, expr->value);
+        if (idx <= REG_INDEX_MASK) return REG_CONST | idx;
+    } else if (expr->type == NODE_VARIABLE && expr->child_count == 0 &&
+               !strchr(expr->text, '$')) {
+        int slot = compiler_find_variable(cs, expr->text);
+        if (slot < 0) {
+            slot = compiler_add_variable(cs, expr->text, VAR_NUMERIC);
+        }
+        if (slot <= REG_INDEX_MASK) return REG_VAR | (uint16_t)slot;
+    }
+    return 0xFFFF;
+}
+
+/* Helper: most temporaries live at once while compile_reg_into() (operand */
+/* 0) or compile_reg_operand() (operand 1) compiles expr; a relation counts */
+/* as the register compare-and-branch an IF makes of it */
+static int reg_temps_needed(CompilerState *cs, ParseNode *expr, int operand) {
+    uint8_t op;
+    int need = 0;
+    
+    expr = unwrap_expression(expr);
+    if (!expr) return operand;
+    if (operand && reg_leaf(cs, expr) != 0xFFFF) return 0;
+    
+    op = reg_arith_opcode(expr);
+    if (op || (operand == 0 && compare_branch_opcode(expr))) {
+        int a = reg_temps_needed(cs, expr->children[0], 1);
+        int held = (a > 0);
+        int power = power_reduced_exponent(cs, expr);
+        
+        if (!op) {
+            /* Relation compiled as a register compare-and-branch */
+            int b = held + reg_temps_needed(cs, expr->children[1], 1);
+            need = (a > b) ? a : b;
+        } else if (op == OP_R_NEG || power == 2) {
+            need = a;
+        } else if (power) {
+            need = (a > held + 1) ? a : held + 1;
+        } else {
+            int b = held + reg_temps_needed(cs, expr->children[1], 1);
+            need = (a > b) ? a : b;
+        }
+    }
+    return operand + need;
+}
+
+/* Helper: true if the register code for expr fits in the temporaries */
+/* still free; expressions that do not are compiled as stack code */
+static int reg_fits(CompilerState *cs, ParseNode *expr, int operand) {
+    return cs->reg_next_temp + reg_temps_needed(cs, expr, operand) <= REG_TEMP_MAX;
+}
+
+/* Compile a numeric expression so that its value ends up in register dst */
+static void compile_reg_into(CompilerState *cs, ParseNode *expr, uint16_t dst) {
+    uint8_t op;
+    uint16_t leaf;
+    
+    expr = unwrap_expression(expr);
+    if (!expr) {
+        compiler_emit(cs, OP_R_MOV, dst);
+        compiler_emit_raw(cs, REG_CONST | compiler_add_const(cs, 0.0));
+        return;
+    }
+    
+    op = reg_arith_opcode(expr);
+    if (op) {
+        uint16_t mark = cs->reg_next_temp;
+        uint16_t a = compile_reg_operand(cs, expr->children[0]);
+        
+        if (op == OP_R_NEG) {
+            compiler_emit(cs, op, dst);
+            compiler_emit_raw(cs, a);
+        } else if (power_reduced_exponent(cs, expr) == 2) {
+            compiler_emit(cs, OP_R_MUL, dst);
+            compiler_emit_raw(cs, a);
+            compiler_emit_raw(cs, a);
+        } else if (power_reduced_exponent(cs, expr)) {
+            /* X^3 is X*X*X and X^4 is (X*X)*(X*X) */
+            uint16_t square = reg_alloc_temp(cs);
+            compiler_emit(cs, OP_R_MUL, square);
+            compiler_emit_raw(cs, a);
+            compiler_emit_raw(cs, a);
+            compiler_emit(cs, OP_R_MUL, dst);
+            compiler_emit_raw(cs, square);
+            compiler_emit_raw(cs, power_reduced_exponent(cs, expr) == 3 ? a : square);
+        } else {
+            uint16_t b = compile_reg_operand(cs, expr->children[1]);
+            compiler_emit(cs, op, dst);
+            compiler_emit_raw(cs, a);
+            compiler_emit_raw(cs, b);
+        }
+        cs->reg_next_temp = mark;
+        return;
+    }
+    
+    leaf = reg_leaf(cs, expr);
+    if (leaf != 0xFFFF) {
+        compiler_emit(cs, OP_R_MOV, dst);
+        compiler_emit_raw(cs, leaf);
+        return;
+    }
+    
+    /* Function calls, array elements, relations: stack code */
+    compile_expression(cs, expr);
+    compiler_emit(cs, OP_R_POP, dst);
+}
+
+/* Compile a numeric expression and return the register holding its value */
+/* (the caller releases any temporary by restoring cs->reg_next_temp) */
+static uint16_t compile_reg_operand(CompilerState *cs, ParseNode *expr) {
+    ParseNode *node = unwrap_expression(expr);
+    uint16_t reg;
+    
+    if (node) {
+        reg = reg_leaf(cs, node);
+        if (reg != 0xFFFF) return reg;
+    }
+    
+    reg = reg_alloc_temp(cs);
+    compile_reg_into(cs, node, reg);
+    return reg;
+}
+
+/* Helper: recursively find first NODE_VARIABLE or NODE_CONSTANT in tree */
+static ParseNode* find_leaf_node(ParseNode *node, NodeType target_type) {
+    int i;
+    if (!node) return NULL;
+    if (node->type == target_type) return node;
+    
+    for (i = 0; i < node->child_count; i++) {
+        ParseNode *result = find_leaf_node(node->children[i], target_type);
+        if (result) return result;
+    }
+    return NULL;
+}
+
+/* Compile assignment statement */
+static void compile_assignment(CompilerState *cs, ParseNode *stmt) {
+    ParseNode *var_node, *expr_node;
+    ParseNode *actual_var, *actual_const;
+    int slot;
+    
+    
+    if (stmt->child_count < 2) return;
+    
+    var_node = stmt->children[0];
+    expr_node = stmt->children[1];
+    
+    
+    /* Find the actual variable node (might be wrapped in EXPRESSION nodes) */
+    actual_var = find_leaf_node(var_node, NODE_VARIABLE);
+    if (!actual_var || !actual_var->text) {
+        return;
+    }
+    
+    
+    slot = compiler_find_variable(cs, actual_var->text);
+    if (slot < 0) {
+        slot = compiler_add_variable(cs, actual_var->text, get_var_type(actual_var->text));
     }
     
     
@@ -635,7 +2090,7 @@ static void compile_assignment(CompilerState *cs, ParseNode *stmt) {
 
 /* Compile PRINT statement */
 static void compile_print(CompilerState *cs, ParseNode *stmt) {
-    size_t i, j;
+    size_t i;
     size_t first_item = 0;
     int has_trailing_separator = 0;
     int is_string;
@@ -698,35 +2153,7 @@ static void compile_print(CompilerState *cs, ParseNode *stmt) {
             /* Expression to print - compile it */
             compile_expression(cs, child);
             
-            /* Determine if it's string or numeric by checking the top-level node type */
-            /* For expressions, we default to numeric unless it's clearly a string */
-            is_string = 0;
-            if (child->type == NODE_CONSTANT && child->token == TOK_STRING) {
-                is_string = 1;
-            } else if (child->type == NODE_VARIABLE && strchr(child->text, '$')) {
-                is_string = 1;
-            } else if (child->type == NODE_FUNCTION_CALL && 
-                       (child->token == TOK_CLEFT || child->token == TOK_CRIGHT || 
-                        child->token == TOK_CMID || child->token == TOK_CCHR ||
-                        child->token == TOK_CSTR)) {
-                is_string = 1;
-            }
-            /* For NODE_EXPRESSION, check if it contains a string variable or function */
-            else if (child->type == NODE_EXPRESSION && child->child_count > 0) {
-                /* Recursively check children for string indicators */
-                for (j = 0; j < child->child_count; j++) {
-                    if (child->children[j]) {
-                        if ((child->children[j]->type == NODE_VARIABLE && strchr(child->children[j]->text, '$')) ||
-                            (child->children[j]->type == NODE_FUNCTION_CALL && 
-                             (child->children[j]->token == TOK_CLEFT || child->children[j]->token == TOK_CRIGHT || 
-                              child->children[j]->token == TOK_CMID || child->children[j]->token == TOK_CCHR ||
-                              child->children[j]->token == TOK_CSTR))) {
-                            is_string = 1;
-                            break;
-                        }
-                    }
-                }
-            }
+            is_string = expression_type(child) == EXPR_STRING;
             
             if (is_string) {
                 compiler_emit_no_operand(cs, OP_PRINT_STR);
@@ -811,6 +2238,7 @@ static void compile_input(CompilerState *cs, ParseNode *stmt) {
 static void compile_if_then(CompilerState *cs, ParseNode *stmt) {
     ParseNode *condition, *then_part, *else_part;
     uint32_t jump_if_false_offset, jump_skip_else_offset;
+    uint8_t branch_op;
     int i;
     
     /* IF structure: [condition, THEN|empty, then_body, else_clause]
@@ -824,12 +2252,32 @@ static void compile_if_then(CompilerState *cs, ParseNode *stmt) {
     then_part = stmt->children[2];
     else_part = (stmt->child_count >= 4) ? stmt->children[3] : NULL;
     
-    /* Compile condition */
-    compile_expression(cs, condition);
-    
-    /* Emit conditional jump - if false, skip to ELSE or end */
-    jump_if_false_offset = cs->program->code_len;
-    compiler_emit(cs, OP_JUMP_IF_FALSE, 0);  /* Placeholder */
+    /* Emit condition and conditional jump - if false, skip to ELSE or end. */
+    /* A single numeric comparison compiles to a fused compare-and-branch. */
+    /* Under the register ISA it compares two registers instead. */
+    branch_op = compare_branch_opcode(condition);
+    if (branch_op && cs->isa == ISA_REG && reg_fits(cs, condition, 0)) {
+        ParseNode *relation = unwrap_expression(condition);
+        uint16_t mark = cs->reg_next_temp;
+        uint16_t a = compile_reg_operand(cs, relation->children[0]);
+        uint16_t b = compile_reg_operand(cs, relation->children[1]);
+        cs->reg_next_temp = mark;
+        jump_if_false_offset = cs->program->code_len;
+        compiler_emit(cs, (uint8_t)(OP_R_JNLT + (branch_op - OP_JNLT)), 0);  /* Placeholder */
+        compiler_emit_raw(cs, a);
+        compiler_emit_raw(cs, b);
+    } else {
+        if (branch_op) {
+            ParseNode *relation = unwrap_expression(condition);
+            compile_expression(cs, relation->children[0]);
+            compile_expression(cs, relation->children[1]);
+        } else {
+            compile_expression(cs, condition);
+            branch_op = OP_JUMP_IF_FALSE;
+        }
+        jump_if_false_offset = cs->program->code_len;
+        compiler_emit(cs, branch_op, 0);  /* Placeholder */
+    }
     
     /* Compile THEN part - it's an EXPRESSION containing statements */
     if (then_part && then_part->child_count > 0) {
@@ -951,166 +2399,1415 @@ static void compile_goto(CompilerState *cs, ParseNode *stmt) {
             compiler_emit(cs, OP_JUMP, 0xFFFF);
             compiler_add_jump_fixup(cs, cs->program->code_len - 1, line, JUMP_ABSOLUTE);
         }
-    } else {
-        /* Variable GOTO - runtime lookup */
-        compile_expression(cs, target);
-        compiler_emit_no_operand(cs, OP_JUMP_LINE);
+    } else {
+        /* Variable GOTO - runtime lookup */
+        compile_expression(cs, target);
+        compiler_emit_no_operand(cs, OP_JUMP_LINE);
+    }
+}
+
+/* GOSUB inlining
+ *
+ * A GOSUB to a short subroutine of plain statements ending in RETURN is
+ * compiled as a copy of those statements instead of OP_GOSUB, saving the
+ * return stack push and pop and both jumps on every call. The subroutine
+ * stays where it is, so a GOTO, ON table or computed GOSUB that reaches it
+ * still runs the original. Only statements that neither transfer control
+ * nor touch the GOSUB stack qualify, and a program with TRAP inlines
+ * nothing: an error inside a copy would reach the handler without the
+ * return address a RETURN there expects.
+ */
+#define INLINE_MAX_STATEMENTS 4
+
+/* 1 if stmt may be compiled at a call site in place of its subroutine */
+static int statement_inlinable(const ParseNode *stmt) {
+    switch (stmt->token) {
+        case TOK_REM:
+        case TOK_IDENT:
+        case TOK_LET:
+        case TOK_PRINT:
+        case TOK_QUESTION:
+        case TOK_POKE:
+        case TOK_DEG:
+        case TOK_RAD:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* 1 if a statement with token appears anywhere under node */
+static int tree_has_statement(const ParseNode *node, unsigned char token) {
+    size_t i;
+    
+    if (!node) return 0;
+    if (node->type == NODE_STATEMENT && node->token == token) return 1;
+    for (i = 0; i < node->child_count; i++) {
+        if (tree_has_statement(node->children[i], token)) return 1;
+    }
+    return 0;
+}
+
+static const Subroutine* compiler_find_subroutine(const CompilerState *cs, uint16_t line) {
+    size_t i;
+    
+    for (i = 0; i < cs->subroutine_count; i++) {
+        if (cs->subroutines[i].line == line) return &cs->subroutines[i];
+    }
+    return NULL;
+}
+
+/* Add line to the subroutine table, inlining it if allowed and it is */
+/* at most INLINE_MAX_STATEMENTS inlinable statements and a RETURN */
+static void compiler_add_subroutine(CompilerState *cs, uint16_t line, int allow_inline) {
+    ParseNode *root = cs->root;
+    Subroutine *sub;
+    size_t first, k;
+    int count = 0;
+    
+    if (compiler_find_subroutine(cs, line)) return;
+    if (cs->subroutine_count >= cs->subroutine_capacity) {
+        cs->subroutine_capacity *= 2;
+        cs->subroutines = realloc(cs->subroutines, sizeof(Subroutine) * cs->subroutine_capacity);
+    }
+    sub = &cs->subroutines[cs->subroutine_count++];
+    sub->line = line;
+    sub->first = 0;
+    sub->length = 0;
+    sub->inlined = 0;
+    
+    for (first = 0; first < root->child_count; first++) {
+        ParseNode *stmt = root->children[first];
+        if (stmt && stmt->type == NODE_STATEMENT && stmt->line_number == line) break;
+    }
+    if (first == root->child_count || !allow_inline) return;
+    
+    for (k = first; k < root->child_count; k++) {
+        ParseNode *stmt = root->children[k];
+        
+        if (!stmt || stmt->type != NODE_STATEMENT) continue;
+        if (stmt->token == TOK_RETURN) {
+            sub->first = (uint32_t)first;
+            sub->length = (uint16_t)(k - first);
+            sub->inlined = 1;
+            return;
+        }
+        if (!statement_inlinable(stmt)) return;
+        if (stmt->token != TOK_REM && ++count > INLINE_MAX_STATEMENTS) return;
+    }
+}
+
+/* Add the target of every GOSUB to a constant line under node */
+static void compiler_add_gosub_targets(CompilerState *cs, const ParseNode *node, int allow_inline) {
+    size_t i;
+    
+    if (!node) return;
+    if (node->type == NODE_STATEMENT &&
+        (node->token == TOK_GOSUB_S || node->token == TOK_CGS) &&
+        node->child_count > 0 && node->children[0]->type == NODE_CONSTANT) {
+        compiler_add_subroutine(cs, (uint16_t)node->children[0]->value, allow_inline);
+    }
+    for (i = 0; i < node->child_count; i++) {
+        compiler_add_gosub_targets(cs, node->children[i], allow_inline);
+    }
+}
+
+/* Build the subroutine table for the program root */
+static void compiler_find_subroutines(CompilerState *cs, ParseNode *root) {
+    cs->root = root;
+    compiler_add_gosub_targets(cs, root, !tree_has_statement(root, TOK_TRAP));
+}
+
+/* Compile GOSUB statement */
+static void compile_gosub(CompilerState *cs, ParseNode *stmt) {
+    ParseNode *target;
+    int32_t offset;
+    
+    if (stmt->child_count < 1) return;
+    
+    target = stmt->children[0];
+    
+    if (target->type == NODE_CONSTANT) {
+        uint16_t line = (uint16_t)target->value;
+        const Subroutine *sub = compiler_find_subroutine(cs, line);
+        
+        if (sub && sub->inlined) {
+            size_t k;
+            for (k = sub->first; k < sub->first + sub->length; k++) {
+                ParseNode *body = cs->root->children[k];
+                if (body && body->type == NODE_STATEMENT) compile_statement(cs, body);
+            }
+            return;
+        }
+        
+        offset = compiler_find_line_offset(cs, line);
+        
+        if (offset >= 0) {
+            compiler_emit(cs, OP_GOSUB, offset);
+        } else {
+            compiler_emit(cs, OP_GOSUB, 0xFFFF);
+            compiler_add_jump_fixup(cs, cs->program->code_len - 1, line, JUMP_GOSUB);
+        }
+    } else {
+        compile_expression(cs, target);
+        compiler_emit_no_operand(cs, OP_GOSUB_LINE);
+    }
+}
+
+/* Compile ON...GOTO/GOSUB statement */
+static void compile_on(CompilerState *cs, ParseNode *stmt) {
+    ParseNode *expr, *on1_node, *expl_node, *current;
+    int is_gosub = 0;
+    size_t count = 0;
+    size_t i;
+    uint32_t *line_numbers;
+    size_t line_count = 0;
+    
+    /* ON structure: [expr, ON1, EXPL, EOS]
+       expr is the index expression
+       ON1 is either GOTO or GOSUB
+       EXPL is the comma-separated list of line numbers */
+    
+    if (stmt->child_count < 3) return;
+    
+    expr = stmt->children[0];
+    on1_node = stmt->children[1];
+    expl_node = stmt->children[2];
+    
+    /* Determine if this is GOTO or GOSUB by checking the ON1 node */
+    /* ON1 can be an expression containing the token */
+    if (on1_node) {
+        if (on1_node->token == TOK_CGS || on1_node->token == TOK_GOSUB_S) {
+            is_gosub = 1;
+        } else if (on1_node->type == NODE_EXPRESSION && on1_node->child_count > 0) {
+            ParseNode *tok_node = on1_node->children[0];
+            if (tok_node && (tok_node->token == TOK_CGS || tok_node->token == TOK_GOSUB_S)) {
+                is_gosub = 1;
+            }
+        }
+    }
+    
+    /* Count the number of targets in the expression list */
+    current = expl_node;
+    while (current && current->type == NODE_EXPRESSION) {
+        if (current->child_count > 0) {
+            count++;
+            /* Navigate to next EXPL via EXPL1 */
+            if (current->child_count > 1 && current->children[1]) {
+                current = current->children[1];
+                /* EXPL1 has comma at [0], next EXPL at [1] */
+                if (current->child_count > 1) {
+                    current = current->children[1];
+                } else {
+                    break;
+                }
+            } else {
+                break;
+            }
+        } else {
+            break;
+        }
+    }
+    
+    if (count == 0) return;
+    
+    /* Allocate array for line numbers */
+    line_numbers = malloc(sizeof(uint32_t) * count);
+    
+    /* Extract line numbers from expression list */
+    current = expl_node;
+    i = 0;
+    while (current && current->type == NODE_EXPRESSION && i < count) {
+        if (current->child_count > 0 && current->children[0]) {
+            ParseNode *line_expr = current->children[0];
+            if (line_expr->type == NODE_CONSTANT) {
+                line_numbers[i++] = (uint32_t)line_expr->value;
+            }
+        }
+        
+        /* Navigate to next */
+        if (current->child_count > 1 && current->children[1]) {
+            current = current->children[1];
+            if (current->child_count > 1) {
+                current = current->children[1];
+            } else {
+                break;
+            }
+        } else {
+            break;
+        }
+    }
+    line_count = i;
+    
+    /* Compile the index expression */
+    compile_expression(cs, expr);
+    
+    /* Emit the ON instruction with count */
+    if (is_gosub) {
+        compiler_emit(cs, OP_ON_GOSUB, line_count);
+    } else {
+        compiler_emit(cs, OP_ON_GOTO, line_count);
+    }
+    
+    /* Emit each target line number */
+    for (i = 0; i < line_count; i++) {
+        int32_t offset = compiler_find_line_offset(cs, line_numbers[i]);
+        if (offset >= 0) {
+            /* Line already compiled */
+            compiler_emit_raw(cs, offset);
+        } else {
+            /* Forward reference */
+            uint32_t fixup_pc = cs->program->code_len;
+            compiler_emit_raw(cs, 0xFFFF);
+            compiler_add_jump_fixup(cs, fixup_pc, line_numbers[i], 
+                                    is_gosub ? JUMP_GOSUB : JUMP_ABSOLUTE);
+        }
+    }
+    
+    free(line_numbers);
+}
+
+/* Helper: store the numeric expr in variable slot, as LET does */
+static void compile_store_number(CompilerState *cs, ParseNode *expr, int slot) {
+    /* Register ISA: compute the value directly into the variable */
+    if (cs->isa == ISA_REG && slot <= REG_INDEX_MASK && expression_is_numeric(expr) &&
+        reg_fits(cs, expr, 0)) {
+        compile_reg_into(cs, expr, REG_VAR | (uint16_t)slot);
+        return;
+    }
+    
+    /* Numeric arithmetic into a numeric variable never needs a tag */
+    if (number_stack_operators(expr) >= 1) {
+        compile_number_stack(cs, expr);
+        compiler_emit(cs, OP_N_POP_VAR, slot);
+        return;
+    }
+    
+    compile_expression(cs, expr);
+    compiler_emit(cs, OP_POP_VAR, slot);
+}
+
+/*
+ * Loop-invariant code motion (basset_compile -O)
+ *
+ * Before any code is generated, compiler_hoist_invariants() looks at the
+ * statements from each FOR to its NEXT. A numeric expression in the body
+ * whose variables the body never assigns - SQR(X*X+Y*Y), 2*PI, LEN(A$) -
+ * moves into a hidden variable that the FOR statement computes before it
+ * starts the loop, and the body reads the variable instead:
+ *
+ *   10 FOR I=1 TO N:A(I)=A(I)*SQR(X*X+Y*Y):NEXT I
+ *
+ * compiles as INV.0=SQR(X*X+Y*Y) followed by the loop over A(I)*INV.0.
+ * Only expressions that cannot fail are moved, since the first iteration
+ * would otherwise stop early, and an IF branch that never runs fail at
+ * all: arithmetic, comparisons, ABS, INT, SGN, EXP, SIN/COS/ATN while the
+ * body has no DEG or RAD, LEN of a string variable, division by a nonzero
+ * constant and SQR of an operand that cannot be negative. RND, PEEK, ERR,
+ * array elements and strings stay where they are.
+ *
+ * A body qualifies only when nothing but its own statements can run in
+ * it: it has no GOTO, GOSUB, ON, RETURN, POP, CLR or IF...THEN line, no FOR
+ * or NEXT inside an IF, no line of it but the FOR's is a jump target, and
+ * the program has no TRAP or computed GOTO/GOSUB. A variable is assigned
+ * if it is the target of LET or FOR, closed by NEXT, or named anywhere in
+ * a statement other than PRINT, POKE or IF (INPUT, READ, GET, DIM, ...).
+ */
+
+#define INVARIANT_NONE 0         /* Varies, or may fail */
+#define INVARIANT_LEAF 1         /* A constant or unassigned variable */
+#define INVARIANT_EXPR 2         /* An operation worth computing once */
+#define INVARIANT_MAX_DEPTH 32   /* FORs nested in a body that are tracked */
+
+/* What the statements of one loop body do */
+typedef struct {
+    const char **assigned;       /* Variable names, pointing into the tree */
+    size_t assigned_count;
+    size_t assigned_capacity;
+    int angle_mode;              /* Has DEG or RAD */
+    int unsafe;                  /* Can transfer control out of the body */
+} LoopEffects;
+
+static void loop_effects_add(LoopEffects *fx, const char *name) {
+    if (fx->assigned_count >= fx->assigned_capacity) {
+        fx->assigned_capacity = fx->assigned_capacity ? fx->assigned_capacity * 2 : 16;
+        fx->assigned = realloc(fx->assigned, sizeof(const char *) * fx->assigned_capacity);
+    }
+    fx->assigned[fx->assigned_count++] = name;
+}
+
+static int loop_effects_assigns(const LoopEffects *fx, const char *name) {
+    size_t i;
+    
+    for (i = 0; i < fx->assigned_count; i++) {
+        if (strcmp(fx->assigned[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+/* Helper: count every variable named under node as assigned */
+static void loop_effects_add_all(LoopEffects *fx, const ParseNode *node) {
+    int i;
+    
+    if (!node) return;
+    if (node->type == NODE_VARIABLE && node->text) loop_effects_add(fx, node->text);
+    for (i = 0; i < node->child_count; i++) {
+        loop_effects_add_all(fx, node->children[i]);
+    }
+}
+
+/* Helper: count the line numbers an IF's THEN or ELSE goes to, in the */
+/* places compile_if_then() takes them from, marking them in lines if set */
+static int if_line_targets(const ParseNode *stmt, uint8_t *lines) {
+    const ParseNode *then_part, *else_action;
+    int count = 0;
+    int i;
+    
+    if (stmt->child_count < 3) return 0;
+    then_part = stmt->children[2];
+    if (then_part && then_part->type == NODE_CONSTANT && then_part->token == TOK_NUMBER) {
+        if (lines) lines[(uint16_t)then_part->value] = 1;
+        count++;
+    }
+    for (i = 0; then_part && i < then_part->child_count; i++) {
+        const ParseNode *child = then_part->children[i];
+        if (child && child->type == NODE_CONSTANT && child->token == TOK_NUMBER) {
+            if (lines) lines[(uint16_t)child->value] = 1;
+            count++;
+        }
+    }
+    
+    if (stmt->child_count < 4 || !stmt->children[3] || stmt->children[3]->child_count < 2) {
+        return count;
+    }
+    else_action = stmt->children[3]->children[1];
+    for (i = 0; else_action && i < else_action->child_count; i++) {
+        const ParseNode *child = else_action->children[i];
+        if (child && child->type == NODE_EXPRESSION && child->child_count >= 1) {
+            child = child->children[0];
+        }
+        if (child && child->type == NODE_CONSTANT && child->token == TOK_NUMBER) {
+            if (lines) lines[(uint16_t)child->value] = 1;
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Helper: mark every numeric constant under node as a line number */
+static void mark_line_constants(const ParseNode *node, uint8_t *lines) {
+    int i;
+    
+    if (!node) return;
+    if (node->type == NODE_CONSTANT && node->token == TOK_NUMBER) {
+        lines[(uint16_t)node->value] = 1;
+    }
+    for (i = 0; i < node->child_count; i++) {
+        mark_line_constants(node->children[i], lines);
+    }
+}
+
+/* Helper: mark every line a GOTO, GOSUB, ON, TRAP or IF under node can */
+/* go to; 0 if one of them computes its line */
+static int mark_line_targets(const ParseNode *node, uint8_t *lines) {
+    int i;
+    
+    if (!node) return 1;
+    if (node->type == NODE_STATEMENT) {
+        switch (node->token) {
+            case TOK_GOTO: case TOK_CGTO:
+            case TOK_GOSUB_S: case TOK_CGS:
+                if (node->child_count < 1 || node->children[0]->type != NODE_CONSTANT) return 0;
+                lines[(uint16_t)node->children[0]->value] = 1;
+                return 1;
+            case TOK_ON:
+                /* The line list follows the index expression */
+                for (i = 1; i < node->child_count; i++) {
+                    mark_line_constants(node->children[i], lines);
+                }
+                return 1;
+            case TOK_TRAP:
+                return 0;
+            case TOK_IF:
+                if_line_targets(node, lines);
+                break;
+            default:
+                break;
+        }
+    }
+    for (i = 0; i < node->child_count; i++) {
+        if (!mark_line_targets(node->children[i], lines)) return 0;
+    }
+    return 1;
+}
+
+/* Helper: record what stmt does to the loop; nested is set for the */
+/* statements of an IF, where a FOR or NEXT would pair at run time */
+static void loop_effects_scan(LoopEffects *fx, const ParseNode *stmt, int nested) {
+    int i;
+    
+    switch (stmt->token) {
+        case TOK_LET:
+        case TOK_IDENT:
+            if (stmt->child_count > 0) loop_effects_add_all(fx, stmt->children[0]);
+            break;
+        case TOK_FOR:
+            if (nested) fx->unsafe = 1;
+            if (stmt->child_count > 0) loop_effects_add_all(fx, stmt->children[0]);
+            break;
+        case TOK_NEXT:
+            if (nested) fx->unsafe = 1;
+            loop_effects_add_all(fx, stmt);
+            break;
+        case TOK_PRINT:
+        case TOK_QUESTION:
+        case TOK_POKE:
+        case TOK_REM:
+        case TOK_DATA:
+        case TOK_END:
+        case TOK_STOP:
+            break;
+        case TOK_DEG:
+        case TOK_RAD:
+            fx->angle_mode = 1;
+            break;
+        case TOK_GOTO: case TOK_CGTO:
+        case TOK_GOSUB_S: case TOK_CGS:
+        case TOK_ON: case TOK_RETURN: case TOK_POP:
+        case TOK_CLR: case TOK_TRAP:
+            fx->unsafe = 1;
+            break;
+        case TOK_IF:
+            if (if_line_targets(stmt, NULL) > 0) fx->unsafe = 1;
+            for (i = 2; i < stmt->child_count; i++) {
+                const ParseNode *part = stmt->children[i];
+                int k;
+                
+                if (part && i == 3 && part->child_count >= 2) part = part->children[1];
+                for (k = 0; part && k < part->child_count; k++) {
+                    if (part->children[k] && part->children[k]->type == NODE_STATEMENT) {
+                        loop_effects_scan(fx, part->children[k], 1);
+                    }
+                }
+            }
+            break;
+        default:
+            loop_effects_add_all(fx, stmt);
+            break;
+    }
+}
+
+/* Helper: true if the invariant expr can never be negative (SQR's check) */
+static int invariant_nonnegative(ParseNode *expr) {
+    double value;
+    ParseNode *a, *b;
+    
+    expr = unwrap_expression(expr);
+    if (!expr) return 0;
+    
+    switch (expr->type) {
+        case NODE_CONSTANT:
+            return expr->token != TOK_STRING && expr->value >= 0;
+        case NODE_FUNCTION_CALL:
+            return expr->token == TOK_CABS || expr->token == TOK_CSQR ||
+                   expr->token == TOK_CLEN || expr->token == TOK_CEXP_F;
+        case NODE_OPERATOR:
+            if (expr->child_count != 2) return 0;
+            a = unwrap_expression(expr->children[0]);
+            b = unwrap_expression(expr->children[1]);
+            switch (expr->token) {
+                case TOK_CLE: case TOK_CNE: case TOK_CGE:
+                case TOK_CLT: case TOK_CGT: case TOK_CEQ:
+                    return 1;
+                case TOK_CPLUS:
+                    return invariant_nonnegative(a) && invariant_nonnegative(b);
+                case TOK_CMUL:
+                    /* X*X, or a product of non-negative factors */
+                    if (a && b && a->type == NODE_VARIABLE && b->type == NODE_VARIABLE &&
+                        strcmp(a->text, b->text) == 0) return 1;
+                    return invariant_nonnegative(a) && invariant_nonnegative(b);
+                case TOK_CEXP:
+                    /* X^2, X^4, ... */
+                    return expression_constant(b, &value) && value == 2.0 * floor(value / 2.0);
+                default:
+                    return 0;
+            }
+        default:
+            return 0;
+    }
+}
+
+/* Helper: how expr depends on the loop whose effects are fx */
+static int invariant_kind(ParseNode *expr, const LoopEffects *fx) {
+    ParseNode *arg;
+    double value;
+    
+    expr = unwrap_expression(expr);
+    if (!expr) return INVARIANT_NONE;
+    
+    switch (expr->type) {
+        case NODE_CONSTANT:
+            return expr->token == TOK_STRING ? INVARIANT_NONE : INVARIANT_LEAF;
+            
+        case NODE_VARIABLE:
+            if (expr->child_count > 0 || !expr->text || strchr(expr->text, '$')) {
+                return INVARIANT_NONE;
+            }
+            return loop_effects_assigns(fx, expr->text) ? INVARIANT_NONE : INVARIANT_LEAF;
+            
+        case NODE_OPERATOR:
+            if (expr->child_count == 1) {
+                if (expr->token != TOK_CMINUS && expr->token != TOK_CUMINUS &&
+                    expr->token != TOK_CNOT) return INVARIANT_NONE;
+                return invariant_kind(expr->children[0], fx) ? INVARIANT_EXPR : INVARIANT_NONE;
+            }
+            if (expr->child_count != 2) return INVARIANT_NONE;
+            switch (expr->token) {
+                case TOK_CPLUS: case TOK_CMINUS: case TOK_CMUL: case TOK_CEXP:
+                case TOK_CLE: case TOK_CNE: case TOK_CGE:
+                case TOK_CLT: case TOK_CGT: case TOK_CEQ:
+                case TOK_CAND: case TOK_COR:
+                    break;
+                case TOK_CDIV:
+                    if (!expression_constant(expr->children[1], &value) || value == 0) {
+                        return INVARIANT_NONE;
+                    }
+                    break;
+                default:
+                    return INVARIANT_NONE;
+            }
+            if (!invariant_kind(expr->children[0], fx) || !invariant_kind(expr->children[1], fx)) {
+                return INVARIANT_NONE;
+            }
+            return INVARIANT_EXPR;
+            
+        case NODE_FUNCTION_CALL:
+            if (expr->child_count != 1) return INVARIANT_NONE;
+            arg = unwrap_expression(expr->children[0]);
+            switch (expr->token) {
+                case TOK_CSIN: case TOK_CCOS: case TOK_CATN:
+                    if (fx->angle_mode) return INVARIANT_NONE;
+                    break;
+                case TOK_CABS: case TOK_CINT: case TOK_CSGN: case TOK_CEXP_F:
+                    break;
+                case TOK_CSQR:
+                    if (!invariant_nonnegative(arg)) return INVARIANT_NONE;
+                    break;
+                case TOK_CLEN:
+                    /* The one string operand: a whole string variable */
+                    return (arg && arg->type == NODE_VARIABLE && arg->child_count == 0 &&
+                            arg->text && strchr(arg->text, '$') &&
+                            !loop_effects_assigns(fx, arg->text)) ? INVARIANT_EXPR : INVARIANT_NONE;
+                default:
+                    return INVARIANT_NONE;
+            }
+            return invariant_kind(arg, fx) ? INVARIANT_EXPR : INVARIANT_NONE;
+            
+        default:
+            return INVARIANT_NONE;
+    }
+}
+
+/* Helper: turn expr into a read of variable name, returning a new node */
+/* holding what it was (NULL if out of memory) */
+static ParseNode* node_detach(ParseNode *expr, const char *name) {
+    ParseNode *moved = node_create(expr->type);
+    
+    if (!moved) return NULL;
+    *moved = *expr;
+    expr->type = NODE_VARIABLE;
+    expr->token = TOK_IDENT;
+    expr->text = basset_strdup(name);
+    expr->value = 0;
+    expr->children = NULL;
+    expr->child_count = 0;
+    expr->child_capacity = 0;
+    return moved;
+}
+
+/* Helper: record expr, moved out of stmt, to be computed into slot first */
+static void compiler_add_hoisted(CompilerState *cs, ParseNode *stmt, ParseNode *expr, uint16_t slot) {
+    HoistedExpression *h;
+    
+    if (cs->hoisted_count >= cs->hoisted_capacity) {
+        cs->hoisted_capacity *= 2;
+        cs->hoisted = realloc(cs->hoisted, sizeof(HoistedExpression) * cs->hoisted_capacity);
+    }
+    h = &cs->hoisted[cs->hoisted_count++];
+    h->stmt = stmt;
+    h->expr = expr;
+    h->slot = slot;
+}
+
+/* Move expr ahead of for_stmt, leaving a hidden variable in its place */
+static void hoist_expression(CompilerState *cs, ParseNode *for_stmt, ParseNode *expr) {
+    ParseNode *moved;
+    char name[32];
+    
+    sprintf(name, "INV.%lu", (unsigned long)cs->hoisted_count);
+    moved = node_detach(expr, name);
+    if (!moved) return;
+    compiler_add_hoisted(cs, for_stmt, moved, compiler_add_hidden_variable(cs, name));
+}
+
+/* Helper: hoist the largest invariant operations under expr */
+static void hoist_in_expression(CompilerState *cs, ParseNode *for_stmt, ParseNode *expr,
+                                const LoopEffects *fx) {
+    int i;
+    
+    if (!expr) return;
+    if (invariant_kind(expr, fx) == INVARIANT_EXPR) {
+        hoist_expression(cs, for_stmt, expr);
+        return;
+    }
+    for (i = 0; i < expr->child_count; i++) {
+        hoist_in_expression(cs, for_stmt, expr->children[i], fx);
+    }
+}
+
+/* Helper: hoist the invariants in the expressions of a body statement */
+static void hoist_in_statement(CompilerState *cs, ParseNode *for_stmt, ParseNode *stmt,
+                               const LoopEffects *fx) {
+    ParseNode *then_part;
+    int i, k;
+    
+    switch (stmt->token) {
+        case TOK_LET:
+        case TOK_IDENT:
+            for (i = 0; i < stmt->child_count; i++) {
+                hoist_in_expression(cs, for_stmt, stmt->children[i], fx);
+            }
+            break;
+        case TOK_PRINT:
+        case TOK_QUESTION:
+            /* compile_print() tells items from a #channel by the operators */
+            /* among its children, so only what is under those may change */
+            for (i = 0; i < stmt->child_count; i++) {
+                ParseNode *item = stmt->children[i];
+                
+                if (item && item->type == NODE_OPERATOR) {
+                    for (k = 0; k < item->child_count; k++) {
+                        hoist_in_expression(cs, for_stmt, item->children[k], fx);
+                    }
+                } else {
+                    hoist_in_expression(cs, for_stmt, item, fx);
+                }
+            }
+            break;
+        case TOK_FOR:
+            if (stmt->child_count < 5) break;
+            hoist_in_expression(cs, for_stmt, stmt->children[2], fx);
+            hoist_in_expression(cs, for_stmt, stmt->children[4], fx);
+            if (stmt->child_count > 6 && stmt->children[5]->child_count > 1) {
+                hoist_in_expression(cs, for_stmt, stmt->children[5]->children[1], fx);
+            }
+            break;
+        case TOK_IF:
+            if (stmt->child_count < 3) break;
+            hoist_in_expression(cs, for_stmt, stmt->children[0], fx);
+            then_part = stmt->children[2];
+            for (k = 0; then_part && k < then_part->child_count; k++) {
+                if (then_part->children[k] && then_part->children[k]->type == NODE_STATEMENT) {
+                    hoist_in_statement(cs, for_stmt, then_part->children[k], fx);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* Helper: the variables a NEXT names, in order and each once (as */
+/* compile_next_variables() emits them) */
+static void loop_next_names(const ParseNode *node, const char **names, int *count) {
+    int i;
+    
+    if (!node) return;
+    if (node->type == NODE_VARIABLE && node->text) {
+        for (i = 0; i < *count; i++) {
+            if (strcmp(names[i], node->text) == 0) return;
+        }
+        if (*count < INVARIANT_MAX_DEPTH) names[(*count)++] = node->text;
+        return;
+    }
+    for (i = 0; i < node->child_count; i++) {
+        loop_next_names(node->children[i], names, count);
+    }
+}
+
+/* Helper: index of the NEXT closing the FOR at root->children[first], or */
+/* 0 if it is not closed by a simple nest of FOR...NEXT statements */
+static int loop_find_next(ParseNode *root, int first) {
+    const char *open[INVARIANT_MAX_DEPTH + 1];
+    const char *names[INVARIANT_MAX_DEPTH];
+    int depth = 0;
+    int i, k;
+    
+    open[depth++] = find_leaf_node(root->children[first]->children[0], NODE_VARIABLE)->text;
+    for (i = first + 1; i < root->child_count; i++) {
+        ParseNode *stmt = root->children[i];
+        int count = 0;
+        
+        if (!stmt || stmt->type != NODE_STATEMENT) continue;
+        if (stmt->token == TOK_FOR) {
+            ParseNode *var = find_leaf_node(stmt->child_count > 0 ? stmt->children[0] : NULL,
+                                            NODE_VARIABLE);
+            if (!var || !var->text || depth > INVARIANT_MAX_DEPTH) return 0;
+            open[depth++] = var->text;
+            continue;
+        }
+        if (stmt->token != TOK_NEXT) continue;
+        
+        /* NEXT J,I closes J then I; a bare NEXT the innermost loop */
+        loop_next_names(stmt, names, &count);
+        if (count == 0) {
+            if (--depth == 0) return i;
+            continue;
+        }
+        for (k = 0; k < count; k++) {
+            if (strcmp(open[depth - 1], names[k]) != 0) return 0;
+            if (--depth == 0) return i;
+        }
+    }
+    return 0;
+}
+
+/* Phase 1d: hoist loop invariants out of FOR bodies (see above) */
+static void compiler_hoist_invariants(CompilerState *cs, ParseNode *root) {
+    uint8_t *lines;
+    LoopEffects fx;
+    int i, k, last;
+    
+    lines = calloc(65536, 1);
+    if (!lines) return;
+    if (!mark_line_targets(root, lines)) {
+        free(lines);
+        return;
+    }
+    memset(&fx, 0, sizeof(fx));
+    
+    for (i = 0; i < root->child_count; i++) {
+        ParseNode *for_stmt = root->children[i];
+        
+        if (!for_stmt || for_stmt->type != NODE_STATEMENT || for_stmt->token != TOK_FOR ||
+            for_stmt->child_count < 5 || !find_leaf_node(for_stmt->children[0], NODE_VARIABLE)) {
+            continue;
+        }
+        last = loop_find_next(root, i);
+        if (last == 0) continue;
+        
+        fx.assigned_count = 0;
+        fx.angle_mode = 0;
+        fx.unsafe = 0;
+        for (k = i + 1; k <= last && !fx.unsafe; k++) {
+            ParseNode *stmt = root->children[k];
+            
+            if (!stmt || stmt->type != NODE_STATEMENT) continue;
+            if (stmt->line_number != for_stmt->line_number && lines[(uint16_t)stmt->line_number]) {
+                fx.unsafe = 1;
+            }
+            loop_effects_scan(&fx, stmt, 0);
+        }
+        if (fx.unsafe) continue;
+        loop_effects_add_all(&fx, for_stmt->children[0]);
+        
+        for (k = i + 1; k < last; k++) {
+            ParseNode *stmt = root->children[k];
+            if (stmt && stmt->type == NODE_STATEMENT) hoist_in_statement(cs, for_stmt, stmt, &fx);
+        }
+    }
+    free(fx.assigned);
+    free(lines);
+}
+
+/*
+ * SSA lowering of assignment blocks (basset_compile -O)
+ *
+ * compiler_lower_blocks() passes each run of LET statements that assign
+ * number stack arithmetic (constants, scalars and operators) to a numeric
+ * scalar through the SSA form in ir.c, provided nothing can jump into the
+ * run except at its first statement: no line of it but the first is a
+ * GOTO, GOSUB, ON, IF or TRAP target, and the program has no TRAP or
+ * computed GOTO/GOSUB. A value computed in one statement is reused by the
+ * next, copies are read through and an assignment overwritten before
+ * anything reads it is dropped:
+ *
+ *   10 X=A*B+C:Y=(A*B+C)*2:Z=Y:Z=Z+1
+ *
+ * compiles as X=A*B+C, Y=X*2, Z=Y+1. compile_let_stmt() then compiles the
+ * assignments recorded for each statement in place of the statement.
+ * Values kept for later statements go in hidden variables SSA.0, SSA.1,
+ * ..., shared by all blocks.
+ */
+
+/* Helper: IR operation of a number_stack_opcode() operator node */
+static IrOp ir_operator(const ParseNode *op) {
+    if (op->child_count == 1) return (op->token == TOK_CNOT) ? IR_NOT : IR_NEG;
+    switch (op->token) {
+        case TOK_CPLUS:  return IR_ADD;
+        case TOK_CMINUS: return IR_SUB;
+        case TOK_CMUL:   return IR_MUL;
+        case TOK_CDIV:   return IR_DIV;
+        case TOK_CEXP:   return IR_POW;
+        case TOK_CEQ:    return IR_EQ;
+        case TOK_CNE:    return IR_NE;
+        case TOK_CLT:    return IR_LT;
+        case TOK_CLE:    return IR_LE;
+        case TOK_CGT:    return IR_GT;
+        case TOK_CGE:    return IR_GE;
+        case TOK_CAND:   return IR_AND;
+        default:         return IR_OR;
+    }
+}
+
+/* Helper: operator token for an IR operation */
+static unsigned char ir_token(IrOp op) {
+    switch (op) {
+        case IR_ADD: return TOK_CPLUS;
+        case IR_SUB: return TOK_CMINUS;
+        case IR_MUL: return TOK_CMUL;
+        case IR_DIV: return TOK_CDIV;
+        case IR_POW: return TOK_CEXP;
+        case IR_EQ:  return TOK_CEQ;
+        case IR_NE:  return TOK_CNE;
+        case IR_LT:  return TOK_CLT;
+        case IR_LE:  return TOK_CLE;
+        case IR_GT:  return TOK_CGT;
+        case IR_GE:  return TOK_CGE;
+        case IR_AND: return TOK_CAND;
+        case IR_OR:  return TOK_COR;
+        case IR_NOT: return TOK_CNOT;
+        default:     return TOK_CUMINUS;
+    }
+}
+
+/* Helper: the scalar a LET assigns number stack arithmetic to, or NULL */
+static ParseNode* lowerable_target(ParseNode *stmt) {
+    ParseNode *target;
+    
+    if (!stmt || stmt->type != NODE_STATEMENT || stmt->child_count < 3 ||
+        (stmt->token != TOK_LET && stmt->token != TOK_IDENT)) {
+        return NULL;
+    }
+    
+    /* [var, subscripts], as compile_let_stmt() reads it; no subscripts */
+    target = stmt->children[0];
+    if (target && target->type == NODE_EXPRESSION && target->child_count == 2 &&
+        target->children[1] && target->children[1]->child_count > 0) {
+        return NULL;
+    }
+    while (target && target->type == NODE_EXPRESSION && target->child_count > 0) {
+        target = target->children[0];
+    }
+    if (!target || target->type != NODE_VARIABLE || !target->text ||
+        target->child_count != 0 || strchr(target->text, '$')) {
+        return NULL;
+    }
+    return number_stack_operators(stmt->children[2]) >= 0 ? target : NULL;
+}
+
+/* Helper: SSA value of a number_stack_operators() expression */
+static uint32_t lower_value(CompilerState *cs, IrBlock *ir, ParseNode *expr) {
+    uint32_t a, b;
+    int slot;
+    
+    expr = expression_node(expr);
+    switch (expr->type) {
+        case NODE_CONSTANT:
+            return ir_constant(ir, expr->value);
+            
+        case NODE_VARIABLE:
+            slot = compiler_find_variable(cs, expr->text);
+            return ir_read(ir, slot < 0 ? (uint32_t)ir->var_count : (uint32_t)slot);
+            
+        default:
+            a = lower_value(cs, ir, expr->children[0]);
+            b = (expr->child_count > 1) ? lower_value(cs, ir, expr->children[1]) : IR_NONE;
+            return ir_operation(ir, ir_operator(expr), a, b);
+    }
+}
+
+/* Helper: expression tree for node index of code; a variable of the */
+/* block's temp range reads hidden variable temps[var - var_count] */
+static ParseNode* raise_node(CompilerState *cs, const IrCode *code, uint32_t index,
+                             size_t var_count, const uint16_t *temps) {
+    const IrNode *ir_node = &code->nodes[index];
+    ParseNode *node;
+    uint32_t var;
+    
+    switch (ir_node->op) {
+        case IR_CONST:
+            node = node_create(NODE_CONSTANT);
+            node->token = TOK_NUMBER;
+            node->value = ir_node->constant;
+            return node;
+            
+        case IR_ENTRY:
+            var = (ir_node->var < var_count) ? ir_node->var : temps[ir_node->var - var_count];
+            node = node_create(NODE_VARIABLE);
+            node->token = TOK_IDENT;
+            node->text = basset_strdup(cs->program->var_table[var].name);
+            return node;
+            
+        default:
+            node = node_create(NODE_OPERATOR);
+            node->token = ir_token(ir_node->op);
+            node_add_child(node, raise_node(cs, code, ir_node->a, var_count, temps));
+            if (ir_node->b != IR_NONE) {
+                node_add_child(node, raise_node(cs, code, ir_node->b, var_count, temps));
+            }
+            return node;
+    }
+}
+
+/* Helper: record an assignment for the lowered statement stmt */
+static void compiler_add_lowered(CompilerState *cs, ParseNode *stmt, ParseNode *expr, uint16_t slot) {
+    LoweredAssignment *lowered;
+    
+    if (cs->lowered_count >= cs->lowered_capacity) {
+        cs->lowered_capacity = cs->lowered_capacity ? cs->lowered_capacity * 2 : 16;
+        cs->lowered = realloc(cs->lowered, sizeof(LoweredAssignment) * cs->lowered_capacity);
+    }
+    if (!cs->lowered_lines[(uint16_t)stmt->line_number]) {
+        cs->lowered_lines[(uint16_t)stmt->line_number] = (uint32_t)cs->lowered_count + 1;
+    }
+    lowered = &cs->lowered[cs->lowered_count++];
+    lowered->stmt = stmt;
+    lowered->expr = expr;
+    lowered->slot = slot;
+}
+
+/* Lower root->children[first..end-1], all lowerable_target() statements */
+static void lower_block(CompilerState *cs, ParseNode *root, int first, int end,
+                        uint16_t **temps, size_t *temp_count) {
+    IrBlock *ir;
+    IrCode *code;
+    size_t var_count = cs->program->var_count;
+    size_t a = 0;
+    int k;
+    
+    ir = ir_block_new(var_count);
+    if (!ir) return;
+    for (k = first; k < end; k++) {
+        ParseNode *stmt = root->children[k];
+        int slot = compiler_find_variable(cs, lowerable_target(stmt)->text);
+        uint32_t value = lower_value(cs, ir, stmt->children[2]);
+        
+        ir_write(ir, slot < 0 ? (uint32_t)var_count : (uint32_t)slot, value, (uint32_t)k);
+    }
+    ir_optimize(ir);
+    code = ir_generate(ir);
+    ir_block_free(ir);
+    if (!code) return;
+    
+    while (*temp_count < code->temp_count) {
+        char name[32];
+        
+        sprintf(name, "SSA.%lu", (unsigned long)*temp_count);
+        *temps = realloc(*temps, sizeof(uint16_t) * (*temp_count + 1));
+        (*temps)[(*temp_count)++] = compiler_add_hidden_variable(cs, name);
+    }
+    
+    for (k = first; k < end; k++) {
+        int assigned = 0;
+        
+        for (; a < code->assign_count && code->assigns[a].statement == (uint32_t)k; a++) {
+            const IrAssign *assign = &code->assigns[a];
+            uint16_t slot = (assign->var < var_count) ? (uint16_t)assign->var :
+                            (*temps)[assign->var - var_count];
+            
+            ParseNode *expr = raise_node(cs, code, assign->root, var_count, *temps);
+            
+            /* Copies may have put constants together */
+            compiler_fold_constants(expr);
+            compiler_add_lowered(cs, root->children[k], expr, slot);
+            assigned = 1;
+        }
+        if (!assigned) compiler_add_lowered(cs, root->children[k], NULL, 0);
     }
+    ir_code_free(code);
 }
 
-/* Compile GOSUB statement */
-static void compile_gosub(CompilerState *cs, ParseNode *stmt) {
-    ParseNode *target;
-    int32_t offset;
-    
-    if (stmt->child_count < 1) return;
-    
-    target = stmt->children[0];
+/* Phase 1e: lower straight-line numeric assignments through SSA (see above) */
+static void compiler_lower_blocks(CompilerState *cs, ParseNode *root) {
+    uint16_t *temps = NULL;
+    size_t temp_count = 0;
+    uint8_t *lines;
+    int i, k;
+    
+    lines = calloc(65536, 1);
+    if (!lines) return;
+    if (!mark_line_targets(root, lines)) {
+        free(lines);
+        return;
+    }
+    cs->lowered_lines = calloc(65536, sizeof(uint32_t));
+    if (!cs->lowered_lines) {
+        free(lines);
+        return;
+    }
     
-    if (target->type == NODE_CONSTANT) {
-        uint16_t line = (uint16_t)target->value;
-        offset = compiler_find_line_offset(cs, line);
+    for (i = 0; i < root->child_count; i = k) {
+        k = i + 1;
+        if (!lowerable_target(root->children[i])) continue;
         
-        if (offset >= 0) {
-            compiler_emit(cs, OP_GOSUB, offset);
-        } else {
-            compiler_emit(cs, OP_GOSUB, 0xFFFF);
-            compiler_add_jump_fixup(cs, cs->program->code_len - 1, line, JUMP_GOSUB);
+        /* A statement joins the block unless a jump can reach its line */
+        while (k < root->child_count && lowerable_target(root->children[k]) &&
+               (root->children[k]->line_number == root->children[k - 1]->line_number ||
+                !lines[(uint16_t)root->children[k]->line_number])) {
+            k++;
         }
-    } else {
-        compile_expression(cs, target);
-        compiler_emit_no_operand(cs, OP_GOSUB_LINE);
+        lower_block(cs, root, i, k, &temps, &temp_count);
     }
+    free(temps);
+    free(lines);
 }
 
-/* Compile ON...GOTO/GOSUB statement */
-static void compile_on(CompilerState *cs, ParseNode *stmt) {
-    ParseNode *expr, *on1_node, *expl_node, *current;
-    int is_gosub = 0;
-    size_t count = 0;
+/* Helper: compile the assignments stmt was lowered to; 0 if it was not */
+static int compile_lowered(CompilerState *cs, ParseNode *stmt) {
+    int found = 0;
     size_t i;
-    uint32_t *line_numbers;
-    size_t line_count = 0;
-    
-    /* ON structure: [expr, ON1, EXPL, EOS]
-       expr is the index expression
-       ON1 is either GOTO or GOSUB
-       EXPL is the comma-separated list of line numbers */
     
-    if (stmt->child_count < 3) return;
+    if (!cs->lowered_lines || !cs->lowered_lines[(uint16_t)stmt->line_number]) return 0;
     
-    expr = stmt->children[0];
-    on1_node = stmt->children[1];
-    expl_node = stmt->children[2];
+    /* Only the entries of stmt's line need looking at */
+    for (i = cs->lowered_lines[(uint16_t)stmt->line_number] - 1;
+         i < cs->lowered_count && cs->lowered[i].stmt->line_number == stmt->line_number; i++) {
+        if (cs->lowered[i].stmt != stmt) continue;
+        if (cs->lowered[i].expr) {
+            compile_store_number(cs, cs->lowered[i].expr, cs->lowered[i].slot);
+        }
+        found = 1;
+    }
+    return found;
+}
+
+/*
+ * Array element updates (basset_compile -O)
+ *
+ * compiler_share_subscripts() looks at the subscripts of the array
+ * elements each LET names, on either side. A subscript that appears more
+ * than once - I+1 in A(I+1,J)=A(I+1,J)+B(I+1,J)*C(I+1,J) - moves into a
+ * hidden variable that the statement computes first, and every copy of
+ * it reads the variable. Only number stack arithmetic that cannot fail is
+ * moved (no division except by a nonzero constant), so no error moves
+ * with it. The variables are IDX.0, IDX.1, ..., numbered afresh for each
+ * statement.
+ *
+ * compile_element_update() then compiles an assignment to a numeric 2D
+ * element subscripted by scalar variables whose value reads that element,
+ * as in A(I,J)=A(I,J)+B(I,J)*C(I,J): the read becomes OP_ARRAY_ADDR_2D,
+ * which remembers the element, and the store OP_ARRAY_STORE_ADDR, so the
+ * subscripts are looked up and checked once. The other reads are compiled
+ * as usual.
+ */
+
+/* Helper: the array element a LET assigns, as compile_let_stmt() reads */
+/* its target: the array's variable node, with the subscripts in */
+/* subscripts[0] and (2D) subscripts[1]. NULL for a scalar */
+static ParseNode* let_array_target(ParseNode *var_expr, ParseNode **subscripts) {
+    ParseNode *var_part, *subscript_expr, *middle;
+    
+    subscripts[0] = NULL;
+    subscripts[1] = NULL;
+    if (!var_expr || var_expr->type != NODE_EXPRESSION || var_expr->child_count != 2) return NULL;
+    var_part = var_expr->children[0];
+    subscript_expr = var_expr->children[1];
+    
+    /* Unwrap variable */
+    while (var_part && var_part->type == NODE_EXPRESSION && var_part->child_count > 0) {
+        var_part = var_part->children[0];
+    }
     
-    /* Determine if this is GOTO or GOSUB by checking the ON1 node */
-    /* ON1 can be an expression containing the token */
-    if (on1_node) {
-        if (on1_node->token == TOK_CGS || on1_node->token == TOK_GOSUB_S) {
-            is_gosub = 1;
-        } else if (on1_node->type == NODE_EXPRESSION && on1_node->child_count > 0) {
-            ParseNode *tok_node = on1_node->children[0];
-            if (tok_node && (tok_node->token == TOK_CGS || tok_node->token == TOK_GOSUB_S)) {
-                is_gosub = 1;
+    /* Subscripts; for 2D, child[2] is an EXPRESSION holding [comma, sub2] */
+    if (subscript_expr && subscript_expr->child_count >= 2) {
+        subscripts[0] = subscript_expr->children[1];
+        if (subscript_expr->child_count >= 4) {
+            middle = subscript_expr->children[2];
+            if (middle && middle->type == NODE_EXPRESSION && middle->child_count >= 2) {
+                subscripts[1] = middle->children[1];
             }
         }
     }
     
-    /* Count the number of targets in the expression list */
-    current = expl_node;
-    while (current && current->type == NODE_EXPRESSION) {
-        if (current->child_count > 0) {
-            count++;
-            /* Navigate to next EXPL via EXPL1 */
-            if (current->child_count > 1 && current->children[1]) {
-                current = current->children[1];
-                /* EXPL1 has comma at [0], next EXPL at [1] */
-                if (current->child_count > 1) {
-                    current = current->children[1];
-                } else {
-                    break;
-                }
-            } else {
-                break;
-            }
-        } else {
+    if (!var_part || var_part->type != NODE_VARIABLE || !var_part->text || !subscripts[0]) {
+        return NULL;
+    }
+    return var_part;
+}
+
+/* Helper: slot of a numeric scalar variable expression, or -1 */
+static int scalar_slot(CompilerState *cs, ParseNode *expr) {
+    expr = expression_node(expr);
+    if (!expr || expr->type != NODE_VARIABLE || expr->child_count != 0 || !expr->text ||
+        strchr(expr->text, '$')) {
+        return -1;
+    }
+    return compiler_find_variable(cs, expr->text);
+}
+
+/* Helper: true if element, an array read, is array(vars[0], vars[1]) */
+static int element_is(CompilerState *cs, ParseNode *element, int array, const uint16_t *vars) {
+    return element->child_count == 2 && compiler_find_variable(cs, element->text) == array &&
+           scalar_slot(cs, element->children[0]) == vars[0] &&
+           scalar_slot(cs, element->children[1]) == vars[1];
+}
+
+/* Helper: true if the array element read at element, of array slot, is */
+/* the one the statement being compiled writes back */
+static int element_updated(CompilerState *cs, ParseNode *element, int slot) {
+    return cs->rmw_array >= 0 && cs->rmw_array == slot &&
+           element_is(cs, element, slot, cs->rmw_vars);
+}
+
+/* Helper: true if node reads array(vars[0], vars[1]) */
+static int reads_element(CompilerState *cs, ParseNode *node, int array, const uint16_t *vars) {
+    int i;
+    
+    if (!node) return 0;
+    if (node->type == NODE_VARIABLE && node->text && element_is(cs, node, array, vars)) return 1;
+    for (i = 0; i < node->child_count; i++) {
+        if (reads_element(cs, node->children[i], array, vars)) return 1;
+    }
+    return 0;
+}
+
+/* Compile array(subscripts) = value as a read-modify-write if value */
+/* reads the element (see above); 0 if it does not qualify and nothing */
+/* was emitted */
+static int compile_element_update(CompilerState *cs, int array, ParseNode **subscripts,
+                                  ParseNode *value) {
+    uint16_t vars[2];
+    int k;
+    
+    for (k = 0; k < 2; k++) {
+        int slot = scalar_slot(cs, subscripts[k]);
+        if (slot < 0) return 0;
+        vars[k] = (uint16_t)slot;
+    }
+    if (!reads_element(cs, value, array, vars)) return 0;
+    
+    cs->rmw_array = array;
+    cs->rmw_vars[0] = vars[0];
+    cs->rmw_vars[1] = vars[1];
+    compile_expression(cs, value);
+    if (cs->rmw_array < 0) {
+        compiler_emit(cs, OP_ARRAY_STORE_ADDR, (uint16_t)array);
+        return 1;
+    }
+    
+    /* The read was compiled some other way: store with the subscripts */
+    /* checked, read after the value (which leaves them alone, see */
+    /* compiler_eliminate_bounds_checks) */
+    cs->rmw_array = -1;
+    compiler_emit(cs, OP_ARRAY_STORE_2D, (uint16_t)array);
+    compiler_emit_raw(cs, vars[0]);
+    compiler_emit_raw(cs, vars[1]);
+    return 1;
+}
+
+/* Helper: true if the subscript may raise an error: it divides by */
+/* something other than a nonzero constant */
+static int subscript_may_fail(ParseNode *expr) {
+    double value;
+    int i;
+    
+    expr = expression_node(expr);
+    if (!expr) return 0;
+    if (expr->type == NODE_OPERATOR && expr->token == TOK_CDIV && expr->child_count == 2 &&
+        (!expression_constant(expr->children[1], &value) || value == 0)) {
+        return 1;
+    }
+    for (i = 0; i < expr->child_count; i++) {
+        if (subscript_may_fail(expr->children[i])) return 1;
+    }
+    return 0;
+}
+
+/* Helper: true if a and b are the same expression */
+static int same_expression(ParseNode *a, ParseNode *b) {
+    int i;
+    
+    a = expression_node(a);
+    b = expression_node(b);
+    if (!a || !b) return a == b;
+    if (a->type != b->type || a->child_count != b->child_count) return 0;
+    switch (a->type) {
+        case NODE_CONSTANT:
+            if (a->token != b->token || a->value != b->value) return 0;
+            break;
+        case NODE_VARIABLE:
+            if (!a->text || !b->text || strcmp(a->text, b->text) != 0) return 0;
+            break;
+        default:
+            if (a->token != b->token) return 0;
             break;
-        }
     }
+    for (i = 0; i < a->child_count; i++) {
+        if (!same_expression(a->children[i], b->children[i])) return 0;
+    }
+    return 1;
+}
+
+/* Helper: add the subscripts of every array element under node to list */
+static void share_collect(ParseNode *node, ParseNode ***list, int *count) {
+    int i;
     
-    if (count == 0) return;
+    if (!node) return;
+    for (i = 0; i < node->child_count; i++) {
+        if (node->type == NODE_VARIABLE) {
+            *list = realloc(*list, sizeof(ParseNode *) * (*count + 1));
+            (*list)[(*count)++] = node->children[i];
+        }
+        share_collect(node->children[i], list, count);
+    }
+}
+
+/* Share the repeated subscripts of a LET statement (see above) */
+static void share_subscripts(CompilerState *cs, ParseNode *stmt) {
+    ParseNode **list = NULL;
+    ParseNode *target[2];
+    int count = 0;
+    int shared = 0;
+    int i, j, k;
     
-    /* Allocate array for line numbers */
-    line_numbers = malloc(sizeof(uint32_t) * count);
+    if (stmt->child_count < 3) return;
+    if (let_array_target(stmt->children[0], target)) {
+        for (k = 0; k < 2 && target[k]; k++) {
+            list = realloc(list, sizeof(ParseNode *) * (count + 1));
+            list[count++] = target[k];
+            share_collect(target[k], &list, &count);
+        }
+    }
+    share_collect(stmt->children[2], &list, &count);
     
-    /* Extract line numbers from expression list */
-    current = expl_node;
-    i = 0;
-    while (current && current->type == NODE_EXPRESSION && i < count) {
-        if (current->child_count > 0 && current->children[0]) {
-            ParseNode *line_expr = current->children[0];
-            if (line_expr->type == NODE_CONSTANT) {
-                line_numbers[i++] = (uint32_t)line_expr->value;
-            }
+    for (i = 0; i < count; i++) {
+        ParseNode *moved;
+        char name[32];
+        int slot;
+        
+        if (number_stack_operators(list[i]) < 1 || subscript_may_fail(list[i])) continue;
+        for (j = i + 1; j < count && !same_expression(list[i], list[j]); j++) {
         }
+        if (j == count) continue;
         
-        /* Navigate to next */
-        if (current->child_count > 1 && current->children[1]) {
-            current = current->children[1];
-            if (current->child_count > 1) {
-                current = current->children[1];
-            } else {
-                break;
+        sprintf(name, "IDX.%d", shared++);
+        slot = compiler_find_variable(cs, name);
+        if (slot < 0) slot = compiler_add_hidden_variable(cs, name);
+        for (j = count - 1; j > i; j--) {
+            if (same_expression(list[i], list[j])) node_free(node_detach(list[j], name));
+        }
+        moved = node_detach(list[i], name);
+        if (moved) compiler_add_hoisted(cs, stmt, moved, (uint16_t)slot);
+    }
+    free(list);
+}
+
+/* Phase 1f: share repeated subscripts within each assignment (see above) */
+static void compiler_share_subscripts(CompilerState *cs, ParseNode *root) {
+    int i, k;
+    
+    for (i = 0; i < root->child_count; i++) {
+        ParseNode *stmt = root->children[i];
+        
+        if (!stmt || stmt->type != NODE_STATEMENT) continue;
+        if (stmt->token == TOK_LET || stmt->token == TOK_IDENT) {
+            share_subscripts(cs, stmt);
+        } else if (stmt->token == TOK_IF && stmt->child_count >= 3 && stmt->children[2]) {
+            ParseNode *then_part = stmt->children[2];
+            
+            for (k = 0; k < then_part->child_count; k++) {
+                ParseNode *inner = then_part->children[k];
+                if (inner && inner->type == NODE_STATEMENT &&
+                    (inner->token == TOK_LET || inner->token == TOK_IDENT)) {
+                    share_subscripts(cs, inner);
+                }
             }
-        } else {
-            break;
         }
     }
-    line_count = i;
+}
+
+/* Helper: FOR bound that may be an integer - numeric, and integral if it */
+/* is a constant (OP_FOR_INIT_INT checks the value it gets at run time) */
+static int for_int_bound(ParseNode *expr) {
+    double value;
     
-    /* Compile the index expression */
-    compile_expression(cs, expr);
+    if (!expression_is_numeric(expr)) return 0;
+    return !expression_constant(expr, &value) || value == floor(value);
+}
+
+/* Helper: record a FOR whose OP_FOR_ENTER was just emitted */
+static void compiler_add_loop(CompilerState *cs, int slot, int int_loop) {
+    LoopRecord *loop;
     
-    /* Emit the ON instruction with count */
-    if (is_gosub) {
-        compiler_emit(cs, OP_ON_GOSUB, line_count);
-    } else {
-        compiler_emit(cs, OP_ON_GOTO, line_count);
+    if (cs->loop_count >= cs->loop_capacity) {
+        cs->loop_capacity *= 2;
+        cs->loops = realloc(cs->loops, sizeof(LoopRecord) * cs->loop_capacity);
     }
     
-    /* Emit each target line number */
-    for (i = 0; i < line_count; i++) {
-        int32_t offset = compiler_find_line_offset(cs, line_numbers[i]);
-        if (offset >= 0) {
-            /* Line already compiled */
-            compiler_emit_raw(cs, offset);
-        } else {
-            /* Forward reference */
-            uint32_t fixup_pc = cs->program->code_len;
-            compiler_emit_raw(cs, 0xFFFF);
-            compiler_add_jump_fixup(cs, fixup_pc, line_numbers[i], 
-                                    is_gosub ? JUMP_GOSUB : JUMP_ABSOLUTE);
+    loop = &cs->loops[cs->loop_count++];
+    loop->var_slot = (uint16_t)slot;
+    loop->next_operand = 0xFFFF;
+    loop->int_loop = (uint8_t)int_loop;
+    loop->state = LOOP_OPEN;
+    loop->for_pc = (uint32_t)cs->program->code_len - FOR_ENTER_WORDS;
+    loop->next_pc = LOOP_NO_PC;
+}
+
+/* Emit NEXT for slot (-1: bare NEXT), paired with the innermost open FOR */
+/* when that is its loop; compiler_pair_loops() has the final say */
+static void compiler_emit_next(CompilerState *cs, int slot) {
+    LoopRecord *loop = NULL;
+    size_t i = cs->loop_count;
+    
+    while (i-- > 0) {
+        if (cs->loops[i].state == LOOP_OPEN) {
+            loop = &cs->loops[i];
+            break;
         }
     }
     
-    free(line_numbers);
+    if (loop && (slot < 0 || loop->var_slot == slot)) {
+        loop->state = LOOP_PAIRED;
+        loop->next_operand = (slot < 0) ? 0xFFFF : (uint16_t)slot;
+        loop->next_pc = (uint32_t)cs->program->code_len;
+        compiler_emit(cs, OP_FOR_LOOP, loop->var_slot);
+        compiler_emit_raw(cs, 0);  /* Hidden slots, set by compiler_pair_loops() */
+        compiler_emit_raw(cs, (uint16_t)(loop->for_pc + FOR_ENTER_WORDS));
+        return;
+    }
+    
+    /* A NEXT for an outer loop (or none): the VM's FOR stack decides */
+    for (i = 0; i < cs->loop_count; i++) {
+        if (cs->loops[i].state == LOOP_OPEN) cs->loops[i].state = LOOP_DYNAMIC;
+    }
+    compiler_emit(cs, OP_FOR_NEXT, (slot < 0) ? 0xFFFF : slot);
 }
 
 /* Compile FOR statement */
 static void compile_for(CompilerState *cs, ParseNode *stmt) {
     ParseNode *var_node, *start_expr, *limit_expr, *step_expr = NULL;
     int slot;
+    int int_loop;
+    size_t i;
     
     /* FOR structure: [var, =, start, TO, limit, STEP?, step_val?, eos] */
     if (stmt->child_count < 5) return;
     
+    /* Loop invariants moved out of the body are computed first */
+    for (i = 0; i < cs->hoisted_count; i++) {
+        if (cs->hoisted[i].stmt == stmt) {
+            compile_store_number(cs, cs->hoisted[i].expr, cs->hoisted[i].slot);
+        }
+    }
+    
     var_node = stmt->children[0];      /* Variable */
     start_expr = stmt->children[2];    /* Start value (skip = at [1]) */
     limit_expr = stmt->children[4];    /* Limit value (skip TO at [3]) */
     
-    /* Check for STEP - if child_count > 6 and child[5] is STEP token */
-    if (stmt->child_count > 6) {
-        step_expr = stmt->children[6];  /* Step value */
+    /* The STEP clause is child[5]: [STEP, step_val], or empty without one */
+    if (stmt->child_count > 6 && stmt->children[5]->child_count > 1) {
+        step_expr = stmt->children[5]->children[1];
     }
     
     /* Navigate to variable */
@@ -1128,16 +3825,21 @@ static void compile_for(CompilerState *cs, ParseNode *stmt) {
     /* Compile: start, limit, step (in that order for stack) */
     compile_expression(cs, start_expr);
     compile_expression(cs, limit_expr);
+    int_loop = for_int_bound(start_expr) && for_int_bound(limit_expr);
     
-    if (step_expr && step_expr->type != NODE_EXPRESSION) {
+    if (step_expr) {
         compile_expression(cs, step_expr);
+        int_loop = int_loop && for_int_bound(step_expr);
     } else {
         /* Default STEP 1 */
         compiler_emit(cs, OP_PUSH_CONST, compiler_add_const(cs, 1.0));
     }
     
-    /* Emit FOR_INIT */
-    compiler_emit(cs, OP_FOR_INIT, slot);
+    /* Emit FOR_ENTER; compiler_pair_loops() turns it back into FOR_INIT */
+    /* (FOR_INIT_INT when the bounds may all be integers) if it cannot pair it */
+    compiler_emit(cs, OP_FOR_ENTER, slot);
+    compiler_emit_raw(cs, 0);
+    compiler_add_loop(cs, slot, int_loop);
 }
 
 /* Compile NEXT statement */
@@ -1171,7 +3873,7 @@ static int compile_next_variables(CompilerState *cs, ParseNode *node, const char
         }
         
         slot = compiler_find_variable(cs, node->text);
-        compiler_emit(cs, OP_FOR_NEXT, (slot < 0) ? 0xFFFF : slot);
+        compiler_emit_next(cs, slot);
         return 1;  /* Emitted one */
     }
     
@@ -1203,7 +3905,7 @@ static void compile_next(CompilerState *cs, ParseNode *stmt) {
     }
     
     /* No variables - emit NEXT with no variable (closes innermost loop) */
-    compiler_emit(cs, OP_FOR_NEXT, 0xFFFF);
+    compiler_emit_next(cs, -1);
 }
 
 /* Compile DIM statement */
@@ -1498,6 +4200,20 @@ static void compile_noop(CompilerState *cs, ParseNode *stmt) {
 
 /* Complex statement compilers */
 static void compile_let_stmt(CompilerState *cs, ParseNode *stmt) {
+    ParseNode *subscripts[2];
+    ParseNode *var_part;
+    size_t i;
+    
+    /* Numeric assignments regenerated from SSA form (-O) */
+    if (compile_lowered(cs, stmt)) return;
+    
+    /* Subscripts it shares are computed first */
+    for (i = 0; i < cs->hoisted_count; i++) {
+        if (cs->hoisted[i].stmt == stmt) {
+            compile_store_number(cs, cs->hoisted[i].expr, cs->hoisted[i].slot);
+        }
+    }
+    
     /* Assignment: children are [var_expr, eq_op, value_expr, eos] */
     if (stmt->child_count >= 3) {
         ParseNode *var_expr = stmt->children[0];
@@ -1506,53 +4222,44 @@ static void compile_let_stmt(CompilerState *cs, ParseNode *stmt) {
         int slot;
         
         /* Check if this is an array assignment (has subscripts) */
-        if (var_expr->type == NODE_EXPRESSION && var_expr->child_count == 2) {
-            ParseNode *var_part = var_expr->children[0];
-            ParseNode *subscript_expr = var_expr->children[1];
-            ParseNode *subscript1 = NULL;
-            ParseNode *subscript2 = NULL;
+        var_part = let_array_target(var_expr, subscripts);
+        if (var_part) {
+            /* Array assignment */
+            ParseNode *subscript1 = subscripts[0];
+            ParseNode *subscript2 = subscripts[1];
+            int is_string = strchr(var_part->text, '$') != NULL;
+            size_t index_pc;
+            int by_var;
             
-            /* Unwrap variable */
-            while (var_part && var_part->type == NODE_EXPRESSION && var_part->child_count > 0) {
-                var_part = var_part->children[0];
+            slot = compiler_find_variable(cs, var_part->text);
+            if (slot < 0) {
+                slot = compiler_add_variable(cs, var_part->text, get_var_type(var_part->text));
             }
             
-            /* Extract subscripts */
-            if (subscript_expr && subscript_expr->child_count >= 2) {
-                subscript1 = subscript_expr->children[1];
-                /* For 2D arrays: child[2] is EXPRESSION containing [comma, sub2] */
-                if (subscript_expr->child_count >= 4) {
-                    ParseNode *middle = subscript_expr->children[2];
-                    if (middle && middle->type == NODE_EXPRESSION && middle->child_count >= 2) {
-                        subscript2 = middle->children[1];
-                    }
-                }
+            /* A(I,J)=A(I,J)+... finds the element once (-O) */
+            if (cs->optimize && subscript2 && !is_string &&
+                compile_element_update(cs, slot, subscripts, value_expr)) {
+                return;
             }
             
-            if (var_part && var_part->type == NODE_VARIABLE && var_part->text && subscript1) {
-                /* Array assignment */
-                int is_string = strchr(var_part->text, '$') != NULL;
-                
-                slot = compiler_find_variable(cs, var_part->text);
-                if (slot < 0) {
-                    slot = compiler_add_variable(cs, var_part->text, get_var_type(var_part->text));
-                }
-                
-                /* Compile subscripts and value */
-                compile_expression(cs, subscript1);
-                if (subscript2) {
-                    compile_expression(cs, subscript2);
-                }
-                compile_expression(cs, value_expr);
-                
-                /* Emit array store */
-                if (subscript2) {
-                    compiler_emit(cs, is_string ? OP_STR_ARRAY_SET_2D : OP_ARRAY_SET_2D, slot);
-                } else {
-                    compiler_emit(cs, is_string ? OP_STR_ARRAY_SET_1D : OP_ARRAY_SET_1D, slot);
-                }
-                return;
+            /* Compile subscripts and value */
+            index_pc = cs->program->code_len;
+            compile_expression(cs, subscript1);
+            by_var = (cs->program->code_len == index_pc + 1);
+            if (subscript2) {
+                compile_expression(cs, subscript2);
+                by_var = by_var && (cs->program->code_len == index_pc + 2);
             }
+            compile_expression(cs, value_expr);
+            
+            /* Emit array store */
+            if (subscript2) {
+                compiler_emit(cs, is_string ? OP_STR_ARRAY_SET_2D : OP_ARRAY_SET_2D, slot);
+            } else {
+                compiler_emit(cs, is_string ? OP_STR_ARRAY_SET_1D : OP_ARRAY_SET_1D, slot);
+            }
+            if (!is_string) compiler_add_array_site(cs, index_pc, subscript2 ? 2 : 1, by_var);
+            return;
         }
         
         /* Simple variable assignment */
@@ -1570,13 +4277,13 @@ static void compile_let_stmt(CompilerState *cs, ParseNode *stmt) {
             slot = compiler_add_variable(cs, actual_var->text, get_var_type(actual_var->text));
         }
         
-        compile_expression(cs, value_expr);
-        
-        if (get_var_type(actual_var->text) == VAR_STRING) {
-            compiler_emit(cs, OP_STR_POP_VAR, slot);
-        } else {
-            compiler_emit(cs, OP_POP_VAR, slot);
+        if (get_var_type(actual_var->text) == VAR_NUMERIC) {
+            compile_store_number(cs, value_expr, slot);
+            return;
         }
+        
+        compile_expression(cs, value_expr);
+        compiler_emit(cs, OP_STR_POP_VAR, slot);
     }
 }
 
@@ -1850,7 +4557,20 @@ static void compile_statement(CompilerState *cs, ParseNode *stmt) {
 }
 
 /* Main compilation entry point */
+/* Initialize compiler options to their defaults */
+void compiler_options_init(CompilerOptions *options) {
+    options->isa = ISA_STACK;
+    options->optimize = 0;
+}
+
 CompiledProgram* compiler_compile(ParseNode *root) {
+    CompilerOptions options;
+    
+    compiler_options_init(&options);
+    return compiler_compile_with_options(root, &options);
+}
+
+CompiledProgram* compiler_compile_with_options(ParseNode *root, const CompilerOptions *options) {
     CompilerState *cs;
     CompiledProgram *prog;
     size_t i;
@@ -1860,9 +4580,34 @@ CompiledProgram* compiler_compile(ParseNode *root) {
     cs = compiler_state_new();
     if (!cs) return NULL;
     
+    cs->isa = options ? options->isa : ISA_STACK;
+    cs->optimize = options ? options->optimize : 0;
+    cs->program->isa = cs->isa;
+    
     /* Phase 1: Discover all variables */
     discover_variables_in_tree(cs, root);
     
+    /* Phase 1b: Evaluate constant subexpressions */
+    compiler_fold_constants(root);
+    
+    /* Phase 1c: Find the GOSUB targets to compile in place */
+    compiler_find_subroutines(cs, root);
+    
+    /* Phase 1d: Move loop invariants out of FOR bodies (-O) */
+    if (options && options->optimize) {
+        compiler_hoist_invariants(cs, root);
+    }
+    
+    /* Phase 1e: Lower straight-line numeric assignments through SSA (-O) */
+    if (options && options->optimize) {
+        compiler_lower_blocks(cs, root);
+    }
+    
+    /* Phase 1f: Share repeated subscripts within assignments (-O) */
+    if (options && options->optimize) {
+        compiler_share_subscripts(cs, root);
+    }
+    
     /* Phase 2 & 3: Compile each line */
     for (i = 0; i < root->child_count; i++) {
         ParseNode *stmt = root->children[i];
@@ -1884,6 +4629,27 @@ CompiledProgram* compiler_compile(ParseNode *root) {
     /* Phase 4: Resolve jump fixups */
     compiler_resolve_jumps(cs);
     
+    /* Phase 5: Pair FOR/NEXT loops that can keep their state in variables */
+    if (!cs->has_error) {
+        compiler_pair_loops(cs);
+    }
+    
+    /* Phase 6: Drop subscript checks the loop bounds make redundant */
+    if (!cs->has_error) {
+        compiler_eliminate_bounds_checks(cs);
+    }
+    
+    /* Phase 6b: Dead code removal and peephole pass (-O) */
+    if (!cs->has_error && options && options->optimize) {
+        compiler_eliminate_dead_code(cs);
+        compiler_peephole(cs);
+    }
+    
+    /* Phase 7: Fuse common sequences into superinstructions */
+    if (!cs->has_error) {
+        compiler_fuse_superinstructions(cs);
+    }
+    
     if (cs->has_error) {
         fprintf(stderr, "Compilation error: %s\n", cs->error_msg);
         compiled_program_free(cs->program);
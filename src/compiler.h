@@ -44,6 +44,57 @@ typedef struct {
     JumpType type;               /* Type of jump */
 } JumpFixup;
 
+/* FOR loop pairing (see compiler_pair_loops) */
+typedef enum {
+    LOOP_OPEN,                   /* FOR compiled, its NEXT not yet seen */
+    LOOP_PAIRED,                 /* NEXT paired with the FOR at compile time */
+    LOOP_DYNAMIC                 /* Runs on the VM's FOR stack */
+} LoopState;
+
+typedef struct {
+    uint16_t var_slot;           /* Loop variable */
+    uint16_t next_operand;       /* NEXT's variable, 0xFFFF for a bare NEXT */
+    uint8_t int_loop;            /* Bounds may be integers (FOR_INIT_INT) */
+    LoopState state;
+    uint32_t for_pc;             /* PC of OP_FOR_ENTER */
+    uint32_t next_pc;            /* PC of OP_FOR_LOOP, once paired */
+} LoopRecord;
+
+#define LOOP_NO_PC 0xFFFFFFFFu
+
+/* Numeric array access whose subscripts are plain variables */
+/* (see compiler_eliminate_bounds_checks) */
+typedef struct {
+    uint32_t index_pc;           /* PUSH_VAR of the first subscript */
+    uint32_t op_pc;              /* OP_ARRAY_GET_ or OP_ARRAY_SET_ */
+    uint8_t dims;
+} ArraySite;
+
+/* Target of a GOSUB to a constant line (see compiler_find_subroutines) */
+typedef struct {
+    uint16_t line;               /* Target line */
+    uint32_t first;              /* Its first statement among the program's */
+    uint16_t length;             /* Statements before the RETURN */
+    uint8_t inlined;             /* Compiled in place of each GOSUB to it */
+} Subroutine;
+
+/* Expression computed once ahead of a statement: a loop invariant before */
+/* its FOR (see compiler_hoist_invariants), or a subscript an assignment */
+/* repeats before the assignment (see compiler_share_subscripts) */
+typedef struct {
+    ParseNode *stmt;             /* FOR or LET statement it is computed ahead of */
+    ParseNode *expr;             /* The expression, moved out of its place */
+    uint16_t slot;               /* Hidden variable holding its value */
+} HoistedExpression;
+
+/* Assignment a lowered statement compiles to (see compiler_lower_blocks); */
+/* a statement left with none has one entry whose expr is NULL */
+typedef struct {
+    ParseNode *stmt;             /* LET statement it belongs to */
+    ParseNode *expr;             /* Value, built from the SSA form */
+    uint16_t slot;               /* Variable assigned */
+} LoweredAssignment;
+
 /* DATA entry types */
 typedef enum {
     DATA_NUMERIC,
@@ -98,8 +149,22 @@ typedef struct {
     size_t line_count;
     size_t line_capacity;
     
+    /* Instruction Set */
+    uint8_t isa;                 /* ISA_STACK or ISA_REG */
+    uint8_t reg_temps;           /* Register temporaries used (ISA_REG) */
+    
+    /* Set by verify_program() (0 = not verified) */
+    size_t max_stack;            /* Deepest expression stack on any path */
+    size_t max_num_stack;        /* Deepest number stack on any path */
+    
 } CompiledProgram;
 
+/* Compiler options */
+typedef struct {
+    uint8_t isa;                 /* ISA_STACK (default) or ISA_REG */
+    uint8_t optimize;            /* Run the peephole pass (-O) */
+} CompilerOptions;
+
 /* Forward declaration for compilation dispatch */
 struct CompilerState_t;
 typedef struct CompilerState_t CompilerState;
@@ -122,9 +187,49 @@ struct CompilerState_t {
     size_t fixup_count;
     size_t fixup_capacity;
     
+    /* FOR loops in program order */
+    LoopRecord *loops;
+    size_t loop_count;
+    size_t loop_capacity;
+    
+    /* Array accesses subscripted by variables, in program order */
+    ArraySite *array_sites;
+    size_t array_site_count;
+    size_t array_site_capacity;
+    
+    /* GOSUB targets, and the program's statements they index */
+    Subroutine *subroutines;
+    size_t subroutine_count;
+    size_t subroutine_capacity;
+    ParseNode *root;
+    
+    /* Loop invariants and shared subscripts, computed ahead of their statements */
+    HoistedExpression *hoisted;
+    size_t hoisted_count;
+    size_t hoisted_capacity;
+    
+    /* Straight-line numeric assignments, regenerated from SSA form */
+    LoweredAssignment *lowered;
+    size_t lowered_count;
+    size_t lowered_capacity;
+    uint32_t *lowered_lines;     /* By line number: 1 + index of the line's */
+                                 /* first entry (they are contiguous), or 0 */
+    
     /* Current line being compiled */
     uint16_t current_line;
     
+    /* Optimizations that may change a result's last bit (-O) */
+    uint8_t optimize;
+    int power_temp;              /* Hidden variable for X^n on the number */
+                                 /* stack, or -1 until one is needed */
+    int rmw_array;               /* Array whose element the LET being compiled */
+    uint16_t rmw_vars[2];        /* reads with OP_ARRAY_ADDR_2D (subscripted */
+                                 /* by these variables), or -1 */
+    
+    /* Register code generation (ISA_REG) */
+    uint8_t isa;                 /* Target instruction set */
+    uint16_t reg_next_temp;      /* Next free temporary */
+    
     /* Error handling */
     int has_error;
     char error_msg[256];
@@ -133,6 +238,8 @@ struct CompilerState_t {
 
 /* Compiler functions */
 CompiledProgram* compiler_compile(ParseNode *root);
+CompiledProgram* compiler_compile_with_options(ParseNode *root, const CompilerOptions *options);
+void compiler_options_init(CompilerOptions *options);
 void compiled_program_free(CompiledProgram *prog);
 
 /* Helper functions for compiler */
@@ -159,4 +266,11 @@ int32_t compiler_find_line_offset(CompilerState *cs, uint16_t line);
 void compiler_add_jump_fixup(CompilerState *cs, uint32_t pc, uint16_t target_line, JumpType type);
 void compiler_resolve_jumps(CompilerState *cs);
 
+/* Optimization passes */
+void compiler_pair_loops(CompilerState *cs);
+void compiler_eliminate_bounds_checks(CompilerState *cs);
+void compiler_eliminate_dead_code(CompilerState *cs);
+void compiler_peephole(CompilerState *cs);
+void compiler_fuse_superinstructions(CompilerState *cs);
+
 #endif /* COMPILER_H */
@@ -0,0 +1,1197 @@
+/* emit_c.c - Translate a compiled program to C */
+#include "emit_c.h"
+#include "bytecode.h"
+#include "verify.h"
+#include <float.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Translation
+ *
+ * The program's code becomes one function, basset_run(VMState *vm), with a
+ * label for every pc a jump can reach. Each instruction is translated in
+ * program order:
+ *
+ *   - numeric stack code is evaluated at translation time. Pushed constants
+ *     and variables are used in place, intermediate results live in locals
+ *     s0, s1, ... (by stack depth), and nothing reaches vm->stack unless an
+ *     instruction run by the interpreter needs it. Number stack (OP_N_*)
+ *     code is translated the same way: its entries are the top ndepth of
+ *     the translation-time stack and go to vm->num_stack when pushed;
+ *   - register instructions, arithmetic, comparisons, INT/ABS/SGN/SQR,
+ *     numeric 1D arrays, element read-modify-write (OP_ARRAY_ADDR_2D and
+ *     OP_ARRAY_STORE_ADDR), jumps, GOSUB, FOR/NEXT and the superinstructions
+ *     are C statements, and branches to known targets are gotos;
+ *   - every other instruction (strings, PRINT, INPUT, files, DATA, RETURN,
+ *     computed GOTOs, ...) is run by vm_step(), the interpreter's own
+ *     handler for it.
+ *
+ * Labeled pcs are line starts, branch targets, GOSUB return addresses and
+ * FOR loop body starts. The dispatch loop at the end of basset_run() maps
+ * vm->pc back to its label, so execution resumes in C after RETURN, TRAP and
+ * anything else that leaves vm_step() somewhere other than the next
+ * instruction; pcs without a label are stepped through until one is reached.
+ *
+ * Errors are never raised by the C code itself: a division by zero, SQR of
+ * a negative number or a subscript out of range pushes the pending values
+ * onto vm->stack and leaves that instruction to vm_step(), which reports it
+ * (or jumps to the TRAP line) exactly as the interpreter does.
+ */
+
+#define EMIT_MAX_DEPTH  32       /* Stack entries held in C locals */
+#define EMIT_NO_PC      ((size_t)-1)
+
+/* Translation-time stack entry kinds */
+#define SYM_TEMP   0             /* Number in local s<depth> */
+#define SYM_REG    1             /* Register file entry v[index], not copied */
+#define SYM_CONST  2             /* Constant, not copied */
+
+typedef struct {
+    uint8_t kind;
+    uint32_t index;              /* SYM_REG: register file index */
+    double value;                /* SYM_CONST: value */
+} SymEntry;
+
+/* Per-pc flags */
+#define PC_START   0x01          /* An instruction starts here */
+#define PC_LABEL   0x02          /* Possible jump destination */
+#define PC_LINE    0x04          /* First pc of a BASIC line */
+
+typedef struct {
+    FILE *out;                   /* NULL while sizing the locals */
+    const CompiledProgram *prog;
+    uint8_t *flags;              /* code_len + 1 entries */
+    uint16_t *lines;             /* Line number at PC_LINE pcs */
+    size_t *last_for;            /* Per variable: pc of the last FOR_INIT seen */
+    size_t last_for_any;
+
+    SymEntry stack[EMIT_MAX_DEPTH];
+    int depth;
+    int ndepth;                  /* Top entries that belong on vm->num_stack */
+    int dead;                    /* Unreachable until the next label */
+
+    /* Locals basset_run() needs */
+    uint8_t temp_used[EMIT_MAX_DEPTH]; /* s<depth> declared */
+    int uses_v, uses_array, uses_for, uses_for_init;
+} EmitState;
+
+static void emit(EmitState *es, const char *fmt, ...) {
+    va_list ap;
+
+    if (!es->out) return;
+    va_start(ap, fmt);
+    vfprintf(es->out, fmt, ap);
+    va_end(ap);
+}
+
+/* C literal for a double that reads back as the same value */
+static void emit_format_double(char *buf, double d) {
+    if (d != d) {
+        strcpy(buf, "(HUGE_VAL - HUGE_VAL)");
+    } else if (d > DBL_MAX) {
+        strcpy(buf, "HUGE_VAL");
+    } else if (d < -DBL_MAX) {
+        strcpy(buf, "(-HUGE_VAL)");
+    } else {
+        char num[40];
+        sprintf(num, "%.17g", d);
+        if (!strpbrk(num, ".eEn")) strcat(num, ".0");
+        if (num[0] == '-') {
+            sprintf(buf, "(%s)", num);
+        } else {
+            strcpy(buf, num);
+        }
+    }
+}
+
+static void emit_string_literal(FILE *out, const char *s) {
+    if (!s) {
+        fputs("NULL", out);
+        return;
+    }
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\' || c == '?') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 32 || c >= 127) {
+            fprintf(out, "\\%03o", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/* Words from the instruction at pc to the next one in program order */
+/* (superinstructions count as one: the words they cover stay instructions) */
+static size_t emit_instruction_words(const CompiledProgram *prog, size_t pc) {
+    uint8_t op = prog->code[pc].opcode;
+    size_t words = 1;
+
+    if (op == OP_ON_GOTO || op == OP_ON_GOSUB) {
+        words = (size_t)prog->code[pc].operand + 1;
+    } else if (op == OP_FOR_ENTER) {
+        words = FOR_ENTER_WORDS;
+    } else if (op == OP_FOR_LOOP) {
+        words = FOR_LOOP_WORDS;
+    } else if (OP_IS_REGISTER(op)) {
+        words = REG_INSTRUCTION_WORDS(op);
+    } else if (OP_IS_ARRAY_INDEXED(op)) {
+        words = ARRAY_INDEXED_WORDS(op);
+    }
+    if (pc + words > prog->code_len) words = prog->code_len - pc;
+    return words;
+}
+
+/* Words covered by a superinstruction, 0 for anything else */
+static size_t emit_fused_words(uint8_t op) {
+    switch (op) {
+        case OP_VAR_ADD_CONST_POP:
+        case OP_VAR_SUB_CONST_POP:
+            return 4;
+        case OP_VAR_MUL_VAR:
+        case OP_N_VAR_MUL_VAR:
+            return 3;
+        case OP_VAR_ARRAY_GET_1D:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+/* Expression stack twin of a number stack instruction (OP_N_BOX: OP_NOP) */
+static uint8_t emit_stack_opcode(uint8_t op) {
+    switch (op) {
+        case OP_N_PUSH_CONST:   return OP_PUSH_CONST;
+        case OP_N_PUSH_VAR:     return OP_PUSH_VAR;
+        case OP_N_POP_VAR:      return OP_POP_VAR;
+        case OP_N_ADD:          return OP_ADD;
+        case OP_N_SUB:          return OP_SUB;
+        case OP_N_MUL:          return OP_MUL;
+        case OP_N_DIV:          return OP_DIV;
+        case OP_N_POW:          return OP_POW;
+        case OP_N_NEG:          return OP_NEG;
+        case OP_N_EQ:           return OP_EQ;
+        case OP_N_NE:           return OP_NE;
+        case OP_N_LT:           return OP_LT;
+        case OP_N_LE:           return OP_LE;
+        case OP_N_GT:           return OP_GT;
+        case OP_N_GE:           return OP_GE;
+        case OP_N_AND:          return OP_AND;
+        case OP_N_OR:           return OP_OR;
+        case OP_N_NOT:          return OP_NOT;
+        case OP_N_VAR_MUL_VAR:  return OP_VAR_MUL_VAR;
+        default:                return OP_NOP;
+    }
+}
+
+/* Labels */
+
+static void emit_mark(EmitState *es, size_t pc) {
+    if (pc <= es->prog->code_len) es->flags[pc] |= PC_LABEL;
+}
+
+static void emit_find_labels(EmitState *es) {
+    const CompiledProgram *prog = es->prog;
+    const Instruction *code = prog->code;
+    size_t len = prog->code_len;
+    size_t pc, i, k, words, fused;
+
+    es->flags[len] |= PC_START;
+    if (len > 0) es->flags[0] |= PC_LABEL;
+
+    for (i = 0; i < prog->line_count; i++) {
+        size_t line_pc = prog->line_map[i].pc_offset;
+        if (line_pc > len) continue;
+        es->flags[line_pc] |= PC_LABEL;
+        if (i == 0 || prog->line_map[i].line_number != prog->line_map[i - 1].line_number) {
+            es->flags[line_pc] |= PC_LINE;
+            es->lines[line_pc] = prog->line_map[i].line_number;
+        }
+    }
+
+    for (pc = 0; pc < len; pc += words) {
+        uint8_t op = code[pc].opcode;
+
+        words = emit_instruction_words(prog, pc);
+        es->flags[pc] |= PC_START;
+
+        switch (op) {
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_JNLT: case OP_JNLE: case OP_JNGT:
+            case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+                emit_mark(es, code[pc].operand);
+                break;
+            case OP_GOSUB:
+                emit_mark(es, code[pc].operand);
+                emit_mark(es, pc + 1);
+                break;
+            case OP_GOSUB_LINE:
+            case OP_FOR_INIT:
+            case OP_FOR_INIT_INT:
+                emit_mark(es, pc + 1);
+                break;
+            case OP_FOR_ENTER:
+                emit_mark(es, pc + words);
+                break;
+            case OP_FOR_LOOP:
+                if (words == FOR_LOOP_WORDS) emit_mark(es, code[pc + 2].operand);
+                break;
+            case OP_ON_GOTO:
+            case OP_ON_GOSUB:
+                for (k = 1; k < words; k++) {
+                    emit_mark(es, code[pc + k].operand);
+                }
+                if (op == OP_ON_GOSUB) emit_mark(es, pc + words);
+                break;
+            default:
+                if (OP_IS_REG_BRANCH(op)) emit_mark(es, code[pc].operand);
+                break;
+        }
+    }
+
+    /* A superinstruction with a label inside ends by jumping past its words */
+    for (pc = 0; pc < len; pc++) {
+        if (!(es->flags[pc] & PC_START)) continue;
+        fused = emit_fused_words(code[pc].opcode);
+        if (!fused || pc + fused > len) continue;
+        for (k = 1; k < fused; k++) {
+            if (es->flags[pc + k] & PC_LABEL) emit_mark(es, pc + fused);
+        }
+    }
+
+    /* Operand words can not be labels, and jumps to the end just stop; */
+    /* both go through dispatch */
+    for (pc = 0; pc <= len; pc++) {
+        if (pc == len || !(es->flags[pc] & PC_START)) {
+            es->flags[pc] &= (uint8_t)~(PC_LABEL | PC_LINE);
+        }
+    }
+}
+
+static int emit_is_label(const EmitState *es, size_t pc) {
+    return pc <= es->prog->code_len && (es->flags[pc] & PC_LABEL);
+}
+
+/* Translation-time stack */
+
+/* C expression for an entry (slot: its stack position) */
+static const char* emit_entry_text(EmitState *es, const SymEntry *e, int slot, char *buf) {
+    if (e->kind == SYM_TEMP) {
+        sprintf(buf, "s%d", slot);
+    } else if (e->kind == SYM_REG) {
+        sprintf(buf, "v[%lu]", (unsigned long)e->index);
+        es->uses_v = 1;
+    } else {
+        emit_format_double(buf, e->value);
+    }
+    return buf;
+}
+
+static const char* emit_slot_text(EmitState *es, int slot, char *buf) {
+    return emit_entry_text(es, &es->stack[slot], slot, buf);
+}
+
+static const char* emit_reg_text(EmitState *es, uint32_t index, char *buf) {
+    sprintf(buf, "v[%lu]", (unsigned long)index);
+    es->uses_v = 1;
+    return buf;
+}
+
+static void emit_set_temp(EmitState *es, int slot) {
+    es->stack[slot].kind = SYM_TEMP;
+    es->temp_used[slot] = 1;
+}
+
+/* Push entries onto vm->stack (the top ndepth onto vm->num_stack), */
+/* bottom first, without forgetting them */
+static void emit_push_entries(EmitState *es, const char *indent) {
+    char t[48];
+    int i;
+
+    for (i = 0; i < es->depth; i++) {
+        emit(es, "%s%s(vm, %s);\n", indent,
+             i < es->depth - es->ndepth ? "vm_push_number" : "vm_num_push",
+             emit_slot_text(es, i, t));
+    }
+}
+
+/* Move every entry onto its stack */
+static void emit_flush(EmitState *es) {
+    emit_push_entries(es, "    ");
+    es->depth = 0;
+    es->ndepth = 0;
+}
+
+/* Copy entries below `below` that read register r before it is written */
+static void emit_spill(EmitState *es, uint32_t r, int below) {
+    int i;
+
+    for (i = 0; i < below; i++) {
+        if (es->stack[i].kind == SYM_REG && es->stack[i].index == r) {
+            emit(es, "    s%d = v[%lu];\n", i, (unsigned long)r);
+            emit_set_temp(es, i);
+        }
+    }
+}
+
+/* Slot for one more entry */
+static int emit_reserve(EmitState *es) {
+    if (es->depth == EMIT_MAX_DEPTH) emit_flush(es);
+    return es->depth;
+}
+
+/* Control transfers */
+
+static void emit_goto(EmitState *es, size_t target) {
+    emit_flush(es);
+    if (emit_is_label(es, target)) {
+        emit(es, "    goto L%lu;\n", (unsigned long)target);
+    } else {
+        emit(es, "    vm->pc = %lu;\n    goto dispatch;\n", (unsigned long)target);
+    }
+    es->dead = 1;
+}
+
+/* Branch to target when cond holds; the stack must be flushed already */
+static void emit_branch(EmitState *es, const char *cond, size_t target) {
+    if (emit_is_label(es, target)) {
+        emit(es, "    if (%s) goto L%lu;\n", cond, (unsigned long)target);
+    } else {
+        emit(es, "    if (%s) {\n        vm->pc = %lu;\n        goto dispatch;\n    }\n",
+             cond, (unsigned long)target);
+    }
+}
+
+/* Run the instruction at pc in the interpreter */
+static void emit_step(EmitState *es, size_t pc, size_t next) {
+    emit_flush(es);
+    emit(es, "    STEP(%lu, %lu);\n", (unsigned long)pc, (unsigned long)next);
+}
+
+/* Leave the instruction at pc to the interpreter when cond holds */
+static void emit_slow_path(EmitState *es, const char *cond, size_t pc) {
+    emit(es, "    if (%s) {\n", cond);
+    emit_push_entries(es, "        ");
+    emit(es, "        SLOW(%lu);\n    }\n", (unsigned long)pc);
+}
+
+/* a = &vm->arrays[slot], i = index, with the interpreter's checks */
+static void emit_array_index(EmitState *es, uint32_t slot, const char *index, size_t pc) {
+    emit(es, "    a = &vm->arrays[%lu];\n", (unsigned long)slot);
+    emit(es, "    i = (size_t)%s;\n", index);
+    emit_slow_path(es, "!a->u.data || i >= a->dim1", pc);
+    es->uses_array = 1;
+}
+
+/* The element an OP_ARRAY_LOAD/STORE at pc names, into buf (160 bytes); */
+/* 0 unless verify_subscripts() proves it in range */
+static int emit_array_element(EmitState *es, size_t pc, char *buf) {
+    const CompiledProgram *prog = es->prog;
+    const Instruction *inst = &prog->code[pc];
+    int dims = (int)ARRAY_INDEXED_WORDS(inst->opcode) - 1;
+    uint16_t vars[2];
+    char ta[48], tb[48];
+    int k;
+
+    if (pc + (size_t)dims >= prog->code_len) return 0;
+    for (k = 0; k < dims; k++) vars[k] = inst[k + 1].operand;
+    if (!verify_subscripts(prog, pc, inst->operand, vars, dims)) return 0;
+
+    if (dims == 1) {
+        sprintf(buf, "vm->arrays[%lu].u.data[(size_t)%s]", (unsigned long)inst->operand,
+                emit_reg_text(es, vars[0], ta));
+    } else {
+        emit(es, "    a = &vm->arrays[%lu];\n", (unsigned long)inst->operand);
+        sprintf(buf, "a->u.data[(size_t)%s * a->dim2 + (size_t)%s]",
+                emit_reg_text(es, vars[0], ta), emit_reg_text(es, vars[1], tb));
+        es->uses_array = 1;
+    }
+    return 1;
+}
+
+/* Instructions */
+
+/* Replace the top two entries with fmt applied to them (%s twice) */
+static int emit_binary(EmitState *es, const char *fmt) {
+    char ta[48], tb[48], expr[160];
+    int d;
+
+    if (es->depth < 2) return 0;
+    d = es->depth - 2;
+    sprintf(expr, fmt, emit_slot_text(es, d, ta), emit_slot_text(es, d + 1, tb));
+    emit(es, "    s%d = %s;\n", d, expr);
+    emit_set_temp(es, d);
+    es->depth--;
+    return 1;
+}
+
+/* Replace the top entry with fmt applied to it (every %s is the entry) */
+static int emit_unary(EmitState *es, const char *fmt) {
+    char ta[48], expr[160];
+    int d;
+
+    if (es->depth < 1) return 0;
+    d = es->depth - 1;
+    emit_slot_text(es, d, ta);
+    sprintf(expr, fmt, ta, ta, ta);
+    emit(es, "    s%d = %s;\n", d, expr);
+    emit_set_temp(es, d);
+    return 1;
+}
+
+/* Fused compare-and-branch: jump unless "a rel b" */
+static int emit_compare_branch(EmitState *es, const char *rel, size_t target) {
+    char ta[48], tb[48], cond[128];
+    int d;
+
+    if (es->depth < 2) return 0;
+    es->depth -= 2;
+    d = es->depth;
+    emit_slot_text(es, d, ta);
+    emit_slot_text(es, d + 1, tb);
+    emit_flush(es);
+    sprintf(cond, "!(%s %s %s)", ta, rel, tb);
+    emit_branch(es, cond, target);
+    return 1;
+}
+
+/* Register operand word as an entry; 0 if malformed */
+static int emit_register_operand(const EmitState *es, uint16_t reg, SymEntry *e) {
+    const CompiledProgram *prog = es->prog;
+    uint32_t index = reg & REG_INDEX_MASK;
+
+    switch (reg & REG_CLASS_MASK) {
+        case REG_VAR:
+            if (index >= prog->var_count) return 0;
+            e->kind = SYM_REG;
+            e->index = index;
+            return 1;
+        case REG_TEMP:
+            if (index >= prog->reg_temps) return 0;
+            e->kind = SYM_REG;
+            e->index = (uint32_t)prog->var_count + index;
+            return 1;
+        case REG_CONST:
+            if (index >= prog->const_count) return 0;
+            e->kind = SYM_CONST;
+            e->value = prog->const_pool[index];
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Register instruction at pc; 0 to leave it to the interpreter */
+static int emit_register(EmitState *es, size_t pc) {
+    const Instruction *code = &es->prog->code[pc];
+    uint8_t op = code->opcode;
+    size_t words = REG_INSTRUCTION_WORDS(op), k;
+    SymEntry r[3];
+    char t0[48], t1[48], t2[48], cond[128];
+    int d;
+
+    if (es->prog->isa != ISA_REG || pc + words > es->prog->code_len) return 0;
+    for (k = OP_IS_REG_BRANCH(op) ? 1 : 0; k < words; k++) {
+        if (!emit_register_operand(es, code[k].operand, &r[k])) return 0;
+    }
+    if (!OP_IS_REG_BRANCH(op) && op != OP_R_PUSH && r[0].kind != SYM_REG) return 0;
+
+    if (op == OP_R_PUSH) {
+        d = emit_reserve(es);
+        es->stack[d] = r[0];
+        es->depth++;
+        return 1;
+    }
+    if (op == OP_R_POP) {
+        if (es->depth < 1) return 0;
+        d = --es->depth;
+        emit_spill(es, r[0].index, d);
+        emit(es, "    %s = %s;\n", emit_reg_text(es, r[0].index, t0), emit_slot_text(es, d, t1));
+        return 1;
+    }
+
+    if (words > 1) emit_entry_text(es, &r[1], 0, t1);
+    if (words > 2) emit_entry_text(es, &r[2], 0, t2);
+
+    if (OP_IS_REG_BRANCH(op)) {
+        static const char *const rel[] = { "<", "<=", ">", ">=", "==", "!=" };
+        emit_flush(es);
+        sprintf(cond, "!(%s %s %s)", t1, rel[op - OP_R_JNLT], t2);
+        emit_branch(es, cond, code->operand);
+        return 1;
+    }
+
+    /* The rest write word 0's register */
+    emit_spill(es, r[0].index, es->depth);
+    emit_reg_text(es, r[0].index, t0);
+    switch (op) {
+        case OP_R_MOV: emit(es, "    %s = %s;\n", t0, t1); break;
+        case OP_R_ADD: emit(es, "    %s = %s + %s;\n", t0, t1, t2); break;
+        case OP_R_SUB: emit(es, "    %s = %s - %s;\n", t0, t1, t2); break;
+        case OP_R_MUL: emit(es, "    %s = %s * %s;\n", t0, t1, t2); break;
+        case OP_R_DIV:
+            sprintf(cond, "%s == 0.0", t2);
+            emit_slow_path(es, cond, pc);
+            emit(es, "    %s = %s / %s;\n", t0, t1, t2);
+            break;
+        case OP_R_POW: emit(es, "    %s = pow(%s, %s);\n", t0, t1, t2); break;
+        case OP_R_NEG: emit(es, "    %s = -%s;\n", t0, t1); break;
+        default: return 0;
+    }
+    return 1;
+}
+
+/* Superinstruction covering `fused` words done: skip the words it covers, */
+/* or jump over them if some are labels (they are emitted as well) */
+static size_t emit_fused_end(EmitState *es, size_t pc, size_t fused) {
+    size_t k;
+
+    for (k = 1; k < fused; k++) {
+        if (emit_is_label(es, pc + k)) {
+            emit_goto(es, pc + fused);
+            return 1;
+        }
+    }
+    return fused;
+}
+
+static void emit_for_next(EmitState *es, size_t pc, uint16_t var) {
+    const CompiledProgram *prog = es->prog;
+    size_t loop_start = (var == 0xFFFF) ? es->last_for_any : es->last_for[var];
+    char tv[48];
+
+    emit_flush(es);
+    if (var == 0xFFFF) {
+        strcpy(tv, "v[f->var_slot]");
+        es->uses_v = 1;
+    } else {
+        emit_reg_text(es, var, tv);
+    }
+
+    emit(es, "    f = vm->for_top ? &vm->for_stack[vm->for_top - 1] : NULL;\n");
+    if (var == 0xFFFF) {
+        emit(es, "    if (!f) SLOW(%lu);\n", (unsigned long)pc);
+    } else {
+        emit(es, "    if (!f || f->var_slot != %u) SLOW(%lu);\n", (unsigned)var, (unsigned long)pc);
+    }
+    emit(es, "    %s += f->step;\n", tv);
+    emit(es, "    if (f->step > 0 ? !(%s > f->limit) : !(%s < f->limit)) {\n", tv, tv);
+    if (loop_start != EMIT_NO_PC && emit_is_label(es, loop_start)) {
+        emit(es, "        if (f->loop_start_pc == %lu) goto L%lu;\n",
+             (unsigned long)loop_start, (unsigned long)loop_start);
+    }
+    emit(es, "        vm->pc = f->loop_start_pc;\n        goto dispatch;\n    }\n");
+    emit(es, "    vm->for_top--;\n");
+    es->uses_for = 1;
+    (void)prog;
+}
+
+/* Translate the instruction at pc as op; returns the words to advance */
+static size_t emit_translate(EmitState *es, size_t pc, uint8_t op) {
+    const CompiledProgram *prog = es->prog;
+    const Instruction *inst = &prog->code[pc];
+    size_t words = emit_instruction_words(prog, pc);
+    size_t fused = emit_fused_words(inst->opcode);
+    uint16_t operand = inst->operand;
+    char ta[48], tb[48], tc[48], cond[128], element[160];
+    int d;
+
+    if (fused && pc + fused > prog->code_len) fused = 0;
+
+    switch (op) {
+        /* Stack */
+        case OP_PUSH_CONST:
+            if (operand >= prog->const_count) break;
+            d = emit_reserve(es);
+            es->stack[d].kind = SYM_CONST;
+            es->stack[d].value = prog->const_pool[operand];
+            es->depth++;
+            return words;
+
+        case OP_PUSH_VAR:
+            if (operand >= prog->var_count) break;
+            d = emit_reserve(es);
+            es->stack[d].kind = SYM_REG;
+            es->stack[d].index = operand;
+            es->depth++;
+            return words;
+
+        case OP_POP_VAR:
+            if (es->depth < 1 || operand >= prog->var_count) break;
+            d = --es->depth;
+            emit_spill(es, operand, d);
+            emit(es, "    %s = %s;\n", emit_reg_text(es, operand, ta), emit_slot_text(es, d, tb));
+            return words;
+
+        case OP_DUP:
+            if (es->depth < 1 || es->depth == EMIT_MAX_DEPTH) break;
+            d = es->depth;
+            es->stack[d] = es->stack[d - 1];
+            if (es->stack[d].kind == SYM_TEMP) {
+                emit(es, "    s%d = s%d;\n", d, d - 1);
+                emit_set_temp(es, d);
+            }
+            es->depth++;
+            return words;
+
+        case OP_POP:
+            if (es->depth < 1) break;
+            es->depth--;
+            return words;
+
+        /* Arithmetic */
+        case OP_ADD: if (emit_binary(es, "%s + %s")) return words; break;
+        case OP_SUB: if (emit_binary(es, "%s - %s")) return words; break;
+        case OP_MUL: if (emit_binary(es, "%s * %s")) return words; break;
+        case OP_MOD: if (emit_binary(es, "fmod(%s, %s)")) return words; break;
+        case OP_POW: if (emit_binary(es, "pow(%s, %s)")) return words; break;
+
+        case OP_DIV:
+            if (es->depth < 2) break;
+            sprintf(cond, "%s == 0.0", emit_slot_text(es, es->depth - 1, tb));
+            emit_slow_path(es, cond, pc);
+            emit_binary(es, "%s / %s");
+            return words;
+
+        case OP_NEG:      if (emit_unary(es, "-%s")) return words; break;
+        case OP_FUNC_INT: if (emit_unary(es, "floor(%s)")) return words; break;
+        case OP_FUNC_ABS: if (emit_unary(es, "fabs(%s)")) return words; break;
+        case OP_FUNC_SGN:
+            if (emit_unary(es, "(%s > 0.0) ? 1.0 : (%s < 0.0) ? -1.0 : 0.0")) return words;
+            break;
+
+        case OP_FUNC_SQR:
+            if (es->depth < 1) break;
+            sprintf(cond, "%s < 0.0", emit_slot_text(es, es->depth - 1, ta));
+            emit_slow_path(es, cond, pc);
+            emit_unary(es, "sqrt(%s)");
+            return words;
+
+        /* Comparisons and logic (numbers only; strings go to the interpreter) */
+        case OP_EQ: if (emit_binary(es, "(%s == %s) ? 1.0 : 0.0")) return words; break;
+        case OP_NE: if (emit_binary(es, "(%s != %s) ? 1.0 : 0.0")) return words; break;
+        case OP_LT: if (emit_binary(es, "(%s < %s) ? 1.0 : 0.0")) return words; break;
+        case OP_LE: if (emit_binary(es, "(%s <= %s) ? 1.0 : 0.0")) return words; break;
+        case OP_GT: if (emit_binary(es, "(%s > %s) ? 1.0 : 0.0")) return words; break;
+        case OP_GE: if (emit_binary(es, "(%s >= %s) ? 1.0 : 0.0")) return words; break;
+        case OP_AND:
+            if (emit_binary(es, "(%s != 0.0 && %s != 0.0) ? 1.0 : 0.0")) return words;
+            break;
+        case OP_OR:
+            if (emit_binary(es, "(%s != 0.0 || %s != 0.0) ? 1.0 : 0.0")) return words;
+            break;
+        case OP_NOT: if (emit_unary(es, "(%s == 0.0) ? 1.0 : 0.0")) return words; break;
+
+        /* Control flow */
+        case OP_JUMP:
+            emit_goto(es, operand);
+            return words;
+
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            if (es->depth < 1) break;
+            d = --es->depth;
+            emit_slot_text(es, d, ta);
+            emit_flush(es);
+            sprintf(cond, "%s %s 0.0", ta, inst->opcode == OP_JUMP_IF_FALSE ? "==" : "!=");
+            emit_branch(es, cond, operand);
+            return words;
+
+        case OP_JNLT: if (emit_compare_branch(es, "<", operand)) return words; break;
+        case OP_JNLE: if (emit_compare_branch(es, "<=", operand)) return words; break;
+        case OP_JNGT: if (emit_compare_branch(es, ">", operand)) return words; break;
+        case OP_JNGE: if (emit_compare_branch(es, ">=", operand)) return words; break;
+        case OP_JNEQ: if (emit_compare_branch(es, "==", operand)) return words; break;
+        case OP_JNNE: if (emit_compare_branch(es, "!=", operand)) return words; break;
+
+        case OP_GOSUB:
+            emit_flush(es);
+            emit(es, "    vm_call_push(vm, %lu);\n", (unsigned long)(pc + 1));
+            emit_goto(es, operand);
+            return words;
+
+        case OP_RETURN:
+            /* Back through dispatch to the label after the GOSUB */
+            emit_flush(es);
+            emit(es, "    SLOW(%lu);\n", (unsigned long)pc);
+            es->dead = 1;
+            return words;
+
+        /* Loops counted in integers by the VM run in doubles here */
+        case OP_FOR_INIT:
+        case OP_FOR_INIT_INT:
+            if (es->depth < 3 || operand >= prog->var_count) break;
+            es->depth -= 3;
+            d = es->depth;
+            emit_spill(es, operand, d);
+            emit(es, "    loop.var_slot = %u;\n", (unsigned)operand);
+            emit(es, "    loop.limit = %s;\n", emit_slot_text(es, d + 1, tb));
+            emit(es, "    loop.step = %s;\n", emit_slot_text(es, d + 2, tc));
+            emit(es, "    loop.loop_start_pc = %lu;\n", (unsigned long)(pc + 1));
+            emit(es, "    loop.int_loop = 0;\n");
+            emit(es, "    %s = %s;\n", emit_reg_text(es, operand, ta), emit_slot_text(es, d, tb));
+            emit(es, "    vm_for_push(vm, loop);\n");
+            /* Out of memory: halted, or at the TRAP line with the stacks cleared */
+            emit(es, "    if (!vm->running || vm->trap_triggered) {\n");
+            emit(es, "        vm->trap_triggered = 0;\n        goto dispatch;\n    }\n");
+            es->uses_for_init = 1;
+            return words;
+
+        case OP_FOR_NEXT:
+        case OP_FOR_NEXT_INT:
+            if (operand != 0xFFFF && operand >= prog->var_count) break;
+            emit_for_next(es, pc, operand);
+            return words;
+
+        /* Statically paired loops: limit and STEP live in v[] */
+        case OP_FOR_ENTER:
+            if (words != FOR_ENTER_WORDS || es->depth < 3 || operand >= prog->var_count ||
+                inst[1].operand + 1 >= prog->var_count) break;
+            es->depth -= 3;
+            d = es->depth;
+            emit_spill(es, inst[1].operand, d);
+            emit_spill(es, inst[1].operand + 1, d);
+            emit_spill(es, operand, d);
+            emit(es, "    %s = %s;\n", emit_reg_text(es, inst[1].operand, ta),
+                 emit_slot_text(es, d + 1, tb));
+            emit(es, "    %s = %s;\n", emit_reg_text(es, inst[1].operand + 1, ta),
+                 emit_slot_text(es, d + 2, tb));
+            emit(es, "    %s = %s;\n", emit_reg_text(es, operand, ta), emit_slot_text(es, d, tb));
+            return words;
+
+        case OP_FOR_LOOP:
+            if (words != FOR_LOOP_WORDS || operand >= prog->var_count ||
+                inst[1].operand + 1 >= prog->var_count) break;
+            emit_flush(es);
+            emit(es, "    %s += %s;\n", emit_reg_text(es, operand, ta),
+                 emit_reg_text(es, inst[1].operand + 1, tb));
+            sprintf(cond, "v[%lu] > 0 ? !(v[%lu] > v[%lu]) : !(v[%lu] < v[%lu])",
+                    (unsigned long)inst[1].operand + 1,
+                    (unsigned long)operand, (unsigned long)inst[1].operand,
+                    (unsigned long)operand, (unsigned long)inst[1].operand);
+            emit_branch(es, cond, inst[2].operand);
+            return words;
+
+        case OP_END:
+        case OP_STOP:
+            emit(es, "    vm->running = 0;\n    return;\n");
+            es->depth = 0;
+            es->ndepth = 0;
+            es->dead = 1;
+            return words;
+
+        case OP_NOP:
+            return words;
+
+        /* Numeric 1D arrays */
+        case OP_ARRAY_GET_1D:
+            if (es->depth < 1 || operand >= prog->var_count) break;
+            d = es->depth - 1;
+            emit_array_index(es, operand, emit_slot_text(es, d, ta), pc);
+            emit(es, "    s%d = a->u.data[i];\n", d);
+            emit_set_temp(es, d);
+            return words;
+
+        case OP_ARRAY_SET_1D:
+            if (es->depth < 2 || operand >= prog->var_count) break;
+            d = es->depth - 2;
+            emit_array_index(es, operand, emit_slot_text(es, d, ta), pc);
+            emit(es, "    a->u.data[i] = %s;\n", emit_slot_text(es, d + 1, tb));
+            es->depth -= 2;
+            return words;
+
+        /* Numeric arrays subscripted by proven loop variables: no checks */
+        case OP_ARRAY_LOAD_1D:
+        case OP_ARRAY_STORE_1D:
+        case OP_ARRAY_LOAD_2D:
+        case OP_ARRAY_STORE_2D:
+            if (op == OP_ARRAY_STORE_1D || op == OP_ARRAY_STORE_2D) {
+                if (es->depth < 1) break;
+            }
+            if (!emit_array_element(es, pc, element)) break;
+            if (op == OP_ARRAY_LOAD_1D || op == OP_ARRAY_LOAD_2D) {
+                d = emit_reserve(es);
+                emit(es, "    s%d = %s;\n", d, element);
+                emit_set_temp(es, d);
+                es->depth++;
+            } else {
+                d = es->depth - 1;
+                emit(es, "    %s = %s;\n", element, emit_slot_text(es, d, ta));
+                es->depth--;
+            }
+            return words;
+
+        /* Read-modify-write: the element is found once, checked as in */
+        /* vm_array_element(), and written back by OP_ARRAY_STORE_ADDR */
+        case OP_ARRAY_ADDR_2D:
+            if (operand >= prog->var_count || inst[1].operand >= prog->var_count ||
+                inst[2].operand >= prog->var_count) break;
+            d = emit_reserve(es);
+            emit(es, "    a = &vm->arrays[%lu];\n", (unsigned long)operand);
+            sprintf(element, "!a->u.data || (size_t)%s >= a->dim1 || (size_t)%s >= a->dim2",
+                    emit_reg_text(es, inst[1].operand, ta), emit_reg_text(es, inst[2].operand, tb));
+            emit_slow_path(es, element, pc);
+            emit(es, "    i = (size_t)%s * a->dim2 + (size_t)%s;\n", ta, tb);
+            emit(es, "    vm->addr_array = a;\n    vm->addr_index = i;\n");
+            emit(es, "    s%d = a->u.data[i];\n", d);
+            emit_set_temp(es, d);
+            es->depth++;
+            es->uses_array = 1;
+            return words;
+
+        case OP_ARRAY_STORE_ADDR:
+            if (es->depth < 1 || operand >= prog->var_count) break;
+            d = es->depth - 1;
+            sprintf(cond, "vm->addr_array != &vm->arrays[%lu]", (unsigned long)operand);
+            emit_slow_path(es, cond, pc);
+            emit(es, "    vm->addr_array->u.data[vm->addr_index] = %s;\n", emit_slot_text(es, d, ta));
+            es->depth--;
+            return words;
+
+        /* Superinstructions (operands from the words they cover) */
+        case OP_VAR_ADD_CONST_POP:
+        case OP_VAR_SUB_CONST_POP:
+            if (!fused || operand >= prog->var_count ||
+                inst[1].operand >= prog->const_count || inst[3].operand >= prog->var_count) break;
+            emit_spill(es, inst[3].operand, es->depth);
+            emit_format_double(tc, prog->const_pool[inst[1].operand]);
+            emit(es, "    %s = %s %c %s;\n", emit_reg_text(es, inst[3].operand, ta),
+                 emit_reg_text(es, operand, tb),
+                 inst->opcode == OP_VAR_ADD_CONST_POP ? '+' : '-', tc);
+            return emit_fused_end(es, pc, fused);
+
+        case OP_VAR_MUL_VAR:
+            if (!fused || operand >= prog->var_count || inst[1].operand >= prog->var_count) break;
+            d = emit_reserve(es);
+            emit(es, "    s%d = %s * %s;\n", d, emit_reg_text(es, operand, ta),
+                 emit_reg_text(es, inst[1].operand, tb));
+            emit_set_temp(es, d);
+            es->depth++;
+            return emit_fused_end(es, pc, fused);
+
+        case OP_VAR_ARRAY_GET_1D:
+            if (!fused || operand >= prog->var_count || inst[1].operand >= prog->var_count) break;
+            d = emit_reserve(es);
+            emit_array_index(es, inst[1].operand, emit_reg_text(es, operand, ta), pc);
+            emit(es, "    s%d = a->u.data[i];\n", d);
+            emit_set_temp(es, d);
+            es->depth++;
+            return emit_fused_end(es, pc, fused);
+
+        default:
+            if (OP_IS_REGISTER(inst->opcode) && emit_register(es, pc)) return words;
+            break;
+    }
+
+    /* Everything else runs in the interpreter */
+    emit_step(es, pc, pc + (fused ? fused : words));
+    return fused ? fused : words;
+}
+
+/* Translate the instruction at pc; returns the words to advance */
+static size_t emit_instruction(EmitState *es, size_t pc) {
+    uint8_t op = es->prog->code[pc].opcode;
+    int pops, pushes;
+    size_t words;
+
+    if (!OP_IS_NUMBER_STACK(op)) {
+        /* Nothing else reads the number stack: its entries go there first */
+        if (es->ndepth > 0 && op != OP_NOP) emit_flush(es);
+        return emit_translate(es, pc, op);
+    }
+
+    /* N_ instructions are their expression stack twins on the top ndepth */
+    /* entries; OP_N_BOX just hands the top one over */
+    switch (op) {
+        case OP_N_PUSH_CONST: case OP_N_PUSH_VAR: case OP_N_VAR_MUL_VAR:
+            pops = 0, pushes = 1;
+            break;
+        case OP_N_POP_VAR: case OP_N_BOX:
+            pops = 1, pushes = 0;
+            break;
+        case OP_N_NEG: case OP_N_NOT:
+            pops = 1, pushes = 1;
+            break;
+        default:
+            pops = 2, pushes = 1;
+            break;
+    }
+    if (es->ndepth < pops || (op == OP_N_BOX && es->ndepth != 1)) {
+        words = emit_fused_words(op);
+        if (!words || pc + words > es->prog->code_len) words = 1;
+        emit_step(es, pc, pc + words);
+        return words;
+    }
+
+    words = emit_translate(es, pc, emit_stack_opcode(op));
+    /* A fallback to the interpreter flushed everything */
+    es->ndepth = es->depth == 0 ? 0 : es->ndepth + pushes - pops;
+    return words;
+}
+
+/* Body of basset_run(): every instruction, in program order */
+static void emit_code(EmitState *es) {
+    const CompiledProgram *prog = es->prog;
+    size_t len = prog->code_len;
+    size_t pc, i, words;
+
+    es->depth = 0;
+    es->ndepth = 0;
+    es->dead = 0;
+    es->last_for_any = EMIT_NO_PC;
+    for (i = 0; i < prog->var_count; i++) es->last_for[i] = EMIT_NO_PC;
+
+    for (pc = 0; pc < len; pc += words) {
+        const Instruction *inst = &prog->code[pc];
+
+        /* FOR_NEXT guesses its loop from the closest FOR before it */
+        if ((inst->opcode == OP_FOR_INIT || inst->opcode == OP_FOR_INIT_INT) &&
+            inst->operand < prog->var_count) {
+            es->last_for[inst->operand] = pc + 1;
+            es->last_for_any = pc + 1;
+        }
+
+        if (es->flags[pc] & PC_LINE) {
+            emit(es, "\n    /* Line %u */\n", (unsigned)es->lines[pc]);
+        }
+        if (es->flags[pc] & PC_LABEL) {
+            if (!es->dead) emit_flush(es);
+            emit(es, "L%lu:\n", (unsigned long)pc);
+            es->depth = 0;
+            es->ndepth = 0;
+            es->dead = 0;
+        }
+
+        if (es->dead) {
+            words = emit_instruction_words(prog, pc);
+            continue;
+        }
+        words = emit_instruction(es, pc);
+    }
+
+    if (!es->dead) {
+        emit_flush(es);
+        emit(es, "    return;\n");
+    }
+}
+
+/* Tables */
+
+static void emit_tables(FILE *out, const CompiledProgram *prog) {
+    char num[48];
+    size_t i;
+
+    if (prog->code_len > 0) {
+        fprintf(out, "static Instruction program_code[] = {");
+        for (i = 0; i < prog->code_len; i++) {
+            fprintf(out, "%s{0x%02X, 0x%02X, %u}%s", (i % 4) ? " " : "\n    ",
+                    (unsigned)prog->code[i].opcode, (unsigned)prog->code[i].flags,
+                    (unsigned)prog->code[i].operand, (i + 1 < prog->code_len) ? "," : "");
+        }
+        fprintf(out, "\n};\n\n");
+    }
+
+    if (prog->const_count > 0) {
+        fprintf(out, "static double program_consts[] = {");
+        for (i = 0; i < prog->const_count; i++) {
+            emit_format_double(num, prog->const_pool[i]);
+            fprintf(out, "%s%s%s", (i % 4) ? " " : "\n    ", num,
+                    (i + 1 < prog->const_count) ? "," : "");
+        }
+        fprintf(out, "\n};\n\n");
+    }
+
+    if (prog->string_count > 0) {
+        fprintf(out, "static char *program_strings[] = {\n");
+        for (i = 0; i < prog->string_count; i++) {
+            fprintf(out, "    ");
+            emit_string_literal(out, prog->string_pool[i]);
+            fprintf(out, "%s\n", (i + 1 < prog->string_count) ? "," : "");
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    if (prog->var_count > 0) {
+        static const char *const types[] = {
+            "VAR_NUMERIC", "VAR_STRING", "VAR_ARRAY_1D", "VAR_ARRAY_2D"
+        };
+        fprintf(out, "static VariableInfo program_vars[] = {\n");
+        for (i = 0; i < prog->var_count; i++) {
+            const VariableInfo *var = &prog->var_table[i];
+            fprintf(out, "    {");
+            emit_string_literal(out, var->name);
+            fprintf(out, ", %u, %s, %u, %u}%s\n", (unsigned)var->slot,
+                    ((unsigned)var->type < 4) ? types[var->type] : "VAR_NUMERIC",
+                    (unsigned)var->array_dim1, (unsigned)var->array_dim2,
+                    (i + 1 < prog->var_count) ? "," : "");
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    if (prog->line_count > 0) {
+        fprintf(out, "static LineMapping program_lines[] = {");
+        for (i = 0; i < prog->line_count; i++) {
+            fprintf(out, "%s{%u, %lu}%s", (i % 6) ? " " : "\n    ",
+                    (unsigned)prog->line_map[i].line_number,
+                    (unsigned long)prog->line_map[i].pc_offset,
+                    (i + 1 < prog->line_count) ? "," : "");
+        }
+        fprintf(out, "\n};\n\n");
+    }
+
+    if (prog->data_numeric_count > 0) {
+        fprintf(out, "static double program_data_numbers[] = {");
+        for (i = 0; i < prog->data_numeric_count; i++) {
+            emit_format_double(num, prog->data_numeric_pool[i]);
+            fprintf(out, "%s%s%s", (i % 4) ? " " : "\n    ", num,
+                    (i + 1 < prog->data_numeric_count) ? "," : "");
+        }
+        fprintf(out, "\n};\n\n");
+    }
+
+    if (prog->data_string_count > 0) {
+        fprintf(out, "static char *program_data_strings[] = {\n");
+        for (i = 0; i < prog->data_string_count; i++) {
+            fprintf(out, "    ");
+            emit_string_literal(out, prog->data_string_pool[i]);
+            fprintf(out, "%s\n", (i + 1 < prog->data_string_count) ? "," : "");
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    if (prog->data_count > 0) {
+        static const char *const kinds[] = { "DATA_NUMERIC", "DATA_STRING", "DATA_NULL" };
+        fprintf(out, "static DataEntry program_data[] = {");
+        for (i = 0; i < prog->data_count; i++) {
+            const DataEntry *entry = &prog->data_entries[i];
+            fprintf(out, "%s{%s, {%lu}}%s", (i % 4) ? " " : "\n    ",
+                    ((unsigned)entry->type < 3) ? kinds[entry->type] : "DATA_NULL",
+                    (unsigned long)entry->value.numeric_idx,
+                    (i + 1 < prog->data_count) ? "," : "");
+        }
+        fprintf(out, "\n};\n\n");
+    }
+}
+
+/* Pointer to a table, or NULL when it was not emitted */
+static const char* emit_table(size_t count, const char *name) {
+    return count > 0 ? name : "NULL";
+}
+
+static void emit_main(FILE *out, const CompiledProgram *prog) {
+    fprintf(out, "int main(void)\n{\n");
+    fprintf(out, "    CompiledProgram program;\n");
+    fprintf(out, "    VMState *vm;\n\n");
+    fprintf(out, "    memset(&program, 0, sizeof(program));\n");
+    fprintf(out, "    program.code = %s;\n", emit_table(prog->code_len, "program_code"));
+    fprintf(out, "    program.code_len = %lu;\n", (unsigned long)prog->code_len);
+    fprintf(out, "    program.const_pool = %s;\n", emit_table(prog->const_count, "program_consts"));
+    fprintf(out, "    program.const_count = %lu;\n", (unsigned long)prog->const_count);
+    fprintf(out, "    program.string_pool = %s;\n", emit_table(prog->string_count, "program_strings"));
+    fprintf(out, "    program.string_count = %lu;\n", (unsigned long)prog->string_count);
+    fprintf(out, "    program.data_numeric_pool = %s;\n",
+            emit_table(prog->data_numeric_count, "program_data_numbers"));
+    fprintf(out, "    program.data_numeric_count = %lu;\n", (unsigned long)prog->data_numeric_count);
+    fprintf(out, "    program.data_string_pool = %s;\n",
+            emit_table(prog->data_string_count, "program_data_strings"));
+    fprintf(out, "    program.data_string_count = %lu;\n", (unsigned long)prog->data_string_count);
+    fprintf(out, "    program.data_entries = %s;\n", emit_table(prog->data_count, "program_data"));
+    fprintf(out, "    program.data_count = %lu;\n", (unsigned long)prog->data_count);
+    fprintf(out, "    program.var_table = %s;\n", emit_table(prog->var_count, "program_vars"));
+    fprintf(out, "    program.var_count = %lu;\n", (unsigned long)prog->var_count);
+    fprintf(out, "    program.line_map = %s;\n", emit_table(prog->line_count, "program_lines"));
+    fprintf(out, "    program.line_count = %lu;\n", (unsigned long)prog->line_count);
+    fprintf(out, "    program.isa = %u;\n", (unsigned)prog->isa);
+    fprintf(out, "    program.reg_temps = %u;\n\n", (unsigned)prog->reg_temps);
+    fprintf(out, "    vm = vm_init(&program);\n");
+    fprintf(out, "    if (!vm) {\n");
+    fprintf(out, "        fprintf(stderr, \"VM initialization failed\\n\");\n");
+    fprintf(out, "        return 1;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    vm_set_jit_threshold(vm, 0);  /* Already native */\n\n");
+    fprintf(out, "    basset_run(vm);\n\n");
+    fprintf(out, "    vm_free(vm);\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n");
+}
+
+int emit_c_program(FILE *out, const CompiledProgram *prog, const char *source_name) {
+    EmitState es;
+    size_t len = prog->code_len;
+    size_t pc;
+    int i;
+
+    memset(&es, 0, sizeof(es));
+    es.prog = prog;
+    es.flags = calloc(len + 1, 1);
+    es.lines = calloc(len + 1, sizeof(uint16_t));
+    es.last_for = malloc(sizeof(size_t) * (prog->var_count ? prog->var_count : 1));
+    if (!es.flags || !es.lines || !es.last_for) {
+        free(es.flags);
+        free(es.lines);
+        free(es.last_for);
+        return 0;
+    }
+
+    emit_find_labels(&es);
+
+    /* First pass: which locals basset_run() needs */
+    es.out = NULL;
+    emit_code(&es);
+
+    fprintf(out, "/* %s translated by basset_compile --emit-c */\n", source_name);
+    fprintf(out, "/* Build: cc -O2 -I<basset>/src <this file> <basset>/libbasset_rt.a -lm */\n");
+    fprintf(out, "#include <math.h>\n");
+    fprintf(out, "#include <stdio.h>\n");
+    fprintf(out, "#include <string.h>\n");
+    fprintf(out, "#include \"vm.h\"\n\n");
+
+    emit_tables(out, prog);
+
+    fprintf(out, "/* Run the instruction at pc in the interpreter; go on here if it falls through */\n");
+    fprintf(out, "#define STEP(at, next) { vm->pc = (at); vm_step(vm); \\\n");
+    fprintf(out, "    if (vm->pc != (next) || !vm->running) goto dispatch; }\n\n");
+    fprintf(out, "/* Run the instruction at pc in the interpreter and go wherever it leads */\n");
+    fprintf(out, "#define SLOW(at) { vm->pc = (at); vm_step(vm); goto dispatch; }\n\n");
+
+    fprintf(out, "static void basset_run(VMState *vm)\n{\n");
+    if (es.uses_v) fprintf(out, "    double *v = vm->num_vars;\n");
+    for (i = 0; i < EMIT_MAX_DEPTH; i++) {
+        if (es.temp_used[i]) fprintf(out, "    double s%d = 0.0;\n", i);
+    }
+    if (es.uses_array) fprintf(out, "    ArrayData *a;\n    size_t i;\n");
+    if (es.uses_for) fprintf(out, "    ForLoopState *f;\n");
+    if (es.uses_for_init) fprintf(out, "    ForLoopState loop;\n");
+    fprintf(out, "\n    goto dispatch;\n");
+
+    /* Second pass: the code */
+    es.out = out;
+    emit_code(&es);
+
+    fprintf(out, "\n    /* Resume at vm->pc: labeled pcs continue in C, others are stepped */\n");
+    fprintf(out, "dispatch:\n");
+    fprintf(out, "    while (vm->running && vm->pc < %lu) {\n", (unsigned long)len);
+    fprintf(out, "        switch (vm->pc) {\n");
+    for (pc = 0; pc < len; pc++) {
+        if (es.flags[pc] & PC_LABEL) {
+            fprintf(out, "            case %lu: goto L%lu;\n", (unsigned long)pc, (unsigned long)pc);
+        }
+    }
+    fprintf(out, "        }\n");
+    fprintf(out, "        vm_step(vm);\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "}\n\n");
+
+    emit_main(out, prog);
+
+    free(es.flags);
+    free(es.lines);
+    free(es.last_for);
+    return !ferror(out);
+}
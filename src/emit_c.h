@@ -0,0 +1,23 @@
+/* emit_c.h - Translate a compiled program to C */
+#ifndef EMIT_C_H
+#define EMIT_C_H
+
+#include "compiler.h"
+#include <stdio.h>
+
+/*
+ * basset_compile --emit-c writes a standalone C program instead of an .abc
+ * file: the program's tables, its code as one C function with a labeled
+ * block per BASIC line, and a main() that runs it. Strings, I/O, arrays and
+ * errors come from the VM runtime library (vm.c), so the output is built
+ * with
+ *
+ *   cc -O2 -Isrc prog.c libbasset_rt.a -lm
+ *
+ * and behaves like ./basset_vm prog.abc.
+ */
+
+/* Write prog as C to out; source_name only appears in comments. 1 on success */
+int emit_c_program(FILE *out, const CompiledProgram *prog, const char *source_name);
+
+#endif /* EMIT_C_H */
@@ -0,0 +1,437 @@
+/* ir.c - SSA form of straight-line numeric code */
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+
+IrBlock *ir_block_new(size_t var_count) {
+    IrBlock *ir = calloc(1, sizeof(IrBlock));
+    size_t k;
+
+    if (!ir) return NULL;
+    ir->var_count = var_count;
+    ir->value_capacity = 64;
+    ir->store_capacity = 16;
+    ir->values = malloc(sizeof(IrValue) * ir->value_capacity);
+    ir->stores = malloc(sizeof(IrStore) * ir->store_capacity);
+    ir->current = malloc(sizeof(uint32_t) * (var_count + 1));
+    ir->entry = malloc(sizeof(uint32_t) * (var_count + 1));
+    if (!ir->values || !ir->stores || !ir->current || !ir->entry) {
+        ir_block_free(ir);
+        return NULL;
+    }
+    for (k = 0; k < var_count; k++) ir->current[k] = ir->entry[k] = IR_NONE;
+    return ir;
+}
+
+void ir_block_free(IrBlock *ir) {
+    if (!ir) return;
+    free(ir->values);
+    free(ir->stores);
+    free(ir->current);
+    free(ir->entry);
+    free(ir);
+}
+
+/* Append a value; IR_NONE (and the block marked failed) if out of memory */
+static uint32_t ir_add_value(IrBlock *ir, IrOp op, uint32_t a, uint32_t b) {
+    IrValue *value;
+
+    if (ir->failed) return IR_NONE;
+    if (ir->value_count >= ir->value_capacity) {
+        IrValue *values = realloc(ir->values, sizeof(IrValue) * ir->value_capacity * 2);
+        if (!values) {
+            ir->failed = 1;
+            return IR_NONE;
+        }
+        ir->values = values;
+        ir->value_capacity *= 2;
+    }
+    value = &ir->values[ir->value_count];
+    memset(value, 0, sizeof(IrValue));
+    value->op = op;
+    value->a = a;
+    value->b = b;
+    value->var = IR_NONE;
+    return (uint32_t)ir->value_count++;
+}
+
+uint32_t ir_constant(IrBlock *ir, double constant) {
+    uint32_t v;
+    size_t i;
+
+    /* memcmp keeps -0 and 0 apart, as the constant pool does */
+    for (i = 0; i < ir->value_count; i++) {
+        if (ir->values[i].op == IR_CONST &&
+            memcmp(&ir->values[i].constant, &constant, sizeof(double)) == 0) {
+            return (uint32_t)i;
+        }
+    }
+    v = ir_add_value(ir, IR_CONST, IR_NONE, IR_NONE);
+    if (v != IR_NONE) ir->values[v].constant = constant;
+    return v;
+}
+
+uint32_t ir_read(IrBlock *ir, uint32_t var) {
+    uint32_t v;
+
+    if (ir->failed || var >= ir->var_count) {
+        ir->failed = 1;
+        return IR_NONE;
+    }
+    if (ir->current[var] != IR_NONE) return ir->current[var];
+
+    v = ir_add_value(ir, IR_ENTRY, IR_NONE, IR_NONE);
+    if (v == IR_NONE) return v;
+    ir->values[v].var = var;
+    ir->entry[var] = ir->current[var] = v;
+    return v;
+}
+
+/* True if a op b == b op a */
+static int ir_commutative(IrOp op) {
+    return op == IR_ADD || op == IR_MUL || op == IR_EQ || op == IR_NE ||
+           op == IR_AND || op == IR_OR;
+}
+
+uint32_t ir_operation(IrBlock *ir, IrOp op, uint32_t a, uint32_t b) {
+    const IrValue *divisor;
+    uint32_t v;
+    size_t i;
+
+    if (ir->failed || a == IR_NONE || (op < IR_NEG && b == IR_NONE)) {
+        ir->failed = 1;
+        return IR_NONE;
+    }
+    if (op >= IR_NEG) b = IR_NONE;
+
+    /* Value numbering: the same operation on the same values, in either */
+    /* order if it commutes; a new value keeps the order it was written in */
+    for (i = 0; i < ir->value_count; i++) {
+        const IrValue *value = &ir->values[i];
+
+        if (value->op != op) continue;
+        if (value->a == a && value->b == b) return (uint32_t)i;
+        if (ir_commutative(op) && value->a == b && value->b == a) return (uint32_t)i;
+    }
+
+    v = ir_add_value(ir, op, a, b);
+    if (v == IR_NONE) return v;
+    ir->values[v].may_fail = ir->values[a].may_fail || (b != IR_NONE && ir->values[b].may_fail);
+    if (op == IR_DIV) {
+        divisor = &ir->values[b];
+        if (divisor->op != IR_CONST || divisor->constant == 0) ir->values[v].may_fail = 1;
+    }
+    return v;
+}
+
+void ir_write(IrBlock *ir, uint32_t var, uint32_t value, uint32_t statement) {
+    IrStore *store;
+
+    if (ir->failed || value == IR_NONE || var >= ir->var_count) {
+        ir->failed = 1;
+        return;
+    }
+    if (ir->store_count >= ir->store_capacity) {
+        IrStore *stores = realloc(ir->stores, sizeof(IrStore) * ir->store_capacity * 2);
+        if (!stores) {
+            ir->failed = 1;
+            return;
+        }
+        ir->stores = stores;
+        ir->store_capacity *= 2;
+    }
+    store = &ir->stores[ir->store_count++];
+    store->var = var;
+    store->value = value;
+    store->statement = statement;
+    store->live = 0;
+    ir->current[var] = value;
+}
+
+/* True for an operation on constants and entry values only, which is */
+/* recomputed at each use rather than kept in a temporary */
+static int ir_cheap(const IrBlock *ir, const IrValue *value) {
+    if (value->op == IR_CONST || value->op == IR_ENTRY) return 0;
+    if (ir->values[value->a].op != IR_CONST && ir->values[value->a].op != IR_ENTRY) return 0;
+    if (value->b == IR_NONE) return 1;
+    return ir->values[value->b].op == IR_CONST || ir->values[value->b].op == IR_ENTRY;
+}
+
+void ir_optimize(IrBlock *ir) {
+    uint8_t *seen;
+    size_t i;
+
+    if (ir->failed) return;
+    seen = calloc(ir->var_count + 1, 1);
+    if (!seen) {
+        ir->failed = 1;
+        return;
+    }
+
+    /* The last store to each variable is live unless it restores the */
+    /* entry value; earlier ones only if their value may fail */
+    i = ir->store_count;
+    while (i-- > 0) {
+        IrStore *store = &ir->stores[i];
+
+        if (!seen[store->var]) {
+            seen[store->var] = 1;
+            store->live = (store->value != ir->entry[store->var]);
+        }
+        if (ir->values[store->value].may_fail) store->live = 1;
+    }
+    free(seen);
+}
+
+/*
+ * Code generation runs twice. The first run counts the reads of each
+ * value, keeping every value it computes as if it were needed again; the
+ * second, with remaining[] set from those counts, keeps a value only while
+ * reads of it are still to come. Whether a value is held when it is read
+ * does not depend on the counts, so both runs read the same values.
+ */
+typedef struct {
+    const IrBlock *ir;
+    IrCode *code;
+    uint32_t *reads;             /* First run: reads of each value so far */
+    uint32_t *remaining;         /* Reads of each value still to come */
+    uint32_t *holder;            /* A variable holding each value, or IR_NONE */
+    uint32_t *holds;             /* Value in each variable and temporary */
+    size_t holds_capacity;
+    uint32_t statement;
+    int failed;
+} IrGenerator;
+
+static uint32_t ir_add_node(IrGenerator *gen, IrOp op, uint32_t a, uint32_t b) {
+    IrCode *code = gen->code;
+    IrNode *node;
+
+    if (gen->failed) return IR_NONE;
+    if (code->node_count >= code->node_capacity) {
+        IrNode *nodes = realloc(code->nodes, sizeof(IrNode) * code->node_capacity * 2);
+        if (!nodes) {
+            gen->failed = 1;
+            return IR_NONE;
+        }
+        code->nodes = nodes;
+        code->node_capacity *= 2;
+    }
+    node = &code->nodes[code->node_count];
+    node->op = op;
+    node->a = a;
+    node->b = b;
+    node->constant = 0;
+    node->var = IR_NONE;
+    return (uint32_t)code->node_count++;
+}
+
+static uint32_t ir_var_node(IrGenerator *gen, uint32_t var) {
+    uint32_t node = ir_add_node(gen, IR_ENTRY, IR_NONE, IR_NONE);
+    if (node != IR_NONE) gen->code->nodes[node].var = var;
+    return node;
+}
+
+static void ir_add_assign(IrGenerator *gen, uint32_t var, uint32_t root) {
+    IrCode *code = gen->code;
+    IrAssign *assign;
+
+    if (gen->failed || root == IR_NONE) {
+        gen->failed = 1;
+        return;
+    }
+    if (code->assign_count >= code->assign_capacity) {
+        IrAssign *assigns = realloc(code->assigns, sizeof(IrAssign) * code->assign_capacity * 2);
+        if (!assigns) {
+            gen->failed = 1;
+            return;
+        }
+        code->assigns = assigns;
+        code->assign_capacity *= 2;
+    }
+    assign = &code->assigns[code->assign_count++];
+    assign->var = var;
+    assign->root = root;
+    assign->statement = gen->statement;
+}
+
+/* A fresh temporary variable, holding nothing yet */
+static uint32_t ir_new_temp(IrGenerator *gen) {
+    uint32_t var = (uint32_t)gen->ir->var_count + gen->code->temp_count;
+
+    if (var >= gen->holds_capacity) {
+        uint32_t *holds = realloc(gen->holds, sizeof(uint32_t) * gen->holds_capacity * 2);
+        if (!holds) {
+            gen->failed = 1;
+            return var;
+        }
+        gen->holds = holds;
+        gen->holds_capacity *= 2;
+    }
+    gen->holds[var] = IR_NONE;
+    gen->code->temp_count++;
+    return var;
+}
+
+/* Note a read of v */
+static void ir_take(IrGenerator *gen, uint32_t v) {
+    if (gen->reads) {
+        gen->reads[v]++;
+    } else if (gen->remaining[v] > 0) {
+        gen->remaining[v]--;
+    }
+}
+
+static uint32_t ir_render(IrGenerator *gen, uint32_t v);
+
+/* The tree computing v from its operands */
+static uint32_t ir_render_operation(IrGenerator *gen, uint32_t v) {
+    const IrValue *value = &gen->ir->values[v];
+    uint32_t a = ir_render(gen, value->a);
+    uint32_t b = (value->b != IR_NONE) ? ir_render(gen, value->b) : IR_NONE;
+
+    return ir_add_node(gen, value->op, a, b);
+}
+
+/* A tree reading v, keeping it in a temporary if it is needed again */
+static uint32_t ir_render(IrGenerator *gen, uint32_t v) {
+    const IrValue *value = &gen->ir->values[v];
+    uint32_t node, temp;
+
+    ir_take(gen, v);
+    if (value->op == IR_CONST) {
+        node = ir_add_node(gen, IR_CONST, IR_NONE, IR_NONE);
+        if (node != IR_NONE) gen->code->nodes[node].constant = value->constant;
+        return node;
+    }
+    if (gen->holder[v] != IR_NONE) return ir_var_node(gen, gen->holder[v]);
+
+    node = ir_render_operation(gen, v);
+    if (gen->remaining[v] == 0 || ir_cheap(gen->ir, value)) return node;
+
+    temp = ir_new_temp(gen);
+    ir_add_assign(gen, temp, node);
+    if (gen->failed) return IR_NONE;
+    gen->holds[temp] = v;
+    gen->holder[v] = temp;
+    return ir_var_node(gen, temp);
+}
+
+/* Before var is assigned: move the record of what it holds elsewhere, */
+/* copying it to a temporary if no other variable has it */
+static void ir_release(IrGenerator *gen, uint32_t var) {
+    uint32_t v = gen->holds[var];
+    uint32_t other, temp;
+    size_t limit = gen->ir->var_count + gen->code->temp_count;
+
+    gen->holds[var] = IR_NONE;
+    if (v == IR_NONE || gen->holder[v] != var) return;
+
+    gen->holder[v] = IR_NONE;
+    for (other = 0; other < limit; other++) {
+        if (gen->holds[other] == v) {
+            gen->holder[v] = other;
+            return;
+        }
+    }
+    if (gen->remaining[v] == 0) return;
+
+    temp = ir_new_temp(gen);
+    ir_add_assign(gen, temp, ir_var_node(gen, var));
+    if (gen->failed) return;
+    gen->holds[temp] = v;
+    gen->holder[v] = temp;
+}
+
+/* One run over the live stores into a new gen->code */
+static int ir_run(IrGenerator *gen) {
+    const IrBlock *ir = gen->ir;
+    IrCode *code;
+    size_t i;
+
+    gen->code = code = calloc(1, sizeof(IrCode));
+    if (!code) return 0;
+    code->node_capacity = 64;
+    code->assign_capacity = 16;
+    code->nodes = malloc(sizeof(IrNode) * code->node_capacity);
+    code->assigns = malloc(sizeof(IrAssign) * code->assign_capacity);
+    if (!code->nodes || !code->assigns) return 0;
+
+    for (i = 0; i < ir->value_count; i++) gen->holder[i] = IR_NONE;
+    for (i = 0; i < ir->var_count; i++) {
+        gen->holds[i] = ir->entry[i];
+        if (ir->entry[i] != IR_NONE) gen->holder[ir->entry[i]] = (uint32_t)i;
+    }
+
+    for (i = 0; i < ir->store_count && !gen->failed; i++) {
+        const IrStore *store = &ir->stores[i];
+        const IrValue *value = &ir->values[store->value];
+        uint32_t root;
+
+        if (!store->live) continue;
+        gen->statement = store->statement;
+
+        /* Already there: X=X, or the same value stored again */
+        if (gen->holds[store->var] == store->value) {
+            ir_take(gen, store->value);
+            continue;
+        }
+
+        /* A value not held anywhere is computed into the variable itself */
+        if (value->op != IR_CONST && gen->holder[store->value] == IR_NONE) {
+            ir_take(gen, store->value);
+            root = ir_render_operation(gen, store->value);
+        } else {
+            root = ir_render(gen, store->value);
+        }
+        ir_release(gen, store->var);
+        ir_add_assign(gen, store->var, root);
+        gen->holds[store->var] = store->value;
+        if (value->op != IR_CONST && gen->holder[store->value] == IR_NONE) {
+            gen->holder[store->value] = store->var;
+        }
+    }
+    return !gen->failed;
+}
+
+IrCode *ir_generate(const IrBlock *ir) {
+    IrGenerator gen;
+    IrCode *code = NULL;
+    size_t i;
+
+    if (ir->failed) return NULL;
+    memset(&gen, 0, sizeof(gen));
+    gen.ir = ir;
+    gen.holds_capacity = ir->var_count + 16;
+    gen.holds = malloc(sizeof(uint32_t) * gen.holds_capacity);
+    gen.reads = calloc(ir->value_count + 1, sizeof(uint32_t));
+    gen.remaining = malloc(sizeof(uint32_t) * (ir->value_count + 1));
+    gen.holder = malloc(sizeof(uint32_t) * (ir->value_count + 1));
+    if (!gen.holds || !gen.reads || !gen.remaining || !gen.holder) goto error;
+
+    /* Counting run */
+    for (i = 0; i < ir->value_count; i++) gen.remaining[i] = IR_NONE;
+    if (!ir_run(&gen)) goto error;
+    ir_code_free(gen.code);
+
+    memcpy(gen.remaining, gen.reads, sizeof(uint32_t) * ir->value_count);
+    free(gen.reads);
+    gen.reads = NULL;
+    if (!ir_run(&gen)) goto error;
+    code = gen.code;
+    gen.code = NULL;
+
+error:
+    ir_code_free(gen.code);
+    free(gen.holds);
+    free(gen.reads);
+    free(gen.remaining);
+    free(gen.holder);
+    return code;
+}
+
+void ir_code_free(IrCode *code) {
+    if (!code) return;
+    free(code->nodes);
+    free(code->assigns);
+    free(code);
+}
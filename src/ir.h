@@ -0,0 +1,118 @@
+/* ir.h - SSA form of straight-line numeric code */
+#ifndef IR_H
+#define IR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * With -O the compiler lowers each run of numeric assignments that can
+ * only be entered at its top (see compiler_lower_blocks() in compiler.c)
+ * into an IrBlock, a basic block in SSA form: every value is defined once,
+ * by a constant, a variable's value on entry to the block or an operation
+ * on earlier values, and each assignment just records which value a
+ * variable now holds. Building the block already does two optimizations:
+ *
+ *   - global value numbering: ir_operation() returns the existing value
+ *     for an operation it has seen on the same operands, so A*B+C is
+ *     computed once however many statements use it;
+ *   - copy propagation: ir_read() of a variable returns the value last
+ *     assigned to it, so after T=X a use of T is a use of X.
+ *
+ * ir_optimize() then removes dead stores: only the last assignment to a
+ * variable in the block is kept, and none at all if the variable ends up
+ * with its entry value (X=Y: Y=X leaves Y alone). A store whose value can
+ * raise an error (division by a value that may be 0) is always kept, so
+ * the error is not lost.
+ *
+ * ir_generate() turns the block back into assignments to emit, whose
+ * right-hand sides are trees over constants and variables. A value used
+ * again later is read from a variable that already holds it, or kept in a
+ * temporary variable when nothing does; a variable about to be assigned
+ * is first copied to a temporary if its old value is still needed.
+ * Values of a single operation on constants and variables are cheaper to
+ * recompute than to keep, and are computed at each use.
+ */
+
+#define IR_NONE 0xFFFFFFFFu
+
+typedef enum {
+    IR_CONST,                    /* constant */
+    IR_ENTRY,                    /* var's value on entry (in IrNode: var) */
+    IR_ADD, IR_SUB, IR_MUL, IR_DIV, IR_POW,
+    IR_EQ, IR_NE, IR_LT, IR_LE, IR_GT, IR_GE,
+    IR_AND, IR_OR,
+    IR_NEG, IR_NOT               /* Unary: operand a only */
+} IrOp;
+
+typedef struct {
+    IrOp op;
+    uint32_t a, b;               /* Operand values, or IR_NONE */
+    double constant;             /* IR_CONST */
+    uint32_t var;                /* IR_ENTRY */
+    uint8_t may_fail;            /* Evaluating it can raise an error */
+} IrValue;
+
+typedef struct {
+    uint32_t var;
+    uint32_t value;
+    uint32_t statement;          /* The caller's index for its statement */
+    uint8_t live;                /* Kept by dead-store elimination */
+} IrStore;
+
+typedef struct {
+    IrValue *values;
+    size_t value_count;
+    size_t value_capacity;
+    IrStore *stores;             /* In program order */
+    size_t store_count;
+    size_t store_capacity;
+    uint32_t *current;           /* Value each variable holds, or IR_NONE */
+    uint32_t *entry;             /* IR_ENTRY value of each variable */
+    size_t var_count;
+    int failed;                  /* Out of memory; the block is unusable */
+} IrBlock;
+
+/* Right-hand side tree: IR_CONST, IR_ENTRY (read var) or an operation */
+typedef struct {
+    IrOp op;
+    uint32_t a, b;               /* Operand nodes, or IR_NONE */
+    double constant;
+    uint32_t var;
+} IrNode;
+
+/* var = nodes[root]; a var of at least the block's var_count is */
+/* temporary number var - var_count */
+typedef struct {
+    uint32_t var;
+    uint32_t root;
+    uint32_t statement;
+} IrAssign;
+
+typedef struct {
+    IrNode *nodes;
+    size_t node_count;
+    size_t node_capacity;
+    IrAssign *assigns;           /* In the order to execute them */
+    size_t assign_count;
+    size_t assign_capacity;
+    uint32_t temp_count;
+} IrCode;
+
+/* A block over variables 0..var_count-1; NULL if out of memory */
+IrBlock *ir_block_new(size_t var_count);
+void ir_block_free(IrBlock *ir);
+
+uint32_t ir_constant(IrBlock *ir, double value);
+uint32_t ir_read(IrBlock *ir, uint32_t var);
+uint32_t ir_operation(IrBlock *ir, IrOp op, uint32_t a, uint32_t b);
+void ir_write(IrBlock *ir, uint32_t var, uint32_t value, uint32_t statement);
+
+/* Dead-store elimination: marks the stores to keep */
+void ir_optimize(IrBlock *ir);
+
+/* Assignments computing the block's live stores; NULL if out of memory */
+IrCode *ir_generate(const IrBlock *ir);
+void ir_code_free(IrCode *code);
+
+#endif /* IR_H */
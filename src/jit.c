@@ -0,0 +1,2268 @@
+/* jit.c - Optional x86-64 template JIT for hot line ranges */
+#define _DEFAULT_SOURCE  /* MAP_ANONYMOUS */
+#include "jit.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(BASSET_JIT) && defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define JIT_X86_64 1
+#endif
+
+#ifdef JIT_X86_64
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/*
+ * Code generation
+ *
+ * A compiled region is a function void region(VMState *vm) covering the
+ * pcs [start, end). Each instruction is a fixed machine-code template:
+ *
+ *   - register instructions (ISA_REG), OP_JUMP, OP_NOP and the
+ *     VAR_*_CONST_POP superinstructions are plain SSE2 code on the
+ *     register file, held in rbx (vm->num_vars);
+ *   - stack, array, loop and subroutine instructions call one of the
+ *     jit_* helpers below with rdi = vm (kept in r12) and rsi = the
+ *     decoded instruction.
+ *
+ * Native code never raises BASIC errors. A helper that meets anything
+ * unusual (a string where a number was expected, an index out of range,
+ * an undimensioned array, ...) returns 0 without side effects, and so does
+ * OP_R_DIV with a zero divisor; the region then stores that instruction's
+ * pc in vm->pc and returns, so the interpreter executes it with its normal
+ * error and TRAP handling. Branches to pcs outside the region, and the
+ * first instruction the region does not cover, leave the same way.
+ */
+
+/* Helper result: 0 = let the interpreter run this instruction, */
+/* 1 = continue with the next instruction, 2 = branch taken */
+typedef int (*JitHelper)(VMState *vm, const DecodedInstruction *inst);
+
+/* Native entry point of a region */
+typedef void (*JitCode)(VMState *vm);
+
+/* Compiled line range or trace */
+typedef struct JitRegion {
+    unsigned char *code;         /* Executable mapping */
+    size_t code_size;            /* Mapping size */
+    size_t entry;                /* Offset of the entry point in code */
+    void **table;                /* Line range: native address per pc in [start, end) */
+    uint32_t start, end;
+    struct JitRegion *next;      /* All regions, for vm_jit_free() */
+} JitRegion;
+
+struct JitState {
+    unsigned threshold;          /* Entry point visits before compiling */
+    uint32_t *hits;              /* Visits per entry point pc */
+    JitRegion **regions;         /* Compiled line range per entry point pc */
+    JitRegion **traces;          /* Compiled trace per loop anchor pc */
+    uint8_t *anchors;            /* 1 if pc is a loop anchor (see Traces) */
+    uint8_t *aborts;             /* Abandoned recordings per anchor */
+    JitRegion *all;
+
+    /* Trace being recorded */
+    uint8_t recording;
+    uint32_t rec_anchor;
+    uint32_t *rec_pcs;           /* JIT_MAX_TRACE entries */
+    size_t rec_len;
+};
+
+/* Fixup kinds for rel32 branch fields */
+#define FIX_PC        0          /* Native code for a pc (exit if none) */
+#define FIX_EXIT      1          /* Store pc into vm->pc and return */
+#define FIX_DISPATCH  2          /* Jump to the native code for vm->pc */
+
+typedef struct {
+    size_t at;                   /* Offset of the rel32 field */
+    uint8_t kind;
+    uint32_t pc;
+} JitFixup;
+
+typedef struct {
+    unsigned char *buf;
+    size_t len, cap;
+    JitFixup *fixups;
+    size_t fixup_count, fixup_cap;
+    int failed;
+} JitBuffer;
+
+/* ------------------------------------------------------------------ */
+/* Helpers called from native code                                     */
+/* ------------------------------------------------------------------ */
+
+#define JIT_TOP(k) (vm->stack[vm->stack_top - (k)])
+
+/* 1 if the top n stack entries are all numbers */
+static int jit_top_numbers(VMState *vm, size_t n) {
+    size_t i;
+    if (vm->stack_top < n) return 0;
+    for (i = 1; i <= n; i++) {
+        if (!VALUE_IS_NUMBER(JIT_TOP(i))) return 0;
+    }
+    return 1;
+}
+
+/* 1 if array is a dimensioned numeric array holding index idx */
+static int jit_array_ok(const ArrayData *array, size_t idx) {
+    return array && !array->is_string && array->u.data && idx < array->dim1;
+}
+
+static int jit_push_const(VMState *vm, const DecodedInstruction *inst) {
+    vm_push_number(vm, inst->imm.number);
+    return 1;
+}
+
+static int jit_push_var(VMState *vm, const DecodedInstruction *inst) {
+    vm_push_number(vm, vm->num_vars[inst->operand]);
+    return 1;
+}
+
+static int jit_pop_var(VMState *vm, const DecodedInstruction *inst) {
+    if (!jit_top_numbers(vm, 1)) return 0;
+    vm->num_vars[inst->operand] = VALUE_NUMBER(vm->stack[--vm->stack_top]);
+    return 1;
+}
+
+static int jit_add(VMState *vm, const DecodedInstruction *inst) {
+    (void)inst;
+    if (!jit_top_numbers(vm, 2)) return 0;
+    vm->stack_top--;
+    VALUE_NUMBER(JIT_TOP(1)) += VALUE_NUMBER(vm->stack[vm->stack_top]);
+    return 1;
+}
+
+static int jit_sub(VMState *vm, const DecodedInstruction *inst) {
+    (void)inst;
+    if (!jit_top_numbers(vm, 2)) return 0;
+    vm->stack_top--;
+    VALUE_NUMBER(JIT_TOP(1)) -= VALUE_NUMBER(vm->stack[vm->stack_top]);
+    return 1;
+}
+
+static int jit_mul(VMState *vm, const DecodedInstruction *inst) {
+    (void)inst;
+    if (!jit_top_numbers(vm, 2)) return 0;
+    vm->stack_top--;
+    VALUE_NUMBER(JIT_TOP(1)) *= VALUE_NUMBER(vm->stack[vm->stack_top]);
+    return 1;
+}
+
+/* A zero divisor is left to the interpreter, which raises the error */
+static int jit_div(VMState *vm, const DecodedInstruction *inst) {
+    (void)inst;
+    if (!jit_top_numbers(vm, 2) || VALUE_NUMBER(JIT_TOP(1)) == 0.0) return 0;
+    vm->stack_top--;
+    VALUE_NUMBER(JIT_TOP(1)) /= VALUE_NUMBER(vm->stack[vm->stack_top]);
+    return 1;
+}
+
+static int jit_neg(VMState *vm, const DecodedInstruction *inst) {
+    (void)inst;
+    if (!jit_top_numbers(vm, 1)) return 0;
+    VALUE_NUMBER(JIT_TOP(1)) = -VALUE_NUMBER(JIT_TOP(1));
+    return 1;
+}
+
+static int jit_func_int(VMState *vm, const DecodedInstruction *inst) {
+    (void)inst;
+    if (!jit_top_numbers(vm, 1)) return 0;
+    VALUE_NUMBER(JIT_TOP(1)) = floor(VALUE_NUMBER(JIT_TOP(1)));
+    return 1;
+}
+
+/* Numeric comparison (OP_EQ..OP_GE), pushing 1 or 0 */
+static int jit_compare(VMState *vm, const DecodedInstruction *inst) {
+    double a, b;
+    int result;
+
+    if (!jit_top_numbers(vm, 2)) return 0;
+    a = VALUE_NUMBER(JIT_TOP(2));
+    b = VALUE_NUMBER(JIT_TOP(1));
+    vm->stack_top--;
+
+    switch (inst->opcode) {
+        case OP_EQ: result = a == b; break;
+        case OP_NE: result = a != b; break;
+        case OP_LT: result = a < b; break;
+        case OP_LE: result = a <= b; break;
+        case OP_GT: result = a > b; break;
+        default:    result = a >= b; break;
+    }
+    VALUE_NUMBER(JIT_TOP(1)) = result ? 1.0 : 0.0;
+    return 1;
+}
+
+static int jit_r_push(VMState *vm, const DecodedInstruction *inst) {
+    vm_push_number(vm, vm->num_vars[inst->operand]);
+    return 1;
+}
+
+static int jit_r_pop(VMState *vm, const DecodedInstruction *inst) {
+    if (!jit_top_numbers(vm, 1)) return 0;
+    vm->num_vars[inst->operand] = VALUE_NUMBER(vm->stack[--vm->stack_top]);
+    return 1;
+}
+
+static int jit_r_pow(VMState *vm, const DecodedInstruction *inst) {
+    vm->num_vars[inst->operand] = pow(vm->num_vars[inst[1].operand],
+                                      vm->num_vars[inst[2].operand]);
+    return 1;
+}
+
+static int jit_var_mul_var(VMState *vm, const DecodedInstruction *inst) {
+    vm_push_number(vm, vm->num_vars[inst->operand] * vm->num_vars[inst[1].operand]);
+    return 1;
+}
+
+/* Number stack instructions; a short stack is left to the interpreter */
+#define JIT_DBL(k) (vm->num_stack[vm->num_top - (k)])
+
+static int jit_n_push_const(VMState *vm, const DecodedInstruction *inst) {
+    vm_num_push(vm, inst->imm.number);
+    return 1;
+}
+
+static int jit_n_push_var(VMState *vm, const DecodedInstruction *inst) {
+    vm_num_push(vm, vm->num_vars[inst->operand]);
+    return 1;
+}
+
+static int jit_n_pop_var(VMState *vm, const DecodedInstruction *inst) {
+    if (vm->num_top < 1) return 0;
+    vm->num_vars[inst->operand] = vm->num_stack[--vm->num_top];
+    return 1;
+}
+
+static int jit_n_var_mul_var(VMState *vm, const DecodedInstruction *inst) {
+    vm_num_push(vm, vm->num_vars[inst->operand] * vm->num_vars[inst[1].operand]);
+    return 1;
+}
+
+/* OP_N_ADD..OP_N_OR other than OP_N_NEG; a zero divisor is left to the */
+/* interpreter, which raises the error */
+static int jit_n_binary(VMState *vm, const DecodedInstruction *inst) {
+    double a, b, result;
+
+    if (vm->num_top < 2) return 0;
+    a = JIT_DBL(2);
+    b = JIT_DBL(1);
+    switch (inst->opcode) {
+        case OP_N_ADD: result = a + b; break;
+        case OP_N_SUB: result = a - b; break;
+        case OP_N_MUL: result = a * b; break;
+        case OP_N_DIV:
+            if (b == 0.0) return 0;
+            result = a / b;
+            break;
+        case OP_N_POW: result = pow(a, b); break;
+        case OP_N_EQ:  result = (a == b) ? 1.0 : 0.0; break;
+        case OP_N_NE:  result = (a != b) ? 1.0 : 0.0; break;
+        case OP_N_LT:  result = (a < b) ? 1.0 : 0.0; break;
+        case OP_N_LE:  result = (a <= b) ? 1.0 : 0.0; break;
+        case OP_N_GT:  result = (a > b) ? 1.0 : 0.0; break;
+        case OP_N_GE:  result = (a >= b) ? 1.0 : 0.0; break;
+        case OP_N_AND: result = (a != 0.0 && b != 0.0) ? 1.0 : 0.0; break;
+        default:       result = (a != 0.0 || b != 0.0) ? 1.0 : 0.0; break;
+    }
+    vm->num_top--;
+    JIT_DBL(1) = result;
+    return 1;
+}
+
+static int jit_n_unary(VMState *vm, const DecodedInstruction *inst) {
+    if (vm->num_top < 1) return 0;
+    if (inst->opcode == OP_N_NEG) {
+        JIT_DBL(1) = -JIT_DBL(1);
+    } else {
+        JIT_DBL(1) = (JIT_DBL(1) == 0.0) ? 1.0 : 0.0;
+    }
+    return 1;
+}
+
+static int jit_n_box(VMState *vm, const DecodedInstruction *inst) {
+    (void)inst;
+    if (vm->num_top < 1) return 0;
+    vm_push_number(vm, vm->num_stack[--vm->num_top]);
+    return 1;
+}
+
+static int jit_array_get_1d(VMState *vm, const DecodedInstruction *inst) {
+    size_t idx;
+    if (!jit_top_numbers(vm, 1)) return 0;
+    idx = (size_t)VALUE_NUMBER(JIT_TOP(1));
+    if (!jit_array_ok(inst->imm.array, idx)) return 0;
+    VALUE_NUMBER(JIT_TOP(1)) = inst->imm.array->u.data[idx];
+    return 1;
+}
+
+static int jit_var_array_get_1d(VMState *vm, const DecodedInstruction *inst) {
+    size_t idx = (size_t)vm->num_vars[inst->operand];
+    if (!jit_array_ok(inst[1].imm.array, idx)) return 0;
+    vm_push_number(vm, inst[1].imm.array->u.data[idx]);
+    return 1;
+}
+
+static int jit_array_set_1d(VMState *vm, const DecodedInstruction *inst) {
+    size_t idx;
+    if (!jit_top_numbers(vm, 2)) return 0;
+    idx = (size_t)VALUE_NUMBER(JIT_TOP(2));
+    if (!jit_array_ok(inst->imm.array, idx)) return 0;
+    inst->imm.array->u.data[idx] = VALUE_NUMBER(JIT_TOP(1));
+    vm->stack_top -= 2;
+    return 1;
+}
+
+/* OP_ARRAY_LOAD/STORE_*: the subscripts are variables named by the */
+/* operand words; dims is 1 or 2 */
+static double *jit_array_element(VMState *vm, const DecodedInstruction *inst, int dims) {
+    const ArrayData *array = inst->imm.array;
+    size_t row = (size_t)vm->num_vars[inst[1].operand];
+    size_t col = (dims == 2) ? (size_t)vm->num_vars[inst[2].operand] : 0;
+    
+    if (!array || array->is_string || !array->u.data || row >= array->dim1 ||
+        (dims == 2 && col >= array->dim2)) {
+        return NULL;
+    }
+    return &array->u.data[(dims == 2) ? row * array->dim2 + col : row];
+}
+
+static int jit_array_load(VMState *vm, const DecodedInstruction *inst) {
+    double *element = jit_array_element(vm, inst, (inst->opcode == OP_ARRAY_LOAD_2D) ? 2 : 1);
+    if (!element) return 0;
+    vm_push_number(vm, *element);
+    return 1;
+}
+
+static int jit_array_store(VMState *vm, const DecodedInstruction *inst) {
+    double *element = jit_array_element(vm, inst, (inst->opcode == OP_ARRAY_STORE_2D) ? 2 : 1);
+    if (!element || !jit_top_numbers(vm, 1)) return 0;
+    *element = VALUE_NUMBER(vm->stack[--vm->stack_top]);
+    return 1;
+}
+
+static int jit_array_addr(VMState *vm, const DecodedInstruction *inst) {
+    double *element = jit_array_element(vm, inst, 2);
+    if (!element) return 0;
+    vm->addr_array = inst->imm.array;
+    vm->addr_index = (size_t)(element - inst->imm.array->u.data);
+    vm_push_number(vm, *element);
+    return 1;
+}
+
+static int jit_array_store_addr(VMState *vm, const DecodedInstruction *inst) {
+    if (vm->addr_array != inst->imm.array || !vm->addr_array || !jit_top_numbers(vm, 1)) return 0;
+    vm->addr_array->u.data[vm->addr_index] = VALUE_NUMBER(vm->stack[--vm->stack_top]);
+    return 1;
+}
+
+static int jit_jump_if_false(VMState *vm, const DecodedInstruction *inst) {
+    (void)inst;
+    if (!jit_top_numbers(vm, 1)) return 0;
+    return (VALUE_NUMBER(vm->stack[--vm->stack_top]) == 0.0) ? 2 : 1;
+}
+
+/* Stack compare-and-branch (OP_JNLT..OP_JNNE): taken when cmp is false */
+static int jit_compare_branch(VMState *vm, const DecodedInstruction *inst) {
+    double a, b;
+    int holds;
+
+    if (!jit_top_numbers(vm, 2)) return 0;
+    a = VALUE_NUMBER(JIT_TOP(2));
+    b = VALUE_NUMBER(JIT_TOP(1));
+    vm->stack_top -= 2;
+
+    switch (inst->opcode) {
+        case OP_JNLT: holds = a < b; break;
+        case OP_JNLE: holds = a <= b; break;
+        case OP_JNGT: holds = a > b; break;
+        case OP_JNGE: holds = a >= b; break;
+        case OP_JNEQ: holds = a == b; break;
+        default:      holds = a != b; break;
+    }
+    return holds ? 1 : 2;
+}
+
+/* OP_FOR_NEXT: sets vm->pc to the loop start when it loops. Also runs */
+/* OP_FOR_NEXT_INT in doubles; the VM's guard notices the variable moved */
+static int jit_for_next(VMState *vm, const DecodedInstruction *inst) {
+    ForLoopState *loop;
+    double value;
+    int done;
+
+    if (vm->for_top == 0) return 0;
+    loop = &vm->for_stack[vm->for_top - 1];
+    if (inst->operand != 0xFFFF && loop->var_slot != inst->operand) return 0;
+
+    value = vm->num_vars[loop->var_slot] + loop->step;
+    vm->num_vars[loop->var_slot] = value;
+    done = (loop->step > 0) ? (value > loop->limit) : (value < loop->limit);
+
+    if (!done) {
+        vm->pc = loop->loop_start_pc;
+        return 2;
+    }
+    vm_for_pop(vm);
+    return 1;
+}
+
+static int jit_for_enter(VMState *vm, const DecodedInstruction *inst) {
+    double *bounds = &vm->num_vars[inst[1].operand];
+
+    if (!jit_top_numbers(vm, 3)) return 0;
+    bounds[0] = VALUE_NUMBER(JIT_TOP(2));
+    bounds[1] = VALUE_NUMBER(JIT_TOP(1));
+    vm->num_vars[inst->operand] = VALUE_NUMBER(JIT_TOP(3));
+    vm->stack_top -= 3;
+    return 1;
+}
+
+/* OP_FOR_LOOP: 2 to branch to the loop body, 1 once past the limit */
+static int jit_for_loop(VMState *vm, const DecodedInstruction *inst) {
+    const double *bounds = &vm->num_vars[inst[1].operand];
+    double value = vm->num_vars[inst->operand] + bounds[1];
+
+    vm->num_vars[inst->operand] = value;
+    if (bounds[1] > 0 ? !(value > bounds[0]) : !(value < bounds[0])) {
+        return 2;
+    }
+    return 1;
+}
+
+static int jit_gosub(VMState *vm, const DecodedInstruction *inst) {
+    vm_call_push(vm, (uint32_t)(inst - vm->decoded) + 1);
+    return 2;
+}
+
+/* OP_RETURN: sets vm->pc to the return address */
+static int jit_return(VMState *vm, const DecodedInstruction *inst) {
+    (void)inst;
+    if (vm->call_top == 0) return 0;
+    vm->pc = vm->call_stack[--vm->call_top];
+    return 2;
+}
+
+/* ------------------------------------------------------------------ */
+/* Machine code emission                                               */
+/* ------------------------------------------------------------------ */
+
+static void emit_byte(JitBuffer *b, unsigned value) {
+    if (b->len >= b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 1024;
+        unsigned char *buf = realloc(b->buf, cap);
+        if (!buf) {
+            b->failed = 1;
+            return;
+        }
+        b->buf = buf;
+        b->cap = cap;
+    }
+    b->buf[b->len++] = (unsigned char)value;
+}
+
+static void emit_bytes(JitBuffer *b, const char *bytes, size_t count) {
+    size_t i;
+    for (i = 0; i < count; i++) {
+        emit_byte(b, (unsigned char)bytes[i]);
+    }
+}
+
+static void emit_u32(JitBuffer *b, uint32_t value) {
+    int i;
+    for (i = 0; i < 4; i++) {
+        emit_byte(b, (value >> (i * 8)) & 0xFF);
+    }
+}
+
+static void emit_u64(JitBuffer *b, unsigned long value) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        emit_byte(b, (unsigned)((value >> (i * 8)) & 0xFF));
+    }
+}
+
+static void emit_pointer(JitBuffer *b, const void *ptr) {
+    unsigned long value;
+    memcpy(&value, &ptr, sizeof(value));
+    emit_u64(b, value);
+}
+
+/* rel32 field resolved once the whole region has been emitted */
+static void emit_rel32(JitBuffer *b, uint8_t kind, uint32_t pc) {
+    if (b->fixup_count >= b->fixup_cap) {
+        size_t cap = b->fixup_cap ? b->fixup_cap * 2 : 64;
+        JitFixup *fixups = realloc(b->fixups, sizeof(JitFixup) * cap);
+        if (!fixups) {
+            b->failed = 1;
+            return;
+        }
+        b->fixups = fixups;
+        b->fixup_cap = cap;
+    }
+    b->fixups[b->fixup_count].at = b->len;
+    b->fixups[b->fixup_count].kind = kind;
+    b->fixups[b->fixup_count].pc = pc;
+    b->fixup_count++;
+    emit_u32(b, 0);
+}
+
+/* Jcc rel32 (cc = second opcode byte, e.g. 0x84 for je) or jmp rel32 */
+static void emit_jcc(JitBuffer *b, unsigned cc, uint8_t kind, uint32_t pc) {
+    emit_byte(b, 0x0F);
+    emit_byte(b, cc);
+    emit_rel32(b, kind, pc);
+}
+
+static void emit_jmp(JitBuffer *b, uint8_t kind, uint32_t pc) {
+    emit_byte(b, 0xE9);
+    emit_rel32(b, kind, pc);
+}
+
+#define JCC_JB   0x82
+#define JCC_JAE  0x83
+#define JCC_JE   0x84
+#define JCC_JNE  0x85
+#define JCC_JBE  0x86
+#define JCC_JA   0x87
+#define JCC_JP   0x8A
+
+/* Base registers for memory operands */
+#define BASE_RAX  0              /* Scratch pointer */
+#define BASE_RBX  3              /* Register file (vm->num_vars) */
+#define BASE_R12  12             /* VMState */
+#define BASE_R13  13             /* Trace stack slots */
+#define BASE_R15  15             /* Trace FOR loop state */
+
+/* ModRM (and SIB) for [base+disp32] with reg field r */
+static void emit_modrm_disp(JitBuffer *b, unsigned r, unsigned base, uint32_t disp) {
+    emit_byte(b, 0x80 | (r << 3) | (base & 7));
+    if ((base & 7) == 4) emit_byte(b, 0x24);
+    emit_u32(b, disp);
+}
+
+/* SSE2 op between xmm0-7 and memory: prefix [REX] 0F op [base+disp] */
+static void emit_sse_mem(JitBuffer *b, unsigned prefix, unsigned op,
+                         unsigned xmm, unsigned base, uint32_t disp) {
+    emit_byte(b, prefix);
+    if (base >= 8) emit_byte(b, 0x41);
+    emit_byte(b, 0x0F);
+    emit_byte(b, op);
+    emit_modrm_disp(b, xmm, base, disp);
+}
+
+/* SSE2 op between xmm and register file entry: prefix 0F op [rbx+index*8] */
+static void emit_sse_reg(JitBuffer *b, unsigned prefix, unsigned op,
+                         unsigned xmm, uint32_t index) {
+    emit_sse_mem(b, prefix, op, xmm, BASE_RBX, index * 8);
+}
+
+#define SSE_MOVSD_LOAD   0xF2, 0x10
+#define SSE_MOVSD_STORE  0xF2, 0x11
+#define SSE_ADDSD        0xF2, 0x58
+#define SSE_MULSD        0xF2, 0x59
+#define SSE_SUBSD        0xF2, 0x5C
+#define SSE_DIVSD        0xF2, 0x5E
+#define SSE_UCOMISD      0x66, 0x2E
+#define SSE_CMPSD        0xF2, 0xC2
+
+/* mov rax, [base+disp] (0x8B) or mov [base+disp], rax (0x89) */
+static void emit_rax_mem(JitBuffer *b, unsigned op, unsigned base, uint32_t disp) {
+    emit_byte(b, base >= 8 ? 0x49 : 0x48);
+    emit_byte(b, op);
+    emit_modrm_disp(b, 0, base, disp);
+}
+
+/* mov rax, [rbx+index*8] (0x8B) or mov [rbx+index*8], rax (0x89) */
+static void emit_rax_reg(JitBuffer *b, unsigned op, uint32_t index) {
+    emit_rax_mem(b, op, BASE_RBX, index * 8);
+}
+
+/* mov dword [r12 + offsetof(VMState, pc)], pc */
+static void emit_store_pc(JitBuffer *b, uint32_t pc) {
+    emit_bytes(b, "\x41\xC7\x84\x24", 4);
+    emit_u32(b, (uint32_t)offsetof(VMState, pc));
+    emit_u32(b, pc);
+}
+
+/* Safepoint before a jump back to target: leave for the interpreter at pc */
+/* (exit) when BREAK is set or the budget cannot cover target's cost, */
+/* otherwise charge it. The interpreter then stops at target */
+static void emit_safepoint(JitBuffer *b, const VMState *vm, uint32_t target,
+                           uint8_t kind, uint32_t exit) {
+    uint32_t cost = 1;
+
+    if (target < vm->program->code_len && vm->decoded[target].safepoint_cost) {
+        cost = vm->decoded[target].safepoint_cost;
+    }
+    emit_bytes(b, "\x41\x83\xBC\x24", 4);      /* cmp dword [r12 + break_flag], 0 */
+    emit_u32(b, (uint32_t)offsetof(VMState, break_flag));
+    emit_byte(b, 0x00);
+    emit_jcc(b, JCC_JNE, kind, exit);
+    emit_bytes(b, "\x49\x81\xBC\x24", 4);      /* cmp qword [r12 + budget], cost */
+    emit_u32(b, (uint32_t)offsetof(VMState, budget));
+    emit_u32(b, cost);
+    emit_jcc(b, JCC_JB, kind, exit);
+    emit_bytes(b, "\x49\x81\xAC\x24", 4);      /* sub qword [r12 + budget], cost */
+    emit_u32(b, (uint32_t)offsetof(VMState, budget));
+    emit_u32(b, cost);
+}
+
+static void emit_prologue(JitBuffer *b) {
+    emit_bytes(b, "\x53", 1);                  /* push rbx */
+    emit_bytes(b, "\x41\x54", 2);              /* push r12 */
+    emit_bytes(b, "\x48\x83\xEC\x08", 4);      /* sub rsp, 8 (align for calls) */
+    emit_bytes(b, "\x49\x89\xFC", 3);          /* mov r12, rdi */
+    emit_bytes(b, "\x48\x8B\x9F", 3);          /* mov rbx, [rdi + num_vars] */
+    emit_u32(b, (uint32_t)offsetof(VMState, num_vars));
+}
+
+static void emit_epilogue(JitBuffer *b) {
+    emit_bytes(b, "\x48\x83\xC4\x08", 4);      /* add rsp, 8 */
+    emit_bytes(b, "\x41\x5C", 2);              /* pop r12 */
+    emit_bytes(b, "\x5B", 1);                  /* pop rbx */
+    emit_bytes(b, "\xC3", 1);                  /* ret */
+}
+
+/* Call helper(vm, inst); result in eax */
+static void emit_call(JitBuffer *b, JitHelper helper, const DecodedInstruction *inst) {
+    unsigned long addr;
+
+    memcpy(&addr, &helper, sizeof(addr));
+    emit_bytes(b, "\x4C\x89\xE7", 3);          /* mov rdi, r12 */
+    emit_bytes(b, "\x48\xBE", 2);              /* mov rsi, inst */
+    emit_pointer(b, inst);
+    emit_bytes(b, "\x48\xB8", 2);              /* mov rax, helper */
+    emit_u64(b, addr);
+    emit_bytes(b, "\xFF\xD0", 2);              /* call rax */
+}
+
+/* Helper that either completes the instruction or hands it back */
+static void emit_step_helper(JitBuffer *b, JitHelper helper,
+                             const DecodedInstruction *inst, uint32_t pc) {
+    emit_call(b, helper, inst);
+    emit_bytes(b, "\x85\xC0", 2);              /* test eax, eax */
+    emit_jcc(b, JCC_JE, FIX_EXIT, pc);
+}
+
+/* Helper returning 1 (fall through) or 2 (branch to kind/target) */
+static void emit_branch_helper(JitBuffer *b, JitHelper helper,
+                               const DecodedInstruction *inst, uint32_t pc,
+                               uint8_t kind, uint32_t target) {
+    emit_call(b, helper, inst);
+    emit_bytes(b, "\x83\xF8\x01", 3);          /* cmp eax, 1 */
+    emit_jcc(b, JCC_JB, FIX_EXIT, pc);
+    emit_jcc(b, JCC_JA, kind, target);
+}
+
+/* Register compare-and-branch: jump to target unless a <relation> b */
+static void emit_reg_compare_branch(JitBuffer *b, uint8_t opcode,
+                                    uint32_t ra, uint32_t rb, uint32_t target) {
+    switch (opcode) {
+        case OP_R_JNLT:  /* b > a holds: ucomisd b, a; ja */
+            emit_sse_reg(b, SSE_MOVSD_LOAD, 0, rb);
+            emit_sse_reg(b, SSE_UCOMISD, 0, ra);
+            emit_jcc(b, JCC_JBE, FIX_PC, target);
+            break;
+        case OP_R_JNLE:  /* b >= a holds: ucomisd b, a; jae */
+            emit_sse_reg(b, SSE_MOVSD_LOAD, 0, rb);
+            emit_sse_reg(b, SSE_UCOMISD, 0, ra);
+            emit_jcc(b, JCC_JB, FIX_PC, target);
+            break;
+        case OP_R_JNGT:
+            emit_sse_reg(b, SSE_MOVSD_LOAD, 0, ra);
+            emit_sse_reg(b, SSE_UCOMISD, 0, rb);
+            emit_jcc(b, JCC_JBE, FIX_PC, target);
+            break;
+        case OP_R_JNGE:
+            emit_sse_reg(b, SSE_MOVSD_LOAD, 0, ra);
+            emit_sse_reg(b, SSE_UCOMISD, 0, rb);
+            emit_jcc(b, JCC_JB, FIX_PC, target);
+            break;
+        case OP_R_JNEQ:  /* equal and ordered holds */
+            emit_sse_reg(b, SSE_MOVSD_LOAD, 0, ra);
+            emit_sse_reg(b, SSE_UCOMISD, 0, rb);
+            emit_jcc(b, JCC_JNE, FIX_PC, target);
+            emit_jcc(b, JCC_JP, FIX_PC, target);
+            break;
+        default:         /* OP_R_JNNE: taken only when equal and ordered */
+            emit_sse_reg(b, SSE_MOVSD_LOAD, 0, ra);
+            emit_sse_reg(b, SSE_UCOMISD, 0, rb);
+            emit_bytes(b, "\x7A\x06", 2);      /* jp +6 (over the je) */
+            emit_jcc(b, JCC_JE, FIX_PC, target);
+            break;
+    }
+}
+
+/* Words covered by the template for the instruction at pc, 0 if none */
+static size_t jit_instruction_words(const VMState *vm, uint32_t pc) {
+    const DecodedInstruction *inst = &vm->decoded[pc];
+
+    switch (inst->opcode) {
+        case OP_PUSH_CONST:
+        case OP_PUSH_VAR:
+        case OP_POP_VAR:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_NEG:
+        case OP_FUNC_INT:
+        case OP_EQ: case OP_NE: case OP_LT:
+        case OP_LE: case OP_GT: case OP_GE:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_GOSUB:
+        case OP_RETURN:
+        case OP_FOR_NEXT:
+        case OP_FOR_NEXT_INT:
+        case OP_ARRAY_GET_1D:
+        case OP_ARRAY_SET_1D:
+        case OP_ARRAY_STORE_ADDR:
+        case OP_NOP:
+        case OP_JNLT: case OP_JNLE: case OP_JNGT:
+        case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+            return 1;
+
+        case OP_VAR_ADD_CONST_POP:
+        case OP_VAR_SUB_CONST_POP:
+            return 4;
+        case OP_VAR_MUL_VAR:
+        case OP_N_VAR_MUL_VAR:
+            return 3;
+        case OP_VAR_ARRAY_GET_1D:
+            return 2;
+        case OP_ARRAY_LOAD_1D: case OP_ARRAY_STORE_1D:
+        case OP_ARRAY_LOAD_2D: case OP_ARRAY_STORE_2D:
+        case OP_ARRAY_ADDR_2D:
+            return ARRAY_INDEXED_WORDS(inst->opcode);
+        case OP_FOR_ENTER:
+            return FOR_ENTER_WORDS;
+        case OP_FOR_LOOP:
+            return FOR_LOOP_WORDS;
+
+        default:
+            if (OP_IS_REGISTER(inst->opcode)) {
+                return REG_INSTRUCTION_WORDS(inst->opcode);
+            }
+            if (OP_IS_NUMBER_STACK(inst->opcode)) {
+                return 1;
+            }
+            return 0;
+    }
+}
+
+/* Safepoint target of the instruction at pc if it can jump back, else */
+/* code_len. NEXT goes back to the instruction after its FOR */
+static uint32_t jit_back_target(const VMState *vm, uint32_t pc) {
+    const DecodedInstruction *inst = &vm->decoded[pc];
+    uint32_t k;
+
+    switch (inst->opcode) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JNLT: case OP_JNLE: case OP_JNGT:
+        case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+        case OP_GOSUB:
+            if (inst->operand <= pc) return inst->operand;
+            break;
+        case OP_FOR_LOOP:
+            if (inst[2].operand <= pc) return inst[2].operand;
+            break;
+        case OP_FOR_NEXT:
+        case OP_FOR_NEXT_INT:
+            for (k = pc; k-- > 0; ) {
+                if ((vm->decoded[k].opcode == OP_FOR_INIT ||
+                     vm->decoded[k].opcode == OP_FOR_INIT_INT) &&
+                    (vm->decoded[k].operand == inst->operand || inst->operand == 0xFFFF)) {
+                    return k + 1;
+                }
+            }
+            return pc;
+        default:
+            if (OP_IS_REG_BRANCH(inst->opcode) && inst->operand <= pc) {
+                return inst->operand;
+            }
+            break;
+    }
+    return (uint32_t)vm->program->code_len;
+}
+
+/* Emit the template for the instruction at pc */
+static void jit_emit_instruction(JitBuffer *b, const VMState *vm, uint32_t pc) {
+    const DecodedInstruction *inst = &vm->decoded[pc];
+    uint32_t d = inst->operand;
+    uint32_t back = jit_back_target(vm, pc);
+
+    /* Leave before a jump back when the interpreter has to stop there */
+    if (back < vm->program->code_len) {
+        emit_safepoint(b, vm, back, FIX_EXIT, pc);
+    }
+
+    switch (inst->opcode) {
+        case OP_PUSH_CONST: emit_step_helper(b, jit_push_const, inst, pc); break;
+        case OP_PUSH_VAR:   emit_step_helper(b, jit_push_var, inst, pc); break;
+        case OP_POP_VAR:    emit_step_helper(b, jit_pop_var, inst, pc); break;
+        case OP_ADD:        emit_step_helper(b, jit_add, inst, pc); break;
+        case OP_SUB:        emit_step_helper(b, jit_sub, inst, pc); break;
+        case OP_MUL:        emit_step_helper(b, jit_mul, inst, pc); break;
+        case OP_DIV:        emit_step_helper(b, jit_div, inst, pc); break;
+        case OP_NEG:        emit_step_helper(b, jit_neg, inst, pc); break;
+        case OP_FUNC_INT:   emit_step_helper(b, jit_func_int, inst, pc); break;
+        case OP_EQ: case OP_NE: case OP_LT:
+        case OP_LE: case OP_GT: case OP_GE:
+            emit_step_helper(b, jit_compare, inst, pc);
+            break;
+        case OP_ARRAY_GET_1D: emit_step_helper(b, jit_array_get_1d, inst, pc); break;
+        case OP_ARRAY_SET_1D: emit_step_helper(b, jit_array_set_1d, inst, pc); break;
+        case OP_VAR_MUL_VAR:  emit_step_helper(b, jit_var_mul_var, inst, pc); break;
+        case OP_VAR_ARRAY_GET_1D: emit_step_helper(b, jit_var_array_get_1d, inst, pc); break;
+        case OP_ARRAY_LOAD_1D: case OP_ARRAY_LOAD_2D:
+            emit_step_helper(b, jit_array_load, inst, pc);
+            break;
+        case OP_ARRAY_STORE_1D: case OP_ARRAY_STORE_2D:
+            emit_step_helper(b, jit_array_store, inst, pc);
+            break;
+        case OP_ARRAY_ADDR_2D: emit_step_helper(b, jit_array_addr, inst, pc); break;
+        case OP_ARRAY_STORE_ADDR: emit_step_helper(b, jit_array_store_addr, inst, pc); break;
+        case OP_R_PUSH:     emit_step_helper(b, jit_r_push, inst, pc); break;
+        case OP_R_POP:      emit_step_helper(b, jit_r_pop, inst, pc); break;
+        case OP_R_POW:      emit_step_helper(b, jit_r_pow, inst, pc); break;
+        case OP_N_PUSH_CONST: emit_step_helper(b, jit_n_push_const, inst, pc); break;
+        case OP_N_PUSH_VAR: emit_step_helper(b, jit_n_push_var, inst, pc); break;
+        case OP_N_POP_VAR:  emit_step_helper(b, jit_n_pop_var, inst, pc); break;
+        case OP_N_NEG: case OP_N_NOT:
+            emit_step_helper(b, jit_n_unary, inst, pc);
+            break;
+        case OP_N_BOX:      emit_step_helper(b, jit_n_box, inst, pc); break;
+        case OP_N_VAR_MUL_VAR: emit_step_helper(b, jit_n_var_mul_var, inst, pc); break;
+        case OP_NOP:        break;
+
+        case OP_JUMP:
+            emit_jmp(b, FIX_PC, d);
+            break;
+        case OP_JUMP_IF_FALSE:
+            emit_branch_helper(b, jit_jump_if_false, inst, pc, FIX_PC, d);
+            break;
+        case OP_JNLT: case OP_JNLE: case OP_JNGT:
+        case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+            emit_branch_helper(b, jit_compare_branch, inst, pc, FIX_PC, d);
+            break;
+        case OP_GOSUB:
+            emit_call(b, jit_gosub, inst);
+            emit_jmp(b, FIX_PC, d);
+            break;
+        case OP_RETURN:
+            emit_call(b, jit_return, inst);
+            emit_bytes(b, "\x85\xC0", 2);      /* test eax, eax */
+            emit_jcc(b, JCC_JE, FIX_EXIT, pc);
+            emit_jmp(b, FIX_DISPATCH, 0);
+            break;
+        case OP_FOR_NEXT:
+        case OP_FOR_NEXT_INT:
+            emit_branch_helper(b, jit_for_next, inst, pc, FIX_DISPATCH, 0);
+            break;
+        case OP_FOR_ENTER:
+            emit_step_helper(b, jit_for_enter, inst, pc);
+            break;
+        case OP_FOR_LOOP:
+            emit_branch_helper(b, jit_for_loop, inst, pc, FIX_PC, inst[2].operand);
+            break;
+
+        case OP_VAR_ADD_CONST_POP:
+        case OP_VAR_SUB_CONST_POP: {
+            unsigned long bits;
+            memcpy(&bits, &inst[1].imm.number, sizeof(bits));
+            emit_sse_reg(b, SSE_MOVSD_LOAD, 0, d);
+            emit_bytes(b, "\x48\xB8", 2);      /* mov rax, constant */
+            emit_u64(b, bits);
+            emit_bytes(b, "\x66\x48\x0F\x6E\xC8", 5);  /* movq xmm1, rax */
+            if (inst->opcode == OP_VAR_ADD_CONST_POP) {
+                emit_bytes(b, "\xF2\x0F\x58\xC1", 4);  /* addsd xmm0, xmm1 */
+            } else {
+                emit_bytes(b, "\xF2\x0F\x5C\xC1", 4);  /* subsd xmm0, xmm1 */
+            }
+            emit_sse_reg(b, SSE_MOVSD_STORE, 0, inst[3].operand);
+            break;
+        }
+
+        case OP_R_MOV:
+            emit_rax_reg(b, 0x8B, inst[1].operand);
+            emit_rax_reg(b, 0x89, d);
+            break;
+        case OP_R_NEG:
+            emit_rax_reg(b, 0x8B, inst[1].operand);
+            emit_bytes(b, "\x48\x0F\xBA\xF8\x3F", 5);  /* btc rax, 63 */
+            emit_rax_reg(b, 0x89, d);
+            break;
+        case OP_R_ADD:
+        case OP_R_SUB:
+        case OP_R_MUL:
+            emit_sse_reg(b, SSE_MOVSD_LOAD, 0, inst[1].operand);
+            if (inst->opcode == OP_R_ADD) {
+                emit_sse_reg(b, SSE_ADDSD, 0, inst[2].operand);
+            } else if (inst->opcode == OP_R_SUB) {
+                emit_sse_reg(b, SSE_SUBSD, 0, inst[2].operand);
+            } else {
+                emit_sse_reg(b, SSE_MULSD, 0, inst[2].operand);
+            }
+            emit_sse_reg(b, SSE_MOVSD_STORE, 0, d);
+            break;
+        case OP_R_DIV:
+            /* A zero divisor goes back to the interpreter, which raises */
+            /* DIVISION BY ZERO (or jumps to the TRAP line) */
+            emit_sse_reg(b, SSE_MOVSD_LOAD, 1, inst[2].operand);
+            emit_bytes(b, "\x66\x0F\x57\xD2", 4);      /* xorpd xmm2, xmm2 */
+            emit_bytes(b, "\x66\x0F\x2E\xCA", 4);      /* ucomisd xmm1, xmm2 */
+            emit_bytes(b, "\x7A\x06", 2);              /* jp +6 (NaN) */
+            emit_jcc(b, JCC_JE, FIX_EXIT, pc);
+            emit_sse_reg(b, SSE_MOVSD_LOAD, 0, inst[1].operand);
+            emit_bytes(b, "\xF2\x0F\x5E\xC1", 4);      /* divsd xmm0, xmm1 */
+            emit_sse_reg(b, SSE_MOVSD_STORE, 0, d);
+            break;
+
+        default:
+            if (OP_IS_REG_BRANCH(inst->opcode)) {
+                emit_reg_compare_branch(b, inst->opcode, inst[1].operand,
+                                        inst[2].operand, d);
+            } else if (OP_IS_NUMBER_STACK(inst->opcode)) {
+                emit_step_helper(b, jit_n_binary, inst, pc);
+            }
+            break;
+    }
+}
+
+/* Write a rel32 field so that it jumps to target (a buffer offset) */
+static void patch_rel32(JitBuffer *b, size_t at, size_t target) {
+    uint32_t rel = (uint32_t)((long)target - (long)(at + 4));
+    int i;
+    for (i = 0; i < 4; i++) {
+        b->buf[at + i] = (unsigned char)((rel >> (i * 8)) & 0xFF);
+    }
+}
+
+static void jit_region_free(JitRegion *region) {
+    if (region->code) munmap(region->code, region->code_size);
+    free(region->table);
+    free(region);
+}
+
+/* Copy b into a new mapping, written and then made read+execute */
+static int jit_map_code(JitRegion *region, const JitBuffer *b) {
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (page <= 0) page = 4096;
+    region->code_size = (b->len + (size_t)page - 1) / (size_t)page * (size_t)page;
+    region->code = mmap(NULL, region->code_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region->code == MAP_FAILED) {
+        region->code = NULL;
+        return 0;
+    }
+    memcpy(region->code, b->buf, b->len);
+    return mprotect(region->code, region->code_size, PROT_READ | PROT_EXEC) == 0;
+}
+
+/* Translate the range starting at entry; NULL if nothing there compiles */
+static JitRegion* jit_compile(VMState *vm, uint32_t entry) {
+    uint32_t code_len = (uint32_t)vm->program->code_len;
+    uint32_t end = entry;
+    uint32_t count, pc;
+    size_t *offsets = NULL;
+    size_t *stub_offsets = NULL;
+    uint32_t *stub_pcs = NULL;
+    size_t stub_count = 0, dispatch_at, epilogue_at, i;
+    JitBuffer b;
+    JitRegion *region;
+
+    /* Find the end of the range: the first instruction without a template */
+    while (end < code_len && end - entry < JIT_MAX_REGION) {
+        size_t words = jit_instruction_words(vm, end);
+        if (words == 0 || end + words > code_len) break;
+        end += (uint32_t)words;
+    }
+    if (end == entry) return NULL;
+    count = end - entry;
+
+    region = calloc(1, sizeof(JitRegion));
+    if (!region) return NULL;
+    region->start = entry;
+    region->end = end;
+    region->table = malloc(sizeof(void*) * count);
+    offsets = malloc(sizeof(size_t) * count);
+    memset(&b, 0, sizeof(b));
+    if (!region->table || !offsets) goto fail;
+    for (i = 0; i < count; i++) offsets[i] = (size_t)-1;
+
+    /* Body */
+    emit_prologue(&b);
+    for (pc = entry; pc < end; pc += (uint32_t)jit_instruction_words(vm, pc)) {
+        offsets[pc - entry] = b.len;
+        jit_emit_instruction(&b, vm, pc);
+    }
+    emit_store_pc(&b, end);
+    emit_epilogue(&b);
+
+    /* Shared dynamic dispatch on vm->pc (FOR_NEXT, RETURN) */
+    dispatch_at = b.len;
+    emit_bytes(&b, "\x41\x8B\x84\x24", 4);     /* mov eax, [r12 + pc] */
+    emit_u32(&b, (uint32_t)offsetof(VMState, pc));
+    emit_byte(&b, 0x2D);                       /* sub eax, entry */
+    emit_u32(&b, entry);
+    emit_byte(&b, 0x3D);                       /* cmp eax, count */
+    emit_u32(&b, count);
+    emit_bytes(&b, "\x72\x08", 2);             /* jb +8 (over the epilogue) */
+    epilogue_at = b.len;
+    emit_epilogue(&b);                         /* outside: vm->pc is already set */
+    emit_bytes(&b, "\x48\xB9", 2);             /* mov rcx, table */
+    emit_pointer(&b, region->table);
+    emit_bytes(&b, "\xFF\x24\xC1", 3);         /* jmp [rcx + rax*8] */
+
+    /* Branches to pcs without native code in this region leave through */
+    /* one exit stub per target pc */
+    for (i = 0; i < b.fixup_count; i++) {
+        JitFixup *fix = &b.fixups[i];
+        if (fix->kind == FIX_PC &&
+            (fix->pc < entry || fix->pc >= end || offsets[fix->pc - entry] == (size_t)-1)) {
+            fix->kind = FIX_EXIT;
+        }
+    }
+    stub_offsets = malloc(sizeof(size_t) * (b.fixup_count + 1));
+    stub_pcs = malloc(sizeof(uint32_t) * (b.fixup_count + 1));
+    if (!stub_offsets || !stub_pcs) goto fail;
+    for (i = 0; i < b.fixup_count; i++) {
+        JitFixup *fix = &b.fixups[i];
+        size_t s;
+        if (fix->kind != FIX_EXIT) continue;
+        for (s = 0; s < stub_count && stub_pcs[s] != fix->pc; s++) {
+            /* search */
+        }
+        if (s == stub_count) {
+            stub_pcs[stub_count] = fix->pc;
+            stub_offsets[stub_count] = b.len;
+            stub_count++;
+            emit_store_pc(&b, fix->pc);
+            emit_epilogue(&b);
+        }
+    }
+    if (b.failed) goto fail;
+
+    /* Resolve branches */
+    for (i = 0; i < b.fixup_count; i++) {
+        JitFixup *fix = &b.fixups[i];
+        size_t target = epilogue_at;
+        if (fix->kind == FIX_PC) {
+            target = offsets[fix->pc - entry];
+        } else if (fix->kind == FIX_DISPATCH) {
+            target = dispatch_at;
+        } else {
+            size_t s;
+            for (s = 0; s < stub_count; s++) {
+                if (stub_pcs[s] == fix->pc) {
+                    target = stub_offsets[s];
+                    break;
+                }
+            }
+        }
+        patch_rel32(&b, fix->at, target);
+    }
+
+    if (!jit_map_code(region, &b)) goto fail;
+
+    for (i = 0; i < count; i++) {
+        size_t off = (offsets[i] == (size_t)-1) ? epilogue_at : offsets[i];
+        region->table[i] = region->code + off;
+    }
+
+    free(offsets);
+    free(stub_offsets);
+    free(stub_pcs);
+    free(b.buf);
+    free(b.fixups);
+    return region;
+
+fail:
+    free(offsets);
+    free(stub_offsets);
+    free(stub_pcs);
+    free(b.buf);
+    free(b.fixups);
+    jit_region_free(region);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Traces                                                              */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Loop anchors are FOR loop body starts and the targets of backward
+ * OP_JUMPs. When an anchor gets hot, vm_execute() routes every instruction
+ * of the next iteration through vm_jit_enter(), which records the pcs
+ * actually executed until control is back at the anchor. The recording is
+ * then compiled as one straight line that loops back to its start:
+ *
+ *   - every branch becomes a guard for the direction the recording took,
+ *     exiting to the interpreter at the other target;
+ *   - the expression stack is simulated at compile time. Pushed variables
+ *     and constants are used directly as memory operands, and intermediate
+ *     results are numbers in the vm->stack slots they would occupy, with no
+ *     type tags or stack_top updates until an exit writes them back;
+ *   - checks that cannot change inside the loop are hoisted to the trace
+ *     entry: stack capacity, the arrays being dimensioned and numeric, and
+ *     the closing FOR loop's variable, loop start and STEP sign. A
+ *     statically paired loop (OP_FOR_LOOP) keeps its limit and STEP in
+ *     hidden variables, so only the STEP sign is checked.
+ *
+ * OP_N_* instructions are simulated on the same stack: their entries are
+ * the top ndepth ones, and an exit copies them to vm->num_stack instead of
+ * their vm->stack slots. The trace assumes the number stack is empty at
+ * the anchor, which the entry checks.
+ *
+ * A recording that meets an instruction without a trace template, another
+ * anchor with a compiled trace, or a pc the previous instruction cannot
+ * lead to (an error jumping to the TRAP line) is abandoned. After
+ * JIT_MAX_TRACE_ABORTS attempts the anchor becomes a plain entry point.
+ */
+
+#define TRACE_MAX_DEPTH  32      /* Expression stack entries a trace may use */
+
+/* Trace stack entry kinds */
+#define TE_SLOT   0              /* Number in its vm->stack slot */
+#define TE_VAR    1              /* Register file entry, not copied yet */
+#define TE_CONST  2              /* Trace constant, not copied yet */
+
+typedef struct {
+    uint8_t kind;
+    uint32_t index;              /* TE_VAR: register, TE_CONST: constant */
+} TraceEntry;
+
+/* Side exit: write the simulated stack back and leave with vm->pc = pc */
+typedef struct {
+    uint32_t pc;
+    uint8_t pop_for;             /* Closing FOR loop finished: pop it */
+    int depth;
+    int ndepth;                  /* Top entries that belong on the number stack */
+    TraceEntry stack[TRACE_MAX_DEPTH];
+} TraceExit;
+
+/* Fixup kinds used by traces (pc field: TraceExit index, unused) */
+#define FIX_TRACE_EXIT  3
+#define FIX_TRACE_LOOP  4
+
+/* RIP-relative reference to a trace constant */
+typedef struct {
+    size_t at;                   /* Offset of the disp32 */
+    size_t tail;                 /* Instruction bytes after the disp32 */
+    size_t index;
+} TraceConstRef;
+
+typedef struct {
+    VMState *vm;
+    JitBuffer b;
+    TraceEntry stack[TRACE_MAX_DEPTH];
+    int depth, max_depth;
+    int ndepth, max_ndepth;      /* Number stack entries on top of stack */
+    double *consts;
+    size_t const_count;
+    TraceConstRef *const_refs;
+    size_t const_ref_count, const_ref_cap;
+    TraceExit *exits;
+    size_t exit_count;
+    const ArrayData **arrays;    /* Checked once at trace entry */
+    size_t array_count;
+    int closing_for;             /* Trace ends in the FOR loop's NEXT */
+    uint16_t for_var;
+    int step_positive;
+    int closing_loop;            /* Trace ends in an OP_FOR_LOOP ... */
+    uint32_t loop_slots;         /* ... whose limit and STEP are here */
+    int failed;
+} TraceCompiler;
+
+/* Instruction words if op can be recorded into a trace, 0 otherwise */
+static size_t trace_instruction_words(uint8_t op) {
+    switch (op) {
+        case OP_PUSH_CONST: case OP_PUSH_VAR: case OP_POP_VAR:
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_NEG:
+        case OP_FUNC_INT:
+        case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE:
+        case OP_JUMP: case OP_JUMP_IF_FALSE:
+        case OP_JNLT: case OP_JNLE: case OP_JNGT:
+        case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+        case OP_GOSUB: case OP_RETURN: case OP_FOR_NEXT: case OP_FOR_NEXT_INT:
+        case OP_ARRAY_GET_1D: case OP_ARRAY_SET_1D:
+        case OP_NOP:
+        case OP_N_PUSH_CONST: case OP_N_PUSH_VAR: case OP_N_POP_VAR:
+        case OP_N_ADD: case OP_N_SUB: case OP_N_MUL: case OP_N_DIV: case OP_N_NEG:
+        case OP_N_EQ: case OP_N_NE: case OP_N_LT:
+        case OP_N_LE: case OP_N_GT: case OP_N_GE:
+        case OP_N_BOX:
+            return 1;
+        case OP_VAR_ADD_CONST_POP:
+        case OP_VAR_SUB_CONST_POP:
+            return 4;
+        case OP_VAR_MUL_VAR:
+        case OP_N_VAR_MUL_VAR:
+            return 3;
+        case OP_VAR_ARRAY_GET_1D:
+        case OP_ARRAY_LOAD_1D: case OP_ARRAY_STORE_1D:
+            return 2;
+        case OP_FOR_LOOP:
+            return FOR_LOOP_WORDS;
+        default:
+            return OP_IS_REGISTER(op) ? REG_INSTRUCTION_WORDS(op) : 0;
+    }
+}
+
+/* Displacement of stack slot i's number from r13 */
+static uint32_t trace_slot_disp(int i) {
+    return (uint32_t)(i * sizeof(Value) + VALUE_NUMBER_OFFSET);
+}
+
+static size_t trace_const(TraceCompiler *tc, double value) {
+    size_t i;
+    for (i = 0; i < tc->const_count; i++) {
+        if (memcmp(&tc->consts[i], &value, sizeof(double)) == 0) return i;
+    }
+    tc->consts[tc->const_count] = value;
+    return tc->const_count++;
+}
+
+/* SSE2 op between xmm and a trace stack entry (slot: its stack position) */
+static void trace_sse(TraceCompiler *tc, unsigned prefix, unsigned op, unsigned xmm,
+                      const TraceEntry *e, int slot, size_t tail) {
+    JitBuffer *b = &tc->b;
+
+    if (e->kind == TE_VAR) {
+        emit_sse_mem(b, prefix, op, xmm, BASE_RBX, e->index * 8);
+    } else if (e->kind == TE_SLOT) {
+        emit_sse_mem(b, prefix, op, xmm, BASE_R13, trace_slot_disp(slot));
+    } else {
+        if (tc->const_ref_count >= tc->const_ref_cap) {
+            size_t cap = tc->const_ref_cap ? tc->const_ref_cap * 2 : 64;
+            TraceConstRef *refs = realloc(tc->const_refs, sizeof(TraceConstRef) * cap);
+            if (!refs) {
+                tc->failed = 1;
+                return;
+            }
+            tc->const_refs = refs;
+            tc->const_ref_cap = cap;
+        }
+        emit_byte(b, prefix);
+        emit_byte(b, 0x0F);
+        emit_byte(b, op);
+        emit_byte(b, (xmm << 3) | 5);          /* [rip+disp32] */
+        tc->const_refs[tc->const_ref_count].at = b->len;
+        tc->const_refs[tc->const_ref_count].tail = tail;
+        tc->const_refs[tc->const_ref_count].index = e->index;
+        tc->const_ref_count++;
+        emit_u32(b, 0);
+    }
+}
+
+/* Copy a not-yet-copied stack entry into its slot */
+static void trace_materialize(TraceCompiler *tc, TraceEntry *stack, int i) {
+    if (stack[i].kind == TE_SLOT) return;
+    trace_sse(tc, SSE_MOVSD_LOAD, 0, &stack[i], i, 0);
+    emit_sse_mem(&tc->b, SSE_MOVSD_STORE, 0, BASE_R13, trace_slot_disp(i));
+    stack[i].kind = TE_SLOT;
+}
+
+/* Register reg is about to change: copy stack entries still reading it */
+static void trace_before_write(TraceCompiler *tc, uint32_t reg) {
+    int i;
+    for (i = 0; i < tc->depth; i++) {
+        if (tc->stack[i].kind == TE_VAR && tc->stack[i].index == reg) {
+            trace_materialize(tc, tc->stack, i);
+        }
+    }
+}
+
+static void trace_push(TraceCompiler *tc, uint8_t kind, uint32_t index) {
+    if (tc->depth >= TRACE_MAX_DEPTH) {
+        tc->failed = 1;
+        return;
+    }
+    tc->stack[tc->depth].kind = kind;
+    tc->stack[tc->depth].index = index;
+    tc->depth++;
+    if (tc->depth > tc->max_depth) tc->max_depth = tc->depth;
+}
+
+/* Pop into *e; fails the trace if it would pop what it did not push */
+static int trace_pop(TraceCompiler *tc, TraceEntry *e) {
+    if (tc->depth == 0) {
+        tc->failed = 1;
+        return 0;
+    }
+    *e = tc->stack[--tc->depth];
+    return 1;
+}
+
+/* Store xmm0 as a new stack entry */
+static void trace_push_result(TraceCompiler *tc) {
+    if (tc->depth >= TRACE_MAX_DEPTH) {
+        tc->failed = 1;
+        return;
+    }
+    emit_sse_mem(&tc->b, SSE_MOVSD_STORE, 0, BASE_R13, trace_slot_disp(tc->depth));
+    trace_push(tc, TE_SLOT, 0);
+}
+
+/* Snapshot the simulated stack for a side exit to pc */
+static size_t trace_exit(TraceCompiler *tc, uint32_t pc, int pop_for) {
+    TraceExit *exit = &tc->exits[tc->exit_count];
+    exit->pc = pc;
+    exit->pop_for = (uint8_t)pop_for;
+    exit->depth = tc->depth;
+    exit->ndepth = tc->ndepth;
+    memcpy(exit->stack, tc->stack, sizeof(TraceEntry) * tc->depth);
+    return tc->exit_count++;
+}
+
+static void trace_guard(TraceCompiler *tc, unsigned cc, size_t exit) {
+    emit_jcc(&tc->b, cc, FIX_TRACE_EXIT, (uint32_t)exit);
+}
+
+/* Call a C math function on xmm0 (and xmm1) */
+static void trace_call_math(TraceCompiler *tc, const void *fn_addr) {
+    emit_bytes(&tc->b, "\x48\xB8", 2);         /* mov rax, fn */
+    emit_pointer(&tc->b, fn_addr);
+    emit_bytes(&tc->b, "\xFF\xD0", 2);         /* call rax */
+}
+
+/* Relations, in OP_JNLT..OP_JNNE order */
+#define REL_LT 0
+#define REL_LE 1
+#define REL_GT 2
+#define REL_GE 3
+#define REL_EQ 4
+#define REL_NE 5
+
+/* Exit unless "a rel b" has the recorded outcome (holds) */
+static void trace_compare_guard(TraceCompiler *tc, int rel,
+                                const TraceEntry *a, int slot_a,
+                                const TraceEntry *b, int slot_b,
+                                int holds, size_t exit) {
+    int exit_on_holds = !holds;
+
+    /* LT/LE compare b with a, so every relation reads as "above" */
+    if (rel == REL_LT || rel == REL_LE) {
+        trace_sse(tc, SSE_MOVSD_LOAD, 0, b, slot_b, 0);
+        trace_sse(tc, SSE_UCOMISD, 0, a, slot_a, 0);
+    } else {
+        trace_sse(tc, SSE_MOVSD_LOAD, 0, a, slot_a, 0);
+        trace_sse(tc, SSE_UCOMISD, 0, b, slot_b, 0);
+    }
+
+    switch (rel) {
+        case REL_LT:
+        case REL_GT:
+            trace_guard(tc, exit_on_holds ? JCC_JA : JCC_JBE, exit);
+            break;
+        case REL_LE:
+        case REL_GE:
+            trace_guard(tc, exit_on_holds ? JCC_JAE : JCC_JB, exit);
+            break;
+        default:
+            /* Equal means ZF set and PF clear (ordered) */
+            if ((rel == REL_EQ) == exit_on_holds) {
+                emit_bytes(&tc->b, "\x7A\x06", 2);  /* jp +6 */
+                trace_guard(tc, JCC_JE, exit);
+            } else {
+                trace_guard(tc, JCC_JNE, exit);
+                trace_guard(tc, JCC_JP, exit);
+            }
+            break;
+    }
+}
+
+/* Binary arithmetic on the two top entries (op: SSE2 opcode byte) */
+static void trace_arith(TraceCompiler *tc, unsigned op, uint32_t pc) {
+    TraceEntry a, b;
+
+    if (tc->depth < 2) {
+        tc->failed = 1;
+        return;
+    }
+    if (op == 0x5E) {
+        /* DIV: a zero divisor exits with the operands still pushed */
+        size_t exit = trace_exit(tc, pc, 0);
+        trace_sse(tc, SSE_MOVSD_LOAD, 1, &tc->stack[tc->depth - 1], tc->depth - 1, 0);
+        emit_bytes(&tc->b, "\x66\x0F\x57\xD2", 4);  /* xorpd xmm2, xmm2 */
+        emit_bytes(&tc->b, "\x66\x0F\x2E\xCA", 4);  /* ucomisd xmm1, xmm2 */
+        emit_bytes(&tc->b, "\x7A\x06", 2);          /* jp +6 */
+        trace_guard(tc, JCC_JE, exit);
+    }
+    if (!trace_pop(tc, &b) || !trace_pop(tc, &a)) return;
+    trace_sse(tc, SSE_MOVSD_LOAD, 0, &a, tc->depth, 0);
+    if (op == 0x5E) {
+        emit_bytes(&tc->b, "\xF2\x0F\x5E\xC1", 4);  /* divsd xmm0, xmm1 */
+    } else {
+        trace_sse(tc, 0xF2, op, 0, &b, tc->depth + 1, 0);
+    }
+    trace_push_result(tc);
+}
+
+/* OP_EQ..OP_GE (or OP_N_EQ..OP_N_GE): push 1 or 0 */
+static void trace_compare_value(TraceCompiler *tc, uint8_t opcode) {
+    static const unsigned char predicate[6] = { 0, 4, 1, 2, 1, 2 };  /* cmpsd */
+    int k = opcode - OP_EQ;
+    int swap = (opcode == OP_GT || opcode == OP_GE);
+    TraceEntry a, b, one;
+
+    if (!trace_pop(tc, &b) || !trace_pop(tc, &a)) return;
+    one.kind = TE_CONST;
+    one.index = (uint32_t)trace_const(tc, 1.0);
+
+    if (swap) {
+        trace_sse(tc, SSE_MOVSD_LOAD, 0, &b, tc->depth + 1, 0);
+        trace_sse(tc, SSE_CMPSD, 0, &a, tc->depth, 1);
+    } else {
+        trace_sse(tc, SSE_MOVSD_LOAD, 0, &a, tc->depth, 0);
+        trace_sse(tc, SSE_CMPSD, 0, &b, tc->depth + 1, 1);
+    }
+    emit_byte(&tc->b, predicate[k]);
+    trace_sse(tc, SSE_MOVSD_LOAD, 1, &one, 0, 0);
+    emit_bytes(&tc->b, "\x66\x0F\x54\xC1", 4);      /* andpd xmm0, xmm1 */
+    trace_push_result(tc);
+}
+
+/* rax = index in entry e; exit unless it is inside array; rdx = data */
+static void trace_array_index(TraceCompiler *tc, const ArrayData *array,
+                              const TraceEntry *e, int slot, size_t exit) {
+    size_t i;
+
+    for (i = 0; i < tc->array_count && tc->arrays[i] != array; i++) {
+        /* search */
+    }
+    if (i == tc->array_count) tc->arrays[tc->array_count++] = array;
+
+    trace_sse(tc, SSE_MOVSD_LOAD, 0, e, slot, 0);
+    emit_bytes(&tc->b, "\xF2\x48\x0F\x2C\xC0", 5);  /* cvttsd2si rax, xmm0 */
+    emit_bytes(&tc->b, "\x48\xB9", 2);              /* mov rcx, array */
+    emit_pointer(&tc->b, array);
+    emit_bytes(&tc->b, "\x48\x3B\x81", 3);          /* cmp rax, [rcx + dim1] */
+    emit_u32(&tc->b, (uint32_t)offsetof(ArrayData, dim1));
+    trace_guard(tc, JCC_JAE, exit);
+    emit_bytes(&tc->b, "\x48\x8B\x91", 3);          /* mov rdx, [rcx + data] */
+    emit_u32(&tc->b, (uint32_t)offsetof(ArrayData, u));
+}
+
+/* Emit the instruction at pc, which the recording left towards next */
+static void trace_emit_instruction(TraceCompiler *tc, uint32_t pc, uint32_t next,
+                                   uint32_t anchor, int closing) {
+    VMState *vm = tc->vm;
+    const DecodedInstruction *inst = &vm->decoded[pc];
+    uint32_t d = inst->operand;
+    uint32_t fall = pc + (uint32_t)trace_instruction_words(inst->opcode);
+    TraceEntry a, b;
+    size_t exit;
+    int npops = 0, npushes = 0;
+
+    /* Number stack entries are the top ndepth: an N_ instruction may only */
+    /* pop those, and anything else only runs with none on the stack */
+    if (OP_IS_NUMBER_STACK(inst->opcode)) {
+        switch (inst->opcode) {
+            case OP_N_PUSH_CONST: case OP_N_PUSH_VAR: case OP_N_VAR_MUL_VAR:
+                npushes = 1;
+                break;
+            case OP_N_POP_VAR:
+                npops = 1;
+                break;
+            case OP_N_NEG: case OP_N_NOT:
+                npops = npushes = 1;
+                break;
+            case OP_N_BOX:
+                /* The boxed value is a plain entry: nothing may be under it */
+                if (tc->ndepth != 1) {
+                    tc->failed = 1;
+                    return;
+                }
+                npops = 1;
+                break;
+            default:
+                npops = 2;
+                npushes = 1;
+                break;
+        }
+        if (tc->ndepth < npops) {
+            tc->failed = 1;
+            return;
+        }
+    } else if (tc->ndepth > 0 && inst->opcode != OP_NOP) {
+        tc->failed = 1;
+        return;
+    }
+
+    /* Everything but control flow must continue with the next instruction */
+    switch (inst->opcode) {
+        case OP_JUMP: case OP_GOSUB: case OP_RETURN:
+        case OP_FOR_NEXT: case OP_FOR_NEXT_INT: case OP_FOR_LOOP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JNLT: case OP_JNLE: case OP_JNGT:
+        case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+            break;
+        default:
+            if (!OP_IS_REG_BRANCH(inst->opcode) && next != fall) {
+                tc->failed = 1;
+                return;
+            }
+            break;
+    }
+
+    switch (inst->opcode) {
+        case OP_NOP:
+        case OP_N_BOX:
+            break;
+        case OP_PUSH_CONST:
+        case OP_N_PUSH_CONST:
+            trace_push(tc, TE_CONST, (uint32_t)trace_const(tc, inst->imm.number));
+            break;
+        case OP_PUSH_VAR:
+        case OP_R_PUSH:
+        case OP_N_PUSH_VAR:
+            trace_push(tc, TE_VAR, d);
+            break;
+        case OP_POP_VAR:
+        case OP_R_POP:
+        case OP_N_POP_VAR:
+            if (!trace_pop(tc, &a)) return;
+            trace_before_write(tc, d);
+            if (a.kind != TE_VAR || a.index != d) {
+                trace_sse(tc, SSE_MOVSD_LOAD, 0, &a, tc->depth, 0);
+                emit_sse_reg(&tc->b, SSE_MOVSD_STORE, 0, d);
+            }
+            break;
+
+        case OP_ADD: case OP_N_ADD: trace_arith(tc, 0x58, pc); break;
+        case OP_SUB: case OP_N_SUB: trace_arith(tc, 0x5C, pc); break;
+        case OP_MUL: case OP_N_MUL: trace_arith(tc, 0x59, pc); break;
+        case OP_DIV: case OP_N_DIV: trace_arith(tc, 0x5E, pc); break;
+
+        case OP_NEG:
+        case OP_N_NEG:
+            if (!trace_pop(tc, &a)) return;
+            if (a.kind == TE_CONST) {
+                trace_push(tc, TE_CONST, (uint32_t)trace_const(tc, -tc->consts[a.index]));
+                break;
+            }
+            if (a.kind == TE_VAR) {
+                emit_rax_reg(&tc->b, 0x8B, a.index);
+            } else {
+                emit_rax_mem(&tc->b, 0x8B, BASE_R13, trace_slot_disp(tc->depth));
+            }
+            emit_bytes(&tc->b, "\x48\x0F\xBA\xF8\x3F", 5);  /* btc rax, 63 */
+            emit_rax_mem(&tc->b, 0x89, BASE_R13, trace_slot_disp(tc->depth));
+            trace_push(tc, TE_SLOT, 0);
+            break;
+
+        case OP_FUNC_INT: {
+            double (*fn)(double) = floor;
+            void *addr;
+            if (!trace_pop(tc, &a)) return;
+            memcpy(&addr, &fn, sizeof(addr));
+            trace_sse(tc, SSE_MOVSD_LOAD, 0, &a, tc->depth, 0);
+            trace_call_math(tc, addr);
+            trace_push_result(tc);
+            break;
+        }
+
+        case OP_EQ: case OP_NE: case OP_LT:
+        case OP_LE: case OP_GT: case OP_GE:
+            trace_compare_value(tc, inst->opcode);
+            break;
+        case OP_N_EQ: case OP_N_NE: case OP_N_LT:
+        case OP_N_LE: case OP_N_GT: case OP_N_GE:
+            trace_compare_value(tc, (uint8_t)(OP_EQ + (inst->opcode - OP_N_EQ)));
+            break;
+
+        case OP_JUMP:
+            if (next != d) tc->failed = 1;
+            break;
+
+        case OP_JUMP_IF_FALSE: {
+            /* Jumps when the condition equals zero */
+            TraceEntry zero;
+            if (next != d && next != pc + 1) {
+                tc->failed = 1;
+                return;
+            }
+            if (!trace_pop(tc, &a)) return;
+            if (d == pc + 1) break;
+            zero.kind = TE_CONST;
+            zero.index = (uint32_t)trace_const(tc, 0.0);
+            exit = trace_exit(tc, next == d ? pc + 1 : d, 0);
+            trace_compare_guard(tc, REL_EQ, &a, tc->depth, &zero, 0, next == d, exit);
+            break;
+        }
+
+        case OP_JNLT: case OP_JNLE: case OP_JNGT:
+        case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+            /* Falls through when the relation holds */
+            if (next != d && next != pc + 1) {
+                tc->failed = 1;
+                return;
+            }
+            if (!trace_pop(tc, &b) || !trace_pop(tc, &a)) return;
+            if (d == pc + 1) break;
+            exit = trace_exit(tc, next == d ? pc + 1 : d, 0);
+            trace_compare_guard(tc, inst->opcode - OP_JNLT, &a, tc->depth, &b, tc->depth + 1,
+                                next != d, exit);
+            break;
+
+        case OP_GOSUB:
+            if (next != d) {
+                tc->failed = 1;
+                return;
+            }
+            emit_call(&tc->b, jit_gosub, inst);
+            break;
+
+        case OP_RETURN:
+            /* The call stack must hold the return address recorded */
+            exit = trace_exit(tc, pc, 0);
+            emit_bytes(&tc->b, "\x49\x8B\x84\x24", 4);  /* mov rax, [r12 + call_top] */
+            emit_u32(&tc->b, (uint32_t)offsetof(VMState, call_top));
+            emit_bytes(&tc->b, "\x48\x85\xC0", 3);      /* test rax, rax */
+            trace_guard(tc, JCC_JE, exit);
+            emit_bytes(&tc->b, "\x49\x8B\x94\x24", 4);  /* mov rdx, [r12 + call_stack] */
+            emit_u32(&tc->b, (uint32_t)offsetof(VMState, call_stack));
+            emit_bytes(&tc->b, "\x81\x7C\x82\xFC", 4);  /* cmp dword [rdx+rax*4-4], next */
+            emit_u32(&tc->b, next);
+            trace_guard(tc, JCC_JNE, exit);
+            emit_bytes(&tc->b, "\x49\x83\xAC\x24", 4);  /* sub qword [r12 + call_top], 1 */
+            emit_u32(&tc->b, (uint32_t)offsetof(VMState, call_top));
+            emit_byte(&tc->b, 0x01);
+            break;
+
+        case OP_FOR_NEXT:
+        case OP_FOR_NEXT_INT: {
+            /* Only the NEXT that closes the trace's own loop */
+            ForLoopState *loop;
+            if (!closing || next != anchor || vm->for_top == 0) {
+                tc->failed = 1;
+                return;
+            }
+            loop = &vm->for_stack[vm->for_top - 1];
+            if (loop->loop_start_pc != anchor || (d != 0xFFFF && d != loop->var_slot)) {
+                tc->failed = 1;
+                return;
+            }
+            tc->closing_for = 1;
+            tc->for_var = loop->var_slot;
+            tc->step_positive = loop->step > 0;
+
+            trace_before_write(tc, tc->for_var);
+            exit = trace_exit(tc, pc + 1, 1);
+            emit_sse_reg(&tc->b, SSE_MOVSD_LOAD, 0, tc->for_var);
+            emit_sse_mem(&tc->b, SSE_ADDSD, 0, BASE_R15, (uint32_t)offsetof(ForLoopState, step));
+            emit_sse_reg(&tc->b, SSE_MOVSD_STORE, 0, tc->for_var);
+            emit_sse_mem(&tc->b, SSE_UCOMISD, 0, BASE_R15, (uint32_t)offsetof(ForLoopState, limit));
+            if (tc->step_positive) {
+                trace_guard(tc, JCC_JA, exit);          /* value > limit */
+            } else {
+                emit_bytes(&tc->b, "\x7A\x06", 2);      /* jp +6 */
+                trace_guard(tc, JCC_JB, exit);          /* value < limit */
+            }
+            break;
+        }
+
+        case OP_FOR_LOOP:
+            /* Only a loop whose body is the whole trace */
+            if (!closing || next != anchor || inst[2].operand != anchor) {
+                tc->failed = 1;
+                return;
+            }
+            tc->closing_loop = 1;
+            tc->loop_slots = inst[1].operand;
+            tc->step_positive = vm->num_vars[tc->loop_slots + 1] > 0;
+
+            trace_before_write(tc, d);
+            exit = trace_exit(tc, pc + FOR_LOOP_WORDS, 0);
+            emit_sse_reg(&tc->b, SSE_MOVSD_LOAD, 0, d);
+            emit_sse_reg(&tc->b, SSE_ADDSD, 0, tc->loop_slots + 1);
+            emit_sse_reg(&tc->b, SSE_MOVSD_STORE, 0, d);
+            emit_sse_reg(&tc->b, SSE_UCOMISD, 0, tc->loop_slots);
+            if (tc->step_positive) {
+                trace_guard(tc, JCC_JA, exit);          /* value > limit */
+            } else {
+                emit_bytes(&tc->b, "\x7A\x06", 2);      /* jp +6 */
+                trace_guard(tc, JCC_JB, exit);          /* value < limit */
+            }
+            break;
+
+        case OP_ARRAY_GET_1D:
+            if (!inst->imm.array || tc->depth < 1) {
+                tc->failed = 1;
+                return;
+            }
+            exit = trace_exit(tc, pc, 0);
+            trace_pop(tc, &a);
+            trace_array_index(tc, inst->imm.array, &a, tc->depth, exit);
+            emit_bytes(&tc->b, "\xF2\x0F\x10\x04\xC2", 5);  /* movsd xmm0, [rdx+rax*8] */
+            trace_push_result(tc);
+            break;
+
+        case OP_VAR_ARRAY_GET_1D:
+            if (!inst[1].imm.array) {
+                tc->failed = 1;
+                return;
+            }
+            a.kind = TE_VAR;
+            a.index = d;
+            exit = trace_exit(tc, pc, 0);
+            trace_array_index(tc, inst[1].imm.array, &a, 0, exit);
+            emit_bytes(&tc->b, "\xF2\x0F\x10\x04\xC2", 5);  /* movsd xmm0, [rdx+rax*8] */
+            trace_push_result(tc);
+            break;
+
+        case OP_ARRAY_SET_1D:
+            if (!inst->imm.array || tc->depth < 2) {
+                tc->failed = 1;
+                return;
+            }
+            exit = trace_exit(tc, pc, 0);
+            trace_pop(tc, &b);
+            trace_pop(tc, &a);
+            trace_array_index(tc, inst->imm.array, &a, tc->depth, exit);
+            trace_sse(tc, SSE_MOVSD_LOAD, 0, &b, tc->depth + 1, 0);
+            emit_bytes(&tc->b, "\xF2\x0F\x11\x04\xC2", 5);  /* movsd [rdx+rax*8], xmm0 */
+            break;
+
+        case OP_ARRAY_LOAD_1D:
+            if (!inst->imm.array) {
+                tc->failed = 1;
+                return;
+            }
+            a.kind = TE_VAR;
+            a.index = inst[1].operand;
+            exit = trace_exit(tc, pc, 0);
+            trace_array_index(tc, inst->imm.array, &a, 0, exit);
+            emit_bytes(&tc->b, "\xF2\x0F\x10\x04\xC2", 5);  /* movsd xmm0, [rdx+rax*8] */
+            trace_push_result(tc);
+            break;
+
+        case OP_ARRAY_STORE_1D:
+            if (!inst->imm.array || tc->depth < 1) {
+                tc->failed = 1;
+                return;
+            }
+            exit = trace_exit(tc, pc, 0);
+            trace_pop(tc, &b);
+            a.kind = TE_VAR;
+            a.index = inst[1].operand;
+            trace_array_index(tc, inst->imm.array, &a, 0, exit);
+            trace_sse(tc, SSE_MOVSD_LOAD, 0, &b, tc->depth, 0);
+            emit_bytes(&tc->b, "\xF2\x0F\x11\x04\xC2", 5);  /* movsd [rdx+rax*8], xmm0 */
+            break;
+
+        case OP_VAR_ADD_CONST_POP:
+        case OP_VAR_SUB_CONST_POP:
+            a.kind = TE_CONST;
+            a.index = (uint32_t)trace_const(tc, inst[1].imm.number);
+            trace_before_write(tc, inst[3].operand);
+            emit_sse_reg(&tc->b, SSE_MOVSD_LOAD, 0, d);
+            trace_sse(tc, 0xF2, inst->opcode == OP_VAR_ADD_CONST_POP ? 0x58 : 0x5C, 0, &a, 0, 0);
+            emit_sse_reg(&tc->b, SSE_MOVSD_STORE, 0, inst[3].operand);
+            break;
+
+        case OP_VAR_MUL_VAR:
+        case OP_N_VAR_MUL_VAR:
+            emit_sse_reg(&tc->b, SSE_MOVSD_LOAD, 0, d);
+            emit_sse_reg(&tc->b, SSE_MULSD, 0, inst[1].operand);
+            trace_push_result(tc);
+            break;
+
+        case OP_R_MOV:
+            trace_before_write(tc, d);
+            emit_sse_reg(&tc->b, SSE_MOVSD_LOAD, 0, inst[1].operand);
+            emit_sse_reg(&tc->b, SSE_MOVSD_STORE, 0, d);
+            break;
+        case OP_R_NEG:
+            trace_before_write(tc, d);
+            emit_rax_reg(&tc->b, 0x8B, inst[1].operand);
+            emit_bytes(&tc->b, "\x48\x0F\xBA\xF8\x3F", 5);  /* btc rax, 63 */
+            emit_rax_reg(&tc->b, 0x89, d);
+            break;
+        case OP_R_ADD:
+        case OP_R_SUB:
+        case OP_R_MUL:
+            trace_before_write(tc, d);
+            emit_sse_reg(&tc->b, SSE_MOVSD_LOAD, 0, inst[1].operand);
+            emit_sse_reg(&tc->b, 0xF2, inst->opcode == OP_R_ADD ? 0x58 :
+                         inst->opcode == OP_R_SUB ? 0x5C : 0x59, 0, inst[2].operand);
+            emit_sse_reg(&tc->b, SSE_MOVSD_STORE, 0, d);
+            break;
+        case OP_R_DIV:
+            trace_before_write(tc, d);
+            exit = trace_exit(tc, pc, 0);
+            emit_sse_reg(&tc->b, SSE_MOVSD_LOAD, 1, inst[2].operand);
+            emit_bytes(&tc->b, "\x66\x0F\x57\xD2", 4);  /* xorpd xmm2, xmm2 */
+            emit_bytes(&tc->b, "\x66\x0F\x2E\xCA", 4);  /* ucomisd xmm1, xmm2 */
+            emit_bytes(&tc->b, "\x7A\x06", 2);          /* jp +6 */
+            trace_guard(tc, JCC_JE, exit);
+            emit_sse_reg(&tc->b, SSE_MOVSD_LOAD, 0, inst[1].operand);
+            emit_bytes(&tc->b, "\xF2\x0F\x5E\xC1", 4);  /* divsd xmm0, xmm1 */
+            emit_sse_reg(&tc->b, SSE_MOVSD_STORE, 0, d);
+            break;
+        case OP_R_POW: {
+            double (*fn)(double, double) = pow;
+            void *addr;
+            memcpy(&addr, &fn, sizeof(addr));
+            trace_before_write(tc, d);
+            emit_sse_reg(&tc->b, SSE_MOVSD_LOAD, 0, inst[1].operand);
+            emit_sse_reg(&tc->b, SSE_MOVSD_LOAD, 1, inst[2].operand);
+            trace_call_math(tc, addr);
+            emit_sse_reg(&tc->b, SSE_MOVSD_STORE, 0, d);
+            break;
+        }
+
+        default:
+            if (OP_IS_REG_BRANCH(inst->opcode)) {
+                uint32_t fall_reg = pc + 3;
+                if (next != d && next != fall_reg) {
+                    tc->failed = 1;
+                    return;
+                }
+                if (d == fall_reg) break;
+                a.kind = TE_VAR;
+                a.index = inst[1].operand;
+                b.kind = TE_VAR;
+                b.index = inst[2].operand;
+                exit = trace_exit(tc, next == d ? fall_reg : d, 0);
+                trace_compare_guard(tc, inst->opcode - OP_R_JNLT, &a, 0, &b, 0,
+                                    next != d, exit);
+                break;
+            }
+            tc->failed = 1;
+            break;
+    }
+
+    tc->ndepth += npushes - npops;
+    if (tc->ndepth > tc->max_ndepth) tc->max_ndepth = tc->ndepth;
+}
+
+static void trace_epilogue(JitBuffer *b) {
+    emit_bytes(b, "\x41\x5F\x41\x5E\x41\x5D", 6);  /* pop r15; pop r14; pop r13 */
+    emit_bytes(b, "\x41\x5C\x5B\xC3", 4);          /* pop r12; pop rbx; ret */
+}
+
+/* Trace entry: set up registers and check the hoisted guards */
+static void trace_emit_prologue(TraceCompiler *tc, uint32_t anchor) {
+    JitBuffer *b = &tc->b;
+    size_t i;
+#ifndef BASSET_NAN_BOXING
+    int k;
+#endif
+
+    emit_bytes(b, "\x53\x41\x54\x41\x55", 5);      /* push rbx; push r12; push r13 */
+    emit_bytes(b, "\x41\x56\x41\x57", 4);          /* push r14; push r15 */
+    emit_bytes(b, "\x49\x89\xFC", 3);              /* mov r12, rdi */
+    emit_bytes(b, "\x48\x8B\x9F", 3);              /* mov rbx, [rdi + num_vars] */
+    emit_u32(b, (uint32_t)offsetof(VMState, num_vars));
+
+    /* r14 = stack_top, r13 = &vm->stack[stack_top] */
+    emit_bytes(b, "\x4D\x8B\xB4\x24", 4);          /* mov r14, [r12 + stack_top] */
+    emit_u32(b, (uint32_t)offsetof(VMState, stack_top));
+    emit_bytes(b, "\x4D\x89\xF5", 3);              /* mov r13, r14 */
+    emit_bytes(b, "\x4D\x69\xED", 3);              /* imul r13, r13, sizeof(Value) */
+    emit_u32(b, (uint32_t)sizeof(Value));
+    emit_bytes(b, "\x4D\x03\xAC\x24", 4);          /* add r13, [r12 + stack] */
+    emit_u32(b, (uint32_t)offsetof(VMState, stack));
+
+    if (tc->max_depth > 0) {
+        emit_bytes(b, "\x4C\x89\xF0", 3);          /* mov rax, r14 */
+        emit_bytes(b, "\x48\x05", 2);              /* add rax, max_depth */
+        emit_u32(b, (uint32_t)tc->max_depth);
+        emit_bytes(b, "\x49\x3B\x84\x24", 4);      /* cmp rax, [r12 + stack_capacity] */
+        emit_u32(b, (uint32_t)offsetof(VMState, stack_capacity));
+        trace_guard(tc, JCC_JA, 0);
+#ifndef BASSET_NAN_BOXING
+        for (k = 0; k < tc->max_depth; k++) {      /* Slots only ever hold numbers */
+            emit_bytes(b, "\x41\xC7\x85", 3);      /* mov dword [r13 + type], VAL_NUMBER */
+            emit_u32(b, (uint32_t)(k * sizeof(Value) + offsetof(Value, type)));
+            emit_u32(b, VAL_NUMBER);
+        }
+#endif
+    }
+
+    if (tc->max_ndepth > 0) {
+        /* The number stack must be empty and hold the deepest exit */
+        emit_bytes(b, "\x49\x83\xBC\x24", 4);      /* cmp qword [r12 + num_top], 0 */
+        emit_u32(b, (uint32_t)offsetof(VMState, num_top));
+        emit_byte(b, 0x00);
+        trace_guard(tc, JCC_JNE, 0);
+        emit_bytes(b, "\x49\x81\xBC\x24", 4);      /* cmp qword [r12 + num_capacity], max */
+        emit_u32(b, (uint32_t)offsetof(VMState, num_capacity));
+        emit_u32(b, (uint32_t)tc->max_ndepth);
+        trace_guard(tc, JCC_JB, 0);
+    }
+
+    if (tc->closing_for) {
+        /* r15 = the innermost FOR loop, which must be this trace's loop */
+        emit_bytes(b, "\x49\x8B\x84\x24", 4);      /* mov rax, [r12 + for_top] */
+        emit_u32(b, (uint32_t)offsetof(VMState, for_top));
+        emit_bytes(b, "\x48\x85\xC0", 3);          /* test rax, rax */
+        trace_guard(tc, JCC_JE, 0);
+        emit_bytes(b, "\x4D\x8B\xBC\x24", 4);      /* mov r15, [r12 + for_stack] */
+        emit_u32(b, (uint32_t)offsetof(VMState, for_stack));
+        emit_bytes(b, "\x48\x69\xC0", 3);          /* imul rax, rax, sizeof(ForLoopState) */
+        emit_u32(b, (uint32_t)sizeof(ForLoopState));
+        emit_bytes(b, "\x49\x01\xC7", 3);          /* add r15, rax */
+        emit_bytes(b, "\x49\x81\xEF", 3);          /* sub r15, sizeof(ForLoopState) */
+        emit_u32(b, (uint32_t)sizeof(ForLoopState));
+        emit_bytes(b, "\x66\x41\x81\xBF", 4);      /* cmp word [r15 + var_slot], var */
+        emit_u32(b, (uint32_t)offsetof(ForLoopState, var_slot));
+        emit_byte(b, tc->for_var & 0xFF);
+        emit_byte(b, tc->for_var >> 8);
+        trace_guard(tc, JCC_JNE, 0);
+        emit_bytes(b, "\x41\x81\xBF", 3);          /* cmp dword [r15 + loop_start_pc], anchor */
+        emit_u32(b, (uint32_t)offsetof(ForLoopState, loop_start_pc));
+        emit_u32(b, anchor);
+        trace_guard(tc, JCC_JNE, 0);
+        emit_sse_mem(b, SSE_MOVSD_LOAD, 0, BASE_R15, (uint32_t)offsetof(ForLoopState, step));
+        emit_bytes(b, "\x66\x0F\x57\xC9", 4);      /* xorpd xmm1, xmm1 */
+        emit_bytes(b, "\x66\x0F\x2E\xC1", 4);      /* ucomisd xmm0, xmm1 */
+        trace_guard(tc, tc->step_positive ? JCC_JBE : JCC_JA, 0);
+    }
+
+    if (tc->closing_loop) {
+        emit_sse_reg(b, SSE_MOVSD_LOAD, 0, tc->loop_slots + 1);
+        emit_bytes(b, "\x66\x0F\x57\xC9", 4);      /* xorpd xmm1, xmm1 */
+        emit_bytes(b, "\x66\x0F\x2E\xC1", 4);      /* ucomisd xmm0, xmm1 */
+        trace_guard(tc, tc->step_positive ? JCC_JBE : JCC_JA, 0);
+    }
+
+    for (i = 0; i < tc->array_count; i++) {
+        emit_bytes(b, "\x48\xB9", 2);              /* mov rcx, array */
+        emit_pointer(b, tc->arrays[i]);
+        emit_bytes(b, "\x48\x83\xB9", 3);          /* cmp qword [rcx + data], 0 */
+        emit_u32(b, (uint32_t)offsetof(ArrayData, u));
+        emit_byte(b, 0x00);
+        trace_guard(tc, JCC_JE, 0);
+        emit_bytes(b, "\x83\xB9", 2);              /* cmp dword [rcx + is_string], 0 */
+        emit_u32(b, (uint32_t)offsetof(ArrayData, is_string));
+        emit_byte(b, 0x00);
+        trace_guard(tc, JCC_JNE, 0);
+    }
+
+    emit_jmp(b, FIX_TRACE_LOOP, 0);
+}
+
+/* Compile a recorded loop (pcs[0] is the anchor); NULL if it cannot be */
+static JitRegion* jit_compile_trace(VMState *vm, const uint32_t *pcs, size_t count) {
+    TraceCompiler tc;
+    JitRegion *region = NULL;
+    size_t *exit_offsets = NULL;
+    size_t i, entry, const_at;
+    uint32_t anchor = pcs[0];
+
+#ifndef BASSET_NAN_BOXING
+    if (sizeof(((Value*)0)->type) != 4) return NULL;
+#endif
+
+    memset(&tc, 0, sizeof(tc));
+    tc.vm = vm;
+    tc.consts = malloc(sizeof(double) * (count + 2));
+    tc.exits = malloc(sizeof(TraceExit) * (count + 1));
+    tc.arrays = malloc(sizeof(ArrayData*) * count);
+    if (!tc.consts || !tc.exits || !tc.arrays) goto done;
+
+    /* Exit 0: back to the interpreter at the anchor (failed entry guard) */
+    trace_exit(&tc, anchor, 0);
+
+    /* Body, looping back to offset 0 */
+    for (i = 0; i < count && !tc.failed; i++) {
+        uint32_t next = (i + 1 < count) ? pcs[i + 1] : anchor;
+        trace_emit_instruction(&tc, pcs[i], next, anchor, i + 1 == count);
+    }
+    if (tc.failed || tc.depth != 0) goto done;
+    emit_safepoint(&tc.b, vm, anchor, FIX_TRACE_EXIT, 0);
+    emit_jmp(&tc.b, FIX_TRACE_LOOP, 0);
+
+    entry = tc.b.len;
+    trace_emit_prologue(&tc, anchor);
+
+    /* Side exits */
+    exit_offsets = malloc(sizeof(size_t) * tc.exit_count);
+    if (!exit_offsets) goto done;
+    for (i = 0; i < tc.exit_count; i++) {
+        TraceExit *exit = &tc.exits[i];
+        int k;
+
+        exit_offsets[i] = tc.b.len;
+        for (k = 0; k < exit->depth - exit->ndepth; k++) {
+            trace_materialize(&tc, exit->stack, k);
+        }
+        if (exit->ndepth > 0) {
+            /* Number stack entries go to vm->num_stack[0..ndepth) */
+            emit_rax_mem(&tc.b, 0x8B, BASE_R12, (uint32_t)offsetof(VMState, num_stack));
+            for (k = exit->depth - exit->ndepth; k < exit->depth; k++) {
+                trace_sse(&tc, SSE_MOVSD_LOAD, 0, &exit->stack[k], k, 0);
+                emit_sse_mem(&tc.b, SSE_MOVSD_STORE, 0, BASE_RAX,
+                             (uint32_t)((k - (exit->depth - exit->ndepth)) * sizeof(double)));
+            }
+            emit_bytes(&tc.b, "\x49\xC7\x84\x24", 4);  /* mov qword [r12 + num_top], ndepth */
+            emit_u32(&tc.b, (uint32_t)offsetof(VMState, num_top));
+            emit_u32(&tc.b, (uint32_t)exit->ndepth);
+        }
+        if (exit->depth - exit->ndepth > 0) {
+            emit_bytes(&tc.b, "\x49\x8D\x86", 3);      /* lea rax, [r14 + depth] */
+            emit_u32(&tc.b, (uint32_t)(exit->depth - exit->ndepth));
+            emit_bytes(&tc.b, "\x49\x89\x84\x24", 4);  /* mov [r12 + stack_top], rax */
+            emit_u32(&tc.b, (uint32_t)offsetof(VMState, stack_top));
+        }
+        if (exit->pop_for) {
+            emit_bytes(&tc.b, "\x49\x83\xAC\x24", 4);  /* sub qword [r12 + for_top], 1 */
+            emit_u32(&tc.b, (uint32_t)offsetof(VMState, for_top));
+            emit_byte(&tc.b, 0x01);
+        }
+        emit_store_pc(&tc.b, exit->pc);
+        trace_epilogue(&tc.b);
+    }
+
+    /* Constants, 8-byte aligned */
+    while (tc.b.len % 8) emit_byte(&tc.b, 0xCC);
+    const_at = tc.b.len;
+    for (i = 0; i < tc.const_count; i++) {
+        unsigned long bits;
+        memcpy(&bits, &tc.consts[i], sizeof(bits));
+        emit_u64(&tc.b, bits);
+    }
+    if (tc.failed || tc.b.failed) goto done;
+
+    for (i = 0; i < tc.b.fixup_count; i++) {
+        JitFixup *fix = &tc.b.fixups[i];
+        patch_rel32(&tc.b, fix->at, fix->kind == FIX_TRACE_LOOP ? 0 : exit_offsets[fix->pc]);
+    }
+    for (i = 0; i < tc.const_ref_count; i++) {
+        TraceConstRef *ref = &tc.const_refs[i];
+        patch_rel32(&tc.b, ref->at, const_at + ref->index * 8 - ref->tail);
+    }
+
+    region = calloc(1, sizeof(JitRegion));
+    if (!region) goto done;
+    region->entry = entry;
+    region->start = anchor;
+    region->end = anchor + 1;
+    if (!jit_map_code(region, &tc.b)) {
+        jit_region_free(region);
+        region = NULL;
+    }
+
+done:
+    free(exit_offsets);
+    free(tc.consts);
+    free(tc.const_refs);
+    free(tc.exits);
+    free(tc.arrays);
+    free(tc.b.buf);
+    free(tc.b.fixups);
+    return region;
+}
+
+/* ------------------------------------------------------------------ */
+/* Entry points                                                        */
+/* ------------------------------------------------------------------ */
+
+/* Route every instruction through vm_jit_enter() while recording */
+static void jit_set_recording(VMState *vm, int on) {
+    size_t i;
+
+    for (i = 0; i <= vm->program->code_len; i++) {
+        if (on) {
+            vm->decoded[i].entry |= JIT_ENTRY_RECORD;
+        } else {
+            vm->decoded[i].entry &= (uint8_t)~JIT_ENTRY_RECORD;
+        }
+    }
+    vm->jit->recording = (uint8_t)on;
+    vm->decoded_bound = VM_BOUND_NONE;
+}
+
+static void jit_trace_abort(VMState *vm) {
+    JitState *jit = vm->jit;
+    uint32_t anchor = jit->rec_anchor;
+
+    jit_set_recording(vm, 0);
+    if (++jit->aborts[anchor] >= JIT_MAX_TRACE_ABORTS) {
+        jit->anchors[anchor] = 0;  /* Compile it as a line range instead */
+    }
+}
+
+static void jit_add_region(JitState *jit, JitRegion *region) {
+    region->next = jit->all;
+    jit->all = region;
+}
+
+static int jit_run(VMState *vm, JitRegion *region) {
+    uint32_t pc = vm->pc;
+    unsigned char *entry = region->code + region->entry;
+    JitCode code;
+
+    memcpy(&code, &entry, sizeof(code));
+    code(vm);
+
+    /* Bailing out on the entry instruction itself: interpret it */
+    return (vm->pc == pc) ? JIT_COLD : JIT_RAN;
+}
+
+/* Record the instruction at vm->pc, or finish the trace at the anchor */
+static int jit_record(VMState *vm) {
+    JitState *jit = vm->jit;
+    uint32_t pc = vm->pc;
+    JitRegion *trace;
+
+    if (pc == jit->rec_anchor) {
+        trace = jit_compile_trace(vm, jit->rec_pcs, jit->rec_len);
+        if (!trace) {
+            jit_trace_abort(vm);
+            return JIT_COLD;
+        }
+        jit_set_recording(vm, 0);
+        jit_add_region(jit, trace);
+        jit->traces[pc] = trace;
+        return jit_run(vm, trace);
+    }
+
+    if (jit->rec_len >= JIT_MAX_TRACE || jit->traces[pc] ||
+        !trace_instruction_words(vm->decoded[pc].opcode)) {
+        jit_trace_abort(vm);
+        return JIT_COLD;
+    }
+    jit->rec_pcs[jit->rec_len++] = pc;
+    return JIT_COLD;
+}
+
+int vm_jit_available(void) {
+    return 1;
+}
+
+JitState* vm_jit_new(VMState *vm, unsigned threshold) {
+    JitState *jit;
+    size_t len = vm->program->code_len;
+    size_t i;
+
+    if (threshold == 0 || sizeof(vm->break_flag) != 4) return NULL;
+
+    jit = calloc(1, sizeof(JitState));
+    if (!jit) return NULL;
+    jit->threshold = threshold;
+    jit->hits = calloc(len + 1, sizeof(uint32_t));
+    jit->regions = calloc(len + 1, sizeof(JitRegion*));
+    jit->traces = calloc(len + 1, sizeof(JitRegion*));
+    jit->anchors = calloc(len + 1, 1);
+    jit->aborts = calloc(len + 1, 1);
+    jit->rec_pcs = malloc(sizeof(uint32_t) * JIT_MAX_TRACE);
+    if (!jit->hits || !jit->regions || !jit->traces || !jit->anchors ||
+        !jit->aborts || !jit->rec_pcs) {
+        vm_jit_free(jit);
+        return NULL;
+    }
+
+    /* Entry points: line starts and loop anchors */
+    for (i = 0; i < vm->program->line_count; i++) {
+        uint32_t pc = vm->program->line_map[i].pc_offset;
+        if (pc < len) vm->decoded[pc].entry |= JIT_ENTRY_POINT;
+    }
+    for (i = 0; i < len; i++) {
+        const DecodedInstruction *inst = &vm->decoded[i];
+        uint32_t anchor = (uint32_t)len;
+
+        if (inst->opcode == OP_FOR_INIT || inst->opcode == OP_FOR_INIT_INT) {
+            anchor = (uint32_t)i + 1;
+        } else if (inst->opcode == OP_FOR_ENTER) {
+            anchor = (uint32_t)i + FOR_ENTER_WORDS;
+        } else if (inst->opcode == OP_JUMP && inst->operand <= i) {
+            anchor = inst->operand;
+        }
+        if (anchor < len) {
+            jit->anchors[anchor] = 1;
+            vm->decoded[anchor].entry |= JIT_ENTRY_POINT;
+        }
+    }
+
+    return jit;
+}
+
+void vm_jit_free(JitState *jit) {
+    if (!jit) return;
+    while (jit->all) {
+        JitRegion *next = jit->all->next;
+        jit_region_free(jit->all);
+        jit->all = next;
+    }
+    free(jit->hits);
+    free(jit->regions);
+    free(jit->traces);
+    free(jit->anchors);
+    free(jit->aborts);
+    free(jit->rec_pcs);
+    free(jit);
+}
+
+int vm_jit_enter(VMState *vm) {
+    JitState *jit = vm->jit;
+    uint32_t pc = vm->pc;
+    JitRegion *region;
+
+    if (!jit) return JIT_NEVER;
+    if (jit->recording) return jit_record(vm);
+    if (jit->traces[pc]) return jit_run(vm, jit->traces[pc]);
+
+    /* Loop anchor: record the next iteration once hot */
+    if (jit->anchors[pc]) {
+        if (++jit->hits[pc] >= jit->threshold) {
+            jit->hits[pc] = 0;
+            jit->rec_anchor = pc;
+            jit_set_recording(vm, 1);
+            if (!trace_instruction_words(vm->decoded[pc].opcode)) {
+                jit_trace_abort(vm);
+                return JIT_COLD;
+            }
+            jit->rec_pcs[0] = pc;
+            jit->rec_len = 1;
+        }
+        return JIT_COLD;
+    }
+
+    /* Line range */
+    region = jit->regions[pc];
+    if (!region) {
+        if (++jit->hits[pc] < jit->threshold) return JIT_COLD;
+        region = jit_compile(vm, pc);
+        if (!region) return JIT_NEVER;
+        jit_add_region(jit, region);
+        jit->regions[pc] = region;
+    }
+    return jit_run(vm, region);
+}
+
+#else /* !JIT_X86_64 */
+
+int vm_jit_available(void) {
+    return 0;
+}
+
+JitState* vm_jit_new(VMState *vm, unsigned threshold) {
+    (void)vm;
+    (void)threshold;
+    return NULL;
+}
+
+void vm_jit_free(JitState *jit) {
+    (void)jit;
+}
+
+int vm_jit_enter(VMState *vm) {
+    (void)vm;
+    return JIT_NEVER;
+}
+
+#endif /* JIT_X86_64 */
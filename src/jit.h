@@ -0,0 +1,58 @@
+/* jit.h - Optional x86-64 template JIT for hot line ranges */
+#ifndef JIT_H
+#define JIT_H
+
+#include "vm.h"
+
+/*
+ * The JIT is compiled in with -DBASSET_JIT (make JIT=yes) on x86-64 Unix
+ * systems; everywhere else the functions below are stubs and the VM only
+ * interprets.
+ *
+ * Every line start (from line_map) and every loop anchor is an entry
+ * point. vm_execute() calls vm_jit_enter() when it reaches one:
+ *
+ *   - a loop anchor (a FOR loop body start or the target of a backward
+ *     GOTO) that has been reached `threshold` times records the pcs its next
+ *     iteration executes, and that trace is compiled into a native loop
+ *     with guards that exit to the interpreter when execution leaves it;
+ *   - any other entry point reached `threshold` times compiles the line
+ *     range from that pc onwards, which runs until an instruction it does
+ *     not handle.
+ *
+ * Either way native code returns to the interpreter with vm->pc set to the
+ * next instruction to interpret.
+ */
+
+/* Entry point visits before a range is compiled */
+#define JIT_DEFAULT_THRESHOLD 100
+
+/* Longest range translated at once, in instruction words */
+#define JIT_MAX_REGION 2048
+
+/* Longest trace, in instructions, and recordings tried per anchor */
+#define JIT_MAX_TRACE 512
+#define JIT_MAX_TRACE_ABORTS 3
+
+/* DecodedInstruction.entry bits */
+#define JIT_ENTRY_POINT   0x01  /* Line start or loop anchor */
+#define JIT_ENTRY_RECORD  0x02  /* Set on every instruction while recording */
+
+/* vm_jit_enter() results */
+#define JIT_COLD   0    /* Not (yet) compiled: interpret the instruction */
+#define JIT_RAN    1    /* Native code ran; continue at vm->pc */
+#define JIT_NEVER  -1   /* Not compilable: stop treating pc as an entry point */
+
+typedef struct JitState JitState;
+
+/* 1 if this build can generate native code */
+int vm_jit_available(void);
+
+/* Create JIT state for vm and mark its entry points; NULL if unavailable */
+JitState* vm_jit_new(VMState *vm, unsigned threshold);
+void vm_jit_free(JitState *jit);
+
+/* Called at an entry point (vm->pc); see the JIT_* results above */
+int vm_jit_enter(VMState *vm);
+
+#endif /* JIT_H */
@@ -1,7 +1,88 @@
-/* value.h - Tagged value type for VM stack */
+/* value.h - Value type for the VM stack */
 #ifndef VALUE_H
 #define VALUE_H
 
+/*
+ * A Value holds either a number or a string. Code outside this header
+ * goes through the accessors below, so the representation is picked at
+ * build time:
+ *
+ *   default             a type tag next to a double/char* union (16 bytes)
+ *   -DBASSET_NAN_BOXING a single 8-byte word (make VALUE=nanbox)
+ *
+ * NaN-boxing stores numbers as plain doubles and hides a string pointer
+ * in the payload of a NaN that arithmetic never produces: the top 16 bits
+ * are VALUE_STRING_TAG and the low 48 bits are the pointer, which assumes
+ * 48-bit user-space addresses (x86-64, AArch64). Every double the VM
+ * stores must therefore be canonical - value_canonical() turns a NaN that
+ * carries the tag into the default quiet NaN - and the places a number
+ * enters the VM from outside (constants, DATA, VAL, INPUT) pass through
+ * it. Results of arithmetic on canonical numbers are canonical already.
+ *
+ *   VALUE_IS_NUMBER(v), VALUE_IS_STRING(v)   type tests
+ *   VALUE_NUMBER(v)                          the double (an lvalue)
+ *   VALUE_STRING(v)                          the char*
+ *   VALUE_SET_NUMBER(v, n)                   store a canonical number
+ *   value_number(n), value_string(s)         construct a Value
+ */
+
+#ifdef BASSET_NAN_BOXING
+
+#include <stdint.h>
+
+typedef union {
+    double number;
+    uint64_t bits;
+} Value;
+
+#define VALUE_TAG_MASK      ((uint64_t)0xFFFF << 48)
+#define VALUE_STRING_TAG    ((uint64_t)0xFFFC << 48)
+#define VALUE_POINTER_MASK  (((uint64_t)1 << 48) - 1)
+#define VALUE_CANONICAL_NAN ((uint64_t)0x7FF8 << 48)
+
+#define VALUE_IS_STRING(v)  (((v).bits & VALUE_TAG_MASK) == VALUE_STRING_TAG)
+#define VALUE_IS_NUMBER(v)  (!VALUE_IS_STRING(v))
+#define VALUE_NUMBER(v)     ((v).number)
+#define VALUE_STRING(v)     ((char *)(uintptr_t)((v).bits & VALUE_POINTER_MASK))
+#define VALUE_SET_NUMBER(v, n) ((v).number = (n))
+
+/* Byte offset of the double inside a Value, for generated code */
+#define VALUE_NUMBER_OFFSET 0
+
+#ifdef __GNUC__
+__attribute__((unused))
+#endif
+static double value_canonical(double n) {
+    Value v;
+    v.number = n;
+    if ((v.bits & VALUE_TAG_MASK) == VALUE_STRING_TAG) {
+        v.bits = VALUE_CANONICAL_NAN;
+    }
+    return v.number;
+}
+
+#ifdef __GNUC__
+__attribute__((unused))
+#endif
+static Value value_number(double n) {
+    Value v;
+    v.number = value_canonical(n);
+    return v;
+}
+
+#ifdef __GNUC__
+__attribute__((unused))
+#endif
+static Value value_string(char *s) {
+    Value v;
+    v.bits = VALUE_STRING_TAG | ((uint64_t)(uintptr_t)s & VALUE_POINTER_MASK);
+    return v;
+}
+
+#else /* tagged */
+
+#include <stddef.h>
+
 /* Value type tags */
 typedef enum {
     VAL_NUMBER,     /* Numeric value (double) */
@@ -17,6 +98,18 @@ typedef struct {
     } data;
 } Value;
 
+#define VALUE_IS_NUMBER(v)  ((v).type == VAL_NUMBER)
+#define VALUE_IS_STRING(v)  ((v).type == VAL_STRING)
+#define VALUE_NUMBER(v)     ((v).data.number)
+#define VALUE_STRING(v)     ((v).data.string)
+#define VALUE_SET_NUMBER(v, n) ((v).type = VAL_NUMBER, (v).data.number = (n))
+
+/* Byte offset of the double inside a Value, for generated code */
+#define VALUE_NUMBER_OFFSET offsetof(Value, data)
+
+/* Every double is representable as-is */
+#define value_canonical(n)  (n)
+
 /* Helper functions for creating values */
 #ifdef __GNUC__
 __attribute__((unused))
@@ -38,4 +131,6 @@ static Value value_string(char *s) {
     return v;
 }
 
+#endif /* BASSET_NAN_BOXING */
+
 #endif
@@ -0,0 +1,1144 @@
+/* verify.c - Load-time bytecode verifier */
+#define _POSIX_C_SOURCE 200112L  /* Enable snprintf */
+#include "verify.h"
+#include "bytecode.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The abstract state at a pc is the expression stack as a list of entry
+ * types. States are joined where paths meet: depths must agree, and an
+ * entry that is a number on one path and a string on another becomes
+ * T_ANY. The worklist runs until no state changes.
+ *
+ * Number stack entries (OP_N_*) are tracked on the same list as T_DBL.
+ * The compiler only ever uses the number stack above everything on the
+ * expression stack, so an instruction must find exactly the kind of entry
+ * it pops - a double for an N_ instruction, a value for any other - and a
+ * position that is a double on one path and a value on another is an
+ * error.
+ *
+ * GOSUB and FOR/NEXT transfer control through the VM's call and FOR stacks
+ * rather than through operands, so two extra nodes stand in for them: every
+ * RETURN flows into a return node, which flows into every GOSUB return
+ * point, and every NEXT flows into a loop node, which flows into every FOR
+ * loop body start.
+ */
+
+/* Abstract stack entry types (joined with |) */
+#define T_NUM   1
+#define T_STR   2
+#define T_ANY   (T_NUM | T_STR)
+#define T_DBL   4                /* Number stack entry */
+
+/* Per-word kinds */
+#define WORD_START      0x01     /* An instruction starts here */
+#define WORD_DATA       0x02     /* ON table entry or register operand word */
+#define WORD_RETURN     0x04     /* GOSUB return point (registered) */
+#define WORD_LOOP       0x08     /* FOR loop body start (registered) */
+
+typedef struct {
+    CompiledProgram *prog;
+    size_t len;                  /* code_len: reaching it halts */
+    size_t join_return;          /* Node every RETURN flows into */
+    size_t join_loop;            /* Node every NEXT flows into */
+    uint8_t *kind;               /* WORD_* per word */
+
+    /* Node states: depth (-1 until reached) and types at pool + base */
+    long *depth;
+    size_t *base;
+    uint8_t *pool;
+    size_t pool_len;
+    size_t pool_capacity;
+
+    size_t *work;                /* Nodes whose state changed */
+    size_t work_len;
+    uint8_t *queued;
+
+    size_t *return_sites;        /* GOSUB return points */
+    size_t return_count;
+    size_t *loop_sites;          /* FOR loop body starts */
+    size_t loop_count;
+
+    /* State being interpreted */
+    uint8_t *stack;
+    size_t stack_top;
+    size_t stack_capacity;
+    size_t max_depth;
+    size_t max_doubles;          /* Deepest number stack */
+
+    char *error;
+    size_t error_size;
+} Verifier;
+
+/* Stack effect as "pops:pushes", deepest entry first; N number, S string, */
+/* A either, D number stack entry. NULL for opcodes the VM has no handler for */
+static const char* verify_signature(uint8_t op) {
+    switch (op) {
+        case OP_PUSH_CONST:
+        case OP_PUSH_VAR:
+        case OP_FN_ERR:
+        case OP_VAR_MUL_VAR:
+        case OP_VAR_ARRAY_GET_1D:
+        case OP_ARRAY_LOAD_1D:
+        case OP_ARRAY_LOAD_2D:
+        case OP_ARRAY_ADDR_2D:
+        case OP_R_PUSH:
+            return ":N";
+        case OP_STR_PUSH:
+        case OP_STR_PUSH_VAR:
+            return ":S";
+        case OP_POP_VAR:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP_LINE:
+        case OP_GOSUB_LINE:
+        case OP_ON_GOTO:
+        case OP_ON_GOSUB:
+        case OP_DIM_1D:
+        case OP_SET_PRINT_CHANNEL:
+        case OP_PRINT_NUM:
+        case OP_TAB_FUNC:
+        case OP_CLOSE:
+        case OP_RESTORE_LINE:
+        case OP_RANDOMIZE:
+        case OP_ARRAY_STORE_1D:
+        case OP_ARRAY_STORE_2D:
+        case OP_ARRAY_STORE_ADDR:
+        case OP_R_POP:
+            return "N:";
+        case OP_STR_POP_VAR:
+        case OP_PRINT_STR:
+            return "S:";
+        case OP_DUP:
+            return "A:AA";
+        case OP_POP:
+            return "A:";
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD:
+        case OP_POW:
+        case OP_EQ:              /* Strings compare too, but unflagged */
+        case OP_NE:
+        case OP_LT:
+        case OP_LE:
+        case OP_GT:
+        case OP_GE:
+        case OP_AND:
+        case OP_OR:
+        case OP_ARRAY_GET_2D:
+            return "NN:N";
+        case OP_NEG:
+        case OP_NOT:
+        case OP_FUNC_SIN:
+        case OP_FUNC_COS:
+        case OP_FUNC_TAN:
+        case OP_FUNC_ATN:
+        case OP_FUNC_EXP:
+        case OP_FUNC_LOG:
+        case OP_FUNC_CLOG:
+        case OP_FUNC_SQR:
+        case OP_FUNC_ABS:
+        case OP_FUNC_INT:
+        case OP_FUNC_RND:
+        case OP_FUNC_SGN:
+        case OP_FUNC_PEEK:
+        case OP_ARRAY_GET_1D:
+        case OP_GET:
+        case OP_STATUS:
+            return "N:N";
+        case OP_STR_LEN:
+        case OP_STR_VAL:
+        case OP_STR_ASC:
+            return "S:N";
+        case OP_STR_CHR:
+        case OP_STR_STR:
+        case OP_STR_ARRAY_GET_1D:
+            return "N:S";
+        case OP_STR_LEFT:
+        case OP_STR_RIGHT:
+        case OP_STR_MID_2:
+            return "SN:S";
+        case OP_STR_MID:
+            return "SNN:S";
+        case OP_STR_ARRAY_GET_2D:
+            return "NN:S";
+        case OP_ARRAY_SET_1D:
+        case OP_DIM_2D:
+        case OP_PUT:
+        case OP_POKE:
+        case OP_JNLT:
+        case OP_JNLE:
+        case OP_JNGT:
+        case OP_JNGE:
+        case OP_JNEQ:
+        case OP_JNNE:
+            return "NN:";
+        case OP_ARRAY_SET_2D:
+        case OP_FOR_INIT:
+        case OP_FOR_INIT_INT:
+        case OP_FOR_ENTER:
+        case OP_POINT:
+            return "NNN:";
+        case OP_STR_ARRAY_SET_1D:
+            return "NS:";
+        case OP_STR_ARRAY_SET_2D:
+            return "NNS:";
+        case OP_NOTE:
+            return "N:NN";
+        case OP_OPEN:
+            return "NNNS:";
+        case OP_XIO:
+            return "NNNNS:";
+        case OP_JUMP:
+        case OP_GOSUB:
+        case OP_RETURN:
+        case OP_FOR_NEXT:
+        case OP_FOR_NEXT_INT:
+        case OP_FOR_LOOP:
+        case OP_PRINT_NEWLINE:
+        case OP_PRINT_SPACE:
+        case OP_PRINT_TAB:
+        case OP_PRINT_NOSEP:
+        case OP_INPUT_NUM:
+        case OP_INPUT_STR:
+        case OP_INPUT_PROMPT:
+        case OP_DATA_READ_NUM:
+        case OP_DATA_READ_STR:
+        case OP_TRAP:
+        case OP_TRAP_DISABLE:
+        case OP_END:
+        case OP_STOP:
+        case OP_RESTORE:
+        case OP_DEG:
+        case OP_RAD:
+        case OP_CLR:
+        case OP_POP_GOSUB:
+        case OP_NOP:
+        case OP_HALT:
+        case OP_VAR_ADD_CONST_POP:
+        case OP_VAR_SUB_CONST_POP:
+        case OP_R_MOV:
+        case OP_R_ADD:
+        case OP_R_SUB:
+        case OP_R_MUL:
+        case OP_R_DIV:
+        case OP_R_POW:
+        case OP_R_NEG:
+        case OP_R_JNLT:
+        case OP_R_JNLE:
+        case OP_R_JNGT:
+        case OP_R_JNGE:
+        case OP_R_JNEQ:
+        case OP_R_JNNE:
+            return ":";
+        case OP_N_PUSH_CONST:
+        case OP_N_PUSH_VAR:
+        case OP_N_VAR_MUL_VAR:
+            return ":D";
+        case OP_N_POP_VAR:
+            return "D:";
+        case OP_N_ADD:
+        case OP_N_SUB:
+        case OP_N_MUL:
+        case OP_N_DIV:
+        case OP_N_POW:
+        case OP_N_EQ:
+        case OP_N_NE:
+        case OP_N_LT:
+        case OP_N_LE:
+        case OP_N_GT:
+        case OP_N_GE:
+        case OP_N_AND:
+        case OP_N_OR:
+            return "DD:D";
+        case OP_N_NEG:
+        case OP_N_NOT:
+            return "D:D";
+        case OP_N_BOX:
+            return "D:N";
+        default:
+            return NULL;
+    }
+}
+
+/* Words from the instruction at pc to the next one in program order */
+/* (superinstructions count as one: the words they cover stay instructions) */
+static size_t verify_instruction_words(const Instruction *inst) {
+    if (inst->opcode == OP_ON_GOTO || inst->opcode == OP_ON_GOSUB) {
+        return (size_t)inst->operand + 1;
+    }
+    if (OP_IS_REGISTER(inst->opcode)) {
+        return REG_INSTRUCTION_WORDS(inst->opcode);
+    }
+    if (inst->opcode == OP_FOR_ENTER) return FOR_ENTER_WORDS;
+    if (inst->opcode == OP_FOR_LOOP) return FOR_LOOP_WORDS;
+    if (OP_IS_ARRAY_INDEXED(inst->opcode)) return ARRAY_INDEXED_WORDS(inst->opcode);
+    return 1;
+}
+
+/* Words the instruction at pc executes (a superinstruction's whole sequence) */
+static size_t verify_step_words(const Instruction *inst) {
+    switch (inst->opcode) {
+        case OP_VAR_ADD_CONST_POP:
+        case OP_VAR_SUB_CONST_POP:
+            return 4;
+        case OP_VAR_MUL_VAR:
+        case OP_N_VAR_MUL_VAR:
+            return 3;
+        case OP_VAR_ARRAY_GET_1D:
+            return 2;
+        default:
+            return verify_instruction_words(inst);
+    }
+}
+
+static int verify_fail(Verifier *v, size_t pc, const char *what) {
+    if (pc < v->len) {
+        snprintf(v->error, v->error_size, "pc %lu (opcode 0x%02X, operand %u): %s",
+                 (unsigned long)pc, (unsigned)v->prog->code[pc].opcode,
+                 (unsigned)v->prog->code[pc].operand, what);
+    } else {
+        snprintf(v->error, v->error_size, "pc %lu: %s", (unsigned long)pc, what);
+    }
+    return 0;
+}
+
+static void verify_enqueue(Verifier *v, size_t node) {
+    if (!v->queued[node]) {
+        v->queued[node] = 1;
+        v->work[v->work_len++] = node;
+    }
+}
+
+/* Join the state being interpreted into node's state */
+static int verify_flow(Verifier *v, size_t from, size_t node) {
+    uint8_t *types;
+    size_t i;
+    int changed = 0;
+
+    if (node == v->len) return 1;  /* Halt sentinel */
+
+    if (v->depth[node] < 0) {
+        if (v->pool_len + v->stack_top > v->pool_capacity) {
+            size_t capacity = v->pool_capacity * 2 + v->stack_top;
+            uint8_t *pool = realloc(v->pool, capacity);
+            if (!pool) return verify_fail(v, from, "out of memory");
+            v->pool = pool;
+            v->pool_capacity = capacity;
+        }
+        v->depth[node] = (long)v->stack_top;
+        v->base[node] = v->pool_len;
+        if (v->stack_top > 0) memcpy(v->pool + v->pool_len, v->stack, v->stack_top);
+        v->pool_len += v->stack_top;
+        verify_enqueue(v, node);
+        return 1;
+    }
+
+    if ((size_t)v->depth[node] != v->stack_top) {
+        char what[96];
+        snprintf(what, sizeof(what), "stack depth %lu flowing to pc %lu, which has %ld",
+                 (unsigned long)v->stack_top, (unsigned long)node, v->depth[node]);
+        return verify_fail(v, from, what);
+    }
+
+    types = v->pool + v->base[node];
+    for (i = 0; i < v->stack_top; i++) {
+        if ((types[i] == T_DBL) != (v->stack[i] == T_DBL)) {
+            return verify_fail(v, from, "number stack entry meets a value where paths join");
+        }
+        if ((types[i] | v->stack[i]) != types[i]) {
+            types[i] |= v->stack[i];
+            changed = 1;
+        }
+    }
+    if (changed) verify_enqueue(v, node);
+    return 1;
+}
+
+/* A jump, GOSUB, ON or TRAP target: an instruction start or the end */
+static int verify_target(Verifier *v, size_t pc, size_t target) {
+    if (target > v->len || (target < v->len && !(v->kind[target] & WORD_START))) {
+        return verify_fail(v, pc, "target is not the start of an instruction");
+    }
+    return 1;
+}
+
+/* Record a GOSUB return point or FOR loop body start; the join node */
+/* flows into it the next time it is processed */
+static void verify_add_site(Verifier *v, size_t site, uint8_t bit) {
+    size_t join = (bit == WORD_RETURN) ? v->join_return : v->join_loop;
+
+    if (site >= v->len || (v->kind[site] & bit)) return;
+    v->kind[site] |= bit;
+    if (bit == WORD_RETURN) {
+        v->return_sites[v->return_count++] = site;
+    } else {
+        v->loop_sites[v->loop_count++] = site;
+    }
+    if (v->depth[join] >= 0) verify_enqueue(v, join);
+}
+
+/* Operand ranges of the instruction at pc */
+static int verify_operands(Verifier *v, size_t pc) {
+    CompiledProgram *prog = v->prog;
+    const Instruction *inst = &prog->code[pc];
+    uint16_t operand = inst->operand;
+    size_t k, words;
+
+    switch (inst->opcode) {
+        case OP_PUSH_VAR:
+        case OP_POP_VAR:
+        case OP_N_PUSH_VAR:
+        case OP_N_POP_VAR:
+        case OP_STR_PUSH_VAR:
+        case OP_STR_POP_VAR:
+        case OP_INPUT_NUM:
+        case OP_INPUT_STR:
+        case OP_DATA_READ_NUM:
+        case OP_DATA_READ_STR:
+        case OP_FOR_INIT:
+        case OP_FOR_INIT_INT:
+        case OP_FOR_NEXT_INT:
+        case OP_ARRAY_GET_1D:
+        case OP_ARRAY_SET_1D:
+        case OP_ARRAY_GET_2D:
+        case OP_ARRAY_SET_2D:
+        case OP_DIM_1D:
+        case OP_DIM_2D:
+        case OP_STR_ARRAY_GET_1D:
+        case OP_STR_ARRAY_SET_1D:
+        case OP_STR_ARRAY_GET_2D:
+        case OP_STR_ARRAY_SET_2D:
+        case OP_ARRAY_STORE_ADDR:
+            if (operand >= prog->var_count) return verify_fail(v, pc, "variable slot out of range");
+            return 1;
+
+        case OP_FOR_NEXT:
+            if (operand != 0xFFFF && operand >= prog->var_count) {
+                return verify_fail(v, pc, "variable slot out of range");
+            }
+            return 1;
+
+        /* Word 1: the hidden limit and step slots; FOR_LOOP word 2: the body */
+        case OP_FOR_ENTER:
+        case OP_FOR_LOOP:
+            if (operand >= prog->var_count || (size_t)inst[1].operand + 1 >= prog->var_count) {
+                return verify_fail(v, pc, "variable slot out of range");
+            }
+            if (inst->opcode == OP_FOR_LOOP && !verify_target(v, pc, inst[2].operand)) return 0;
+            return 1;
+
+        /* The array, then one subscript variable per operand word */
+        case OP_ARRAY_LOAD_1D:
+        case OP_ARRAY_STORE_1D:
+        case OP_ARRAY_LOAD_2D:
+        case OP_ARRAY_STORE_2D:
+        case OP_ARRAY_ADDR_2D:
+            for (k = 0; k < ARRAY_INDEXED_WORDS(inst->opcode); k++) {
+                if (inst[k].operand >= prog->var_count) {
+                    return verify_fail(v, pc, "variable slot out of range");
+                }
+            }
+            return 1;
+
+        case OP_PUSH_CONST:
+        case OP_N_PUSH_CONST:
+            if (operand >= prog->const_count) return verify_fail(v, pc, "constant out of range");
+            return 1;
+
+        case OP_STR_PUSH:
+        case OP_INPUT_PROMPT:
+            if (operand >= prog->string_count) return verify_fail(v, pc, "string out of range");
+            return 1;
+
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_GOSUB:
+        case OP_TRAP:
+        case OP_JNLT:
+        case OP_JNLE:
+        case OP_JNGT:
+        case OP_JNGE:
+        case OP_JNEQ:
+        case OP_JNNE:
+            return verify_target(v, pc, operand);
+
+        case OP_ON_GOTO:
+        case OP_ON_GOSUB:
+            for (k = 1; k <= operand; k++) {
+                if (!verify_target(v, pc, prog->code[pc + k].operand)) return 0;
+            }
+            return 1;
+
+        /* Superinstructions: the rest of the sequence must still be there */
+        case OP_VAR_ADD_CONST_POP:
+        case OP_VAR_SUB_CONST_POP: {
+            int add = inst->opcode == OP_VAR_ADD_CONST_POP;
+            if (pc + 3 >= v->len ||
+                !((inst[1].opcode == OP_PUSH_CONST &&
+                   inst[2].opcode == (add ? OP_ADD : OP_SUB) &&
+                   inst[3].opcode == OP_POP_VAR) ||
+                  (inst[1].opcode == OP_N_PUSH_CONST &&
+                   inst[2].opcode == (add ? OP_N_ADD : OP_N_SUB) &&
+                   inst[3].opcode == OP_N_POP_VAR))) {
+                return verify_fail(v, pc, "superinstruction sequence is incomplete");
+            }
+            if (operand >= prog->var_count || inst[3].operand >= prog->var_count) {
+                return verify_fail(v, pc, "variable slot out of range");
+            }
+            if (inst[1].operand >= prog->const_count) return verify_fail(v, pc, "constant out of range");
+            return 1;
+        }
+
+        case OP_VAR_MUL_VAR:
+        case OP_N_VAR_MUL_VAR: {
+            int n = inst->opcode == OP_N_VAR_MUL_VAR;
+            if (pc + 2 >= v->len ||
+                inst[1].opcode != (n ? OP_N_PUSH_VAR : OP_PUSH_VAR) ||
+                inst[2].opcode != (n ? OP_N_MUL : OP_MUL)) {
+                return verify_fail(v, pc, "superinstruction sequence is incomplete");
+            }
+            if (operand >= prog->var_count || inst[1].operand >= prog->var_count) {
+                return verify_fail(v, pc, "variable slot out of range");
+            }
+            return 1;
+        }
+
+        case OP_VAR_ARRAY_GET_1D:
+            if (pc + 1 >= v->len || inst[1].opcode != OP_ARRAY_GET_1D) {
+                return verify_fail(v, pc, "superinstruction sequence is incomplete");
+            }
+            if (operand >= prog->var_count || inst[1].operand >= prog->var_count) {
+                return verify_fail(v, pc, "variable slot out of range");
+            }
+            return 1;
+
+        default:
+            break;
+    }
+
+    if (OP_IS_REGISTER(inst->opcode)) {
+        if (prog->isa != ISA_REG) return verify_fail(v, pc, "register instruction outside ISA_REG code");
+        if (OP_IS_REG_BRANCH(inst->opcode) && !verify_target(v, pc, operand)) return 0;
+
+        /* Word 0 holds the jump target for branches, a register otherwise */
+        words = REG_INSTRUCTION_WORDS(inst->opcode);
+        for (k = OP_IS_REG_BRANCH(inst->opcode) ? 1 : 0; k < words; k++) {
+            uint16_t reg = inst[k].operand;
+            size_t index = reg & REG_INDEX_MASK;
+            size_t limit;
+
+            switch (reg & REG_CLASS_MASK) {
+                case REG_VAR:   limit = prog->var_count; break;
+                case REG_TEMP:  limit = prog->reg_temps; break;
+                case REG_CONST: limit = prog->const_count; break;
+                default:        limit = 0; break;
+            }
+            if (index >= limit) return verify_fail(v, pc, "register out of range");
+        }
+    }
+    return 1;
+}
+
+/* Interpret the instruction at pc from its recorded state */
+static int verify_instruction(Verifier *v, size_t pc) {
+    const Instruction *inst = &v->prog->code[pc];
+    const char *sig = verify_signature(inst->opcode);
+    const char *pushes;
+    size_t next, k, pops;
+
+    if (!sig) return verify_fail(v, pc, "unknown opcode");
+    if (!verify_operands(v, pc)) return 0;
+
+    /* Load the state */
+    v->stack_top = (size_t)v->depth[pc];
+    if (v->stack_top + 2 > v->stack_capacity) {
+        size_t capacity = v->stack_capacity * 2 + v->stack_top;
+        uint8_t *stack = realloc(v->stack, capacity);
+        if (!stack) return verify_fail(v, pc, "out of memory");
+        v->stack = stack;
+        v->stack_capacity = capacity;
+    }
+    if (v->stack_top > 0) memcpy(v->stack, v->pool + v->base[pc], v->stack_top);
+
+    /* Apply the stack effect */
+    pushes = strchr(sig, ':') + 1;
+    pops = (size_t)(pushes - 1 - sig);
+    if (v->stack_top < pops) return verify_fail(v, pc, "stack underflow");
+    for (k = 0; k < pops; k++) {
+        uint8_t type = v->stack[v->stack_top - pops + k];
+        if (sig[k] == 'D' ? type != T_DBL : (type & T_DBL) != 0) {
+            return verify_fail(v, pc, sig[k] == 'D' ? "number stack entry expected" :
+                               "value expected, number stack entry found");
+        }
+    }
+    if (inst->opcode == OP_DUP) {
+        v->stack[v->stack_top] = v->stack[v->stack_top - 1];
+        v->stack_top++;
+    } else {
+        v->stack_top -= pops;
+        for (; *pushes; pushes++) {
+            v->stack[v->stack_top++] = (*pushes == 'S') ? T_STR :
+                                       (*pushes == 'D') ? T_DBL : T_NUM;
+        }
+    }
+    if (v->stack_top > v->max_depth) v->max_depth = v->stack_top;
+    if (strchr(pushes - 1, 'D') || inst->opcode == OP_N_VAR_MUL_VAR) {
+        size_t doubles = 0;
+        for (k = 0; k < v->stack_top; k++) {
+            if (v->stack[k] == T_DBL) doubles++;
+        }
+        if (doubles > v->max_doubles) v->max_doubles = doubles;
+    }
+
+    /* Successors */
+    next = pc + verify_step_words(inst);
+    switch (inst->opcode) {
+        case OP_END:
+        case OP_STOP:
+        case OP_HALT:
+            return 1;
+
+        case OP_JUMP:
+            return verify_flow(v, pc, inst->operand);
+
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JNLT:
+        case OP_JNLE:
+        case OP_JNGT:
+        case OP_JNGE:
+        case OP_JNEQ:
+        case OP_JNNE:
+        case OP_R_JNLT:
+        case OP_R_JNLE:
+        case OP_R_JNGT:
+        case OP_R_JNGE:
+        case OP_R_JNEQ:
+        case OP_R_JNNE:
+            return verify_flow(v, pc, inst->operand) && verify_flow(v, pc, next);
+
+        /* Computed targets are line starts, which begin on an empty stack */
+        case OP_JUMP_LINE:
+        case OP_GOSUB_LINE:
+            if (v->stack_top != 0) return verify_fail(v, pc, "values left on the stack at GOTO/GOSUB");
+            if (inst->opcode == OP_GOSUB_LINE) verify_add_site(v, next, WORD_RETURN);
+            return 1;
+
+        case OP_GOSUB:
+            verify_add_site(v, next, WORD_RETURN);
+            return verify_flow(v, pc, inst->operand);
+
+        case OP_RETURN:
+            return verify_flow(v, pc, v->join_return);
+
+        case OP_ON_GOTO:
+        case OP_ON_GOSUB:
+            for (k = 1; k <= inst->operand; k++) {
+                if (!verify_flow(v, pc, inst[k].operand)) return 0;
+            }
+            if (inst->opcode == OP_ON_GOSUB) verify_add_site(v, next, WORD_RETURN);
+            return verify_flow(v, pc, next);
+
+        case OP_FOR_INIT:
+        case OP_FOR_INIT_INT:
+            verify_add_site(v, next, WORD_LOOP);
+            return verify_flow(v, pc, next);
+
+        case OP_FOR_NEXT:
+        case OP_FOR_NEXT_INT:
+            return verify_flow(v, pc, v->join_loop) && verify_flow(v, pc, next);
+
+        case OP_FOR_LOOP:
+            return verify_flow(v, pc, inst[2].operand) && verify_flow(v, pc, next);
+
+        /* An error caught by TRAP restarts at its line on an empty stack */
+        case OP_TRAP:
+            if (!verify_flow(v, pc, next)) return 0;
+            v->stack_top = 0;
+            return verify_flow(v, pc, inst->operand);
+
+        default:
+            return verify_flow(v, pc, next);
+    }
+}
+
+/* Flow a join node's state into every site registered for it */
+static int verify_join(Verifier *v, size_t node) {
+    const size_t *sites = (node == v->join_return) ? v->return_sites : v->loop_sites;
+    size_t count = (node == v->join_return) ? v->return_count : v->loop_count;
+    size_t i;
+
+    v->stack_top = (size_t)v->depth[node];
+    if (v->stack_top > v->stack_capacity) {
+        uint8_t *stack = realloc(v->stack, v->stack_top);
+        if (!stack) return verify_fail(v, node, "out of memory");
+        v->stack = stack;
+        v->stack_capacity = v->stack_top;
+    }
+    if (v->stack_top > 0) memcpy(v->stack, v->pool + v->base[node], v->stack_top);
+
+    for (i = 0; i < count; i++) {
+        if (!verify_flow(v, node, sites[i])) return 0;
+    }
+    return 1;
+}
+
+/* 1 if every entry the instruction pops is proven to have the type it takes */
+static int verify_operand_types(const Verifier *v, size_t pc) {
+    const char *sig = verify_signature(v->prog->code[pc].opcode);
+    size_t pops = (size_t)(strchr(sig, ':') - sig);
+    const uint8_t *types = v->pool + v->base[pc] + (size_t)v->depth[pc] - pops;
+    size_t i;
+
+    for (i = 0; i < pops; i++) {
+        if (sig[i] == 'N' && types[i] != T_NUM) return 0;
+        if (sig[i] == 'S' && types[i] != T_STR) return 0;
+    }
+    return 1;
+}
+
+/* Subscript ranges
+ *
+ * verify_subscripts() proves an array access subscripted by variables in
+ * range from the shape of the code alone, so the proof holds on every path:
+ *
+ *   - the array is numeric, the program has no CLR, and its only DIM has
+ *     constant bounds and sits in the straight-line code the program opens
+ *     with, which nothing jumps into and which cannot set a TRAP, so the
+ *     DIM runs exactly once, before anything else uses the array, and an
+ *     allocation failure ends the run;
+ *   - each subscript variable belongs to a paired FOR loop whose body holds
+ *     the access, whose start, limit and STEP are constants pushed right
+ *     before its OP_FOR_ENTER, and whose body is entered only through the
+ *     FOR and its NEXT and never stores into the variable or the loop's
+ *     hidden limit and STEP slots. The variable then stays between the
+ *     start and the limit (the body runs once even if the start is past
+ *     the limit).
+ */
+
+#define BOUNDS_MAX_DIM 2147483647.0  /* Largest DIM bound the proof accepts */
+
+typedef struct {
+    size_t first, last;          /* No transfer may land in here ... */
+    size_t body_first, body_last;/* ... nor in here from outside */
+    int has_body;
+} BoundsRegion;
+
+/* 1 unless a transfer from pc (from any pc, with anywhere) lands in region */
+static int bounds_target_ok(const BoundsRegion *r, size_t pc, size_t target, int anywhere) {
+    if (target >= r->first && target <= r->last) return 0;
+    if (r->has_body && target >= r->body_first && target <= r->body_last &&
+        (anywhere || pc < r->body_first || pc > r->body_last)) return 0;
+    return 1;
+}
+
+/* 1 if no jump, call, return, NEXT or TRAP can enter region other than */
+/* from inside its body */
+static int bounds_no_entry(const CompiledProgram *prog, const BoundsRegion *r) {
+    const Instruction *code = prog->code;
+    size_t len = prog->code_len;
+    size_t pc, k, words;
+    int computed = 0;
+
+    for (pc = 0; pc < len; pc += words) {
+        const Instruction *inst = &code[pc];
+        int ok = 1;
+
+        words = verify_instruction_words(inst);
+        if (pc + words > len) return 0;
+        switch (inst->opcode) {
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_JNLT: case OP_JNLE: case OP_JNGT:
+            case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+                ok = bounds_target_ok(r, pc, inst->operand, 0);
+                break;
+            case OP_GOSUB:
+                ok = bounds_target_ok(r, pc, inst->operand, 0) &&
+                     bounds_target_ok(r, pc, pc + 1, 1);
+                break;
+            case OP_ON_GOTO:
+            case OP_ON_GOSUB:
+                for (k = 1; k < words && ok; k++) {
+                    ok = bounds_target_ok(r, pc, inst[k].operand, 0);
+                }
+                if (ok && inst->opcode == OP_ON_GOSUB) ok = bounds_target_ok(r, pc, pc + words, 1);
+                break;
+            case OP_FOR_LOOP:
+                ok = bounds_target_ok(r, pc, inst[2].operand, 0);
+                break;
+
+            /* RETURN, NEXT and a trapped error come back from anywhere */
+            case OP_GOSUB_LINE:
+            case OP_FOR_INIT:
+            case OP_FOR_INIT_INT:
+                ok = bounds_target_ok(r, pc, pc + 1, 1);
+                computed |= inst->opcode == OP_GOSUB_LINE;
+                break;
+            case OP_TRAP:
+                ok = bounds_target_ok(r, pc, inst->operand, 1);
+                break;
+            case OP_JUMP_LINE:
+                computed = 1;
+                break;
+            default:
+                if (OP_IS_REG_BRANCH(inst->opcode)) ok = bounds_target_ok(r, pc, inst->operand, 0);
+                break;
+        }
+        if (!ok) return 0;
+    }
+
+    /* A computed GOTO or GOSUB can reach any line */
+    for (k = 0; computed && k < prog->line_count; k++) {
+        if (!bounds_target_ok(r, len, prog->line_map[k].pc_offset, 1)) return 0;
+    }
+    return 1;
+}
+
+/* 1 if the instruction at pc may store into numeric variable slot */
+static int bounds_stores(const CompiledProgram *prog, size_t pc, uint16_t slot) {
+    const Instruction *inst = &prog->code[pc];
+    size_t len = prog->code_len;
+
+    switch (inst->opcode) {
+        case OP_POP_VAR:
+        case OP_N_POP_VAR:
+        case OP_INPUT_NUM:
+        case OP_DATA_READ_NUM:
+        case OP_FOR_INIT:
+        case OP_FOR_INIT_INT:
+        case OP_FOR_NEXT_INT:
+            return inst->operand == slot;
+        case OP_FOR_NEXT:
+            return inst->operand == slot || inst->operand == 0xFFFF;
+        case OP_FOR_ENTER:
+        case OP_FOR_LOOP:
+            return inst->operand == slot || pc + 1 >= len ||
+                   inst[1].operand == slot || inst[1].operand + 1 == slot;
+        case OP_VAR_ADD_CONST_POP:
+        case OP_VAR_SUB_CONST_POP:
+            return pc + 3 >= len || inst[3].operand == slot;
+        case OP_CLR:
+            return 1;
+        case OP_R_PUSH:
+            return 0;
+        default:
+            return OP_IS_REGISTER(inst->opcode) && !OP_IS_REG_BRANCH(inst->opcode) &&
+                   inst->operand == (REG_VAR | slot);
+    }
+}
+
+/* 1 if the instruction uses array slot as an array */
+static int bounds_uses_array(const Instruction *inst, uint16_t array) {
+    switch (inst->opcode) {
+        case OP_ARRAY_GET_1D:
+        case OP_ARRAY_SET_1D:
+        case OP_ARRAY_GET_2D:
+        case OP_ARRAY_SET_2D:
+        case OP_ARRAY_LOAD_1D:
+        case OP_ARRAY_STORE_1D:
+        case OP_ARRAY_LOAD_2D:
+        case OP_ARRAY_STORE_2D:
+        case OP_ARRAY_ADDR_2D:
+        case OP_ARRAY_STORE_ADDR:
+        case OP_STR_ARRAY_GET_1D:
+        case OP_STR_ARRAY_SET_1D:
+        case OP_STR_ARRAY_GET_2D:
+        case OP_STR_ARRAY_SET_2D:
+        case OP_DIM_1D:
+        case OP_DIM_2D:
+            return inst->operand == array;
+        default:
+            return 0;
+    }
+}
+
+/* 1 if the instruction always continues with the next one (or halts) */
+static int bounds_straight(uint8_t op) {
+    switch (op) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP_LINE:
+        case OP_GOSUB:
+        case OP_GOSUB_LINE:
+        case OP_RETURN:
+        case OP_ON_GOTO:
+        case OP_ON_GOSUB:
+        case OP_FOR_INIT:
+        case OP_FOR_INIT_INT:
+        case OP_FOR_NEXT:
+        case OP_FOR_NEXT_INT:
+        case OP_FOR_ENTER:
+        case OP_FOR_LOOP:
+        case OP_TRAP:
+        case OP_JNLT: case OP_JNLE: case OP_JNGT:
+        case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+            return 0;
+        default:
+            return !OP_IS_REG_BRANCH(op);
+    }
+}
+
+/* Elements per dimension of array, if its one DIM runs once, up front */
+static int bounds_array_size(const CompiledProgram *prog, uint16_t array, int dims, double *size) {
+    const Instruction *code = prog->code;
+    const VariableInfo *var = &prog->var_table[array];
+    size_t len = prog->code_len;
+    size_t pc, words, dim = len;
+    BoundsRegion prefix;
+    int k;
+
+    if (var->type == VAR_STRING || (var->name && strchr(var->name, '$'))) return 0;
+
+    for (pc = 0; pc < len; pc += words) {
+        const Instruction *inst = &code[pc];
+
+        words = verify_instruction_words(inst);
+        if (inst->opcode == OP_CLR) return 0;
+        if (inst->opcode >= OP_STR_ARRAY_GET_1D && inst->opcode <= OP_STR_ARRAY_SET_2D &&
+            inst->operand == array) return 0;
+        if ((inst->opcode == OP_DIM_1D || inst->opcode == OP_DIM_2D) && inst->operand == array) {
+            if (dim < len) return 0;
+            dim = pc;
+        }
+    }
+    if (dim == len || code[dim].opcode != (dims == 1 ? OP_DIM_1D : OP_DIM_2D) ||
+        dim < (size_t)dims) return 0;
+
+    /* Everything before it runs straight through, leaving the array alone, */
+    /* and its bounds are the constants pushed just before it */
+    for (pc = 0; pc < dim; pc += words) {
+        const Instruction *inst = &code[pc];
+
+        words = verify_instruction_words(inst);
+        if (!bounds_straight(inst->opcode) || bounds_uses_array(inst, array)) return 0;
+        if (pc < dim - dims && pc + verify_step_words(inst) > dim - dims) return 0;
+    }
+    if (pc != dim) return 0;
+    for (k = 0; k < dims; k++) {
+        const Instruction *push = &code[dim - dims + k];
+        double bound;
+
+        if (push->opcode != OP_PUSH_CONST || push->operand >= prog->const_count) return 0;
+        bound = prog->const_pool[push->operand];
+        if (!(bound >= 0.0 && bound <= BOUNDS_MAX_DIM)) return 0;
+        size[k] = floor(bound) + 1.0;
+    }
+    if (dims == 2 && size[0] * size[1] > (double)((size_t)-1 / sizeof(double))) return 0;
+
+    prefix.first = 0;
+    prefix.last = dim;
+    prefix.has_body = 0;
+    return bounds_no_entry(prog, &prefix);
+}
+
+/* 1 if the paired loop closed by the OP_FOR_LOOP at next holds var in */
+/* [0, size) throughout a body that contains pc */
+static int bounds_loop_range(const CompiledProgram *prog, size_t next, size_t pc, double size) {
+    const Instruction *code = prog->code;
+    uint16_t var = code[next].operand;
+    uint16_t slots = code[next + 1].operand;
+    size_t body = code[next + 2].operand;
+    size_t enter, p, words;
+    double value[3], low, high;
+    BoundsRegion loop;
+    int k, starts = 0;
+
+    if (body > pc || pc >= next || body < FOR_ENTER_WORDS + 3) return 0;
+    enter = body - FOR_ENTER_WORDS;
+    if (code[enter].opcode != OP_FOR_ENTER || code[enter].operand != var ||
+        code[enter + 1].operand != slots) return 0;
+
+    /* Start, limit and STEP */
+    for (k = 0; k < 3; k++) {
+        const Instruction *push = &code[enter - 3 + k];
+        if (push->opcode != OP_PUSH_CONST || push->operand >= prog->const_count) return 0;
+        value[k] = prog->const_pool[push->operand];
+        if (!(value[k] - value[k] == 0.0)) return 0;  /* NaN or infinite */
+    }
+    low = value[0] < value[1] ? value[0] : value[1];
+    high = value[0] < value[1] ? value[1] : value[0];
+    if (!(low >= 0.0 && high < size)) return 0;
+
+    /* The pushes and FOR_ENTER are instructions, and the body leaves the */
+    /* variable and hidden slots to FOR_LOOP */
+    for (p = 0; p < next; p += words) {
+        words = verify_instruction_words(&code[p]);
+        if (p >= enter - 3 && p <= enter) starts++;
+        if (p < enter - 3 && p + verify_step_words(&code[p]) > enter - 3) return 0;
+        if (p >= body && (bounds_stores(prog, p, var) || bounds_stores(prog, p, slots) ||
+                          bounds_stores(prog, p, (uint16_t)(slots + 1)))) return 0;
+    }
+    if (starts != 4 || p != next) return 0;
+
+    loop.first = enter - 2;
+    loop.last = enter;
+    loop.body_first = body;
+    loop.body_last = next;
+    loop.has_body = 1;
+    return bounds_no_entry(prog, &loop);
+}
+
+int verify_subscripts(const CompiledProgram *prog, size_t pc, uint16_t array,
+                      const uint16_t *vars, int dims) {
+    const Instruction *code = prog->code;
+    size_t len = prog->code_len;
+    double size[2];
+    size_t next, words;
+    int k;
+
+    if (dims < 1 || dims > 2 || array >= prog->var_count) return 0;
+    if (!bounds_array_size(prog, array, dims, size)) return 0;
+
+    for (k = 0; k < dims; k++) {
+        int proven = 0;
+
+        if (vars[k] >= prog->var_count) return 0;
+        for (next = 0; next < len && !proven; next += words) {
+            words = verify_instruction_words(&code[next]);
+            proven = code[next].opcode == OP_FOR_LOOP && code[next].operand == vars[k] &&
+                     next + FOR_LOOP_WORDS <= len &&
+                     bounds_loop_range(prog, next, pc, size[k]);
+        }
+        if (!proven) return 0;
+    }
+    return 1;
+}
+
+/* 1 unless the instruction at pc is an OP_ARRAY_LOAD, STORE or ADDR */
+/* whose subscripts are not proven in range */
+static int verify_array_site(const CompiledProgram *prog, size_t pc) {
+    const Instruction *inst = &prog->code[pc];
+    uint16_t vars[2];
+    int k, dims;
+
+    if (!OP_IS_ARRAY_INDEXED(inst->opcode)) return 1;
+    dims = (int)ARRAY_INDEXED_WORDS(inst->opcode) - 1;
+    for (k = 0; k < dims; k++) vars[k] = inst[k + 1].operand;
+    return verify_subscripts(prog, pc, inst->operand, vars, dims);
+}
+
+/* Static checks that do not depend on control flow */
+static int verify_tables(Verifier *v) {
+    CompiledProgram *prog = v->prog;
+    size_t pc, k, words;
+
+    /* Instruction boundaries, in program order */
+    for (pc = 0; pc < v->len; pc += words) {
+        words = verify_instruction_words(&prog->code[pc]);
+        if (pc + words > v->len) return verify_fail(v, pc, "instruction runs past the end of the code");
+        v->kind[pc] |= WORD_START;
+        for (k = 1; k < words; k++) v->kind[pc + k] |= WORD_DATA;
+    }
+
+    for (k = 0; k < prog->line_count; k++) {
+        if (!verify_target(v, prog->line_map[k].pc_offset, prog->line_map[k].pc_offset)) {
+            snprintf(v->error, v->error_size, "line %u: not the start of an instruction",
+                     (unsigned)prog->line_map[k].line_number);
+            return 0;
+        }
+    }
+
+    for (k = 0; k < prog->data_count; k++) {
+        const DataEntry *entry = &prog->data_entries[k];
+        int ok;
+
+        switch (entry->type) {
+            case DATA_NUMERIC: ok = entry->value.numeric_idx < prog->data_numeric_count; break;
+            case DATA_STRING:  ok = entry->value.string_idx < prog->data_string_count; break;
+            case DATA_NULL:    ok = 1; break;
+            default:           ok = 0; break;
+        }
+        if (!ok) {
+            snprintf(v->error, v->error_size, "DATA item %lu out of range", (unsigned long)k);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int verify_program(CompiledProgram *prog, char *error, size_t error_size) {
+    Verifier v;
+    size_t nodes, pc, i;
+    int ok = 0;
+
+    memset(&v, 0, sizeof(v));
+    v.prog = prog;
+    v.len = prog->code_len;
+    v.join_return = v.len + 1;
+    v.join_loop = v.len + 2;
+    v.error = error;
+    v.error_size = error_size;
+    nodes = v.len + 3;
+
+    v.kind = calloc(v.len + 1, 1);
+    v.depth = malloc(sizeof(long) * nodes);
+    v.base = calloc(nodes, sizeof(size_t));
+    v.queued = calloc(nodes, 1);
+    v.work = malloc(sizeof(size_t) * nodes);
+    v.return_sites = malloc(sizeof(size_t) * (v.len + 1));
+    v.loop_sites = malloc(sizeof(size_t) * (v.len + 1));
+    v.pool_capacity = 256;
+    v.pool = malloc(v.pool_capacity);
+    v.stack_capacity = 64;
+    v.stack = malloc(v.stack_capacity);
+    if (!v.kind || !v.depth || !v.base || !v.queued || !v.work ||
+        !v.return_sites || !v.loop_sites || !v.pool || !v.stack) {
+        snprintf(error, error_size, "out of memory");
+        goto done;
+    }
+    for (i = 0; i < nodes; i++) v.depth[i] = -1;
+
+    if (!verify_tables(&v)) goto done;
+
+    /* Roots: the first instruction and every line start, on an empty stack */
+    if (!verify_flow(&v, 0, 0)) goto done;
+    for (i = 0; i < prog->line_count; i++) {
+        if (!verify_flow(&v, 0, prog->line_map[i].pc_offset)) goto done;
+    }
+
+    while (v.work_len > 0) {
+        size_t node = v.work[--v.work_len];
+        v.queued[node] = 0;
+        if (node >= v.len) {
+            if (!verify_join(&v, node)) goto done;
+        } else if (v.kind[node] & WORD_DATA) {
+            verify_fail(&v, node, "control reaches an operand word");
+            goto done;
+        } else if (!verify_instruction(&v, node)) {
+            goto done;
+        }
+    }
+
+    /* Flags are the verifier's alone: whatever the file said is dropped */
+    for (pc = 0; pc < v.len; pc++) {
+        prog->code[pc].flags = 0;
+        if (v.depth[pc] >= 0 && verify_operand_types(&v, pc) && verify_array_site(prog, pc)) {
+            prog->code[pc].flags = INST_FLAG_VERIFIED;
+        }
+    }
+    prog->max_stack = v.max_depth > 0 ? v.max_depth : 1;
+    prog->max_num_stack = v.max_doubles > 0 ? v.max_doubles : 1;
+    ok = 1;
+
+done:
+    free(v.kind);
+    free(v.depth);
+    free(v.base);
+    free(v.queued);
+    free(v.work);
+    free(v.return_sites);
+    free(v.loop_sites);
+    free(v.pool);
+    free(v.stack);
+    return ok;
+}
@@ -0,0 +1,43 @@
+/* verify.h - Load-time bytecode verifier */
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "compiler.h"
+#include <stddef.h>
+
+/*
+ * bytecode_file_load() runs every program through verify_program() before
+ * handing it to the VM, so a damaged or hand-made .abc file is rejected
+ * instead of indexing past a pool or underflowing the stack. The verifier
+ * interprets the code abstractly, following every path from pc 0, the line
+ * starts and the TRAP targets, and checks that:
+ *
+ *   - every variable, constant, string and array operand is in range, and
+ *     every jump, GOSUB, ON and TRAP target is the start of an instruction;
+ *   - the expression stack has the same depth on every path into a pc and
+ *     never underflows, with statements (line starts, GOSUB return points,
+ *     FOR loop bodies) beginning on an empty stack.
+ *
+ * It also tracks whether each stack entry is a number or a string. A
+ * type mismatch is left to the VM to report (A$ + 1 is a runtime error,
+ * not a malformed program), but instructions whose operands are proven
+ * to have the types they pop get INST_FLAG_VERIFIED, and the program gets
+ * the deepest stack any path needs in max_stack (and number stack in
+ * max_num_stack). The VM allocates the stacks at those sizes and runs
+ * flagged instructions with handlers that skip the depth, capacity and
+ * type checks (see vm.c).
+ */
+
+/* Verify prog, setting its stack sizes and instruction flags. 1 on success; */
+/* otherwise 0 with a description of the first problem in error */
+int verify_program(CompiledProgram *prog, char *error, size_t error_size);
+
+/* 1 if an access to numeric array array at pc, subscripted by the dims */
+/* variables in vars, is always inside the array's DIM (see verify.c). The */
+/* compiler asks before emitting OP_ARRAY_LOAD/STORE; verify_program() */
+/* asks again before flagging one (or an OP_ARRAY_ADDR_2D), since a .abc */
+/* file can say anything */
+int verify_subscripts(const CompiledProgram *prog, size_t pc, uint16_t array,
+                      const uint16_t *vars, int dims);
+
+#endif /* VERIFY_H */
@@ -1,6 +1,7 @@
 /* vm.c - Virtual machine executor */
 #define _POSIX_C_SOURCE 200112L  /* Enable snprintf */
 #include "vm.h"
+#include "jit.h"
 #include "util.h"
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +13,9 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+/* Largest start, limit or step an OP_FOR_INIT_INT loop counts in int64 (2^52) */
+#define VM_INT_LOOP_MAX 4503599627370496.0
+
 /* Validate numeric input string */
 static int is_valid_numeric_input(const char *str) {
     const char *p = str;
@@ -45,6 +49,206 @@ static int is_valid_numeric_input(const char *str) {
     return has_digit;
 }
 
+/* Translate program code into the VM's pre-decoded instruction stream */
+static DecodedInstruction* vm_decode_program(VMState *vm) {
+    CompiledProgram *program = vm->program;
+    DecodedInstruction *decoded;
+    size_t i;
+    
+    decoded = malloc(sizeof(DecodedInstruction) * (program->code_len + 1));
+    if (!decoded) return NULL;
+    
+    for (i = 0; i < program->code_len; i++) {
+        const Instruction *inst = &program->code[i];
+        DecodedInstruction *d = &decoded[i];
+        
+        d->handler = NULL;
+        d->opcode = inst->opcode;
+        d->flags = inst->flags;
+        d->operand = inst->operand;
+        d->entry = 0;
+        d->safepoint_cost = 0;
+        d->imm.number = 0.0;
+        
+        switch (inst->opcode) {
+            case OP_PUSH_CONST:
+            case OP_N_PUSH_CONST:
+                if (inst->operand < program->const_count) {
+                    d->imm.number = value_canonical(program->const_pool[inst->operand]);
+                }
+                break;
+                
+            case OP_ARRAY_GET_1D:
+            case OP_ARRAY_SET_1D:
+            case OP_ARRAY_GET_2D:
+            case OP_ARRAY_SET_2D:
+            case OP_DIM_1D:
+            case OP_DIM_2D:
+            case OP_STR_ARRAY_GET_1D:
+            case OP_STR_ARRAY_SET_1D:
+            case OP_STR_ARRAY_GET_2D:
+            case OP_STR_ARRAY_SET_2D:
+            case OP_ARRAY_LOAD_1D:
+            case OP_ARRAY_STORE_1D:
+            case OP_ARRAY_LOAD_2D:
+            case OP_ARRAY_STORE_2D:
+            case OP_ARRAY_ADDR_2D:
+            case OP_ARRAY_STORE_ADDR:
+                if (inst->operand < vm->var_capacity) {
+                    d->imm.array = &vm->arrays[inst->operand];
+                }
+                break;
+        }
+    }
+    
+    /* Register instructions: resolve tagged operands to register file indices */
+    for (i = 0; i < program->code_len; i++) {
+        uint8_t op = program->code[i].opcode;
+        size_t words, k;
+        
+        if (!OP_IS_REGISTER(op)) continue;
+        
+        words = REG_INSTRUCTION_WORDS(op);
+        if (program->isa != ISA_REG || i + words > program->code_len) {
+            decoded[i].opcode = OP_HALT;  /* Malformed program */
+            continue;
+        }
+        
+        /* Word 0 holds the jump target for branches, a register otherwise */
+        for (k = OP_IS_REG_BRANCH(op) ? 1 : 0; k < words; k++) {
+            uint16_t reg = program->code[i + k].operand;
+            uint32_t index = reg & REG_INDEX_MASK;
+            
+            switch (reg & REG_CLASS_MASK) {
+                case REG_VAR:   break;
+                case REG_TEMP:  index += vm->var_capacity; break;
+                case REG_CONST: index += vm->var_capacity + program->reg_temps; break;
+                default:        index = vm->reg_count; break;
+            }
+            if (index >= vm->reg_count) {
+                decoded[i].opcode = OP_HALT;  /* Malformed program */
+                break;
+            }
+            decoded[i + k].operand = index;
+        }
+        i += words - 1;
+    }
+    
+    /* Running off the end of the program halts without a bounds check */
+    decoded[program->code_len].handler = NULL;
+    decoded[program->code_len].opcode = OP_HALT;
+    decoded[program->code_len].flags = 0;
+    decoded[program->code_len].operand = 0;
+    decoded[program->code_len].entry = 0;
+    decoded[program->code_len].safepoint_cost = 0;
+    decoded[program->code_len].imm.number = 0.0;
+    
+    return decoded;
+}
+
+/* Build vm->line_pcs from the program's line map; 0 if out of memory */
+static int vm_build_line_table(VMState *vm) {
+    const CompiledProgram *prog = vm->program;
+    size_t i;
+    
+    vm->line_limit = 0;
+    for (i = 0; i < prog->line_count; i++) {
+        if ((size_t)prog->line_map[i].line_number + 1 > vm->line_limit) {
+            vm->line_limit = (size_t)prog->line_map[i].line_number + 1;
+        }
+    }
+    vm->line_pcs = malloc(sizeof(int32_t) * (vm->line_limit ? vm->line_limit : 1));
+    if (!vm->line_pcs) return 0;
+    for (i = 0; i < vm->line_limit; i++) {
+        vm->line_pcs[i] = -1;
+    }
+    
+    /* A line's first mapping is where it starts */
+    for (i = 0; i < prog->line_count; i++) {
+        int32_t *entry = &vm->line_pcs[prog->line_map[i].line_number];
+        if (*entry < 0) *entry = (int32_t)prog->line_map[i].pc_offset;
+    }
+    return 1;
+}
+
+/* Make target a safepoint that charges at least cost */
+static void vm_add_safepoint(VMState *vm, uint32_t target, uint32_t cost) {
+    DecodedInstruction *d;
+    
+    if (target >= vm->program->code_len) return;
+    d = &vm->decoded[target];
+    d->entry |= VM_ENTRY_SAFEPOINT;
+    if (cost > d->safepoint_cost) d->safepoint_cost = cost;
+}
+
+/* Mark the safepoints (see vm.h): each charges the words from it to the */
+/* furthest jump back to it, or 1 */
+static void vm_mark_safepoints(VMState *vm) {
+    const CompiledProgram *prog = vm->program;
+    const Instruction *code = prog->code;
+    size_t len = prog->code_len;
+    size_t pc, k;
+    int computed = 0;
+    
+    for (pc = 0; pc < len; pc++) {
+        const Instruction *inst = &code[pc];
+        uint32_t target = inst->operand;
+        
+        switch (inst->opcode) {
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_JNLT: case OP_JNLE: case OP_JNGT:
+            case OP_JNGE: case OP_JNEQ: case OP_JNNE:
+            case OP_R_JNLT: case OP_R_JNLE: case OP_R_JNGT:
+            case OP_R_JNGE: case OP_R_JNEQ: case OP_R_JNNE:
+                if (target <= pc) vm_add_safepoint(vm, target, (uint32_t)(pc - target + 1));
+                break;
+            case OP_FOR_LOOP:
+                if (pc + 2 < len && code[pc + 2].operand <= pc) {
+                    target = code[pc + 2].operand;
+                    vm_add_safepoint(vm, target, (uint32_t)(pc - target + 1));
+                }
+                break;
+            case OP_GOSUB:
+                vm_add_safepoint(vm, target, target <= pc ? (uint32_t)(pc - target + 1) : 1);
+                break;
+            case OP_ON_GOTO:
+            case OP_ON_GOSUB:
+                for (k = 1; k <= inst->operand && pc + k < len; k++) {
+                    target = code[pc + k].operand;
+                    if (target <= pc) {
+                        vm_add_safepoint(vm, target, (uint32_t)(pc - target + 1));
+                    } else if (inst->opcode == OP_ON_GOSUB) {
+                        vm_add_safepoint(vm, target, 1);
+                    }
+                }
+                break;
+            case OP_FOR_INIT:
+            case OP_FOR_INIT_INT:
+                /* NEXT comes back to the instruction after the FOR */
+                for (k = pc + 1; k < len; k++) {
+                    if ((code[k].opcode == OP_FOR_NEXT || code[k].opcode == OP_FOR_NEXT_INT) &&
+                        (code[k].operand == inst->operand || code[k].operand == 0xFFFF)) break;
+                }
+                vm_add_safepoint(vm, (uint32_t)(pc + 1), k < len ? (uint32_t)(k - pc) : 1);
+                break;
+            case OP_TRAP:
+                vm_add_safepoint(vm, target, 1);
+                break;
+            case OP_JUMP_LINE:
+            case OP_GOSUB_LINE:
+                computed = 1;
+                break;
+        }
+    }
+    
+    /* A computed GOTO or GOSUB can go back to any line */
+    for (k = 0; computed && k < prog->line_count; k++) {
+        vm_add_safepoint(vm, prog->line_map[k].pc_offset, 1);
+    }
+}
+
 /* Initialize VM */
 VMState* vm_init(CompiledProgram *program) {
     size_t i;
@@ -55,11 +259,15 @@ VMState* vm_init(CompiledProgram *program) {
     vm = calloc(1, sizeof(VMState));
     if (!vm) return NULL;
     
-    /* Initialize stack */
-    vm->stack_capacity = 256;
+    /* Initialize stack: verified programs never need more than max_stack */
+    vm->stack_capacity = program->max_stack ? program->max_stack : 256;
     vm->stack = malloc(sizeof(Value) * vm->stack_capacity);
     vm->stack_top = 0;
     
+    vm->num_capacity = program->max_num_stack ? program->max_num_stack : 64;
+    vm->num_stack = malloc(sizeof(double) * vm->num_capacity);
+    vm->num_top = 0;
+    
     vm->call_capacity = 64;
     vm->call_stack = malloc(sizeof(uint32_t) * vm->call_capacity);
     vm->call_top = 0;
@@ -70,7 +278,19 @@ VMState* vm_init(CompiledProgram *program) {
     
     /* Initialize variables */
     vm->var_capacity = program->var_count;
-    vm->num_vars = calloc(vm->var_capacity, sizeof(double));
+    
+    /* Register ISA: num_vars is the register file - variables, then */
+    /* expression temporaries, then a copy of the constant pool */
+    vm->reg_count = vm->var_capacity;
+    if (program->isa == ISA_REG) {
+        vm->reg_count += program->reg_temps + program->const_count;
+    }
+    vm->num_vars = calloc(vm->reg_count ? vm->reg_count : 1, sizeof(double));
+    if (vm->num_vars && program->isa == ISA_REG) {
+        for (i = 0; i < program->const_count; i++) {
+            vm->num_vars[vm->var_capacity + program->reg_temps + i] = value_canonical(program->const_pool[i]);
+        }
+    }
     vm->str_vars = calloc(vm->var_capacity, sizeof(char*));
     vm->arrays = calloc(vm->var_capacity, sizeof(ArrayData));
     
@@ -101,6 +321,9 @@ VMState* vm_init(CompiledProgram *program) {
     vm->trap_enabled = 0;
     vm->trap_triggered = 0;
     vm->error_code = ERR_NONE;
+    vm->break_flag = 0;
+    vm->run_status = VM_RUN_FINISHED;
+    vm->budget = VM_RUN_UNLIMITED;
     vm->print_needs_newline = 0;
     vm->print_last_char = '\0';
     vm->print_after_tab = 0;
@@ -117,11 +340,13 @@ VMState* vm_init(CompiledProgram *program) {
     vm->input_buffer[0] = '\0';
     vm->input_ptr = NULL;
     vm->input_available = 0;
+    vm->host_input = 0;
     
     /* Allocate simulated memory buffer (64KB) for PEEK/POKE */
     vm->memory = calloc(65536, 1);
     if (!vm->memory) {
         free(vm->stack);
+        free(vm->num_stack);
         free(vm->call_stack);
         free(vm->for_stack);
         free(vm->num_vars);
@@ -133,9 +358,41 @@ VMState* vm_init(CompiledProgram *program) {
     
     vm->program = program;
     
+    /* Pre-decode the program into the execution-ready stream */
+    vm->decoded = vm_decode_program(vm);
+    if (!vm->decoded || !vm_build_line_table(vm)) {
+        free(vm->decoded);
+        free(vm->line_pcs);
+        free(vm->memory);
+        free(vm->stack);
+        free(vm->num_stack);
+        free(vm->call_stack);
+        free(vm->for_stack);
+        free(vm->num_vars);
+        free(vm->str_vars);
+        free(vm->arrays);
+        free(vm);
+        return NULL;
+    }
+    vm_mark_safepoints(vm);
+    
+    /* Native code for hot line ranges, when built with the JIT */
+    vm->jit = vm_jit_new(vm, JIT_DEFAULT_THRESHOLD);
     return vm;
 }
 
+/* Drop native code and count entry point visits from zero; 0 disables the JIT */
+void vm_set_jit_threshold(VMState *vm, unsigned threshold) {
+    size_t i;
+    
+    vm_jit_free(vm->jit);
+    for (i = 0; i <= vm->program->code_len; i++) {
+        vm->decoded[i].entry &= VM_ENTRY_SAFEPOINT;
+    }
+    vm->jit = vm_jit_new(vm, threshold);
+    vm->decoded_bound = VM_BOUND_NONE;
+}
+
 /* Free VM */
 void vm_free(VMState *vm) {
     size_t i;
@@ -145,17 +402,19 @@ void vm_free(VMState *vm) {
     /* Free strings on the stack */
     if (vm->stack) {
         for (i = 0; i < vm->stack_top; i++) {
-            if (vm->stack[i].type == VAL_STRING && vm->stack[i].data.string) {
-                free(vm->stack[i].data.string);
+            if (VALUE_IS_STRING(vm->stack[i]) && VALUE_STRING(vm->stack[i])) {
+                free(VALUE_STRING(vm->stack[i]));
             }
         }
         free(vm->stack);
     }
     
+    if (vm->num_stack) free(vm->num_stack);
     if (vm->call_stack) free(vm->call_stack);
     if (vm->for_stack) free(vm->for_stack);
     
     if (vm->num_vars) free(vm->num_vars);
+    if (vm->line_pcs) free(vm->line_pcs);
     
     if (vm->str_vars) {
         for (i = 0; i < vm->var_capacity; i++) {
@@ -192,7 +451,10 @@ void vm_free(VMState *vm) {
     if (vm->memory) {
         free(vm->memory);
     }
-    
+
+    vm_jit_free(vm->jit);
+    if (vm->decoded) free(vm->decoded);
+
     free(vm);
 }
 
@@ -227,24 +489,33 @@ void vm_push_string(VMState *vm, char *s) {
 /* Helper: pop and expect number */
 double vm_pop_number(VMState *vm) {
     Value v = vm_pop(vm);
-    if (v.type != VAL_NUMBER) {
+    if (!VALUE_IS_NUMBER(v)) {
         vm_error(vm, ERR_TYPE_MISMATCH, "TYPE MISMATCH - expected number");
-        if (v.type == VAL_STRING && v.data.string) {
-            free(v.data.string);
+        if (VALUE_IS_STRING(v) && VALUE_STRING(v)) {
+            free(VALUE_STRING(v));
         }
         return 0.0;
     }
-    return v.data.number;
+    return VALUE_NUMBER(v);
 }
 
 /* Helper: pop and expect string */
 char* vm_pop_string(VMState *vm) {
     Value v = vm_pop(vm);
-    if (v.type != VAL_STRING) {
+    if (!VALUE_IS_STRING(v)) {
         vm_error(vm, ERR_TYPE_MISMATCH, "TYPE MISMATCH - expected string");
         return basset_strdup("");
     }
-    return v.data.string;  /* Caller takes ownership */
+    return VALUE_STRING(v);  /* Caller takes ownership */
+}
+
+/* Number stack push (OP_N_* instructions) */
+void vm_num_push(VMState *vm, double n) {
+    if (vm->num_top >= vm->num_capacity) {
+        vm->num_capacity *= 2;
+        vm->num_stack = realloc(vm->num_stack, sizeof(double) * vm->num_capacity);
+    }
+    vm->num_stack[vm->num_top++] = n;
 }
 
 /* Call stack operations */
@@ -267,8 +538,13 @@ uint32_t vm_call_pop(VMState *vm) {
 /* FOR stack operations */
 void vm_for_push(VMState *vm, ForLoopState state) {
     if (vm->for_top >= vm->for_capacity) {
+        ForLoopState *grown = realloc(vm->for_stack, sizeof(ForLoopState) * vm->for_capacity * 2);
+        if (!grown) {
+            vm_error(vm, ERR_OUT_OF_MEMORY, "OUT OF MEMORY");
+            return;
+        }
+        vm->for_stack = grown;
         vm->for_capacity *= 2;
-        vm->for_stack = realloc(vm->for_stack, sizeof(ForLoopState) * vm->for_capacity);
     }
     vm->for_stack[vm->for_top++] = state;
 }
@@ -306,7 +582,8 @@ static FILE* vm_get_output_file(VMState *vm) {
     return stdout;
 }
 
-/* Get next comma-separated value from INPUT buffer */
+/* Get next comma-separated value from INPUT buffer; NULL when the VM */
+/* stopped to wait for the host's input */
 static char* get_next_input_value(VMState *vm) {
     static char value_buffer[256];
     char *start, *end;
@@ -318,6 +595,13 @@ static char* get_next_input_value(VMState *vm) {
         printf("? ");
         fflush(stdout);
         
+        /* The host supplies it through vm_provide_input() */
+        if (vm->host_input) {
+            vm->running = 0;
+            vm->run_status = VM_RUN_INPUT;
+            return NULL;
+        }
+        
         if (!fgets(vm->input_buffer, sizeof(vm->input_buffer), stdin)) {
             value_buffer[0] = '\0';
             return value_buffer;
@@ -423,11 +707,12 @@ void vm_error(VMState *vm, int error_code, const char *message) {
     if (vm->trap_enabled && vm->trap_line > 0) {
         /* Clear stacks to avoid corruption - free strings on stack */
         for (i = 0; i < vm->stack_top; i++) {
-            if (vm->stack[i].type == VAL_STRING && vm->stack[i].data.string) {
-                free(vm->stack[i].data.string);
+            if (VALUE_IS_STRING(vm->stack[i]) && VALUE_STRING(vm->stack[i])) {
+                free(VALUE_STRING(vm->stack[i]));
             }
         }
         vm->stack_top = 0;
+        vm->num_top = 0;
         
         /* Jump to trap handler instead of halting */
         vm->pc = vm->trap_line;
@@ -439,6 +724,39 @@ void vm_error(VMState *vm, int error_code, const char *message) {
     /* No trap - print error and halt */
     fprintf(stderr, "ERROR - %s\n", message);
     vm->running = 0;
+    vm->run_status = VM_RUN_ERROR;
+}
+
+/* At a safepoint: 1 to go on, charging cost to the budget; 0 after */
+/* stopping the VM because the budget is used up or BREAK was set */
+static int vm_safepoint(VMState *vm, uint32_t cost) {
+    if (vm->break_flag) {
+        vm->break_flag = 0;
+        vm->run_status = VM_RUN_BREAK;
+    } else if (vm->budget == 0) {
+        vm->run_status = VM_RUN_BUDGET;
+    } else {
+        vm->budget = (vm->budget > cost) ? vm->budget - cost : 0;
+        return 1;
+    }
+    vm->running = 0;
+    return 0;
+}
+
+/* Finish a trapped error once its handler has returned: whatever the */
+/* handler did after vm_error(), continue at the TRAP line on an empty stack */
+static void vm_trap_resume(VMState *vm) {
+    size_t i;
+    
+    for (i = 0; i < vm->stack_top; i++) {
+        if (VALUE_IS_STRING(vm->stack[i]) && VALUE_STRING(vm->stack[i])) {
+            free(VALUE_STRING(vm->stack[i]));
+        }
+    }
+    vm->stack_top = 0;
+    vm->num_top = 0;
+    vm->pc = vm->trap_line;
+    vm->trap_triggered = 0;
 }
 
 /* Get variable name by slot */
@@ -449,322 +767,917 @@ static const char* vm_get_var_name(VMState *vm, uint16_t slot) {
     return "?";
 }
 
-/* Find line offset (binary search) */
-int32_t vm_find_line_offset(VMState *vm, uint16_t line_number) {
-    int left = 0;
-    int right = vm->program->line_count - 1;
+/* NEXT: step the innermost loop's variable and loop back or leave */
+/* (var is the NEXT's variable slot, 0xFFFF for a bare NEXT) */
+static void vm_for_next(VMState *vm, uint16_t var) {
+    ForLoopState *loop;
+    double new_val;
+    int done;
+    uint16_t var_slot;
     
-    while (left <= right) {
-        int mid = left + (right - left) / 2;
-        
-        if (vm->program->line_map[mid].line_number == line_number) {
-            return vm->program->line_map[mid].pc_offset;
-        } else if (vm->program->line_map[mid].line_number < line_number) {
-            left = mid + 1;
-        } else {
-            right = mid - 1;
+    loop = vm_for_top(vm);
+    if (!loop) return;
+    
+    /* Check if variable was specified (0xFFFF means no variable) */
+    if (var != 0xFFFF) {
+        /* Variable specified - validate it matches the FOR loop */
+        if (loop->var_slot != var) {
+            char err_msg[256];
+            snprintf(err_msg, sizeof(err_msg),
+                    "NEXT variable mismatch: expected %s, got %s",
+                    vm_get_var_name(vm, loop->var_slot),
+                    vm_get_var_name(vm, var));
+            vm_error(vm, ERR_FOR_NEXT_MISMATCH, err_msg);
+            return;
         }
+        var_slot = var;
+    } else {
+        /* No variable specified - use the FOR loop's variable */
+        var_slot = loop->var_slot;
+    }
+    
+    new_val = vm->num_vars[var_slot] + loop->step;
+    vm->num_vars[var_slot] = new_val;
+    
+    if (loop->step > 0) {
+        done = (new_val > loop->limit);
+    } else {
+        done = (new_val < loop->limit);
     }
     
-    return -1;
+    if (!done) {
+        vm->pc = loop->loop_start_pc;
+    } else {
+        vm_for_pop(vm);
+        vm->pc++;
+    }
 }
 
-/* Main VM execution loop */
-void vm_execute(VMState *vm) {
+/* Element of the numeric array of an OP_ARRAY_LOAD or OP_ARRAY_STORE, */
+/* auto-dimensioning it first; NULL after a subscript error */
+static double *vm_array_element(VMState *vm, const DecodedInstruction *inst, int dims) {
+    ArrayData *array = inst->imm.array;
+    size_t row = (size_t)vm->num_vars[inst[1].operand];
+    size_t col = (dims == 2) ? (size_t)vm->num_vars[inst[2].operand] : 0;
+    
+    /* Auto-dimension if not already dimensioned */
+    if (array->u.data == NULL) {
+        array->type = (dims == 2) ? VAR_ARRAY_2D : VAR_ARRAY_1D;
+        array->dim1 = 11;  /* Default 0-10 */
+        array->dim2 = (dims == 2) ? 11 : 0;
+        array->is_string = 0;
+        array->u.data = calloc((dims == 2) ? 11 * 11 : 11, sizeof(double));
+    }
+    
+    if (!array->u.data || row >= array->dim1 || (dims == 2 && col >= array->dim2)) {
+        vm_error(vm, ERR_SUBSCRIPT_RANGE, "ARRAY BOUNDS ERROR");
+        return NULL;
+    }
+    return &array->u.data[(dims == 2) ? row * array->dim2 + col : row];
+}
+
+/* vm_array_element() for OP_ARRAY_ADDR_2D, remembering the element for */
+/* the OP_ARRAY_STORE_ADDR that writes it back */
+static double *vm_array_address(VMState *vm, const DecodedInstruction *inst) {
+    double *element = vm_array_element(vm, inst, 2);
+    
+    if (element) {
+        vm->addr_array = inst->imm.array;
+        vm->addr_index = (size_t)(element - inst->imm.array->u.data);
+    }
+    return element;
+}
+
+/* Find line offset (direct lookup in the table vm_init() builds) */
+int32_t vm_find_line_offset(VMState *vm, uint16_t line_number) {
+    if (line_number >= vm->line_limit) return -1;
+    return vm->line_pcs[line_number];
+}
+
+/*
+ * Dispatch engines
+ *
+ * The opcode handlers in vm_execute() are written once, against the
+ * VM_CASE / VM_DEFAULT / VM_NEXT macros, and expand into one of two engines:
+ *
+ *   switch   - a while/switch loop; strict ISO C90 and always available.
+ *   threaded - direct-threaded dispatch using the GCC labels-as-values
+ *              extension.  Each handler ends in its own indirect jump
+ *              through a table of label addresses, so the branch predictor
+ *              sees one jump site per opcode instead of a single shared one,
+ *              and the per-opcode pc bounds check is replaced by the OP_HALT
+ *              sentinel at the end of vm->decoded.
+ *
+ * The threaded engine is selected at build time with
+ * -DBASSET_THREADED_DISPATCH (make DISPATCH=threaded) and is ignored by
+ * compilers that do not provide the extension.
+ */
+#if defined(BASSET_THREADED_DISPATCH) && defined(__GNUC__)
+#define VM_THREADED_DISPATCH 1
+#endif
+
+#ifdef VM_THREADED_DISPATCH
+/* Label addresses and computed gotos are GNU extensions; __extension__ */
+/* keeps -pedantic quiet about these uses and no others */
+#define VM_LABEL(name)  (__extension__ &&name)
+#define VM_GOTO(target) __extension__ ({ goto *(target); })
+#define VM_CASE(op)     vm_##op:
+#define VM_DEFAULT      vm_default:
+#define VM_TARGET(op)   dispatch_table[op] = VM_LABEL(vm_##op)
+/* Handler for a decoded instruction: its unchecked one if the verifier */
+/* flagged it and there is one, otherwise the opcode's */
+#define VM_HANDLER(d) (((d)->flags & INST_FLAG_VERIFIED) && unchecked_table[(d)->opcode] ? \
+    unchecked_table[(d)->opcode] : dispatch_table[(d)->opcode])
+/* Point each instruction at its handler, or at vm_jit_entry for JIT entries; */
+/* when single-stepping, at vm_step_done so that only one handler runs */
+#define VM_BIND_HANDLERS(mode) { \
+    if (vm->decoded_bound != (mode)) { \
+        size_t bind_i; \
+        for (bind_i = 0; bind_i <= vm->program->code_len; bind_i++) { \
+            DecodedInstruction *bind = &vm->decoded[bind_i]; \
+            if ((mode) == VM_BOUND_STEP) { \
+                bind->handler = VM_LABEL(vm_step_done); \
+            } else { \
+                bind->handler = bind->entry ? VM_LABEL(vm_jit_entry) : VM_HANDLER(bind); \
+            } \
+        } \
+        vm->decoded_bound = (mode); \
+    } \
+}
+#define VM_NEXT() { \
+    inst = &vm->decoded[vm->pc]; \
+    VM_GOTO(inst->handler); \
+}
+#else
+#define VM_CASE(op)     case op:
+#define VM_DEFAULT      default:
+#define VM_NEXT()       break
+#endif
+
+/* Dispatch carries no error checks: a handler whose code can raise an */
+/* error or stop the VM leaves through VM_CHECK() when it did - a trapped */
+/* error to vm_trap_taken, which continues at the TRAP line, anything */
+/* else that stopped the VM to vm_stopped */
+#define VM_CHECK() { \
+    if (VM_UNLIKELY(vm->trap_triggered)) goto vm_trap_taken; \
+    if (VM_UNLIKELY(!vm->running)) goto vm_stopped; \
+}
+#define VM_NEXT_CHECKED() { \
+    VM_CHECK(); \
+    VM_NEXT(); \
+}
+
+/* Numeric fast paths
+ *
+ * The compiler only feeds numeric handlers numbers, so each one first tests
+ * all of its operands with a single condition and then works on the stack
+ * in place, with no error checks. Anything else (a string, an empty stack)
+ * falls through to the handler's general code, whose vm_pop_number() calls
+ * raise the error and take the TRAP exactly as before.
+ */
+#if defined(__GNUC__)
+#define VM_LIKELY(x)    __builtin_expect(!!(x), 1)
+#define VM_UNLIKELY(x)  __builtin_expect(!!(x), 0)
+#else
+#define VM_LIKELY(x)    (x)
+#define VM_UNLIKELY(x)  (x)
+#endif
+
+/* vm_safepoint() with the common case - no BREAK, budget to spare - inline */
+#define VM_SAFEPOINT(vm, cost) \
+    (VM_LIKELY(!(vm)->break_flag && (vm)->budget >= (cost)) ? \
+        ((vm)->budget -= (cost), 1) : vm_safepoint(vm, cost))
+
+/* Number k entries below the top of the stack */
+#define VM_NUM(k)       VALUE_NUMBER(vm->stack[vm->stack_top - 1 - (k)])
+
+#define VM_TOP_IS_NUMBER() VM_LIKELY(vm->stack_top >= 1 && \
+    VALUE_IS_NUMBER(vm->stack[vm->stack_top - 1]))
+#define VM_TOP2_ARE_NUMBERS() VM_LIKELY(vm->stack_top >= 2 && \
+    VALUE_IS_NUMBER(vm->stack[vm->stack_top - 2]) && \
+    VALUE_IS_NUMBER(vm->stack[vm->stack_top - 1]))
+
+/* a op b: replace the top two numbers with expr */
+#define VM_FAST_BINARY(expr) { \
+    if (VM_TOP2_ARE_NUMBERS()) { \
+        double a = VM_NUM(1); \
+        double b = VM_NUM(0); \
+        vm->stack_top--; \
+        VM_NUM(0) = (expr); \
+        vm->pc++; \
+        VM_NEXT(); \
+    } \
+}
+
+/* f(x): replace the top number with expr */
+#define VM_FAST_UNARY(expr) { \
+    if (VM_TOP_IS_NUMBER()) { \
+        double x = VM_NUM(0); \
+        VM_NUM(0) = (expr); \
+        vm->pc++; \
+        VM_NEXT(); \
+    } \
+}
+
+/* Fused compare-and-branch: pop b and a, fall through when cmp holds and */
+/* jump to the operand otherwise. The compiler only emits these for numeric */
+/* operands; anything else goes through vm_pop_number() and its errors. */
+#define VM_COMPARE_BRANCH(cmp) { \
+    if (VM_TOP2_ARE_NUMBERS()) { \
+        double a = VM_NUM(1); \
+        double b = VM_NUM(0); \
+        vm->stack_top -= 2; \
+        vm->pc = (cmp) ? vm->pc + 1 : inst->operand; \
+    } else { \
+        (void)vm_pop_number(vm); \
+        VM_CHECK(); \
+        (void)vm_pop_number(vm); \
+        VM_CHECK(); \
+        vm->pc++; \
+    } \
+}
+
+/* Number stack instructions
+ *
+ * OP_N_* work on vm->num_stack, which holds bare doubles, so there are no
+ * type tags to test or write. The checked handlers below only test the
+ * depth (and grow the stack on a push); verified ones skip that as well.
+ */
+#define VM_DBL(k)       (vm->num_stack[vm->num_top - 1 - (k)])
+
+#define VM_NUMBER_BINARY(expr) { \
+    if (VM_LIKELY(vm->num_top >= 2)) { \
+        double a = VM_DBL(1); \
+        double b = VM_DBL(0); \
+        vm->num_top--; \
+        VM_DBL(0) = (expr); \
+        vm->pc++; \
+    } else { \
+        vm_error(vm, ERR_OVERFLOW, "STACK UNDERFLOW"); \
+        VM_CHECK(); \
+    } \
+}
+
+#define VM_NUMBER_UNARY(expr) { \
+    if (VM_LIKELY(vm->num_top >= 1)) { \
+        double x = VM_DBL(0); \
+        VM_DBL(0) = (expr); \
+        vm->pc++; \
+    } else { \
+        vm_error(vm, ERR_OVERFLOW, "STACK UNDERFLOW"); \
+        VM_CHECK(); \
+    } \
+}
+
+/* Unchecked handlers (threaded dispatch)
+ *
+ * For an instruction flagged INST_FLAG_VERIFIED, verify_program() has
+ * proven that the stack holds the entries it pops, with the types it
+ * expects, and vm_init() has sized the stack for the deepest path, so these
+ * handlers use vm->stack directly with no depth, capacity or type checks.
+ * VM_BIND_HANDLERS() selects them; the switch engine keeps its checks.
+ */
+#define VM_UNCHECKED(op)        vm_unchecked_##op:
+#define VM_UNCHECKED_TARGET(op) unchecked_table[op] = VM_LABEL(vm_unchecked_##op)
+
+#define VM_UNCHECKED_PUSH(n) { \
+    VALUE_SET_NUMBER(vm->stack[vm->stack_top], (n)); \
+    vm->stack_top++; \
+}
+
+#define VM_UNCHECKED_BINARY(expr) { \
+    double b = VALUE_NUMBER(vm->stack[--vm->stack_top]); \
+    double a = VM_NUM(0); \
+    VM_NUM(0) = (expr); \
+    vm->pc++; \
+    VM_NEXT(); \
+}
+
+#define VM_UNCHECKED_UNARY(expr) { \
+    double x = VM_NUM(0); \
+    VM_NUM(0) = (expr); \
+    vm->pc++; \
+    VM_NEXT(); \
+}
+
+#define VM_UNCHECKED_NUMBER_BINARY(expr) { \
+    double b = vm->num_stack[--vm->num_top]; \
+    double a = VM_DBL(0); \
+    VM_DBL(0) = (expr); \
+    vm->pc++; \
+    VM_NEXT(); \
+}
+
+#define VM_UNCHECKED_NUMBER_UNARY(expr) { \
+    double x = VM_DBL(0); \
+    VM_DBL(0) = (expr); \
+    vm->pc++; \
+    VM_NEXT(); \
+}
+
+#define VM_UNCHECKED_BRANCH(cmp) { \
+    double a = VM_NUM(1); \
+    double b = VM_NUM(0); \
+    vm->stack_top -= 2; \
+    vm->pc = (cmp) ? vm->pc + 1 : inst->operand; \
+    VM_NEXT(); \
+}
+
+/* Register instructions: operand k of the current instruction, resolved */
+/* to a register file index by vm_decode_program() */
+#define VM_REG(k)       (vm->num_vars[inst[k].operand])
+
+/* Register compare-and-branch: fall through when cmp holds */
+#define VM_REG_BRANCH(cmp) { \
+    double a = VM_REG(1); \
+    double b = VM_REG(2); \
+    vm->pc = (cmp) ? vm->pc + 3 : inst->operand; \
+}
+
+/* Main VM execution loop; with step set, return after one instruction */
+static void vm_dispatch(VMState *vm, int step) {
+    const DecodedInstruction *inst;
+#ifdef VM_THREADED_DISPATCH
+    static const void *dispatch_table[256];
+    static const void *unchecked_table[256];
+    static int dispatch_ready = 0;
+
+    if (!dispatch_ready) {
+        int i;
+        for (i = 0; i < 256; i++) {
+            dispatch_table[i] = VM_LABEL(vm_default);
+            unchecked_table[i] = NULL;
+        }
+        VM_TARGET(OP_PUSH_CONST);
+        VM_TARGET(OP_PUSH_VAR);
+        VM_TARGET(OP_STR_PUSH_VAR);
+        VM_TARGET(OP_POP_VAR);
+        VM_TARGET(OP_STR_POP_VAR);
+        VM_TARGET(OP_DUP);
+        VM_TARGET(OP_POP);
+        VM_TARGET(OP_ADD);
+        VM_TARGET(OP_SUB);
+        VM_TARGET(OP_MUL);
+        VM_TARGET(OP_DIV);
+        VM_TARGET(OP_MOD);
+        VM_TARGET(OP_POW);
+        VM_TARGET(OP_NEG);
+        VM_TARGET(OP_EQ);
+        VM_TARGET(OP_NE);
+        VM_TARGET(OP_LT);
+        VM_TARGET(OP_LE);
+        VM_TARGET(OP_GT);
+        VM_TARGET(OP_GE);
+        VM_TARGET(OP_AND);
+        VM_TARGET(OP_OR);
+        VM_TARGET(OP_NOT);
+        VM_TARGET(OP_STR_PUSH);
+        VM_TARGET(OP_STR_LEFT);
+        VM_TARGET(OP_STR_RIGHT);
+        VM_TARGET(OP_STR_MID);
+        VM_TARGET(OP_STR_MID_2);
+        VM_TARGET(OP_STR_LEN);
+        VM_TARGET(OP_STR_CHR);
+        VM_TARGET(OP_STR_ASC);
+        VM_TARGET(OP_STR_STR);
+        VM_TARGET(OP_STR_VAL);
+        VM_TARGET(OP_FN_ERR);
+        VM_TARGET(OP_JUMP);
+        VM_TARGET(OP_JUMP_IF_FALSE);
+        VM_TARGET(OP_JUMP_IF_TRUE);
+        VM_TARGET(OP_JUMP_LINE);
+        VM_TARGET(OP_GOSUB);
+        VM_TARGET(OP_GOSUB_LINE);
+        VM_TARGET(OP_ON_GOTO);
+        VM_TARGET(OP_ON_GOSUB);
+        VM_TARGET(OP_RETURN);
+        VM_TARGET(OP_FOR_INIT);
+        VM_TARGET(OP_FOR_NEXT);
+        VM_TARGET(OP_FOR_INIT_INT);
+        VM_TARGET(OP_FOR_NEXT_INT);
+        VM_TARGET(OP_FOR_ENTER);
+        VM_TARGET(OP_FOR_LOOP);
+        VM_TARGET(OP_SET_PRINT_CHANNEL);
+        VM_TARGET(OP_PRINT_NUM);
+        VM_TARGET(OP_PRINT_STR);
+        VM_TARGET(OP_PRINT_NEWLINE);
+        VM_TARGET(OP_PRINT_SPACE);
+        VM_TARGET(OP_PRINT_TAB);
+        VM_TARGET(OP_TAB_FUNC);
+        VM_TARGET(OP_PRINT_NOSEP);
+        VM_TARGET(OP_INPUT_PROMPT);
+        VM_TARGET(OP_INPUT_NUM);
+        VM_TARGET(OP_INPUT_STR);
+        VM_TARGET(OP_OPEN);
+        VM_TARGET(OP_CLOSE);
+        VM_TARGET(OP_GET);
+        VM_TARGET(OP_PUT);
+        VM_TARGET(OP_NOTE);
+        VM_TARGET(OP_POINT);
+        VM_TARGET(OP_STATUS);
+        VM_TARGET(OP_FUNC_SIN);
+        VM_TARGET(OP_FUNC_COS);
+        VM_TARGET(OP_FUNC_TAN);
+        VM_TARGET(OP_FUNC_ATN);
+        VM_TARGET(OP_FUNC_EXP);
+        VM_TARGET(OP_FUNC_LOG);
+        VM_TARGET(OP_FUNC_CLOG);
+        VM_TARGET(OP_FUNC_SQR);
+        VM_TARGET(OP_FUNC_ABS);
+        VM_TARGET(OP_FUNC_INT);
+        VM_TARGET(OP_FUNC_RND);
+        VM_TARGET(OP_FUNC_SGN);
+        VM_TARGET(OP_FUNC_PEEK);
+        VM_TARGET(OP_POKE);
+        VM_TARGET(OP_DIM_1D);
+        VM_TARGET(OP_DIM_2D);
+        VM_TARGET(OP_ARRAY_GET_1D);
+        VM_TARGET(OP_ARRAY_SET_1D);
+        VM_TARGET(OP_ARRAY_GET_2D);
+        VM_TARGET(OP_ARRAY_SET_2D);
+        VM_TARGET(OP_STR_ARRAY_GET_1D);
+        VM_TARGET(OP_STR_ARRAY_SET_1D);
+        VM_TARGET(OP_STR_ARRAY_GET_2D);
+        VM_TARGET(OP_STR_ARRAY_SET_2D);
+        VM_TARGET(OP_ARRAY_LOAD_1D);
+        VM_TARGET(OP_ARRAY_STORE_1D);
+        VM_TARGET(OP_ARRAY_LOAD_2D);
+        VM_TARGET(OP_ARRAY_STORE_2D);
+        VM_TARGET(OP_ARRAY_ADDR_2D);
+        VM_TARGET(OP_ARRAY_STORE_ADDR);
+        VM_TARGET(OP_DATA_READ_NUM);
+        VM_TARGET(OP_DATA_READ_STR);
+        VM_TARGET(OP_RESTORE);
+        VM_TARGET(OP_RESTORE_LINE);
+        VM_TARGET(OP_TRAP);
+        VM_TARGET(OP_TRAP_DISABLE);
+        VM_TARGET(OP_XIO);
+        VM_TARGET(OP_END);
+        VM_TARGET(OP_STOP);
+        VM_TARGET(OP_DEG);
+        VM_TARGET(OP_RAD);
+        VM_TARGET(OP_RANDOMIZE);
+        VM_TARGET(OP_CLR);
+        VM_TARGET(OP_POP_GOSUB);
+        VM_TARGET(OP_NOP);
+        VM_TARGET(OP_VAR_ADD_CONST_POP);
+        VM_TARGET(OP_VAR_SUB_CONST_POP);
+        VM_TARGET(OP_VAR_MUL_VAR);
+        VM_TARGET(OP_VAR_ARRAY_GET_1D);
+        VM_TARGET(OP_JNLT);
+        VM_TARGET(OP_JNLE);
+        VM_TARGET(OP_JNGT);
+        VM_TARGET(OP_JNGE);
+        VM_TARGET(OP_JNEQ);
+        VM_TARGET(OP_JNNE);
+        VM_TARGET(OP_R_MOV);
+        VM_TARGET(OP_R_ADD);
+        VM_TARGET(OP_R_SUB);
+        VM_TARGET(OP_R_MUL);
+        VM_TARGET(OP_R_DIV);
+        VM_TARGET(OP_R_POW);
+        VM_TARGET(OP_R_NEG);
+        VM_TARGET(OP_R_PUSH);
+        VM_TARGET(OP_R_POP);
+        VM_TARGET(OP_R_JNLT);
+        VM_TARGET(OP_R_JNLE);
+        VM_TARGET(OP_R_JNGT);
+        VM_TARGET(OP_R_JNGE);
+        VM_TARGET(OP_R_JNEQ);
+        VM_TARGET(OP_R_JNNE);
+        VM_TARGET(OP_N_PUSH_CONST);
+        VM_TARGET(OP_N_PUSH_VAR);
+        VM_TARGET(OP_N_POP_VAR);
+        VM_TARGET(OP_N_ADD);
+        VM_TARGET(OP_N_SUB);
+        VM_TARGET(OP_N_MUL);
+        VM_TARGET(OP_N_DIV);
+        VM_TARGET(OP_N_POW);
+        VM_TARGET(OP_N_NEG);
+        VM_TARGET(OP_N_EQ);
+        VM_TARGET(OP_N_NE);
+        VM_TARGET(OP_N_LT);
+        VM_TARGET(OP_N_LE);
+        VM_TARGET(OP_N_GT);
+        VM_TARGET(OP_N_GE);
+        VM_TARGET(OP_N_AND);
+        VM_TARGET(OP_N_OR);
+        VM_TARGET(OP_N_NOT);
+        VM_TARGET(OP_N_BOX);
+        VM_TARGET(OP_N_VAR_MUL_VAR);
+        VM_UNCHECKED_TARGET(OP_PUSH_CONST);
+        VM_UNCHECKED_TARGET(OP_PUSH_VAR);
+        VM_UNCHECKED_TARGET(OP_POP_VAR);
+        VM_UNCHECKED_TARGET(OP_ADD);
+        VM_UNCHECKED_TARGET(OP_SUB);
+        VM_UNCHECKED_TARGET(OP_MUL);
+        VM_UNCHECKED_TARGET(OP_MOD);
+        VM_UNCHECKED_TARGET(OP_POW);
+        VM_UNCHECKED_TARGET(OP_NEG);
+        VM_UNCHECKED_TARGET(OP_EQ);
+        VM_UNCHECKED_TARGET(OP_NE);
+        VM_UNCHECKED_TARGET(OP_LT);
+        VM_UNCHECKED_TARGET(OP_LE);
+        VM_UNCHECKED_TARGET(OP_GT);
+        VM_UNCHECKED_TARGET(OP_GE);
+        VM_UNCHECKED_TARGET(OP_AND);
+        VM_UNCHECKED_TARGET(OP_OR);
+        VM_UNCHECKED_TARGET(OP_NOT);
+        VM_UNCHECKED_TARGET(OP_FUNC_ABS);
+        VM_UNCHECKED_TARGET(OP_FUNC_INT);
+        VM_UNCHECKED_TARGET(OP_JUMP_IF_FALSE);
+        VM_UNCHECKED_TARGET(OP_JUMP_IF_TRUE);
+        VM_UNCHECKED_TARGET(OP_JNLT);
+        VM_UNCHECKED_TARGET(OP_JNLE);
+        VM_UNCHECKED_TARGET(OP_JNGT);
+        VM_UNCHECKED_TARGET(OP_JNGE);
+        VM_UNCHECKED_TARGET(OP_JNEQ);
+        VM_UNCHECKED_TARGET(OP_JNNE);
+        VM_UNCHECKED_TARGET(OP_VAR_MUL_VAR);
+        VM_UNCHECKED_TARGET(OP_ARRAY_LOAD_1D);
+        VM_UNCHECKED_TARGET(OP_ARRAY_STORE_1D);
+        VM_UNCHECKED_TARGET(OP_ARRAY_LOAD_2D);
+        VM_UNCHECKED_TARGET(OP_ARRAY_STORE_2D);
+        VM_UNCHECKED_TARGET(OP_ARRAY_ADDR_2D);
+        VM_UNCHECKED_TARGET(OP_ARRAY_STORE_ADDR);
+        VM_UNCHECKED_TARGET(OP_R_PUSH);
+        VM_UNCHECKED_TARGET(OP_R_POP);
+        VM_UNCHECKED_TARGET(OP_N_PUSH_CONST);
+        VM_UNCHECKED_TARGET(OP_N_PUSH_VAR);
+        VM_UNCHECKED_TARGET(OP_N_POP_VAR);
+        VM_UNCHECKED_TARGET(OP_N_ADD);
+        VM_UNCHECKED_TARGET(OP_N_SUB);
+        VM_UNCHECKED_TARGET(OP_N_MUL);
+        VM_UNCHECKED_TARGET(OP_N_POW);
+        VM_UNCHECKED_TARGET(OP_N_NEG);
+        VM_UNCHECKED_TARGET(OP_N_EQ);
+        VM_UNCHECKED_TARGET(OP_N_NE);
+        VM_UNCHECKED_TARGET(OP_N_LT);
+        VM_UNCHECKED_TARGET(OP_N_LE);
+        VM_UNCHECKED_TARGET(OP_N_GT);
+        VM_UNCHECKED_TARGET(OP_N_GE);
+        VM_UNCHECKED_TARGET(OP_N_AND);
+        VM_UNCHECKED_TARGET(OP_N_OR);
+        VM_UNCHECKED_TARGET(OP_N_NOT);
+        VM_UNCHECKED_TARGET(OP_N_BOX);
+        VM_UNCHECKED_TARGET(OP_N_VAR_MUL_VAR);
+        dispatch_ready = 1;
+    }
+    
+    /* Bind handler labels into the decoded stream */
+    if (step) {
+        VM_BIND_HANDLERS(VM_BOUND_STEP);
+    } else {
+        VM_BIND_HANDLERS(VM_BOUND_RUN);
+    }
+
+    if (!vm->running || vm->pc >= vm->program->code_len) return;
+    inst = &vm->decoded[vm->pc];
+    if (step) VM_GOTO(dispatch_table[inst->opcode]);
+    VM_GOTO(inst->handler);
+#else
     while (vm->running && vm->pc < vm->program->code_len) {
-        Instruction inst = vm->program->code[vm->pc];
+        inst = &vm->decoded[vm->pc];
+        
+        if (inst->entry && !step) {
+            int jit;
+            if ((inst->entry & VM_ENTRY_SAFEPOINT) && !VM_SAFEPOINT(vm, inst->safepoint_cost)) break;
+            if (inst->entry & (uint8_t)~VM_ENTRY_SAFEPOINT) {
+                jit = vm_jit_enter(vm);
+                if (jit == JIT_RAN) continue;
+                if (jit == JIT_NEVER) vm->decoded[vm->pc].entry &= (uint8_t)~JIT_ENTRY_POINT;
+            }
+        }
         
-        switch (inst.opcode) {
+        switch (inst->opcode) {
+#endif
             /* Stack Operations */
-            case OP_PUSH_CONST: {
-                double value = vm->program->const_pool[inst.operand];
+            VM_CASE(OP_PUSH_CONST) {
+                double value = inst->imm.number;
                 vm_push_number(vm, value);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_PUSH_VAR: {
-                double value = vm->num_vars[inst.operand];
+            VM_CASE(OP_PUSH_VAR) {
+                double value = vm->num_vars[inst->operand];
                 vm_push_number(vm, value);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_PUSH_VAR: {
-                const char *str = vm->str_vars[inst.operand];
+            VM_CASE(OP_STR_PUSH_VAR) {
+                const char *str = vm->str_vars[inst->operand];
                 if (str) {
                     vm_push_string(vm, basset_strdup(str));
                 } else {
                     vm_push_string(vm, basset_strdup(""));
                 }
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_POP_VAR: {
-                double value = vm_pop_number(vm);
-                vm->num_vars[inst.operand] = value;
+            VM_CASE(OP_POP_VAR) {
+                double value;
+                if (VM_TOP_IS_NUMBER()) {
+                    vm->num_vars[inst->operand] = VM_NUM(0);
+                    vm->stack_top--;
+                    vm->pc++;
+                    VM_NEXT();
+                }
+                value = vm_pop_number(vm);
+                vm->num_vars[inst->operand] = value;
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_POP_VAR: {
+            VM_CASE(OP_STR_POP_VAR) {
                 char *str = vm_pop_string(vm);
-                if (vm->str_vars[inst.operand]) {
-                    free(vm->str_vars[inst.operand]);
+                if (vm->str_vars[inst->operand]) {
+                    free(vm->str_vars[inst->operand]);
                 }
-                vm->str_vars[inst.operand] = str;
+                vm->str_vars[inst->operand] = str;
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_DUP: {
+            VM_CASE(OP_DUP) {
                 if (vm->stack_top > 0) {
                     Value value = vm->stack[vm->stack_top - 1];
                     /* Deep copy strings */
-                    if (value.type == VAL_STRING) {
-                        vm_push_string(vm, basset_strdup(value.data.string));
+                    if (VALUE_IS_STRING(value)) {
+                        vm_push_string(vm, basset_strdup(VALUE_STRING(value)));
                     } else {
                         vm_push(vm, value);
                     }
                 }
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_POP: {
+            VM_CASE(OP_POP) {
                 Value val = vm_pop(vm);
-                if (val.type == VAL_STRING) {
-                    free(val.data.string);
+                if (VALUE_IS_STRING(val)) {
+                    free(VALUE_STRING(val));
                 }
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
             /* Arithmetic Operations */
-            case OP_ADD: {
+            VM_CASE(OP_ADD) {
                 double a, b;
+                VM_FAST_BINARY(a + b);
                 b = vm_pop_number(vm);
-                if (vm->trap_triggered) break;
+                VM_CHECK();
                 a = vm_pop_number(vm);
-                if (vm->trap_triggered) break;
+                VM_CHECK();
                 vm_push_number(vm, a + b);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_SUB: {
+            VM_CASE(OP_SUB) {
                 double a, b;
+                VM_FAST_BINARY(a - b);
                 b = vm_pop_number(vm);
-                if (vm->trap_triggered) break;
+                VM_CHECK();
                 a = vm_pop_number(vm);
-                if (vm->trap_triggered) break;
+                VM_CHECK();
                 vm_push_number(vm, a - b);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_MUL: {
+            VM_CASE(OP_MUL) {
                 double a, b;
+                VM_FAST_BINARY(a * b);
                 b = vm_pop_number(vm);
-                if (vm->trap_triggered) break;
+                VM_CHECK();
                 a = vm_pop_number(vm);
-                if (vm->trap_triggered) break;
+                VM_CHECK();
                 vm_push_number(vm, a * b);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_DIV: {
-                double b = vm_pop_number(vm);
-                double a = vm_pop_number(vm);
+            VM_CASE(OP_DIV) {
+                double a, b;
+                if (VM_TOP2_ARE_NUMBERS() && VM_NUM(0) != 0.0) {
+                    vm->stack_top--;
+                    VM_NUM(0) /= VALUE_NUMBER(vm->stack[vm->stack_top]);
+                    vm->pc++;
+                    VM_NEXT();
+                }
+                b = vm_pop_number(vm);
+                a = vm_pop_number(vm);
                 if (b == 0.0) {
                     vm_error(vm, ERR_DIVISION_BY_ZERO, "DIVISION BY ZERO");
-                    if (vm->trap_triggered) {
-                        vm->trap_triggered = 0;
-                        break;  /* Don't increment pc, trap handler set it */
-                    }
+                    VM_CHECK();
                 } else {
                     vm_push_number(vm, a / b);
                 }
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_MOD: {
+            VM_CASE(OP_MOD) {
                 double a, b;
+                VM_FAST_BINARY(fmod(a, b));
                 b = vm_pop_number(vm);
-                if (vm->trap_triggered) break;
+                VM_CHECK();
                 a = vm_pop_number(vm);
-                if (vm->trap_triggered) break;
+                VM_CHECK();
                 vm_push_number(vm, fmod(a, b));
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_POW: {
-                double b = vm_pop_number(vm);
-                double a = vm_pop_number(vm);
+            VM_CASE(OP_POW) {
+                double a, b;
+                VM_FAST_BINARY(pow(a, b));
+                b = vm_pop_number(vm);
+                a = vm_pop_number(vm);
                 vm_push_number(vm, pow(a, b));
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_NEG: {
-                double a = vm_pop_number(vm);
+            VM_CASE(OP_NEG) {
+                double a;
+                VM_FAST_UNARY(-x);
+                a = vm_pop_number(vm);
                 vm_push_number(vm, -a);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
             /* Comparison Operations */
-            case OP_EQ: {
-                Value b = vm_pop(vm);
-                Value a = vm_pop(vm);
+            VM_CASE(OP_EQ) {
+                Value a, b;
                 int result;
-                if (a.type != b.type) {
+                VM_FAST_BINARY((a == b) ? 1.0 : 0.0);
+                b = vm_pop(vm);
+                a = vm_pop(vm);
+                if (VALUE_IS_STRING(a) != VALUE_IS_STRING(b)) {
                     vm_error(vm, ERR_TYPE_MISMATCH, "TYPE MISMATCH");
                     result = 0;
-                } else if (a.type == VAL_STRING) {
-                    result = (strcmp(a.data.string, b.data.string) == 0) ? 1 : 0;
-                    free(a.data.string);
-                    free(b.data.string);
+                } else if (VALUE_IS_STRING(a)) {
+                    result = (strcmp(VALUE_STRING(a), VALUE_STRING(b)) == 0) ? 1 : 0;
+                    free(VALUE_STRING(a));
+                    free(VALUE_STRING(b));
                 } else {
-                    result = (a.data.number == b.data.number) ? 1 : 0;
+                    result = (VALUE_NUMBER(a) == VALUE_NUMBER(b)) ? 1 : 0;
                 }
                 vm_push_number(vm, (double)result);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_NE: {
-                Value b = vm_pop(vm);
-                Value a = vm_pop(vm);
+            VM_CASE(OP_NE) {
+                Value a, b;
                 int result;
-                if (a.type != b.type) {
+                VM_FAST_BINARY((a != b) ? 1.0 : 0.0);
+                b = vm_pop(vm);
+                a = vm_pop(vm);
+                if (VALUE_IS_STRING(a) != VALUE_IS_STRING(b)) {
                     vm_error(vm, ERR_TYPE_MISMATCH, "TYPE MISMATCH");
                     result = 1;
-                } else if (a.type == VAL_STRING) {
-                    result = (strcmp(a.data.string, b.data.string) != 0) ? 1 : 0;
-                    free(a.data.string);
-                    free(b.data.string);
+                } else if (VALUE_IS_STRING(a)) {
+                    result = (strcmp(VALUE_STRING(a), VALUE_STRING(b)) != 0) ? 1 : 0;
+                    free(VALUE_STRING(a));
+                    free(VALUE_STRING(b));
                 } else {
-                    result = (a.data.number != b.data.number) ? 1 : 0;
+                    result = (VALUE_NUMBER(a) != VALUE_NUMBER(b)) ? 1 : 0;
                 }
                 vm_push_number(vm, (double)result);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_LT: {
-                Value b = vm_pop(vm);
-                Value a = vm_pop(vm);
+            VM_CASE(OP_LT) {
+                Value a, b;
                 int result;
-                if (a.type != b.type) {
+                VM_FAST_BINARY((a < b) ? 1.0 : 0.0);
+                b = vm_pop(vm);
+                a = vm_pop(vm);
+                if (VALUE_IS_STRING(a) != VALUE_IS_STRING(b)) {
                     vm_error(vm, ERR_TYPE_MISMATCH, "TYPE MISMATCH");
                     result = 0;
-                } else if (a.type == VAL_STRING) {
-                    result = (strcmp(a.data.string, b.data.string) < 0) ? 1 : 0;
-                    free(a.data.string);
-                    free(b.data.string);
+                } else if (VALUE_IS_STRING(a)) {
+                    result = (strcmp(VALUE_STRING(a), VALUE_STRING(b)) < 0) ? 1 : 0;
+                    free(VALUE_STRING(a));
+                    free(VALUE_STRING(b));
                 } else {
-                    result = (a.data.number < b.data.number) ? 1 : 0;
+                    result = (VALUE_NUMBER(a) < VALUE_NUMBER(b)) ? 1 : 0;
                 }
                 vm_push_number(vm, (double)result);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_LE: {
-                Value b = vm_pop(vm);
-                Value a = vm_pop(vm);
+            VM_CASE(OP_LE) {
+                Value a, b;
                 int result;
-                if (a.type != b.type) {
+                VM_FAST_BINARY((a <= b) ? 1.0 : 0.0);
+                b = vm_pop(vm);
+                a = vm_pop(vm);
+                if (VALUE_IS_STRING(a) != VALUE_IS_STRING(b)) {
                     vm_error(vm, ERR_TYPE_MISMATCH, "TYPE MISMATCH");
                     result = 0;
-                } else if (a.type == VAL_STRING) {
-                    result = (strcmp(a.data.string, b.data.string) <= 0) ? 1 : 0;
-                    free(a.data.string);
-                    free(b.data.string);
+                } else if (VALUE_IS_STRING(a)) {
+                    result = (strcmp(VALUE_STRING(a), VALUE_STRING(b)) <= 0) ? 1 : 0;
+                    free(VALUE_STRING(a));
+                    free(VALUE_STRING(b));
                 } else {
-                    result = (a.data.number <= b.data.number) ? 1 : 0;
+                    result = (VALUE_NUMBER(a) <= VALUE_NUMBER(b)) ? 1 : 0;
                 }
                 vm_push_number(vm, (double)result);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_GT: {
-                Value b = vm_pop(vm);
-                Value a = vm_pop(vm);
+            VM_CASE(OP_GT) {
+                Value a, b;
                 int result;
-                if (a.type != b.type) {
+                VM_FAST_BINARY((a > b) ? 1.0 : 0.0);
+                b = vm_pop(vm);
+                a = vm_pop(vm);
+                if (VALUE_IS_STRING(a) != VALUE_IS_STRING(b)) {
                     vm_error(vm, ERR_TYPE_MISMATCH, "TYPE MISMATCH");
                     result = 0;
-                } else if (a.type == VAL_STRING) {
-                    result = (strcmp(a.data.string, b.data.string) > 0) ? 1 : 0;
-                    free(a.data.string);
-                    free(b.data.string);
+                } else if (VALUE_IS_STRING(a)) {
+                    result = (strcmp(VALUE_STRING(a), VALUE_STRING(b)) > 0) ? 1 : 0;
+                    free(VALUE_STRING(a));
+                    free(VALUE_STRING(b));
                 } else {
-                    result = (a.data.number > b.data.number) ? 1 : 0;
+                    result = (VALUE_NUMBER(a) > VALUE_NUMBER(b)) ? 1 : 0;
                 }
                 vm_push_number(vm, (double)result);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_GE: {
-                Value b = vm_pop(vm);
-                Value a = vm_pop(vm);
+            VM_CASE(OP_GE) {
+                Value a, b;
                 int result;
-                if (a.type != b.type) {
+                VM_FAST_BINARY((a >= b) ? 1.0 : 0.0);
+                b = vm_pop(vm);
+                a = vm_pop(vm);
+                if (VALUE_IS_STRING(a) != VALUE_IS_STRING(b)) {
                     vm_error(vm, ERR_TYPE_MISMATCH, "TYPE MISMATCH");
                     result = 0;
-                } else if (a.type == VAL_STRING) {
-                    result = (strcmp(a.data.string, b.data.string) >= 0) ? 1 : 0;
-                    free(a.data.string);
-                    free(b.data.string);
+                } else if (VALUE_IS_STRING(a)) {
+                    result = (strcmp(VALUE_STRING(a), VALUE_STRING(b)) >= 0) ? 1 : 0;
+                    free(VALUE_STRING(a));
+                    free(VALUE_STRING(b));
                 } else {
-                    result = (a.data.number >= b.data.number) ? 1 : 0;
+                    result = (VALUE_NUMBER(a) >= VALUE_NUMBER(b)) ? 1 : 0;
                 }
                 vm_push_number(vm, (double)result);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
             /* Logical Operations */
-            case OP_AND: {
-                double b = vm_pop_number(vm);
-                double a = vm_pop_number(vm);
+            VM_CASE(OP_AND) {
+                double a, b;
+                VM_FAST_BINARY((a != 0.0 && b != 0.0) ? 1.0 : 0.0);
+                b = vm_pop_number(vm);
+                a = vm_pop_number(vm);
                 vm_push_number(vm, (a != 0.0 && b != 0.0) ? 1.0 : 0.0);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_OR: {
-                double b = vm_pop_number(vm);
-                double a = vm_pop_number(vm);
+            VM_CASE(OP_OR) {
+                double a, b;
+                VM_FAST_BINARY((a != 0.0 || b != 0.0) ? 1.0 : 0.0);
+                b = vm_pop_number(vm);
+                a = vm_pop_number(vm);
                 vm_push_number(vm, (a != 0.0 || b != 0.0) ? 1.0 : 0.0);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_NOT: {
-                double a = vm_pop_number(vm);
+            VM_CASE(OP_NOT) {
+                double a;
+                VM_FAST_UNARY((x == 0.0) ? 1.0 : 0.0);
+                a = vm_pop_number(vm);
                 vm_push_number(vm, (a == 0.0) ? 1.0 : 0.0);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
             /* String Operations */
-            case OP_STR_PUSH: {
-                const char *str = vm->program->string_pool[inst.operand];
+            VM_CASE(OP_STR_PUSH) {
+                const char *str = vm->program->string_pool[inst->operand];
                 vm_push_string(vm, basset_strdup(str));
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_LEFT: {
+            VM_CASE(OP_STR_LEFT) {
                 /* LEFT$(str, len) - pops len, then str */
                 double len_d;
                 char *str;
@@ -774,7 +1687,7 @@ void vm_execute(VMState *vm) {
                 
                 len_d = vm_pop_number(vm);
                 str = vm_pop_string(vm);
-                if (vm->trap_triggered) break;  /* Error occurred */
+                VM_CHECK();  /* Error occurred */
                 len = (int)len_d;
                 
                 if (len < 0) len = 0;
@@ -786,10 +1699,10 @@ void vm_execute(VMState *vm) {
                 vm_push_string(vm, result);
                 free(str);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_RIGHT: {
+            VM_CASE(OP_STR_RIGHT) {
                 /* RIGHT$(str, len) - pops len, then str */
                 double len_d;
                 char *str;
@@ -800,7 +1713,7 @@ void vm_execute(VMState *vm) {
                 
                 len_d = vm_pop_number(vm);
                 str = vm_pop_string(vm);
-                if (vm->trap_triggered) break;  /* Error occurred */
+                VM_CHECK();  /* Error occurred */
                 len = (int)len_d;
                 str_len = strlen(str);
                 
@@ -811,10 +1724,10 @@ void vm_execute(VMState *vm) {
                 vm_push_string(vm, result);
                 free(str);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_MID: {
+            VM_CASE(OP_STR_MID) {
                 /* MID$(str, start, len) - pops len, start, then str */
                 /* If len is missing (only 2 args), it's treated as rest of string */
                 double len_d;
@@ -829,7 +1742,7 @@ void vm_execute(VMState *vm) {
                 len_d = vm_pop_number(vm);
                 start_d = vm_pop_number(vm);
                 str = vm_pop_string(vm);
-                if (vm->trap_triggered) break;  /* Error occurred */
+                VM_CHECK();  /* Error occurred */
                 start = (int)start_d;
                 len = (int)len_d;
                 str_len = strlen(str);
@@ -841,7 +1754,7 @@ void vm_execute(VMState *vm) {
                     vm_push_string(vm, basset_strdup(""));
                     free(str);
                     vm->pc++;
-                    break;
+                    VM_NEXT_CHECKED();
                 }
                 
                 if (len < 0 || len > str_len - start) {
@@ -856,10 +1769,10 @@ void vm_execute(VMState *vm) {
                 vm_push_string(vm, result);
                 free(str);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_MID_2: {
+            VM_CASE(OP_STR_MID_2) {
                 /* MID$(str, start) - 2 args, return from start to end */
                 double start_d = vm_pop_number(vm);
                 char *str = vm_pop_string(vm);
@@ -876,7 +1789,7 @@ void vm_execute(VMState *vm) {
                     vm_push_string(vm, basset_strdup(""));
                     free(str);
                     vm->pc++;
-                    break;
+                    VM_NEXT_CHECKED();
                 }
                 
                 /* Return rest of string from start position */
@@ -889,102 +1802,114 @@ void vm_execute(VMState *vm) {
                 vm_push_string(vm, result);
                 free(str);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_LEN: {
+            VM_CASE(OP_STR_LEN) {
                 char *str;
                 double len;
                 
                 str = vm_pop_string(vm);
-                if (vm->trap_triggered) break;  /* Error occurred, TRAP handler set PC */
+                VM_CHECK();  /* Error occurred, TRAP handler set PC */
                 len = (double)strlen(str);
                 free(str);
                 vm_push_number(vm, len);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_CHR: {
+            VM_CASE(OP_STR_CHR) {
                 double code = vm_pop_number(vm);
                 char result[2];
                 result[0] = (char)(int)code;
                 result[1] = '\0';
                 vm_push_string(vm, basset_strdup(result));
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_ASC: {
+            VM_CASE(OP_STR_ASC) {
                 char *str;
                 double code;
                 
                 str = vm_pop_string(vm);
-                if (vm->trap_triggered) break;  /* Error occurred */
+                VM_CHECK();  /* Error occurred */
                 code = str[0] ? (double)(unsigned char)str[0] : 0.0;
                 free(str);
                 vm_push_number(vm, code);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_STR: {
+            VM_CASE(OP_STR_STR) {
                 double value = vm_pop_number(vm);
                 char buffer[64];
                 sprintf(buffer, "%g", value);
                 vm_push_string(vm, basset_strdup(buffer));
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_VAL: {
+            VM_CASE(OP_STR_VAL) {
                 char *str;
                 double value;
                 
                 str = vm_pop_string(vm);
-                if (vm->trap_triggered) break;  /* Error occurred */
+                VM_CHECK();  /* Error occurred */
                 value = atof(str);
                 free(str);
                 vm_push_number(vm, value);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
             /* System Functions */
-            case OP_FN_ERR: {
+            VM_CASE(OP_FN_ERR) {
                 /* Return the last error code */
                 vm_push_number(vm, (double)vm->error_code);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
             /* Control Flow */
-            case OP_JUMP: {
-                vm->pc = inst.operand;
-                break;
+            VM_CASE(OP_JUMP) {
+                vm->pc = inst->operand;
+                VM_NEXT();
             }
             
-            case OP_JUMP_IF_FALSE: {
-                double cond = vm_pop_number(vm);
+            VM_CASE(OP_JUMP_IF_FALSE) {
+                double cond;
+                if (VM_TOP_IS_NUMBER()) {
+                    vm->stack_top--;
+                    vm->pc = (VALUE_NUMBER(vm->stack[vm->stack_top]) == 0.0) ? inst->operand : vm->pc + 1;
+                    VM_NEXT();
+                }
+                cond = vm_pop_number(vm);
                 if (cond == 0.0) {
-                    vm->pc = inst.operand;
+                    vm->pc = inst->operand;
                 } else {
                     vm->pc++;
                 }
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_JUMP_IF_TRUE: {
-                double cond = vm_pop_number(vm);
+            VM_CASE(OP_JUMP_IF_TRUE) {
+                double cond;
+                if (VM_TOP_IS_NUMBER()) {
+                    vm->stack_top--;
+                    vm->pc = (VALUE_NUMBER(vm->stack[vm->stack_top]) != 0.0) ? inst->operand : vm->pc + 1;
+                    VM_NEXT();
+                }
+                cond = vm_pop_number(vm);
                 if (cond != 0.0) {
-                    vm->pc = inst.operand;
+                    vm->pc = inst->operand;
                 } else {
                     vm->pc++;
                 }
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_JUMP_LINE: {
+            VM_CASE(OP_JUMP_LINE) {
                 double line_d = vm_pop_number(vm);
                 uint16_t line = (uint16_t)line_d;
                 int32_t offset = vm_find_line_offset(vm, line);
@@ -994,16 +1919,16 @@ void vm_execute(VMState *vm) {
                 } else {
                     vm->pc = offset;
                 }
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_GOSUB: {
+            VM_CASE(OP_GOSUB) {
                 vm_call_push(vm, vm->pc + 1);
-                vm->pc = inst.operand;
-                break;
+                vm->pc = inst->operand;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_GOSUB_LINE: {
+            VM_CASE(OP_GOSUB_LINE) {
                 double line_d = vm_pop_number(vm);
                 uint16_t line = (uint16_t)line_d;
                 int32_t offset = vm_find_line_offset(vm, line);
@@ -1014,13 +1939,13 @@ void vm_execute(VMState *vm) {
                     vm_call_push(vm, vm->pc + 1);
                     vm->pc = offset;
                 }
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_ON_GOTO: {
+            VM_CASE(OP_ON_GOTO) {
                 double index_d = vm_pop_number(vm);
                 int index = (int)index_d;
-                uint16_t count = inst.operand;
+                uint16_t count = inst->operand;
                 
                 /* Index is 1-based; if out of range, skip the targets and continue */
                 if (index >= 1 && index <= count) {
@@ -1031,13 +1956,13 @@ void vm_execute(VMState *vm) {
                     /* Skip the jump table */
                     vm->pc += count + 1;
                 }
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_ON_GOSUB: {
+            VM_CASE(OP_ON_GOSUB) {
                 double index_d = vm_pop_number(vm);
                 int index = (int)index_d;
-                uint16_t count = inst.operand;
+                uint16_t count = inst->operand;
                 
                 /* Index is 1-based; if out of range, skip the targets and continue */
                 if (index >= 1 && index <= count) {
@@ -1050,15 +1975,16 @@ void vm_execute(VMState *vm) {
                     /* Skip the jump table */
                     vm->pc += count + 1;
                 }
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_RETURN: {
+            VM_CASE(OP_RETURN) {
                 vm->pc = vm_call_pop(vm);
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FOR_INIT: {
+            VM_CASE(OP_FOR_INIT)
+            VM_CASE(OP_FOR_INIT_INT) {
                 ForLoopState state;
                 double step, limit, start;
                 
@@ -1068,63 +1994,93 @@ void vm_execute(VMState *vm) {
                 
                 state.step = step;
                 state.limit = limit;
-                state.var_slot = inst.operand;
+                state.var_slot = inst->operand;
                 state.loop_start_pc = vm->pc + 1;
+                state.int_loop = 0;
+                
+                /* Count in int64 when every value is an integer of at most */
+                /* 2^52, so the doubles written back are exact */
+                if (inst->opcode == OP_FOR_INIT_INT && step != 0.0 &&
+                    fabs(start) <= VM_INT_LOOP_MAX && fabs(limit) <= VM_INT_LOOP_MAX &&
+                    fabs(step) <= VM_INT_LOOP_MAX &&
+                    start == floor(start) && limit == floor(limit) && step == floor(step)) {
+                    int64_t first = (int64_t)start;
+                    int64_t last = (int64_t)limit;
+                    int64_t by = (int64_t)step;
+                    int64_t span = (by > 0) ? last - first : first - last;
+                    int64_t passes = (span < 0) ? 1 : span / (by > 0 ? by : -by) + 1;
+                    
+                    state.int_loop = 1;
+                    state.int_value = first;
+                    state.int_step = by;
+                    state.int_end = first + passes * by;
+                }
                 
-                vm->num_vars[inst.operand] = start;
+                vm->num_vars[inst->operand] = start;
                 vm_for_push(vm, state);
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FOR_NEXT: {
-                ForLoopState *loop;
-                double new_val;
-                int done;
-                uint16_t var_slot;
-                
-                loop = vm_for_top(vm);
-                if (!loop) break;
-                
-                /* Check if variable was specified (0xFFFF means no variable) */
-                if (inst.operand != 0xFFFF) {
-                    /* Variable specified - validate it matches the FOR loop */
-                    if (loop->var_slot != inst.operand) {
-                        char err_msg[256];
-                        snprintf(err_msg, sizeof(err_msg),
-                                "NEXT variable mismatch: expected %s, got %s",
-                                vm_get_var_name(vm, loop->var_slot),
-                                vm_get_var_name(vm, inst.operand));
-                        vm_error(vm, ERR_FOR_NEXT_MISMATCH, err_msg);
-                        break;
+            VM_CASE(OP_FOR_NEXT) {
+                vm_for_next(vm, inst->operand);
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_FOR_NEXT_INT) {
+                ForLoopState *loop = vm->for_top ? &vm->for_stack[vm->for_top - 1] : NULL;
+                
+                /* Integer count, unless the body has stored to the variable */
+                if (VM_LIKELY(loop && loop->int_loop && loop->var_slot == inst->operand &&
+                              vm->num_vars[inst->operand] == (double)loop->int_value)) {
+                    loop->int_value += loop->int_step;
+                    vm->num_vars[inst->operand] = (double)loop->int_value;
+                    if (loop->int_value != loop->int_end) {
+                        vm->pc = loop->loop_start_pc;
+                    } else {
+                        vm->for_top--;
+                        vm->pc++;
                     }
-                    var_slot = inst.operand;
-                } else {
-                    /* No variable specified - use the FOR loop's variable */
-                    var_slot = loop->var_slot;
+                    VM_NEXT();
                 }
+                if (loop && loop->var_slot == inst->operand) loop->int_loop = 0;
+                vm_for_next(vm, inst->operand);
+                VM_NEXT_CHECKED();
+            }
+            
+            /* Statically paired loops: limit and step live in num_vars */
+            VM_CASE(OP_FOR_ENTER) {
+                double step, limit, start;
+                uint32_t slots = inst[1].operand;
                 
-                new_val = vm->num_vars[var_slot] + loop->step;
-                vm->num_vars[var_slot] = new_val;
+                step = vm_pop_number(vm);
+                limit = vm_pop_number(vm);
+                start = vm_pop_number(vm);
                 
-                if (loop->step > 0) {
-                    done = (new_val > loop->limit);
-                } else {
-                    done = (new_val < loop->limit);
-                }
+                vm->num_vars[slots] = limit;
+                vm->num_vars[slots + 1] = step;
+                vm->num_vars[inst->operand] = start;
                 
-                if (!done) {
-                    vm->pc = loop->loop_start_pc;
+                vm->pc += FOR_ENTER_WORDS;
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_FOR_LOOP) {
+                const double *bounds = &vm->num_vars[inst[1].operand];
+                double value = vm->num_vars[inst->operand] + bounds[1];
+                
+                vm->num_vars[inst->operand] = value;
+                if (bounds[1] > 0 ? !(value > bounds[0]) : !(value < bounds[0])) {
+                    vm->pc = inst[2].operand;
                 } else {
-                    vm_for_pop(vm);
-                    vm->pc++;
+                    vm->pc += FOR_LOOP_WORDS;
                 }
-                break;
+                VM_NEXT();
             }
             
             /* I/O Operations */
-            case OP_SET_PRINT_CHANNEL: {
+            VM_CASE(OP_SET_PRINT_CHANNEL) {
                 /* Pop channel number from stack and set as current print channel */
                 double chan_val = vm_pop_number(vm);
                 int chan = (int)chan_val;
@@ -1137,10 +2093,10 @@ void vm_execute(VMState *vm) {
                     vm->print_channel = (uint8_t)chan;
                 }
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_PRINT_NUM: {
+            VM_CASE(OP_PRINT_NUM) {
                 double value = vm_pop_number(vm);
                 char buffer[32];
                 size_t len;
@@ -1178,10 +2134,10 @@ void vm_execute(VMState *vm) {
                 vm->print_after_tab = 0;  /* Reset after consuming */
                 vm->print_needs_newline = 1;
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_PRINT_STR: {
+            VM_CASE(OP_PRINT_STR) {
                 char *str = vm_pop_string(vm);
                 size_t len = strlen(str);
                 FILE *out = vm_get_output_file(vm);
@@ -1195,10 +2151,10 @@ void vm_execute(VMState *vm) {
                 vm->print_after_tab = 0;  /* Reset after any print operation */
                 vm->print_needs_newline = 1;
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_PRINT_NEWLINE: {
+            VM_CASE(OP_PRINT_NEWLINE) {
                 FILE *out = vm_get_output_file(vm);
                 fprintf(out, "\n");
                 fflush(out);  /* Ensure data is written to file */
@@ -1211,19 +2167,19 @@ void vm_execute(VMState *vm) {
                 vm->print_channel = 0;
                 
                 vm->pc++;
-                break;
+                VM_NEXT();
             }
             
-            case OP_PRINT_SPACE: {
+            VM_CASE(OP_PRINT_SPACE) {
                 FILE *out = vm_get_output_file(vm);
                 fprintf(out, " ");
                 vm->print_last_char = ' ';
                 vm->print_after_tab = 0;
                 vm->pc++;
-                break;
+                VM_NEXT();
             }
             
-            case OP_PRINT_TAB: {
+            VM_CASE(OP_PRINT_TAB) {
                 FILE *out = vm_get_output_file(vm);
                 /* Classic BASIC uses 10-character print zones for commas */
                 /* Just output a single space and set flag to suppress next number's leading space */
@@ -1232,10 +2188,10 @@ void vm_execute(VMState *vm) {
                 vm->print_column++;
                 vm->print_after_tab = 1;  /* Signal to suppress leading space on next number */
                 vm->pc++;
-                break;
+                VM_NEXT();
             }
             
-            case OP_TAB_FUNC: {
+            VM_CASE(OP_TAB_FUNC) {
                 /* TAB(n) function - move cursor to column n */
                 double target_col_d = vm_pop_number(vm);
                 int target_col = (int)target_col_d;
@@ -1270,38 +2226,40 @@ void vm_execute(VMState *vm) {
                 vm->print_last_char = ' ';
                 vm->print_after_tab = 1;  /* Suppress leading space on next number */
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_PRINT_NOSEP: {
+            VM_CASE(OP_PRINT_NOSEP) {
                 /* Semicolon separator - suppress spacing on next number */
                 vm->print_after_tab = 1;  /* Reuse flag to suppress leading space */
                 vm->pc++;
-                break;
+                VM_NEXT();
             }
             
-            case OP_INPUT_PROMPT: {
+            VM_CASE(OP_INPUT_PROMPT) {
                 /* Display prompt string before INPUT */
-                const char *prompt = vm->program->string_pool[inst.operand];
+                const char *prompt = vm->program->string_pool[inst->operand];
                 printf("%s", prompt);
                 fflush(stdout);
                 vm->pc++;
-                break;
+                VM_NEXT();
             }
             
-            case OP_INPUT_NUM: {
+            VM_CASE(OP_INPUT_NUM) {
                 char *value_str;
                 int input_valid = 0;
                 
                 while (!input_valid) {
                     value_str = get_next_input_value(vm);
                     
-                    if (strlen(value_str) == 0 && !vm->input_available) {
+                    if (!value_str) {
+                        break;  /* Run this INPUT again once the host has a line */
+                    } else if (strlen(value_str) == 0 && !vm->input_available) {
                         /* Empty input or EOF */
                         input_valid = 1;
-                        vm->num_vars[inst.operand] = 0.0;
+                        vm->num_vars[inst->operand] = 0.0;
                     } else if (is_valid_numeric_input(value_str)) {
-                        vm->num_vars[inst.operand] = atof(value_str);
+                        vm->num_vars[inst->operand] = value_canonical(atof(value_str));
                         input_valid = 1;
                     } else {
                         printf("ERROR - 18\n");
@@ -1309,24 +2267,25 @@ void vm_execute(VMState *vm) {
                     }
                 }
                 
-                vm->pc++;
-                break;
+                if (input_valid) vm->pc++;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_INPUT_STR: {
+            VM_CASE(OP_INPUT_STR) {
                 char *value_str = get_next_input_value(vm);
                 
-                if (vm->str_vars[inst.operand]) {
-                    free(vm->str_vars[inst.operand]);
+                if (value_str) {
+                    if (vm->str_vars[inst->operand]) {
+                        free(vm->str_vars[inst->operand]);
+                    }
+                    vm->str_vars[inst->operand] = basset_strdup(value_str);
+                    vm->pc++;
                 }
-                vm->str_vars[inst.operand] = basset_strdup(value_str);
-                
-                vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
             /* File I/O Operations */
-            case OP_OPEN: {
+            VM_CASE(OP_OPEN) {
                 /* Stack: channel, mode, aux, filename */
                 char *filename;
                 double mode;
@@ -1342,7 +2301,7 @@ void vm_execute(VMState *vm) {
                 if (chan < 1 || chan > 7) {
                     vm_error(vm, ERR_BAD_FILE_NUMBER, "Invalid channel number");
                     free(filename);
-                    break;
+                    VM_NEXT_CHECKED();
                 }
                 
                 /* Close existing handle if open */
@@ -1376,10 +2335,10 @@ void vm_execute(VMState *vm) {
                 
                 free(filename);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_CLOSE: {
+            VM_CASE(OP_CLOSE) {
                 /* Stack: channel */
                 double channel = vm_pop_number(vm);
                 int chan = (int)channel;
@@ -1396,10 +2355,10 @@ void vm_execute(VMState *vm) {
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_GET: {
+            VM_CASE(OP_GET) {
                 /* Stack: channel - Push: byte value */
                 double channel;
                 int chan;
@@ -1410,7 +2369,7 @@ void vm_execute(VMState *vm) {
                 
                 if (chan < 1 || chan > 7 || !vm->file_handles[chan]) {
                     vm_error(vm, ERR_FILE_NOT_FOUND, "Channel not open");
-                    break;
+                    VM_NEXT_CHECKED();
                 }
                 
                 byte = fgetc(vm->file_handles[chan]);
@@ -1424,10 +2383,10 @@ void vm_execute(VMState *vm) {
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_PUT: {
+            VM_CASE(OP_PUT) {
                 /* Stack: channel, value */
                 double value;
                 double channel;
@@ -1440,7 +2399,7 @@ void vm_execute(VMState *vm) {
                 
                 if (chan < 1 || chan > 7 || !vm->file_handles[chan]) {
                     vm_error(vm, ERR_FILE_NOT_FOUND, "Channel not open");
-                    break;
+                    VM_NEXT_CHECKED();
                 }
                 
                 byte = (int)value & 0xFF;
@@ -1452,10 +2411,10 @@ void vm_execute(VMState *vm) {
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_NOTE: {
+            VM_CASE(OP_NOTE) {
                 /* Stack: channel - Push: sector, byte_position */
                 double channel;
                 int chan;
@@ -1468,7 +2427,7 @@ void vm_execute(VMState *vm) {
                 
                 if (chan < 1 || chan > 7 || !vm->file_handles[chan]) {
                     vm_error(vm, ERR_FILE_NOT_FOUND, "Channel not open");
-                    break;
+                    VM_NEXT_CHECKED();
                 }
                 
                 pos = ftell(vm->file_handles[chan]);
@@ -1480,10 +2439,10 @@ void vm_execute(VMState *vm) {
                 vm->file_positions[chan] = pos;
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_POINT: {
+            VM_CASE(OP_POINT) {
                 /* Stack: channel, sector, byte_position */
                 double byte_pos;
                 double sector;
@@ -1498,7 +2457,7 @@ void vm_execute(VMState *vm) {
                 
                 if (chan < 1 || chan > 7 || !vm->file_handles[chan]) {
                     vm_error(vm, ERR_FILE_NOT_FOUND, "Channel not open");
-                    break;
+                    VM_NEXT_CHECKED();
                 }
                 
                 pos = (long)sector * 125 + (long)byte_pos;
@@ -1510,10 +2469,10 @@ void vm_execute(VMState *vm) {
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STATUS: {
+            VM_CASE(OP_STATUS) {
                 /* Stack: channel - Push: status */
                 double channel = vm_pop_number(vm);
                 int chan = (int)channel;
@@ -1525,11 +2484,11 @@ void vm_execute(VMState *vm) {
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
             /* Math Functions */
-            case OP_FUNC_SIN: {
+            VM_CASE(OP_FUNC_SIN) {
                 double x = vm_pop_number(vm);
                 if (vm->deg_mode) {
                     vm_push_number(vm, sin(x * M_PI / 180.0));
@@ -1537,10 +2496,10 @@ void vm_execute(VMState *vm) {
                     vm_push_number(vm, sin(x));
                 }
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FUNC_COS: {
+            VM_CASE(OP_FUNC_COS) {
                 double x = vm_pop_number(vm);
                 if (vm->deg_mode) {
                     vm_push_number(vm, cos(x * M_PI / 180.0));
@@ -1548,10 +2507,10 @@ void vm_execute(VMState *vm) {
                     vm_push_number(vm, cos(x));
                 }
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FUNC_TAN: {
+            VM_CASE(OP_FUNC_TAN) {
                 double x = vm_pop_number(vm);
                 if (vm->deg_mode) {
                     vm_push_number(vm, tan(x * M_PI / 180.0));
@@ -1559,10 +2518,10 @@ void vm_execute(VMState *vm) {
                     vm_push_number(vm, tan(x));
                 }
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FUNC_ATN: {
+            VM_CASE(OP_FUNC_ATN) {
                 double x = vm_pop_number(vm);
                 if (vm->deg_mode) {
                     vm_push_number(vm, atan(x) * 180.0 / M_PI);
@@ -1570,67 +2529,71 @@ void vm_execute(VMState *vm) {
                     vm_push_number(vm, atan(x));
                 }
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FUNC_EXP: {
+            VM_CASE(OP_FUNC_EXP) {
                 double x = vm_pop_number(vm);
                 vm_push_number(vm, exp(x));
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FUNC_LOG: {
+            VM_CASE(OP_FUNC_LOG) {
                 double x = vm_pop_number(vm);
                 if (x <= 0) {
                     vm_error(vm, ERR_ILLEGAL_FUNCTION, "LOG OF NEGATIVE NUMBER");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                 } else {
                     vm_push_number(vm, log(x));
                 }
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FUNC_CLOG: {
+            VM_CASE(OP_FUNC_CLOG) {
                 double x = vm_pop_number(vm);
                 if (x <= 0) {
                     vm_error(vm, ERR_ILLEGAL_FUNCTION, "LOG OF NEGATIVE NUMBER");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                 } else {
                     vm_push_number(vm, log10(x));
                 }
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FUNC_SQR: {
+            VM_CASE(OP_FUNC_SQR) {
                 double x = vm_pop_number(vm);
                 if (x < 0) {
                     vm_error(vm, ERR_ILLEGAL_FUNCTION, "SQRT OF NEGATIVE NUMBER");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                 } else {
                     vm_push_number(vm, sqrt(x));
                 }
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FUNC_ABS: {
-                double x = vm_pop_number(vm);
+            VM_CASE(OP_FUNC_ABS) {
+                double x;
+                VM_FAST_UNARY(fabs(x));
+                x = vm_pop_number(vm);
                 vm_push_number(vm, fabs(x));
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FUNC_INT: {
-                double x = vm_pop_number(vm);
+            VM_CASE(OP_FUNC_INT) {
+                double x;
+                VM_FAST_UNARY(floor(x));
+                x = vm_pop_number(vm);
                 vm_push_number(vm, floor(x));
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FUNC_RND: {
+            VM_CASE(OP_FUNC_RND) {
                 double x = vm_pop_number(vm);
                 double result;
                 
@@ -1659,19 +2622,21 @@ void vm_execute(VMState *vm) {
                 
                 vm_push_number(vm, result);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FUNC_SGN: {
-                double x = vm_pop_number(vm);
+            VM_CASE(OP_FUNC_SGN) {
+                double x;
+                VM_FAST_UNARY((x > 0) ? 1.0 : (x < 0) ? -1.0 : 0.0);
+                x = vm_pop_number(vm);
                 if (x > 0) vm_push_number(vm, 1.0);
                 else if (x < 0) vm_push_number(vm, -1.0);
                 else vm_push_number(vm, 0.0);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_FUNC_PEEK: {
+            VM_CASE(OP_FUNC_PEEK) {
                 /* PEEK(address) - returns byte value at memory location */
                 double addr_d = vm_pop_number(vm);
                 int addr = (int)addr_d;
@@ -1680,7 +2645,7 @@ void vm_execute(VMState *vm) {
                 /* Validate address range (0-65535) */
                 if (addr < 0 || addr > 65535) {
                     vm_error(vm, ERR_ILLEGAL_FUNCTION, "ILLEGAL ADDRESS IN PEEK");
-                    break;
+                    VM_NEXT_CHECKED();
                 }
                 
                 /* Read from simulated memory buffer */
@@ -1688,10 +2653,10 @@ void vm_execute(VMState *vm) {
                 vm_push_number(vm, (double)value);
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_POKE: {
+            VM_CASE(OP_POKE) {
                 /* POKE address, value - writes byte value to memory location */
                 double value_d = vm_pop_number(vm);
                 double addr_d = vm_pop_number(vm);
@@ -1701,7 +2666,7 @@ void vm_execute(VMState *vm) {
                 /* Validate address range (0-65535) */
                 if (addr < 0 || addr > 65535) {
                     vm_error(vm, ERR_ILLEGAL_FUNCTION, "ILLEGAL ADDRESS IN POKE");
-                    break;
+                    VM_NEXT_CHECKED();
                 }
                 
                 /* Only use low order byte (0-255) per Microsoft BASIC spec */
@@ -1711,111 +2676,142 @@ void vm_execute(VMState *vm) {
                 vm->memory[addr] = (unsigned char)byte_val;
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
             /* Array Operations */
-            case OP_DIM_1D: {
+            VM_CASE(OP_DIM_1D) {
                 double size_d = vm_pop_number(vm);
                 size_t size = (size_t)size_d + 1;  /* Classic BASIC: DIM A(10) allocates 0-10 */
-                int is_string = vm->arrays[inst.operand].is_string;
+                int is_string = inst->imm.array->is_string;
                 size_t i;
                 
                 /* Free existing array */
-                if (is_string && vm->arrays[inst.operand].u.str_data) {
-                    size_t old_size = vm->arrays[inst.operand].dim1;
+                if (vm->addr_array == inst->imm.array) vm->addr_array = NULL;
+                if (is_string && inst->imm.array->u.str_data) {
+                    size_t old_size = inst->imm.array->dim1;
                     for (i = 0; i < old_size; i++) {
-                        if (vm->arrays[inst.operand].u.str_data[i]) free(vm->arrays[inst.operand].u.str_data[i]);
+                        if (inst->imm.array->u.str_data[i]) free(inst->imm.array->u.str_data[i]);
                     }
-                    free(vm->arrays[inst.operand].u.str_data);
-                } else if (!is_string && vm->arrays[inst.operand].u.data) {
-                    free(vm->arrays[inst.operand].u.data);
+                    free(inst->imm.array->u.str_data);
+                } else if (!is_string && inst->imm.array->u.data) {
+                    free(inst->imm.array->u.data);
                 }
                 
-                vm->arrays[inst.operand].type = VAR_ARRAY_1D;
-                vm->arrays[inst.operand].dim1 = size;
-                vm->arrays[inst.operand].dim2 = 0;
+                inst->imm.array->type = VAR_ARRAY_1D;
+                inst->imm.array->dim1 = size;
+                inst->imm.array->dim2 = 0;
                 
                 if (is_string) {
-                    vm->arrays[inst.operand].u.str_data = calloc(size, sizeof(char*));
+                    inst->imm.array->u.str_data = calloc(size, sizeof(char*));
                     for (i = 0; i < size; i++) {
-                        vm->arrays[inst.operand].u.str_data[i] = basset_strdup("");
+                        inst->imm.array->u.str_data[i] = basset_strdup("");
                     }
                 } else {
-                    vm->arrays[inst.operand].u.data = calloc(size, sizeof(double));
+                    inst->imm.array->u.data = calloc(size, sizeof(double));
+                    if (!inst->imm.array->u.data) {
+                        inst->imm.array->dim1 = 0;
+                        vm_error(vm, ERR_OUT_OF_MEMORY, "OUT OF MEMORY");
+                        VM_CHECK();
+                    }
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_DIM_2D: {
+            VM_CASE(OP_DIM_2D) {
                 double col_d = vm_pop_number(vm);
                 double row_d = vm_pop_number(vm);
                 size_t rows = (size_t)row_d + 1;
                 size_t cols = (size_t)col_d + 1;
-                int is_string = vm->arrays[inst.operand].is_string;
+                int is_string = inst->imm.array->is_string;
                 size_t i;
                 
                 /* Free existing array */
-                if (is_string && vm->arrays[inst.operand].u.str_data) {
-                    size_t old_size = vm->arrays[inst.operand].dim1 * vm->arrays[inst.operand].dim2;
+                if (vm->addr_array == inst->imm.array) vm->addr_array = NULL;
+                if (is_string && inst->imm.array->u.str_data) {
+                    size_t old_size = inst->imm.array->dim1 * inst->imm.array->dim2;
                     for (i = 0; i < old_size; i++) {
-                        if (vm->arrays[inst.operand].u.str_data[i]) free(vm->arrays[inst.operand].u.str_data[i]);
+                        if (inst->imm.array->u.str_data[i]) free(inst->imm.array->u.str_data[i]);
                     }
-                    free(vm->arrays[inst.operand].u.str_data);
-                } else if (!is_string && vm->arrays[inst.operand].u.data) {
-                    free(vm->arrays[inst.operand].u.data);
+                    free(inst->imm.array->u.str_data);
+                } else if (!is_string && inst->imm.array->u.data) {
+                    free(inst->imm.array->u.data);
                 }
                 
-                vm->arrays[inst.operand].type = VAR_ARRAY_2D;
-                vm->arrays[inst.operand].dim1 = rows;
-                vm->arrays[inst.operand].dim2 = cols;
+                inst->imm.array->type = VAR_ARRAY_2D;
+                inst->imm.array->dim1 = rows;
+                inst->imm.array->dim2 = cols;
                 
                 if (is_string) {
-                    vm->arrays[inst.operand].u.str_data = calloc(rows * cols, sizeof(char*));
+                    inst->imm.array->u.str_data = calloc(rows * cols, sizeof(char*));
                     for (i = 0; i < rows * cols; i++) {
-                        vm->arrays[inst.operand].u.str_data[i] = basset_strdup("");
+                        inst->imm.array->u.str_data[i] = basset_strdup("");
                     }
                 } else {
-                    vm->arrays[inst.operand].u.data = calloc(rows * cols, sizeof(double));
+                    inst->imm.array->u.data = calloc(rows * cols, sizeof(double));
+                    if (!inst->imm.array->u.data) {
+                        inst->imm.array->dim1 = 0;
+                        inst->imm.array->dim2 = 0;
+                        vm_error(vm, ERR_OUT_OF_MEMORY, "OUT OF MEMORY");
+                        VM_CHECK();
+                    }
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_ARRAY_GET_1D: {
-                double idx_d = vm_pop_number(vm);
-                size_t idx = (size_t)idx_d;
+            VM_CASE(OP_ARRAY_GET_1D) {
+                double idx_d;
+                size_t idx;
+                
+                if (VM_TOP_IS_NUMBER() && inst->imm.array->u.data &&
+                    (size_t)VM_NUM(0) < inst->imm.array->dim1) {
+                    VM_NUM(0) = inst->imm.array->u.data[(size_t)VM_NUM(0)];
+                    vm->pc++;
+                    VM_NEXT();
+                }
+                
+                idx_d = vm_pop_number(vm);
+                idx = (size_t)idx_d;
                 
                 /* Auto-dimension if not already dimensioned */
-                if (vm->arrays[inst.operand].u.data == NULL) {
-                    vm->arrays[inst.operand].type = VAR_ARRAY_1D;
-                    vm->arrays[inst.operand].dim1 = 11;  /* Default 0-10 */
-                    vm->arrays[inst.operand].dim2 = 0;
-                    vm->arrays[inst.operand].is_string = 0;
-                    vm->arrays[inst.operand].u.data = calloc(11, sizeof(double));
+                if (inst->imm.array->u.data == NULL) {
+                    inst->imm.array->type = VAR_ARRAY_1D;
+                    inst->imm.array->dim1 = 11;  /* Default 0-10 */
+                    inst->imm.array->dim2 = 0;
+                    inst->imm.array->is_string = 0;
+                    inst->imm.array->u.data = calloc(11, sizeof(double));
                 }
                 
-                if (idx >= vm->arrays[inst.operand].dim1) {
+                if (idx >= inst->imm.array->dim1) {
                     vm_error(vm, ERR_SUBSCRIPT_RANGE, "ARRAY BOUNDS ERROR");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                 } else {
-                    vm_push_number(vm, vm->arrays[inst.operand].u.data[idx]);
+                    vm_push_number(vm, inst->imm.array->u.data[idx]);
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_ARRAY_SET_1D: {
+            VM_CASE(OP_ARRAY_SET_1D) {
                 double value, idx_d;
                 size_t idx;
                 
+                if (VM_TOP2_ARE_NUMBERS() && inst->imm.array->u.data &&
+                    (size_t)VM_NUM(1) < inst->imm.array->dim1) {
+                    inst->imm.array->u.data[(size_t)VM_NUM(1)] = VM_NUM(0);
+                    vm->stack_top -= 2;
+                    vm->pc++;
+                    VM_NEXT();
+                }
+                
                 if (vm->stack_top < 2) {
                     vm_error(vm, ERR_OVERFLOW, "STACK UNDERFLOW");
-                    break;
+                    VM_NEXT_CHECKED();
                 }
                 
                 value = vm_pop_number(vm);
@@ -1823,26 +2819,26 @@ void vm_execute(VMState *vm) {
                 idx = (size_t)idx_d;
                 
                 /* Auto-dimension if not already dimensioned */
-                if (vm->arrays[inst.operand].u.data == NULL) {
-                    vm->arrays[inst.operand].type = VAR_ARRAY_1D;
-                    vm->arrays[inst.operand].dim1 = 11;  /* Default 0-10 */
-                    vm->arrays[inst.operand].dim2 = 0;
-                    vm->arrays[inst.operand].is_string = 0;
-                    vm->arrays[inst.operand].u.data = calloc(11, sizeof(double));
+                if (inst->imm.array->u.data == NULL) {
+                    inst->imm.array->type = VAR_ARRAY_1D;
+                    inst->imm.array->dim1 = 11;  /* Default 0-10 */
+                    inst->imm.array->dim2 = 0;
+                    inst->imm.array->is_string = 0;
+                    inst->imm.array->u.data = calloc(11, sizeof(double));
                 }
                 
-                if (idx >= vm->arrays[inst.operand].dim1) {
+                if (idx >= inst->imm.array->dim1) {
                     vm_error(vm, ERR_SUBSCRIPT_RANGE, "ARRAY BOUNDS ERROR");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                 } else {
-                    vm->arrays[inst.operand].u.data[idx] = value;
+                    inst->imm.array->u.data[idx] = value;
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_ARRAY_GET_2D: {
+            VM_CASE(OP_ARRAY_GET_2D) {
                 double col_d = vm_pop_number(vm);
                 double row_d = vm_pop_number(vm);
                 size_t row = (size_t)row_d;
@@ -1850,28 +2846,28 @@ void vm_execute(VMState *vm) {
                 size_t cols;
                 
                 /* Auto-dimension if not already dimensioned */
-                if (vm->arrays[inst.operand].u.data == NULL) {
-                    vm->arrays[inst.operand].type = VAR_ARRAY_2D;
-                    vm->arrays[inst.operand].dim1 = 11;  /* Default 0-10 */
-                    vm->arrays[inst.operand].dim2 = 11;  /* Default 0-10 */
-                    vm->arrays[inst.operand].is_string = 0;
-                    vm->arrays[inst.operand].u.data = calloc(11 * 11, sizeof(double));
+                if (inst->imm.array->u.data == NULL) {
+                    inst->imm.array->type = VAR_ARRAY_2D;
+                    inst->imm.array->dim1 = 11;  /* Default 0-10 */
+                    inst->imm.array->dim2 = 11;  /* Default 0-10 */
+                    inst->imm.array->is_string = 0;
+                    inst->imm.array->u.data = calloc(11 * 11, sizeof(double));
                 }
                 
-                cols = vm->arrays[inst.operand].dim2;
+                cols = inst->imm.array->dim2;
                 
-                if (row >= vm->arrays[inst.operand].dim1 || col >= cols) {
+                if (row >= inst->imm.array->dim1 || col >= cols) {
                     vm_error(vm, ERR_SUBSCRIPT_RANGE, "ARRAY BOUNDS ERROR");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                 } else {
-                    vm_push_number(vm, vm->arrays[inst.operand].u.data[row * cols + col]);
+                    vm_push_number(vm, inst->imm.array->u.data[row * cols + col]);
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_ARRAY_SET_2D: {
+            VM_CASE(OP_ARRAY_SET_2D) {
                 double value = vm_pop_number(vm);
                 double col_d = vm_pop_number(vm);
                 double row_d = vm_pop_number(vm);
@@ -1880,64 +2876,135 @@ void vm_execute(VMState *vm) {
                 size_t cols;
                 
                 /* Auto-dimension if not already dimensioned */
-                if (vm->arrays[inst.operand].u.data == NULL) {
-                    vm->arrays[inst.operand].type = VAR_ARRAY_2D;
-                    vm->arrays[inst.operand].dim1 = 11;  /* Default 0-10 */
-                    vm->arrays[inst.operand].dim2 = 11;  /* Default 0-10 */
-                    vm->arrays[inst.operand].is_string = 0;
-                    vm->arrays[inst.operand].u.data = calloc(11 * 11, sizeof(double));
+                if (inst->imm.array->u.data == NULL) {
+                    inst->imm.array->type = VAR_ARRAY_2D;
+                    inst->imm.array->dim1 = 11;  /* Default 0-10 */
+                    inst->imm.array->dim2 = 11;  /* Default 0-10 */
+                    inst->imm.array->is_string = 0;
+                    inst->imm.array->u.data = calloc(11 * 11, sizeof(double));
                 }
                 
-                cols = vm->arrays[inst.operand].dim2;
+                cols = inst->imm.array->dim2;
                 
-                if (row >= vm->arrays[inst.operand].dim1 || col >= cols) {
+                if (row >= inst->imm.array->dim1 || col >= cols) {
                     vm_error(vm, ERR_SUBSCRIPT_RANGE, "ARRAY BOUNDS ERROR");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                 } else {
-                    vm->arrays[inst.operand].u.data[row * cols + col] = value;
+                    inst->imm.array->u.data[row * cols + col] = value;
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
+            }
+            
+            /* Arrays subscripted by variables (checked when not verified) */
+            VM_CASE(OP_ARRAY_LOAD_1D) {
+                double *element = vm_array_element(vm, inst, 1);
+                if (element) {
+                    vm_push_number(vm, *element);
+                } else {
+                    VM_CHECK();
+                }
+                vm->pc += 2;
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_ARRAY_STORE_1D) {
+                double value = vm_pop_number(vm);
+                double *element = vm_array_element(vm, inst, 1);
+                if (element) {
+                    *element = value;
+                } else {
+                    VM_CHECK();
+                }
+                vm->pc += 2;
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_ARRAY_LOAD_2D) {
+                double *element = vm_array_element(vm, inst, 2);
+                if (element) {
+                    vm_push_number(vm, *element);
+                } else {
+                    VM_CHECK();
+                }
+                vm->pc += 3;
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_ARRAY_STORE_2D) {
+                double value = vm_pop_number(vm);
+                double *element = vm_array_element(vm, inst, 2);
+                if (element) {
+                    *element = value;
+                } else {
+                    VM_CHECK();
+                }
+                vm->pc += 3;
+                VM_NEXT_CHECKED();
+            }
+            
+            /* Read-modify-write: the store goes to the element the read found */
+            VM_CASE(OP_ARRAY_ADDR_2D) {
+                double *element = vm_array_address(vm, inst);
+                if (element) {
+                    vm_push_number(vm, *element);
+                } else {
+                    VM_CHECK();
+                }
+                vm->pc += 3;
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_ARRAY_STORE_ADDR) {
+                double value = vm_pop_number(vm);
+                if (vm->addr_array == inst->imm.array && vm->addr_array) {
+                    vm->addr_array->u.data[vm->addr_index] = value;
+                } else {
+                    vm_error(vm, ERR_SUBSCRIPT_RANGE, "ARRAY BOUNDS ERROR");
+                    VM_CHECK();
+                }
+                vm->pc++;
+                VM_NEXT_CHECKED();
             }
             
             /* String Array Operations */
-            case OP_STR_ARRAY_GET_1D: {
+            VM_CASE(OP_STR_ARRAY_GET_1D) {
                 double idx_d = vm_pop_number(vm);
                 size_t idx = (size_t)idx_d;
                 
                 /* Auto-dimension if not already dimensioned */
-                if (vm->arrays[inst.operand].u.str_data == NULL) {
+                if (inst->imm.array->u.str_data == NULL) {
                     size_t i;
-                    vm->arrays[inst.operand].type = VAR_ARRAY_1D;
-                    vm->arrays[inst.operand].dim1 = 11;  /* Default 0-10 */
-                    vm->arrays[inst.operand].dim2 = 0;
-                    vm->arrays[inst.operand].is_string = 1;
-                    vm->arrays[inst.operand].u.str_data = calloc(11, sizeof(char*));
+                    inst->imm.array->type = VAR_ARRAY_1D;
+                    inst->imm.array->dim1 = 11;  /* Default 0-10 */
+                    inst->imm.array->dim2 = 0;
+                    inst->imm.array->is_string = 1;
+                    inst->imm.array->u.str_data = calloc(11, sizeof(char*));
                     for (i = 0; i < 11; i++) {
-                        vm->arrays[inst.operand].u.str_data[i] = basset_strdup("");
+                        inst->imm.array->u.str_data[i] = basset_strdup("");
                     }
                 }
                 
-                if (idx >= vm->arrays[inst.operand].dim1) {
+                if (idx >= inst->imm.array->dim1) {
                     vm_error(vm, ERR_SUBSCRIPT_RANGE, "ARRAY BOUNDS ERROR");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                 } else {
-                    vm_push_string(vm, basset_strdup(vm->arrays[inst.operand].u.str_data[idx]));
+                    vm_push_string(vm, basset_strdup(inst->imm.array->u.str_data[idx]));
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_ARRAY_SET_1D: {
+            VM_CASE(OP_STR_ARRAY_SET_1D) {
                 char *value;
                 double idx_d;
                 size_t idx;
                 
                 if (vm->stack_top < 2) {
                     vm_error(vm, ERR_OVERFLOW, "STACK UNDERFLOW");
-                    break;
+                    VM_NEXT_CHECKED();
                 }
                 
                 value = vm_pop_string(vm);
@@ -1945,34 +3012,34 @@ void vm_execute(VMState *vm) {
                 idx = (size_t)idx_d;
                 
                 /* Auto-dimension if not already dimensioned */
-                if (vm->arrays[inst.operand].u.str_data == NULL) {
+                if (inst->imm.array->u.str_data == NULL) {
                     size_t i;
-                    vm->arrays[inst.operand].type = VAR_ARRAY_1D;
-                    vm->arrays[inst.operand].dim1 = 11;  /* Default 0-10 */
-                    vm->arrays[inst.operand].dim2 = 0;
-                    vm->arrays[inst.operand].is_string = 1;
-                    vm->arrays[inst.operand].u.str_data = calloc(11, sizeof(char*));
+                    inst->imm.array->type = VAR_ARRAY_1D;
+                    inst->imm.array->dim1 = 11;  /* Default 0-10 */
+                    inst->imm.array->dim2 = 0;
+                    inst->imm.array->is_string = 1;
+                    inst->imm.array->u.str_data = calloc(11, sizeof(char*));
                     for (i = 0; i < 11; i++) {
-                        vm->arrays[inst.operand].u.str_data[i] = basset_strdup("");
+                        inst->imm.array->u.str_data[i] = basset_strdup("");
                     }
                 }
                 
-                if (idx >= vm->arrays[inst.operand].dim1) {
+                if (idx >= inst->imm.array->dim1) {
                     vm_error(vm, ERR_SUBSCRIPT_RANGE, "ARRAY BOUNDS ERROR");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                     free(value);
                 } else {
-                    if (vm->arrays[inst.operand].u.str_data[idx]) {
-                        free(vm->arrays[inst.operand].u.str_data[idx]);
+                    if (inst->imm.array->u.str_data[idx]) {
+                        free(inst->imm.array->u.str_data[idx]);
                     }
-                    vm->arrays[inst.operand].u.str_data[idx] = value;
+                    inst->imm.array->u.str_data[idx] = value;
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_ARRAY_GET_2D: {
+            VM_CASE(OP_STR_ARRAY_GET_2D) {
                 double col_d = vm_pop_number(vm);
                 double row_d = vm_pop_number(vm);
                 size_t row = (size_t)row_d;
@@ -1980,32 +3047,32 @@ void vm_execute(VMState *vm) {
                 size_t cols;
                 
                 /* Auto-dimension if not already dimensioned */
-                if (vm->arrays[inst.operand].u.str_data == NULL) {
+                if (inst->imm.array->u.str_data == NULL) {
                     size_t i;
-                    vm->arrays[inst.operand].type = VAR_ARRAY_2D;
-                    vm->arrays[inst.operand].dim1 = 11;  /* Default 0-10 */
-                    vm->arrays[inst.operand].dim2 = 11;  /* Default 0-10 */
-                    vm->arrays[inst.operand].is_string = 1;
-                    vm->arrays[inst.operand].u.str_data = calloc(11 * 11, sizeof(char*));
+                    inst->imm.array->type = VAR_ARRAY_2D;
+                    inst->imm.array->dim1 = 11;  /* Default 0-10 */
+                    inst->imm.array->dim2 = 11;  /* Default 0-10 */
+                    inst->imm.array->is_string = 1;
+                    inst->imm.array->u.str_data = calloc(11 * 11, sizeof(char*));
                     for (i = 0; i < 11 * 11; i++) {
-                        vm->arrays[inst.operand].u.str_data[i] = basset_strdup("");
+                        inst->imm.array->u.str_data[i] = basset_strdup("");
                     }
                 }
                 
-                cols = vm->arrays[inst.operand].dim2;
+                cols = inst->imm.array->dim2;
                 
-                if (row >= vm->arrays[inst.operand].dim1 || col >= cols) {
+                if (row >= inst->imm.array->dim1 || col >= cols) {
                     vm_error(vm, ERR_SUBSCRIPT_RANGE, "ARRAY BOUNDS ERROR");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                 } else {
-                    vm_push_string(vm, basset_strdup(vm->arrays[inst.operand].u.str_data[row * cols + col]));
+                    vm_push_string(vm, basset_strdup(inst->imm.array->u.str_data[row * cols + col]));
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_STR_ARRAY_SET_2D: {
+            VM_CASE(OP_STR_ARRAY_SET_2D) {
                 char *value = vm_pop_string(vm);
                 double col_d = vm_pop_number(vm);
                 double row_d = vm_pop_number(vm);
@@ -2014,40 +3081,40 @@ void vm_execute(VMState *vm) {
                 size_t cols;
                 
                 /* Auto-dimension if not already dimensioned */
-                if (vm->arrays[inst.operand].u.str_data == NULL) {
+                if (inst->imm.array->u.str_data == NULL) {
                     size_t i;
-                    vm->arrays[inst.operand].type = VAR_ARRAY_2D;
-                    vm->arrays[inst.operand].dim1 = 11;  /* Default 0-10 */
-                    vm->arrays[inst.operand].dim2 = 11;  /* Default 0-10 */
-                    vm->arrays[inst.operand].is_string = 1;
-                    vm->arrays[inst.operand].u.str_data = calloc(11 * 11, sizeof(char*));
+                    inst->imm.array->type = VAR_ARRAY_2D;
+                    inst->imm.array->dim1 = 11;  /* Default 0-10 */
+                    inst->imm.array->dim2 = 11;  /* Default 0-10 */
+                    inst->imm.array->is_string = 1;
+                    inst->imm.array->u.str_data = calloc(11 * 11, sizeof(char*));
                     for (i = 0; i < 11 * 11; i++) {
-                        vm->arrays[inst.operand].u.str_data[i] = basset_strdup("");
+                        inst->imm.array->u.str_data[i] = basset_strdup("");
                     }
                 }
                 
-                cols = vm->arrays[inst.operand].dim2;
+                cols = inst->imm.array->dim2;
                 
-                if (row >= vm->arrays[inst.operand].dim1 || col >= cols) {
+                if (row >= inst->imm.array->dim1 || col >= cols) {
                     vm_error(vm, ERR_SUBSCRIPT_RANGE, "ARRAY BOUNDS ERROR");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                     free(value);
                 } else {
-                    if (vm->arrays[inst.operand].u.str_data[row * cols + col]) {
-                        free(vm->arrays[inst.operand].u.str_data[row * cols + col]);
+                    if (inst->imm.array->u.str_data[row * cols + col]) {
+                        free(inst->imm.array->u.str_data[row * cols + col]);
                     }
-                    vm->arrays[inst.operand].u.str_data[row * cols + col] = value;
+                    inst->imm.array->u.str_data[row * cols + col] = value;
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
             /* DATA/READ Operations */
-            case OP_DATA_READ_NUM: {
+            VM_CASE(OP_DATA_READ_NUM) {
                 if (vm->data_pointer >= vm->program->data_count) {
                     vm_error(vm, ERR_OUT_OF_DATA, "OUT OF DATA");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                 } else {
                     DataEntry *entry = &vm->program->data_entries[vm->data_pointer++];
                     
@@ -2055,27 +3122,27 @@ void vm_execute(VMState *vm) {
                         /* String to numeric conversion (per Microsoft BASIC spec) */
                         /* Identifiers in DATA convert to 0, not error */
                         const char *str = vm->program->data_string_pool[entry->value.string_idx];
-                        double value = atof(str);  /* atof returns 0 for non-numeric strings */
-                        vm->num_vars[inst.operand] = value;
+                        double value = value_canonical(atof(str));  /* 0 for non-numeric strings */
+                        vm->num_vars[inst->operand] = value;
                     } else if (entry->type == DATA_NUMERIC) {
                         double value = vm->program->data_numeric_pool[entry->value.numeric_idx];
-                        vm->num_vars[inst.operand] = value;
+                        vm->num_vars[inst->operand] = value_canonical(value);
                     } else if (entry->type == DATA_NULL) {
                         /* NULL data item - convert to 0 for numeric variable */
-                        vm->num_vars[inst.operand] = 0;
+                        vm->num_vars[inst->operand] = 0;
                     } else {
                         vm_error(vm, ERR_TYPE_MISMATCH, "TYPE MISMATCH IN DATA");
                     }
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_DATA_READ_STR: {
+            VM_CASE(OP_DATA_READ_STR) {
                 if (vm->data_pointer >= vm->program->data_count) {
                     vm_error(vm, ERR_OUT_OF_DATA, "OUT OF DATA");
-                    if (vm->trap_triggered) break;
+                    VM_CHECK();
                 } else {
                     DataEntry *entry = &vm->program->data_entries[vm->data_pointer++];
                     char buffer[64];
@@ -2094,50 +3161,52 @@ void vm_execute(VMState *vm) {
                         str_value = "";
                     } else {
                         vm_error(vm, ERR_TYPE_MISMATCH, "TYPE MISMATCH IN DATA");
-                        break;
+                        VM_NEXT_CHECKED();
                     }
                     
-                    if (vm->str_vars[inst.operand]) {
-                        free(vm->str_vars[inst.operand]);
+                    if (vm->str_vars[inst->operand]) {
+                        free(vm->str_vars[inst->operand]);
                     }
-                    vm->str_vars[inst.operand] = basset_strdup(str_value);
+                    vm->str_vars[inst->operand] = basset_strdup(str_value);
                 }
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_RESTORE: {
+            VM_CASE(OP_RESTORE) {
                 vm->data_pointer = 0;
                 vm->pc++;
-                break;
+                VM_NEXT();
             }
             
-            case OP_RESTORE_LINE: {
+            VM_CASE(OP_RESTORE_LINE) {
                 /* RESTORE with line number - for now just reset to beginning */
                 /* TODO: Could track line-specific data positions if needed */
+                (void)vm_pop_number(vm);
+                VM_CHECK();
                 vm->data_pointer = 0;
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
             /* System Operations */
-            case OP_TRAP: {
+            VM_CASE(OP_TRAP) {
                 /* Set trap line */
-                vm->trap_line = inst.operand;
+                vm->trap_line = inst->operand;
                 vm->trap_enabled = 1;
                 vm->pc++;
-                break;
+                VM_NEXT();
             }
             
-            case OP_TRAP_DISABLE: {
+            VM_CASE(OP_TRAP_DISABLE) {
                 vm->trap_enabled = 0;
                 vm->pc++;
-                break;
+                VM_NEXT();
             }
             
             /* File I/O Operations */
-            case OP_XIO: {
+            VM_CASE(OP_XIO) {
                 /* Stack: command, channel, aux1, aux2, device_string (TOS) */
                 char *device = vm_pop_string(vm);
                 int channel, command;
@@ -2149,7 +3218,7 @@ void vm_execute(VMState *vm) {
                 if (channel < 1 || channel >= 8) {
                     free(device);
                     vm_error(vm, ERR_BAD_FILE_NUMBER, "Invalid channel number");
-                    break;
+                    VM_NEXT_CHECKED();
                 }
                 
                 switch (command) {
@@ -2199,28 +3268,28 @@ void vm_execute(VMState *vm) {
                 
                 free(device);
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_END:
-            case OP_STOP: {
+            VM_CASE(OP_END)
+            VM_CASE(OP_STOP) {
                 vm->running = 0;
-                break;
+                goto vm_stopped;
             }
             
-            case OP_DEG: {
+            VM_CASE(OP_DEG) {
                 vm->deg_mode = 1;
                 vm->pc++;
-                break;
+                VM_NEXT();
             }
             
-            case OP_RAD: {
+            VM_CASE(OP_RAD) {
                 vm->deg_mode = 0;
                 vm->pc++;
-                break;
+                VM_NEXT();
             }
             
-            case OP_RANDOMIZE: {
+            VM_CASE(OP_RANDOMIZE) {
                 /* Pop seed value from stack */
                 double seed_val = vm_pop_number(vm);
                 uint32_t seed;
@@ -2237,10 +3306,10 @@ void vm_execute(VMState *vm) {
                 vm->last_rnd = ((vm->rnd_seed >> 16) & 0xFFFF) / 65536.0;
                 
                 vm->pc++;
-                break;
+                VM_NEXT_CHECKED();
             }
             
-            case OP_CLR: {
+            VM_CASE(OP_CLR) {
                 size_t i, j;
                 /* Clear all numeric variables */
                 for (i = 0; i < vm->var_capacity; i++) {
@@ -2254,6 +3323,7 @@ void vm_execute(VMState *vm) {
                     }
                 }
                 /* Clear all arrays */
+                vm->addr_array = NULL;
                 for (i = 0; i < vm->var_capacity; i++) {
                     if (vm->arrays[i].u.data) {
                         free(vm->arrays[i].u.data);
@@ -2272,34 +3342,530 @@ void vm_execute(VMState *vm) {
                     vm->arrays[i].dim2 = 0;
                 }
                 vm->pc++;
-                break;
+                VM_NEXT();
             }
             
-            case OP_POP_GOSUB: {
+            VM_CASE(OP_POP_GOSUB) {
                 /* Pop one entry from the GOSUB stack without jumping */
                 if (vm->call_top > 0) {
                     vm->call_top--;
                 }
                 vm->pc++;
-                break;
+                VM_NEXT();
             }
             
-            case OP_NOP: {
+            VM_CASE(OP_NOP) {
                 vm->pc++;
-                break;
+                VM_NEXT();
+            }
+            
+            /* Fused compare-and-branch */
+            VM_CASE(OP_JNLT) {
+                VM_COMPARE_BRANCH(a < b);
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_JNLE) {
+                VM_COMPARE_BRANCH(a <= b);
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_JNGT) {
+                VM_COMPARE_BRANCH(a > b);
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_JNGE) {
+                VM_COMPARE_BRANCH(a >= b);
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_JNEQ) {
+                VM_COMPARE_BRANCH(a == b);
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_JNNE) {
+                VM_COMPARE_BRANCH(a != b);
+                VM_NEXT();
+            }
+            
+            /* Superinstructions: operands past the first come from the */
+            /* instructions they were fused over (see bytecode.h) */
+            VM_CASE(OP_VAR_ADD_CONST_POP) {
+                vm->num_vars[inst[3].operand] = vm->num_vars[inst->operand] + inst[1].imm.number;
+                vm->pc += 4;
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_VAR_SUB_CONST_POP) {
+                vm->num_vars[inst[3].operand] = vm->num_vars[inst->operand] - inst[1].imm.number;
+                vm->pc += 4;
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_VAR_MUL_VAR) {
+                vm_push_number(vm, vm->num_vars[inst->operand] * vm->num_vars[inst[1].operand]);
+                vm->pc += 3;
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_VAR_ARRAY_GET_1D) {
+                ArrayData *array = inst[1].imm.array;
+                size_t idx = (size_t)vm->num_vars[inst->operand];
+                
+                /* Auto-dimension if not already dimensioned */
+                if (array->u.data == NULL) {
+                    array->type = VAR_ARRAY_1D;
+                    array->dim1 = 11;  /* Default 0-10 */
+                    array->dim2 = 0;
+                    array->is_string = 0;
+                    array->u.data = calloc(11, sizeof(double));
+                }
+                
+                if (idx >= array->dim1) {
+                    vm_error(vm, ERR_SUBSCRIPT_RANGE, "ARRAY BOUNDS ERROR");
+                    VM_CHECK();
+                } else {
+                    vm_push_number(vm, array->u.data[idx]);
+                }
+                
+                vm->pc += 2;
+                VM_NEXT_CHECKED();
+            }
+            
+            /* Number stack instructions */
+            VM_CASE(OP_N_PUSH_CONST) {
+                vm_num_push(vm, inst->imm.number);
+                vm->pc++;
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_N_PUSH_VAR) {
+                vm_num_push(vm, vm->num_vars[inst->operand]);
+                vm->pc++;
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_N_POP_VAR) {
+                if (VM_LIKELY(vm->num_top >= 1)) {
+                    vm->num_vars[inst->operand] = vm->num_stack[--vm->num_top];
+                    vm->pc++;
+                } else {
+                    vm_error(vm, ERR_OVERFLOW, "STACK UNDERFLOW");
+                }
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_N_ADD) { VM_NUMBER_BINARY(a + b); VM_NEXT(); }
+            VM_CASE(OP_N_SUB) { VM_NUMBER_BINARY(a - b); VM_NEXT(); }
+            VM_CASE(OP_N_MUL) { VM_NUMBER_BINARY(a * b); VM_NEXT(); }
+            VM_CASE(OP_N_POW) { VM_NUMBER_BINARY(pow(a, b)); VM_NEXT(); }
+            VM_CASE(OP_N_EQ) { VM_NUMBER_BINARY((a == b) ? 1.0 : 0.0); VM_NEXT(); }
+            VM_CASE(OP_N_NE) { VM_NUMBER_BINARY((a != b) ? 1.0 : 0.0); VM_NEXT(); }
+            VM_CASE(OP_N_LT) { VM_NUMBER_BINARY((a < b) ? 1.0 : 0.0); VM_NEXT(); }
+            VM_CASE(OP_N_LE) { VM_NUMBER_BINARY((a <= b) ? 1.0 : 0.0); VM_NEXT(); }
+            VM_CASE(OP_N_GT) { VM_NUMBER_BINARY((a > b) ? 1.0 : 0.0); VM_NEXT(); }
+            VM_CASE(OP_N_GE) { VM_NUMBER_BINARY((a >= b) ? 1.0 : 0.0); VM_NEXT(); }
+            VM_CASE(OP_N_AND) { VM_NUMBER_BINARY((a != 0.0 && b != 0.0) ? 1.0 : 0.0); VM_NEXT(); }
+            VM_CASE(OP_N_OR) { VM_NUMBER_BINARY((a != 0.0 || b != 0.0) ? 1.0 : 0.0); VM_NEXT(); }
+            VM_CASE(OP_N_NEG) { VM_NUMBER_UNARY(-x); VM_NEXT(); }
+            VM_CASE(OP_N_NOT) { VM_NUMBER_UNARY((x == 0.0) ? 1.0 : 0.0); VM_NEXT(); }
+            
+            VM_CASE(OP_N_DIV) {
+                if (VM_LIKELY(vm->num_top >= 2 && VM_DBL(0) != 0.0)) {
+                    vm->num_top--;
+                    VM_DBL(0) /= vm->num_stack[vm->num_top];
+                    vm->pc++;
+                } else if (vm->num_top < 2) {
+                    vm_error(vm, ERR_OVERFLOW, "STACK UNDERFLOW");
+                } else {
+                    vm->num_top -= 2;
+                    vm_error(vm, ERR_DIVISION_BY_ZERO, "DIVISION BY ZERO");
+                    if (!vm->trap_triggered) vm->pc++;
+                }
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_N_BOX) {
+                if (VM_LIKELY(vm->num_top >= 1)) {
+                    vm_push_number(vm, vm->num_stack[--vm->num_top]);
+                    vm->pc++;
+                } else {
+                    vm_error(vm, ERR_OVERFLOW, "STACK UNDERFLOW");
+                }
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_N_VAR_MUL_VAR) {
+                vm_num_push(vm, vm->num_vars[inst->operand] * vm->num_vars[inst[1].operand]);
+                vm->pc += 3;
+                VM_NEXT_CHECKED();
+            }
+            
+            /* Register instructions (ISA_REG) */
+            VM_CASE(OP_R_MOV) {
+                VM_REG(0) = VM_REG(1);
+                vm->pc += 2;
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_R_ADD) {
+                VM_REG(0) = VM_REG(1) + VM_REG(2);
+                vm->pc += 3;
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_R_SUB) {
+                VM_REG(0) = VM_REG(1) - VM_REG(2);
+                vm->pc += 3;
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_R_MUL) {
+                VM_REG(0) = VM_REG(1) * VM_REG(2);
+                vm->pc += 3;
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_R_DIV) {
+                double b = VM_REG(2);
+                if (b == 0.0) {
+                    vm_error(vm, ERR_DIVISION_BY_ZERO, "DIVISION BY ZERO");
+                    VM_CHECK();
+                } else {
+                    VM_REG(0) = VM_REG(1) / b;
+                }
+                vm->pc += 3;
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_R_POW) {
+                VM_REG(0) = pow(VM_REG(1), VM_REG(2));
+                vm->pc += 3;
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_R_NEG) {
+                VM_REG(0) = -VM_REG(1);
+                vm->pc += 2;
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_R_PUSH) {
+                vm_push_number(vm, VM_REG(0));
+                vm->pc++;
+                VM_NEXT_CHECKED();
+            }
+            
+            VM_CASE(OP_R_POP) {
+                double value = vm_pop_number(vm);
+                VM_CHECK();
+                VM_REG(0) = value;
+                vm->pc++;
+                VM_NEXT_CHECKED();
             }
             
-            default: {
+            VM_CASE(OP_R_JNLT) {
+                VM_REG_BRANCH(a < b);
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_R_JNLE) {
+                VM_REG_BRANCH(a <= b);
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_R_JNGT) {
+                VM_REG_BRANCH(a > b);
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_R_JNGE) {
+                VM_REG_BRANCH(a >= b);
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_R_JNEQ) {
+                VM_REG_BRANCH(a == b);
+                VM_NEXT();
+            }
+            
+            VM_CASE(OP_R_JNNE) {
+                VM_REG_BRANCH(a != b);
+                VM_NEXT();
+            }
+            
+            VM_DEFAULT {
                 vm->running = 0;
-                break;
+                goto vm_stopped;
+            }
+#ifdef VM_THREADED_DISPATCH
+            /* Safepoint, JIT entry point (line start or loop anchor), or any */
+            /* instruction while a trace is recorded: stop if the budget is */
+            /* used up, then native code if there is some, otherwise the */
+            /* opcode's own handler */
+        vm_jit_entry: {
+                int jit;
+                if ((inst->entry & VM_ENTRY_SAFEPOINT) && !VM_SAFEPOINT(vm, inst->safepoint_cost)) {
+                    return;
+                }
+                if (!(inst->entry & (uint8_t)~VM_ENTRY_SAFEPOINT)) VM_GOTO(VM_HANDLER(inst));
+                jit = vm_jit_enter(vm);
+                if (jit == JIT_NEVER) {
+                    vm->decoded[vm->pc].entry &= (uint8_t)~JIT_ENTRY_POINT;
+                    if (!vm->decoded[vm->pc].entry) {
+                        vm->decoded[vm->pc].handler = VM_HANDLER(inst);
+                    }
+                }
+                /* Trace recording started or stopped */
+                VM_BIND_HANDLERS(VM_BOUND_RUN);
+                if (jit == JIT_RAN) VM_NEXT_CHECKED();
+                VM_GOTO(dispatch_table[inst->opcode]);
+            }
+            
+            /* Single step: the handler has run, stop before the next one */
+        vm_step_done:
+            return;
+            
+            /* A handler raised an error that TRAP caught (and maybe another */
+            /* after it, which stopped the VM) */
+        vm_trap_taken:
+            vm_trap_resume(vm);
+            if (!vm->running) goto vm_stopped;
+            VM_NEXT();
+            
+            /* Unchecked handlers for verified instructions */
+            VM_UNCHECKED(OP_PUSH_CONST) {
+                VM_UNCHECKED_PUSH(inst->imm.number);
+                vm->pc++;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_PUSH_VAR) {
+                VM_UNCHECKED_PUSH(vm->num_vars[inst->operand]);
+                vm->pc++;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_POP_VAR) {
+                vm->num_vars[inst->operand] = VALUE_NUMBER(vm->stack[--vm->stack_top]);
+                vm->pc++;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_ADD) VM_UNCHECKED_BINARY(a + b)
+            VM_UNCHECKED(OP_SUB) VM_UNCHECKED_BINARY(a - b)
+            VM_UNCHECKED(OP_MUL) VM_UNCHECKED_BINARY(a * b)
+            VM_UNCHECKED(OP_MOD) VM_UNCHECKED_BINARY(fmod(a, b))
+            VM_UNCHECKED(OP_POW) VM_UNCHECKED_BINARY(pow(a, b))
+            VM_UNCHECKED(OP_EQ) VM_UNCHECKED_BINARY((a == b) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_NE) VM_UNCHECKED_BINARY((a != b) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_LT) VM_UNCHECKED_BINARY((a < b) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_LE) VM_UNCHECKED_BINARY((a <= b) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_GT) VM_UNCHECKED_BINARY((a > b) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_GE) VM_UNCHECKED_BINARY((a >= b) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_AND) VM_UNCHECKED_BINARY((a != 0.0 && b != 0.0) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_OR) VM_UNCHECKED_BINARY((a != 0.0 || b != 0.0) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_NEG) VM_UNCHECKED_UNARY(-x)
+            VM_UNCHECKED(OP_NOT) VM_UNCHECKED_UNARY((x == 0.0) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_FUNC_ABS) VM_UNCHECKED_UNARY(fabs(x))
+            VM_UNCHECKED(OP_FUNC_INT) VM_UNCHECKED_UNARY(floor(x))
+            
+            VM_UNCHECKED(OP_JUMP_IF_FALSE) {
+                vm->stack_top--;
+                vm->pc = (VALUE_NUMBER(vm->stack[vm->stack_top]) == 0.0) ? inst->operand : vm->pc + 1;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_JUMP_IF_TRUE) {
+                vm->stack_top--;
+                vm->pc = (VALUE_NUMBER(vm->stack[vm->stack_top]) != 0.0) ? inst->operand : vm->pc + 1;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_JNLT) VM_UNCHECKED_BRANCH(a < b)
+            VM_UNCHECKED(OP_JNLE) VM_UNCHECKED_BRANCH(a <= b)
+            VM_UNCHECKED(OP_JNGT) VM_UNCHECKED_BRANCH(a > b)
+            VM_UNCHECKED(OP_JNGE) VM_UNCHECKED_BRANCH(a >= b)
+            VM_UNCHECKED(OP_JNEQ) VM_UNCHECKED_BRANCH(a == b)
+            VM_UNCHECKED(OP_JNNE) VM_UNCHECKED_BRANCH(a != b)
+            
+            VM_UNCHECKED(OP_VAR_MUL_VAR) {
+                VM_UNCHECKED_PUSH(vm->num_vars[inst->operand] * vm->num_vars[inst[1].operand]);
+                vm->pc += 3;
+                VM_NEXT();
+            }
+            
+            /* Subscripts proven inside the DIM: no auto-dimension or range check */
+            VM_UNCHECKED(OP_ARRAY_LOAD_1D) {
+                VM_UNCHECKED_PUSH(inst->imm.array->u.data[(size_t)vm->num_vars[inst[1].operand]]);
+                vm->pc += 2;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_ARRAY_STORE_1D) {
+                inst->imm.array->u.data[(size_t)vm->num_vars[inst[1].operand]] =
+                    VALUE_NUMBER(vm->stack[--vm->stack_top]);
+                vm->pc += 2;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_ARRAY_LOAD_2D) {
+                ArrayData *array = inst->imm.array;
+                VM_UNCHECKED_PUSH(array->u.data[(size_t)vm->num_vars[inst[1].operand] * array->dim2 +
+                                                (size_t)vm->num_vars[inst[2].operand]]);
+                vm->pc += 3;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_ARRAY_STORE_2D) {
+                ArrayData *array = inst->imm.array;
+                array->u.data[(size_t)vm->num_vars[inst[1].operand] * array->dim2 +
+                              (size_t)vm->num_vars[inst[2].operand]] =
+                    VALUE_NUMBER(vm->stack[--vm->stack_top]);
+                vm->pc += 3;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_ARRAY_ADDR_2D) {
+                ArrayData *array = inst->imm.array;
+                vm->addr_array = array;
+                vm->addr_index = (size_t)vm->num_vars[inst[1].operand] * array->dim2 +
+                                 (size_t)vm->num_vars[inst[2].operand];
+                VM_UNCHECKED_PUSH(array->u.data[vm->addr_index]);
+                vm->pc += 3;
+                VM_NEXT();
+            }
+            
+            /* The element still has to be the one the read found */
+            VM_UNCHECKED(OP_ARRAY_STORE_ADDR) {
+                double value = VALUE_NUMBER(vm->stack[--vm->stack_top]);
+                if (VM_LIKELY(vm->addr_array == inst->imm.array && vm->addr_array)) {
+                    vm->addr_array->u.data[vm->addr_index] = value;
+                } else {
+                    vm_error(vm, ERR_SUBSCRIPT_RANGE, "ARRAY BOUNDS ERROR");
+                    if (vm->trap_triggered) VM_NEXT_CHECKED();
+                }
+                vm->pc++;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_R_PUSH) {
+                VM_UNCHECKED_PUSH(VM_REG(0));
+                vm->pc++;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_R_POP) {
+                VM_REG(0) = VALUE_NUMBER(vm->stack[--vm->stack_top]);
+                vm->pc++;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_N_PUSH_CONST) {
+                vm->num_stack[vm->num_top++] = inst->imm.number;
+                vm->pc++;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_N_PUSH_VAR) {
+                vm->num_stack[vm->num_top++] = vm->num_vars[inst->operand];
+                vm->pc++;
+                VM_NEXT();
             }
+            
+            VM_UNCHECKED(OP_N_POP_VAR) {
+                vm->num_vars[inst->operand] = vm->num_stack[--vm->num_top];
+                vm->pc++;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_N_ADD) VM_UNCHECKED_NUMBER_BINARY(a + b)
+            VM_UNCHECKED(OP_N_SUB) VM_UNCHECKED_NUMBER_BINARY(a - b)
+            VM_UNCHECKED(OP_N_MUL) VM_UNCHECKED_NUMBER_BINARY(a * b)
+            VM_UNCHECKED(OP_N_POW) VM_UNCHECKED_NUMBER_BINARY(pow(a, b))
+            VM_UNCHECKED(OP_N_EQ) VM_UNCHECKED_NUMBER_BINARY((a == b) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_N_NE) VM_UNCHECKED_NUMBER_BINARY((a != b) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_N_LT) VM_UNCHECKED_NUMBER_BINARY((a < b) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_N_LE) VM_UNCHECKED_NUMBER_BINARY((a <= b) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_N_GT) VM_UNCHECKED_NUMBER_BINARY((a > b) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_N_GE) VM_UNCHECKED_NUMBER_BINARY((a >= b) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_N_AND) VM_UNCHECKED_NUMBER_BINARY((a != 0.0 && b != 0.0) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_N_OR) VM_UNCHECKED_NUMBER_BINARY((a != 0.0 || b != 0.0) ? 1.0 : 0.0)
+            VM_UNCHECKED(OP_N_NEG) VM_UNCHECKED_NUMBER_UNARY(-x)
+            VM_UNCHECKED(OP_N_NOT) VM_UNCHECKED_NUMBER_UNARY((x == 0.0) ? 1.0 : 0.0)
+            
+            VM_UNCHECKED(OP_N_BOX) {
+                VM_UNCHECKED_PUSH(vm->num_stack[--vm->num_top]);
+                vm->pc++;
+                VM_NEXT();
+            }
+            
+            VM_UNCHECKED(OP_N_VAR_MUL_VAR) {
+                vm->num_stack[vm->num_top++] = vm->num_vars[inst->operand] * vm->num_vars[inst[1].operand];
+                vm->pc += 3;
+                VM_NEXT();
+            }
+#else
         }
         
-        /* If TRAP was triggered during this instruction, vm_error already set PC */
-        /* to the trap handler. Ignore any PC increments that happened after the error. */
-        if (vm->trap_triggered) {
-            vm->trap_triggered = 0;
-            /* PC is already set to trap handler by vm_error, just continue */
+        if (step) break;
+        continue;
+        
+        /* A handler raised an error that TRAP caught */
+    vm_trap_taken:
+        vm_trap_resume(vm);
+        if (step) break;
+    }
+#endif
+    
+    /* END, STOP, an error without TRAP, or INPUT waiting for the host */
+vm_stopped:
+    return;
+}
+
+void vm_execute(VMState *vm) {
+    vm_run(vm, VM_RUN_UNLIMITED);
+}
+
+VMRunStatus vm_run(VMState *vm, uint64_t max_instructions) {
+    /* Resume after a stop at a safepoint, or at an INPUT that has its line */
+    if (!vm->running) {
+        switch (vm->run_status) {
+            case VM_RUN_BUDGET:
+            case VM_RUN_BREAK:
+                break;
+            case VM_RUN_INPUT:
+                if (!vm->input_available) return VM_RUN_INPUT;
+                break;
+            default:
+                return (VMRunStatus)vm->run_status;
         }
+        vm->running = 1;
     }
+    
+    vm->run_status = VM_RUN_FINISHED;
+    vm->budget = max_instructions;
+    vm_dispatch(vm, 0);
+    return (VMRunStatus)vm->run_status;
+}
+
+/* Hand INPUT the next line (without its newline) after VM_RUN_INPUT */
+void vm_provide_input(VMState *vm, const char *line) {
+    size_t len = strlen(line);
+    
+    if (len >= sizeof(vm->input_buffer)) len = sizeof(vm->input_buffer) - 1;
+    memcpy(vm->input_buffer, line, len);
+    vm->input_buffer[len] = '\0';
+    if (len > 0 && vm->input_buffer[len - 1] == '\n') vm->input_buffer[len - 1] = '\0';
+    
+    /* Echo it, as for piped input */
+    printf("%s\n", vm->input_buffer);
+    vm->input_ptr = vm->input_buffer;
+    vm->input_available = 1;
+}
+
+void vm_step(VMState *vm) {
+    vm_dispatch(vm, 1);
 }
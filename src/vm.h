@@ -5,6 +5,7 @@
 #include "compiler.h"
 #include "bytecode.h"
 #include "value.h"
+#include <signal.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -51,20 +52,86 @@ typedef struct {
     double limit;                /* TO value */
     double step;                 /* STEP value (default 1.0) */
     uint32_t loop_start_pc;      /* PC of first instruction in loop body */
+    
+    /* Integer-counted loops (OP_FOR_INIT_INT); valid while int_loop is set */
+    int int_loop;
+    int64_t int_value;           /* Value last stored in the loop variable */
+    int64_t int_step;
+    int64_t int_end;             /* First value past the limit */
 } ForLoopState;
 
+/* Pre-decoded instruction
+ *
+ * vm_init() translates the program's 4-byte Instructions into this
+ * execution-ready form, one entry per pc plus a trailing OP_HALT sentinel.
+ * Operands that would otherwise be looked up on every execution are
+ * resolved once: OP_PUSH_CONST carries its double and array opcodes carry
+ * the ArrayData they operate on.
+ */
+typedef struct {
+    const void *handler;         /* Threaded dispatch: handler label (bound on first vm_execute) */
+    uint8_t opcode;              /* Original opcode (switch dispatch, diagnostics) */
+    uint8_t flags;               /* Original flags */
+    uint32_t operand;            /* Operand widened to 32 bits */
+    uint8_t entry;               /* VM_ENTRY_SAFEPOINT and JIT_ENTRY_* bits (see jit.h) */
+    uint32_t safepoint_cost;     /* Budget charged at a safepoint (see vm_run) */
+    union {
+        double number;           /* OP_PUSH_CONST: constant value */
+        ArrayData *array;        /* Array opcodes: target array */
+    } imm;
+} DecodedInstruction;
+
+/* Budgeted execution
+ *
+ * vm_run() executes until the program ends or stops, or until it has
+ * used up max_instructions, and can be called again to resume. Nothing is
+ * counted per instruction: the VM only stops at safepoints, the targets of
+ * backward jumps, GOSUBs, NEXTs and TRAPs (and every line start when the
+ * program has a computed GOTO or GOSUB), which any loop has to pass. Each
+ * charges the budget with the words of the loop it closes, so the count
+ * is an estimate; the VM stops at the first safepoint after the budget
+ * is used up. A safepoint also stops once break_flag is set.
+ */
+
+/* DecodedInstruction.entry bit: a safepoint */
+#define VM_ENTRY_SAFEPOINT 0x80
+
+/* vm_run() results (VMState.run_status) */
+typedef enum {
+    VM_RUN_FINISHED,             /* END, STOP or the end of the program */
+    VM_RUN_BUDGET,               /* max_instructions used up; vm_run() resumes */
+    VM_RUN_BREAK,                /* break_flag was set (and is cleared); vm_run() resumes */
+    VM_RUN_INPUT,                /* INPUT needs vm_provide_input(), then vm_run() resumes */
+    VM_RUN_ERROR                 /* Stopped by an error no TRAP caught */
+} VMRunStatus;
+
+/* vm_run() budget that never runs out in practice */
+#define VM_RUN_UNLIMITED ((uint64_t)-1)
+
+/* VMState.decoded_bound: handler labels in the decoded stream (threaded dispatch) */
+#define VM_BOUND_NONE   0        /* Not filled in yet */
+#define VM_BOUND_RUN    1        /* Opcode handlers, for vm_execute() */
+#define VM_BOUND_STEP   2        /* Stop after each instruction, for vm_step() */
+
 /* VM State */
 typedef struct {
     /* Execution State */
     uint32_t pc;                 /* Program counter */
     uint8_t running;             /* 1 if executing, 0 if stopped */
-    uint8_t break_flag;          /* Set when BREAK key pressed */
+    volatile sig_atomic_t break_flag; /* Set (e.g. from a signal handler) to stop at the next safepoint */
+    uint8_t run_status;          /* VMRunStatus of the last stop */
+    uint64_t budget;             /* Instructions vm_run() may still charge at safepoints */
     
     /* Expression Stack */
     Value *stack;                /* Stack of tagged values */
     size_t stack_top;            /* Index of top element */
     size_t stack_capacity;       /* Allocated capacity */
     
+    /* Number Stack (untagged doubles for the OP_N_* instructions) */
+    double *num_stack;
+    size_t num_top;              /* Number of entries */
+    size_t num_capacity;         /* Allocated capacity */
+    
     /* Call Stack (for GOSUB/RETURN) */
     uint32_t *call_stack;        /* Return addresses */
     size_t call_top;             /* Top of call stack */
@@ -76,10 +143,13 @@ typedef struct {
     size_t for_capacity;         /* Allocated capacity */
     
     /* Variable Storage (parallel arrays indexed by slot) */
-    double *num_vars;            /* Numeric variable values */
+    double *num_vars;            /* Numeric variable values (register file under ISA_REG) */
     char **str_vars;             /* String variable values */
     ArrayData *arrays;           /* Array storage */
     size_t var_capacity;         /* Allocated slots */
+    size_t reg_count;            /* Entries in num_vars (var_capacity unless ISA_REG) */
+    ArrayData *addr_array;       /* Array of the element OP_ARRAY_ADDR_2D last read, or NULL */
+    size_t addr_index;           /* That element's index in addr_array->u.data */
     
     /* File I/O */
     FILE *file_handles[8];       /* File handles for channels 1-7 (0 unused) */
@@ -112,6 +182,7 @@ typedef struct {
     char input_buffer[256];      /* Buffer for INPUT line */
     char *input_ptr;             /* Current position in input buffer */
     int input_available;         /* 1 if there's unparsed input in buffer */
+    uint8_t host_input;          /* INPUT stops with VM_RUN_INPUT instead of reading stdin */
     
     /* Simulated memory buffer for PEEK/POKE (64KB) */
     unsigned char *memory;       /* 64KB memory buffer (0-65535) */
@@ -119,12 +190,28 @@ typedef struct {
     /* Reference to compiled program */
     CompiledProgram *program;
     
+    /* Line number -> pc for GOTO/GOSUB to a computed line: line_limit */
+    /* entries (the highest line number + 1), -1 where no line starts */
+    int32_t *line_pcs;
+    size_t line_limit;
+    
+    /* Execution-ready copy of program->code, terminated by an OP_HALT sentinel */
+    DecodedInstruction *decoded; /* code_len + 1 entries */
+    uint8_t decoded_bound;       /* VM_BOUND_*: how handler labels are filled in */
+    
+    /* Native code for hot line ranges (NULL unless built with the JIT) */
+    struct JitState *jit;
+    
 } VMState;
 
 /* VM functions */
 VMState* vm_init(CompiledProgram *program);
 void vm_free(VMState *vm);
-void vm_execute(VMState *vm);
+void vm_execute(VMState *vm);   /* vm_run() with VM_RUN_UNLIMITED */
+VMRunStatus vm_run(VMState *vm, uint64_t max_instructions);
+void vm_provide_input(VMState *vm, const char *line);
+void vm_step(VMState *vm);       /* Execute only the instruction at vm->pc */
+void vm_set_jit_threshold(VMState *vm, unsigned threshold);
 
 /* Stack operations */
 void vm_push(VMState *vm, Value value);
@@ -133,6 +220,7 @@ void vm_push_number(VMState *vm, double n);
 void vm_push_string(VMState *vm, char *s);
 double vm_pop_number(VMState *vm);
 char* vm_pop_string(VMState *vm);
+void vm_num_push(VMState *vm, double n);
 
 /* Call stack operations */
 void vm_call_push(VMState *vm, uint32_t return_addr);
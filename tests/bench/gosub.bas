@@ -0,0 +1,14 @@
+10 REM Benchmark: GOSUB/RETURN and IF/GOTO control flow (Collatz steps)
+20 T=0
+30 FOR N=1 TO 50000
+40 X=N
+50 GOSUB 1000
+60 NEXT N
+70 PRINT T
+80 END
+1000 REM Count Collatz steps for X into T
+1010 IF X=1 THEN RETURN
+1020 T=T+1
+1030 IF X-INT(X/2)*2=0 THEN X=X/2:GOTO 1010
+1040 X=3*X+1
+1050 GOTO 1010
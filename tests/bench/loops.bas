@@ -0,0 +1,9 @@
+10 REM Benchmark: nested FOR loops with scalar arithmetic
+20 S=0
+30 FOR I=1 TO 3000
+40 FOR J=1 TO 1000
+50 S=S+I*J-J
+60 NEXT J
+70 NEXT I
+80 PRINT S
+90 END
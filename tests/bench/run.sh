@@ -0,0 +1,73 @@
+#!/bin/bash
+# Benchmark runner - times the VM on the programs in tests/bench
+#
+# Usage: tests/bench/run.sh [vm_binary ...]
+#
+# Each benchmark is compiled once with ./basset_compile, checked against its
+# .bas.expected output, and then run RUNS times (default 3) on every VM
+# binary given on the command line (default ./basset_vm). The best wall-clock
+# time of the runs is reported, so two builds can be compared side by side:
+#
+#   make clean && make DISPATCH=switch && cp basset_vm /tmp/basset_vm_switch
+#   make clean && make && tests/bench/run.sh /tmp/basset_vm_switch ./basset_vm
+#
+# COMPILE_FLAGS is passed to the compiler, e.g. COMPILE_FLAGS=--isa=reg,
+# and VM_FLAGS to every VM, e.g. VM_FLAGS=--jit-threshold=1.
+
+RUNS=${RUNS:-3}
+FAIL=0
+
+# Get script directory to support running from anywhere
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+PROJECT_ROOT="$(cd "$SCRIPT_DIR/../.." && pwd)"
+cd "$PROJECT_ROOT"
+
+if [ $# -eq 0 ]; then
+    set -- ./basset_vm
+fi
+
+TIMEFORMAT=%R
+
+printf "%-12s" "benchmark"
+for vm in "$@"; do
+    printf " %22s" "$(basename "$vm")"
+done
+printf "\n"
+
+for bench_file in tests/bench/*.bas; do
+    bench_name=$(basename "$bench_file" .bas)
+    expected_file="${bench_file}.expected"
+    abc_file="/tmp/bench_${bench_name}.abc"
+
+    if ! ./basset_compile $COMPILE_FLAGS "$bench_file" "$abc_file" > /dev/null 2>&1; then
+        echo "✗ $bench_name - COMPILE ERROR"
+        FAIL=$((FAIL + 1))
+        continue
+    fi
+
+    printf "%-12s" "$bench_name"
+    for vm in "$@"; do
+        # Check output before timing anything
+        if [ -f "$expected_file" ] && ! "$vm" $VM_FLAGS "$abc_file" 2>&1 | diff -q - "$expected_file" > /dev/null; then
+            printf " %22s" "OUTPUT MISMATCH"
+            FAIL=$((FAIL + 1))
+            continue
+        fi
+
+        best=""
+        for run in $(seq "$RUNS"); do
+            t=$( { time "$vm" $VM_FLAGS "$abc_file" > /dev/null 2>&1; } 2>&1 )
+            if [ -z "$best" ] || awk "BEGIN { exit !($t < $best) }"; then
+                best=$t
+            fi
+        done
+        printf " %21ss" "$best"
+    done
+    printf "\n"
+    rm -f "$abc_file"
+done
+
+if [ $FAIL -gt 0 ]; then
+    exit 1
+fi
+exit 0
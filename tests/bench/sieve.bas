@@ -0,0 +1,19 @@
+10 REM Benchmark: sieve of Eratosthenes, repeated
+20 N=8190
+30 DIM F(8190)
+40 FOR R=1 TO 200
+50 C=0
+60 FOR I=0 TO N
+70 F(I)=1
+80 NEXT I
+90 FOR I=2 TO N
+100 IF F(I)=0 THEN 160
+110 C=C+1
+120 K=I+I
+130 IF K>N THEN 160
+140 F(K)=0
+150 K=K+I:GOTO 130
+160 NEXT I
+170 NEXT R
+180 PRINT C
+190 END
@@ -0,0 +1,10 @@
+10 REM Benchmark: string functions and string variables
+20 L=0
+30 FOR I=1 TO 500000
+40 A$=STR$(I)
+50 B$=LEFT$(A$,2)
+60 C$=RIGHT$(A$,1)
+70 L=L+LEN(B$)+ASC(C$)-48+VAL(B$)
+80 NEXT I
+90 PRINT L
+100 END
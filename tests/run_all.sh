@@ -23,8 +23,8 @@ echo "╚═══════════════════════
 echo ""
 
 # Check that binaries exist
-if [ ! -f "./basset_compile" ] || [ ! -f "./basset_vm" ]; then
-    echo "Error: Binaries not found. Run 'make' first."
+if [ ! -f "./basset_compile" ] || [ ! -f "./basset_vm" ] || [ ! -f "./tests/vm/vm_run_test" ]; then
+    echo "Error: Binaries not found. Run 'make test' first."
     exit 1
 fi
 
@@ -59,6 +59,14 @@ echo ""
 ./tests/tokenizer/run.sh
 TOKENIZER_EXIT=$?
 
+echo ""
+echo "═══════════════════════════════════════════════════════════════"
+echo " VM Host Interface Tests"
+echo "═══════════════════════════════════════════════════════════════"
+echo ""
+./tests/vm/run.sh
+VM_EXIT=$?
+
 echo ""
 echo "╔════════════════════════════════════════════════════════════╗"
 echo "║                    OVERALL RESULTS                         ║"
@@ -88,9 +96,15 @@ else
     echo "✗ Tokenizer tests: FAIL"
 fi
 
+if [ $VM_EXIT -eq 0 ]; then
+    echo "✓ VM host interface tests: PASS"
+else
+    echo "✗ VM host interface tests: FAIL"
+fi
+
 echo ""
 
-if [ $VALIDATION_EXIT -eq 0 ] && [ $STANDARD_EXIT -eq 0 ] && [ $ERRORS_EXIT -eq 0 ] && [ $TOKENIZER_EXIT -eq 0 ]; then
+if [ $VALIDATION_EXIT -eq 0 ] && [ $STANDARD_EXIT -eq 0 ] && [ $ERRORS_EXIT -eq 0 ] && [ $TOKENIZER_EXIT -eq 0 ] && [ $VM_EXIT -eq 0 ]; then
     echo "All test suites completed successfully!"
     exit 0
 else
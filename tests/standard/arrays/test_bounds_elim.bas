@@ -0,0 +1,24 @@
+10 REM Array accesses subscripted by FOR loop variables
+20 DIM A(20)
+30 DIM B(4,6)
+40 FOR I=0 TO 20
+50 A(I)=I*I
+60 NEXT I
+70 S=0
+80 FOR I=20 TO 1 STEP -2
+90 S=S+A(I)
+100 NEXT I
+110 PRINT "SUM = ";S
+120 FOR I=0 TO 4: FOR J=0 TO 6
+130 B(I,J)=I*10+J
+140 NEXT J: NEXT I
+150 T=0
+160 FOR J=6 TO 0 STEP -1: FOR I=4 TO 0 STEP -1: T=T+B(I,J): NEXT I: NEXT J
+170 PRINT "TOTAL = ";T
+180 PRINT "B(4,6) = ";B(4,6)
+190 REM The body may still change the subscript: stays checked
+200 FOR K=0 TO 20
+210 A(K)=K
+220 IF K=5 THEN K=30
+230 NEXT K
+240 PRINT "A(5) = ";A(5)
@@ -0,0 +1,40 @@
+10 REM Assignments that read and write back the same element
+20 DIM A(4,4),B(5,5),C(4,4)
+30 FOR I=0 TO 4: FOR J=0 TO 4
+40 A(I,J)=1: B(I,J)=I+J: C(I,J)=I*J
+50 NEXT J: NEXT I
+60 FOR I=0 TO 4: FOR J=0 TO 4
+70 A(I,J)=A(I,J)+B(I,J)*C(I,J)
+80 NEXT J: NEXT I
+90 PRINT "A(2,3) = ";A(2,3);"  A(4,4) = ";A(4,4)
+100 REM Repeated compound subscripts
+110 FOR I=0 TO 3: FOR J=0 TO 4
+120 A(I+1,J)=A(I+1,J)+B(I+1,J)-C(I+1,J)
+130 NEXT J: NEXT I
+140 PRINT "A(1,0) = ";A(1,0);"  A(4,4) = ";A(4,4)
+150 S=0
+160 FOR I=0 TO 4: S=S+B(I*2/2,I)+B(I*2/2,I): NEXT I
+170 PRINT "S = ";S
+180 REM The element read twice, and a different element read
+190 I=2: J=3
+200 A(I,J)=A(I,J)*A(I,J)-A(J,I)
+210 PRINT "A(2,3) = ";A(2,3)
+220 IF I=2 THEN A(I,J)=A(I,J)/2: A(J-1,I+1)=A(J-1,I+1)+1
+230 PRINT "A(2,3) = ";A(2,3)
+240 REM An array without DIM
+250 FOR I=0 TO 3: FOR J=0 TO 3
+260 Z(I,J)=Z(I,J)+I*10+J
+270 Z(I,J)=Z(I,J)*2
+280 NEXT J: NEXT I
+290 PRINT "Z(3,2) = ";Z(3,2)
+300 REM Redimensioned between updates
+310 DIM A(2,2)
+320 A(1,1)=A(1,1)+5
+330 PRINT "A(1,1) = ";A(1,1)
+340 REM Out of range: the error comes from the read
+350 TRAP 400
+360 I=9: J=0
+370 A(I,J)=A(I,J)+1
+380 PRINT "NOT REACHED"
+390 END
+400 PRINT "ERROR ";ERR
@@ -0,0 +1,35 @@
+10 REM Loops over numeric arrays (traced to native code in JIT builds)
+20 DIM A(300):DIM B(300)
+30 FOR I=0 TO 300:A(I)=I:B(I)=0:NEXT I
+40 REM Nested loops with a branch that changes direction
+50 FOR R=1 TO 20
+60 FOR I=1 TO 300
+70 IF A(I)/2=INT(A(I)/2) THEN B(I)=B(I)+R:GOTO 90
+80 B(I)=B(I)-1
+90 NEXT I
+100 NEXT R
+110 S=0:FOR I=0 TO 300:S=S+B(I):NEXT I
+120 PRINT S;" ";B(1);" ";B(2)
+130 REM Comparisons as values
+140 C=0:FOR I=0 TO 300:C=C+(A(I)>150)-(A(I)<=20):NEXT I
+150 PRINT C;" ";I
+160 REM GOTO loop calling a subroutine
+170 K=0:T=0
+180 K=K+1
+185 GOSUB 500:IF K<250 THEN 180
+190 PRINT T
+200 REM Errors inside a hot loop still reach TRAP
+210 TRAP 250
+220 FOR I=1 TO 300:Q=A(I)/(I-260):NEXT I
+230 PRINT "WRONG NO TRAP"
+240 END
+250 PRINT "TRAPPED";ERR;" AT";I
+260 TRAP 300
+270 FOR I=0 TO 400:B(I)=-A(I):NEXT I
+280 PRINT "WRONG NO TRAP"
+290 END
+300 PRINT "TRAPPED";ERR;" AT";I;" ";B(300)
+310 END
+500 T=T+K*2
+505 IF T>1000 THEN T=T-1000
+510 RETURN
@@ -0,0 +1,16 @@
+10 REM Constant folding: constant subexpressions are evaluated by the
+20 REM compiler and must print exactly what the VM would compute
+30 PRINT 2*3+1, -(-4), 2^10, 7/2
+40 PRINT 1<2; 2<1; 1 AND 0; 1 OR 0; NOT 0; NOT 5
+50 PRINT SQR(16), INT(-2.5), ABS(-3), SGN(-7), EXP(0), LOG(1), CLOG(100)
+60 PRINT CHR$(65); CHR$(66); " "; LEN("ABC"); ASC("B"); VAL("12.5"); " "; STR$(1/4)
+70 Y=5: PRINT Y*1, 1*Y, Y/1, Y-0, Y^1
+80 PRINT NOT NOT (Y>3), NOT NOT Y
+90 X=-0: PRINT X, X+0, X-0
+100 FOR I=10 TO 1 STEP -1: S=S+I: NEXT I: PRINT "S = ";S
+110 TRAP 200: Z=1/0
+120 END
+200 PRINT "ERR ";ERR
+210 TRAP 300: Z=SQR(-1)
+220 END
+300 PRINT "ERR ";ERR
@@ -0,0 +1,17 @@
+10 REM Numeric expressions typed at compile time (number stack)
+20 A=1.5:B=2.5:C=4:D=-2
+30 X=(A+B)*(C-D)/2-A*B:PRINT "X=";X
+40 Y=-(A*C)+C^2-(D*D):PRINT "Y=";Y
+50 PRINT (A<B)+(B<A)*2;" ";(C>=4 AND D<0);" ";(A=B OR NOT C=0)
+60 PRINT "SQR=";SQR(C*C+3*3);" VAL=";VAL("12")*2+1
+70 A$="HI":B$="HO"
+80 PRINT A$<B$;" ";A$=B$;" ";LEFT$(B$,C-3);" ";STR$(C*2);" ";CHR$(64+C)
+90 S=0:FOR I=1 TO 500:S=S+(I*A-B)/(C+I)*(I-D):NEXT I
+100 PRINT "S=";INT(S)
+110 TRAP 150
+120 FOR I=1 TO 400:Q=(A+B)*(C+1/(I-300))-A:NEXT I
+130 PRINT "WRONG NO TRAP"
+140 END
+150 PRINT "TRAPPED";ERR;" AT";I
+160 Z=(A+B)*(C+D)-1:PRINT "Z=";Z
+170 END
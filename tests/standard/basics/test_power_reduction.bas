@@ -0,0 +1,11 @@
+10 REM Test powers and divisions the compiler turns into multiplies:
+20 REM X^2 (and with -O X^3, X^4) and division by a power of two
+30 X=3: A=7: B=2.5: N=-2
+40 PRINT X^2;" ";X^3;" ";X^4;" ";N^3;" ";N^4
+50 PRINT (A-B)^2;" ";(A-B)^3;" ";(A+B)^4
+60 D=(A-B)^2+(X-1)^2: PRINT D
+70 E=((A-B)^2-0.25)^2: PRINT E
+80 PRINT X/4;" ";A/-0.5;" ";N/2;" ";(A-B)/8;" ";X/3
+90 REM Other exponents still use the power function
+100 PRINT X^0;" ";X^1.5;" ";X^-1;" ";2^X
+110 FOR I=1 TO 4: S=S+I^2: NEXT I: PRINT S
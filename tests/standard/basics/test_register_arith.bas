@@ -0,0 +1,26 @@
+10 REM Nested arithmetic (register instructions under --isa=reg)
+20 A=3:B=4:C=0.5
+30 D=A*A+B*B
+40 PRINT D
+50 E=-(A-B)/2+SQR(D)
+60 PRINT E
+70 F=((A+B)*(A-B)-(B/C))^2
+80 PRINT F
+90 G=A:G=G*G:G=-G
+100 PRINT G
+110 H=A+B*C-A/B+2^3
+120 PRINT H
+130 PRINT A*B+1;" ";-A+B;" ";(A+1)*(B+1)
+140 DIM X(10)
+150 FOR I=1 TO 5:X(I)=I*I+1:NEXT I
+160 S=0:FOR I=1 TO 5:S=S+X(I)*2-1:NEXT I
+170 PRINT S
+180 IF A*B-12=0 THEN PRINT "A*B=12"
+190 IF -A>B THEN PRINT "WRONG" ELSE PRINT "-A<=B"
+200 Z=0
+210 TRAP 250
+220 Q=A/Z
+230 PRINT "WRONG NO TRAP"
+240 END
+250 PRINT "TRAPPED";ERR
+260 PRINT A/B*Z+1
@@ -0,0 +1,6 @@
+10 REM More nested operands than register temporaries: stack code
+20 I=1
+30 X=I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(1))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))
+40 PRINT X
+50 PRINT I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(1))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))
+60 IF I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(1))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))>I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(I+(1))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))-1 THEN PRINT "OK"
@@ -0,0 +1,15 @@
+10 REM Test runs of numeric assignments, which -O compiles through SSA:
+20 REM repeated values, copies, overwritten and swapped variables
+30 A=3: B=4: C=5: X=0: Y=7
+40 X=A*B+C: Y=(A*B+C)*2: Z=Y: Z=Z+1
+50 PRINT X;" ";Y;" ";Z
+60 T=X: X=Y: Y=T: PRINT X;" ";Y;" ";T
+70 Q=A+B: A=10: R=Q*(A+B)+(A+B): PRINT Q;" ";R;" ";A
+80 W=1: W=2: W=W*(B+C)*(B-C)+(B+C)*(B-C): PRINT W
+90 N=A: A=B: B=N*2: C=(N+1)*(N+1)+(N+1)*(N+1): PRINT A;" ";B;" ";C
+100 P=A-B: A=P*P: B=P*P*P: P=B-A: PRINT P;" ";A;" ";B
+110 U=X: X=U: V=-U: V=-V: PRINT X;" ";U;" ";V
+120 H=A: GOTO 140
+130 H=999
+140 H=H+1: K=H*2: PRINT H;" ";K
+150 F=1/B: F=B: G=(A>B)+(A<B)*2: PRINT F;" ";G
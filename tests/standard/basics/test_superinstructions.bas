@@ -0,0 +1,18 @@
+10 REM Fused sequences: I=I+c, I=I-c, A*B and A(I)
+20 DIM A(5)
+30 FOR I=0 TO 5
+40 A(I)=I*I
+50 NEXT I
+60 J=0:S=0
+70 S=S+A(J)
+80 J=J+1
+90 IF J<=5 THEN 70
+100 PRINT "SUM OF SQUARES ";S
+110 K=10:K=K-2.5:PRINT "K=";K
+120 X=3:Y=4:Z=X*Y:PRINT "X*Y=";Z
+130 L=K+1:PRINT "L=";L;" K=";K
+140 TRAP 200
+150 J=6:PRINT A(J)
+160 PRINT "NOT REACHED"
+200 PRINT "TRAPPED ERR=";ERR
+210 END
@@ -0,0 +1,28 @@
+10 REM IF with a single numeric comparison (fused compare-and-branch)
+20 A=3:B=5
+30 IF A<B THEN PRINT "A<B"
+40 IF B<A THEN PRINT "WRONG B<A"
+50 IF A<=3 THEN PRINT "A<=3"
+60 IF A<=2 THEN PRINT "WRONG A<=2"
+70 IF B>A THEN PRINT "B>A"
+80 IF A>B THEN PRINT "WRONG A>B"
+90 IF B>=5 THEN PRINT "B>=5"
+100 IF B>=6 THEN PRINT "WRONG B>=6"
+110 IF A=3 THEN PRINT "A=3"
+120 IF A=4 THEN PRINT "WRONG A=4"
+130 IF A<>4 THEN PRINT "A<>4"
+140 IF A<>3 THEN PRINT "WRONG A<>3"
+150 IF A*2+1>B THEN PRINT "A*2+1>B" ELSE PRINT "WRONG ELSE"
+160 IF INT(B/2)=2 THEN PRINT "INT(B/2)=2"
+170 IF LEN("ABC")<>A THEN PRINT "WRONG LEN" ELSE PRINT "LEN=A"
+180 IF (A<B)=1 THEN PRINT "(A<B)=1"
+190 A$="X":B$="Y"
+200 IF A$<B$ THEN PRINT "A$<B$"
+210 IF A$=B$ THEN PRINT "WRONG A$=B$"
+220 I=0
+230 I=I+1
+240 IF I<1000 THEN 230
+250 PRINT "I=";I
+260 IF I>=1000 THEN 280
+270 PRINT "WRONG FALLTHROUGH"
+280 END
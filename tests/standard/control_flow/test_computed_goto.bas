@@ -0,0 +1,37 @@
+10 REM Test GOTO and GOSUB to computed line numbers
+20 S = 0
+30 FOR I = 1 TO 8
+40 K = I - INT(I / 4) * 4
+50 GOTO K * 100 + 1000
+60 NEXT I
+70 PRINT " S=";S
+80 FOR I = 1 TO 3
+90 GOSUB I * 10 + 2000
+100 NEXT I
+110 PRINT
+120 TRAP 200
+130 L = 1050: GOTO L
+140 PRINT "WRONG"
+200 PRINT "MISSING LINE";ERR
+210 TRAP 300
+220 L = 5000
+230 GOSUB L
+240 PRINT "WRONG"
+300 PRINT "PAST LAST LINE";ERR
+310 END
+1000 PRINT "A";
+1010 S = S + 1
+1020 GOTO 60
+1100 PRINT "B";
+1110 S = S + 10
+1120 GOTO 60
+1200 PRINT "C";
+1210 S = S + 100
+1220 GOTO 60
+1300 PRINT "D";
+1310 S = S + 1000
+1320 GOTO 60
+2010 PRINT "ONE ";
+2020 PRINT "TWO ";
+2030 PRINT "THREE ";
+2040 RETURN
@@ -0,0 +1,20 @@
+10 REM Test code only some paths reach: -O drops what nothing can
+20 REM reach, but keeps ON, TRAP, GOSUB and DATA targets after END
+30 GOSUB 500: PRINT "BACK"
+40 GOTO 60: PRINT "UNREACHED"
+50 PRINT "UNREACHED"
+60 K=2: ON K GOTO 600,700
+70 PRINT "AFTER ON"
+80 TRAP 800: A=1/0
+90 READ A,B: PRINT "READ ";A;" ";B
+100 GOTO 1000
+110 PRINT "UNREACHED"
+500 PRINT "SUBROUTINE": RETURN
+510 PRINT "UNREACHED"
+600 PRINT "UNREACHED"
+700 PRINT "ON TARGET": GOTO 70
+800 PRINT "TRAPPED": GOTO 90
+900 DATA 3,4
+1000 PRINT "DONE"
+1010 END
+1020 PRINT "UNREACHED"
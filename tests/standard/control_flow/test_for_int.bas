@@ -0,0 +1,40 @@
+10 REM Test FOR loops the compiler counts in integers
+20 FOR I = 1 TO 3
+30 PRINT I;
+40 NEXT I
+50 PRINT " AFTER";I
+60 FOR I = 10 TO 1 STEP -4
+70 PRINT I;
+80 NEXT I
+90 PRINT " AFTER";I
+100 FOR I = 5 TO 1
+110 PRINT "NEVER"
+120 NEXT I
+130 PRINT "ZERO PASS";I
+140 REM The body moves the variable
+150 FOR I = 1 TO 10
+160 PRINT I;
+170 I = I + 2
+180 NEXT I
+190 PRINT " AFTER";I
+200 REM A start that is not a whole number at run time
+210 S = 0.5
+220 FOR I = S TO 3
+230 PRINT I;
+240 NEXT I
+250 PRINT " AFTER";I
+260 REM Nested loops with a runtime limit
+270 N = 3
+280 T = 0
+290 FOR I = 1 TO N
+300 FOR J = I TO N
+310 T = T + I * J
+320 NEXT J
+330 NEXT I
+340 PRINT "T=";T;" I=";I;" J=";J
+350 REM Bare NEXT closes an integer loop too
+360 FOR K = -2 TO 2 STEP 2
+370 PRINT K;
+380 NEXT
+390 PRINT " AFTER";K
+400 END
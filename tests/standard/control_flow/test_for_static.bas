@@ -0,0 +1,41 @@
+10 REM Test FOR loops the compiler pairs with their NEXT
+20 N = 3
+30 FOR I = 1 TO N
+40 N = 10
+50 PRINT I;
+60 NEXT I
+70 PRINT " AFTER";I;" N=";N
+80 REM NEXT J,I closes both loops
+90 T = 0
+100 FOR I = 1 TO 3
+110 FOR J = 1 TO I
+120 T = T + J
+130 NEXT J,I
+140 PRINT "T=";T;" I=";I;" J=";J
+150 REM A jump that stays inside the body
+160 FOR I = 1 TO 6
+170 IF I / 2 = INT(I / 2) THEN GOTO 190
+180 PRINT I;
+190 NEXT I
+200 PRINT
+210 REM A GOSUB from the body to a routine with its own loop
+220 FOR I = 1 TO 2
+230 GOSUB 500
+240 NEXT
+250 PRINT "S=";S;" I=";I
+260 REM A GOTO out of the body leaves the loop on the FOR stack
+270 FOR I = 1 TO 10
+280 IF I = 4 THEN GOTO 300
+290 NEXT I
+300 PRINT "LEFT AT";I
+310 REM A STEP computed at run time
+320 D = -0.5
+330 FOR X = 1 TO 0 STEP D
+340 PRINT X;
+350 NEXT X
+360 PRINT " AFTER";X
+370 END
+500 FOR K = 1 TO 3
+510 S = S + K * I
+520 NEXT K
+530 RETURN
@@ -0,0 +1,19 @@
+10 REM Test FOR with a fractional STEP
+20 FOR X = 0 TO 1 STEP 0.25
+30 PRINT X;
+40 NEXT X
+50 PRINT
+60 FOR X = 1 TO 0 STEP -0.5
+70 PRINT X;
+80 NEXT X
+90 PRINT
+100 FOR X = 0.5 TO 3 STEP 1.5
+110 PRINT X;
+120 NEXT X
+130 PRINT
+140 N = 0
+150 FOR X = 0 TO 10 STEP 0.5
+160 N = N + 1
+170 NEXT X
+180 PRINT "PASSES";N;" AFTER";X
+190 END
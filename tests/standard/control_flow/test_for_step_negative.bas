@@ -0,0 +1,21 @@
+10 REM Test FOR with a negative STEP
+20 FOR I = 10 TO 1 STEP -3
+30 PRINT I;
+40 NEXT I
+50 PRINT
+60 S = -2
+70 FOR I = 6 TO 0 STEP S
+80 PRINT I;
+90 NEXT I
+100 PRINT
+110 FOR I = 3 TO 1 STEP -(1 + 1)
+120 PRINT I;
+130 NEXT I
+140 PRINT
+150 REM The body runs once even when the range is empty
+160 FOR I = 1 TO 5 STEP -1
+170 PRINT I;
+180 NEXT I
+190 PRINT
+200 PRINT "AFTER";I
+210 END
@@ -0,0 +1,13 @@
+10 REM Test FOR with STEP 0: it counts as a negative STEP, so the loop
+20 REM ends once the variable is below the limit and repeats otherwise
+30 FOR I = 1 TO 3 STEP 0
+40 PRINT I;
+50 NEXT I
+60 PRINT
+70 N = 0
+80 FOR I = 3 TO 1 STEP 0
+90 N = N + 1
+100 IF N = 4 THEN I = 0
+110 NEXT I
+120 PRINT "PASSES";N;" AFTER";I
+130 END
@@ -0,0 +1,25 @@
+10 REM Test GOSUB inlining: small leaf subroutines are compiled
+20 REM in place, the rest are called; all must behave the same
+30 S=0
+40 FOR I=1 TO 10
+50 GOSUB 1000
+60 NEXT I
+70 PRINT "SUM OF SQUARES = ";S
+80 X=3: GOSUB 3000: PRINT "X = ";X
+90 GOSUB 2000
+100 IF S>0 THEN GOSUB 4000
+110 N=0: GOSUB 5000: PRINT "N = ";N
+120 GOSUB 1010: PRINT "S = ";S
+130 END
+1000 REM ADD I SQUARED
+1010 S=S+I*I: RETURN
+2000 PRINT "CALLED": GOTO 2010
+2010 RETURN
+3000 X=X*2
+3010 X=X+1
+3020 RETURN
+4000 PRINT "IN THEN"
+4010 RETURN
+5000 N=N+1
+5010 N=N+1: N=N+1: N=N+1: N=N+1
+5020 RETURN
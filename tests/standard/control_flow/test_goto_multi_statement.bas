@@ -0,0 +1,13 @@
+10 REM GOTO, GOSUB and ON into a line of several statements start at its first
+20 GOTO 100
+30 PRINT "NOT REACHED"
+100 PRINT "A";: PRINT "B";: PRINT "C";: PRINT "D";: PRINT "E"
+110 N=N+1: IF N<2 THEN 100
+120 GOSUB 300
+130 FOR K=1 TO 2: ON K GOTO 200,210
+200 PRINT "ON1 ";: X=1: PRINT X;: PRINT " ";: GOTO 220
+210 PRINT "ON2 ";: X=2: PRINT X;: PRINT " ";: GOTO 220
+220 PRINT "K=";K: NEXT K
+230 END
+300 PRINT "S1 ";: PRINT "S2 ";: PRINT "S3 ";: PRINT "S4 ";: PRINT "S5"
+310 RETURN
@@ -0,0 +1,30 @@
+10 REM Hot loops leaving native code (JIT builds) at errors and strings
+20 DIM A(200)
+30 S=0:T=0
+40 FOR I=0 TO 200:A(I)=I*2:NEXT I
+50 FOR I=1 TO 200
+60 S=S+A(I)-A(I-1)*(I>100)
+70 IF I/2=INT(I/2) THEN T=T+1
+80 GOSUB 500
+90 NEXT I
+100 PRINT S;" ";T;" ";C
+110 N$=""
+120 FOR J=1 TO 150:IF J=149 THEN N$="HOT"
+130 IF N$="HOT" THEN M=M+1
+135 NEXT J
+140 PRINT N$:PRINT M
+150 Z=150:K=0
+160 TRAP 200
+170 FOR I=1 TO 300:K=K+1:Q=I/(Z-I):NEXT I
+180 PRINT "WRONG NO TRAP"
+190 END
+200 PRINT "TRAPPED";ERR;" AT";K
+210 K=0:TRAP 260
+220 FOR I=0 TO 1000:K=K+A(I):NEXT I
+230 PRINT "WRONG NO TRAP"
+240 END
+260 PRINT "TRAPPED";ERR;" AT";I;" SUM";K
+270 FOR I=1 TO 3:FOR J=1 TO 200:NEXT J:PRINT I;J:NEXT I
+280 END
+500 C=C+1:IF C<0 THEN C=0
+510 RETURN
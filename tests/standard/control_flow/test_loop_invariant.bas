@@ -0,0 +1,22 @@
+10 REM Test loop-invariant expressions: -O computes them once before the
+20 REM loop, but anything the body changes or that could fail stays put
+30 X=3: Y=4: N=3: A$="BASSET": DIM A(10)
+40 FOR I=1 TO N
+50 A(I)=I*SQR(X*X+Y*Y)+LEN(A$)
+60 PRINT A(I);" ";2*X+I
+70 NEXT I
+80 REM Y changes in the body, so Y*2 is computed each time
+90 FOR I=1 TO 3: PRINT Y*2;: Y=Y+1: NEXT I: PRINT
+100 REM The inner loop's invariant depends on the outer variable
+110 FOR I=1 TO 2: FOR J=1 TO 2: PRINT I*10+J*(X+1);" ";: NEXT J: NEXT I: PRINT
+120 REM Z is never 0 where it is divided by, and SQR(Z) never negative
+130 Z=0: FOR I=1 TO 3: IF Z<>0 THEN PRINT 1/Z;SQR(Z)
+140 NEXT I
+150 REM DEG in the body changes what SIN returns
+160 FOR I=1 TO 2: PRINT INT(SIN(90)*1000): DEG: NEXT I
+170 RAD
+180 REM A line in the body that is a GOTO target keeps the loop as is
+190 C=0: FOR I=1 TO 2
+200 PRINT "C";C*2+1: C=C+1: IF C=1 THEN 200
+210 NEXT I
+220 PRINT "DONE"
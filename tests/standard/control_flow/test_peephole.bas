@@ -0,0 +1,29 @@
+10 REM Test the code -O rewrites: jumps to jumps, X=X, branches over
+20 REM a GOTO, and loop exits; the output must not depend on -O
+30 X=7: A$="AB"
+40 X=X: A$=A$
+50 PRINT "X = ";X;" A$ = ";A$
+60 FOR I=1 TO 4
+70 IF I=2 THEN 90
+80 IF I<>3 THEN PRINT "I = ";I
+90 NEXT I
+100 GOTO 120
+110 PRINT "SKIPPED"
+120 GOTO 140
+130 PRINT "SKIPPED"
+140 GOSUB 500
+150 FOR K=1 TO 2: ON K GOTO 160,170
+160 X=X: PRINT "ON 1"
+170 GOTO 180
+180 NEXT K
+190 L=200: GOTO L
+200 X=X
+210 PRINT "COMPUTED GOTO"
+220 IF X=7 THEN 240
+230 PRINT "WRONG"
+240 IF X<>7 THEN 260
+250 PRINT "DONE"
+260 END
+500 GOTO 510
+510 GOTO 520
+520 PRINT "SUBROUTINE": RETURN
@@ -0,0 +1,7 @@
+10 REM The last line is an IF: its jump goes to the end of the code
+20 PRINT "HI"
+30 GOTO 50
+40 PRINT "SKIPPED"
+50 FOR M=1 TO 3: PRINT M;: IF M<3 THEN PRINT " Y": NEXT M
+60 IF M>2 THEN PRINT " DONE"
+70 IF 1>2 THEN PRINT "BIG"
@@ -0,0 +1,9 @@
+10 REM A GOTO out of an inner loop leaves its frame on the FOR stack,
+20 REM so the outer NEXT meets it; the outer loop cannot be paired
+30 FOR I = 1 TO 3
+40 FOR J = 1 TO 3
+50 IF J = 2 THEN 70
+60 NEXT J
+70 PRINT I;J
+80 NEXT I
+90 PRINT "DONE"
@@ -0,0 +1,23 @@
+10 REM Errors inside numeric expressions still reach TRAP
+20 X=5:Y=0
+30 TRAP 100
+40 Z=(X+1)*(X/Y)+2
+50 PRINT "FAIL":END
+100 PRINT "DIVIDE TRAPPED";ERR
+110 TRAP 200
+120 B(3)=7
+130 PRINT B(3)+B(4),-B(3),NOT B(4),ABS(X-9),SGN(Y-X),INT(X/2)
+140 B(X*4)=1
+150 PRINT "FAIL":END
+200 PRINT "STORE TRAPPED";ERR
+210 TRAP 300
+220 IF X>4 AND Y<1 THEN PRINT "AND OK"
+230 Z=B(X+6)+1
+240 PRINT "FAIL":END
+300 PRINT "LOAD TRAPPED";ERR;Z
+310 TRAP 400
+320 PRINT LEN("ABC")+ASC("ABC")
+330 Z=SQR(X-Y*2-6)
+340 PRINT "FAIL":END
+400 PRINT "SQR TRAPPED";ERR
+410 END
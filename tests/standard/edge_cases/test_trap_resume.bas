@@ -0,0 +1,19 @@
+10 REM TRAP resumes at its line with an empty stack, RESTORE n pops its line
+20 DATA 7,8
+30 FOR I=1 TO 3
+40 RESTORE 20
+50 READ A,B
+60 NEXT I
+70 PRINT "READ";A;B
+80 TRAP 200
+90 A$="X"
+100 IF A$<5 THEN PRINT "NOT REACHED"
+110 PRINT "NOT REACHED"
+120 END
+200 PRINT "COMPARE TRAPPED";ERR
+210 TRAP 300
+220 X=1+LEN(STR$(1)+5)
+230 PRINT "NOT REACHED"
+240 END
+300 PRINT "CONCAT TRAPPED";ERR
+310 PRINT "DONE"
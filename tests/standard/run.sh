@@ -1,6 +1,14 @@
 #!/bin/bash
 
 # Standard functional test runner for Classic BASIC compiler
+#
+# Extra compiler flags can be passed through COMPILE_FLAGS, e.g.
+#   COMPILE_FLAGS=--isa=reg tests/standard/run.sh
+#   COMPILE_FLAGS=-O tests/standard/run.sh
+# and extra VM flags through VM_FLAGS, e.g.
+#   VM_FLAGS=--jit-threshold=1 tests/standard/run.sh
+# With EMIT_C=1 each test is translated with --emit-c and built against
+# libbasset_rt.a with ${CC:-gcc} instead of being run by basset_vm.
 PASS=0
 FAIL=0
 ERRORS=0
@@ -30,9 +38,18 @@ while IFS= read -r test_file; do
     TOTAL=$((TOTAL + 1))
     test_name=$(basename "$test_file" .bas)
     
-    # Compile the BASIC file
-    ./basset_compile "$test_file" "/tmp/${test_name}.abc" > /dev/null 2>&1
-    if [ $? -ne 0 ]; then
+    # Compile the BASIC file (and with EMIT_C=1 the C translation)
+    if [ "${EMIT_C}" = "1" ]; then
+        ./basset_compile $COMPILE_FLAGS --emit-c "$test_file" "/tmp/${test_name}.c" > /dev/null 2>&1 &&
+            ${CC:-gcc} -O2 -Isrc -o "/tmp/${test_name}" "/tmp/${test_name}.c" libbasset_rt.a -lm > /dev/null 2>&1
+        compile_status=$?
+        run_command="/tmp/${test_name}"
+    else
+        ./basset_compile $COMPILE_FLAGS "$test_file" "/tmp/${test_name}.abc" > /dev/null 2>&1
+        compile_status=$?
+        run_command="./basset_vm $VM_FLAGS /tmp/${test_name}.abc"
+    fi
+    if [ $compile_status -ne 0 ]; then
         echo "✗ $test_name - COMPILE ERROR"
         ERRORS=$((ERRORS + 1))
         continue
@@ -41,9 +58,9 @@ while IFS= read -r test_file; do
     # Run the compiled bytecode
     # If .input file exists, pipe it to the VM for INPUT statements
     if [ -f "$input_file" ]; then
-        ./basset_vm "/tmp/${test_name}.abc" < "$input_file" > "${base_name}.out" 2>&1
+        $run_command < "$input_file" > "${base_name}.out" 2>&1
     else
-        ./basset_vm "/tmp/${test_name}.abc" > "${base_name}.out" 2>&1
+        $run_command > "${base_name}.out" 2>&1
     fi
     exit_code=$?
     
@@ -0,0 +1,9 @@
+10 REM vm_run() stops a long loop for its budget and resumes it
+20 S=0
+30 FOR I=1 TO 20000
+40 S=S+I
+50 NEXT I
+60 N=0
+70 N=N+1
+80 IF N<5000 THEN 70
+90 PRINT S;" ";N
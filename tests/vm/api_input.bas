@@ -0,0 +1,4 @@
+10 REM INPUT stops vm_run() until vm_provide_input() hands it a line
+20 INPUT A
+30 INPUT B$
+40 PRINT A*2;" ";B$
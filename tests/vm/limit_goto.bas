@@ -0,0 +1,3 @@
+10 REM --max-instructions stops a program that never ends
+20 PRINT "START"
+30 GOTO 30
@@ -0,0 +1,91 @@
+#!/bin/bash
+
+# VM host interface test runner
+#
+# Each test_name.bas is compiled and then run one of two ways:
+#   test_name.bas.args     - by tests/vm/vm_run_test, which drives vm_run()
+#                            and vm_provide_input(); one argument per line
+#                            (the budget, then the INPUT lines)
+#   test_name.bas.vmflags  - by basset_vm with these options, one per line
+# Its stdout and stderr, followed by "[exit N]", must match
+# test_name.bas.expected. Extra compiler flags can be passed through
+# COMPILE_FLAGS, as for tests/standard/run.sh.
+PASS=0
+FAIL=0
+ERRORS=0
+TOTAL=0
+
+# Get script directory to support running from anywhere
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+PROJECT_ROOT="$(cd "$SCRIPT_DIR/../.." && pwd)"
+cd "$PROJECT_ROOT"
+
+echo "╔═════════════════════════════════════════════════════╗"
+echo "║        BASIC VM Host Interface Test Runner          ║"
+echo "╚═════════════════════════════════════════════════════╝"
+echo ""
+
+if [ ! -f "./basset_vm" ] || [ ! -f "./tests/vm/vm_run_test" ]; then
+    echo "Error: basset_vm or tests/vm/vm_run_test not found. Run 'make test-vm' first."
+    exit 1
+fi
+
+for test_file in tests/vm/*.bas; do
+    [ -e "$test_file" ] || continue
+
+    base_name="${test_file%.bas}"
+    expected_file="${test_file}.expected"
+
+    if [ ! -f "$expected_file" ]; then
+        echo "⚠ $(basename "$test_file") - no expected file"
+        continue
+    fi
+
+    TOTAL=$((TOTAL + 1))
+    test_name=$(basename "$test_file" .bas)
+
+    if ! ./basset_compile $COMPILE_FLAGS "$test_file" "/tmp/vm_${test_name}.abc" > /dev/null 2>&1; then
+        echo "✗ $test_name - COMPILE ERROR"
+        ERRORS=$((ERRORS + 1))
+        continue
+    fi
+
+    # Run it through the host API or the standalone VM; a broken limit
+    # would otherwise hang the suite, so each run gets a time limit
+    if [ -f "${test_file}.args" ]; then
+        mapfile -t args < "${test_file}.args"
+        timeout 30 ./tests/vm/vm_run_test "/tmp/vm_${test_name}.abc" "${args[@]}" > "${base_name}.out" 2>&1
+    else
+        mapfile -t args < "${test_file}.vmflags"
+        timeout 30 ./basset_vm "${args[@]}" "/tmp/vm_${test_name}.abc" > "${base_name}.out" 2>&1 < /dev/null
+    fi
+    echo "[exit $?]" >> "${base_name}.out"
+
+    if diff -q "${base_name}.out" "$expected_file" > /dev/null 2>&1; then
+        echo "✓ $test_name"
+        PASS=$((PASS + 1))
+        rm -f "${base_name}.out" "/tmp/vm_${test_name}.abc"
+    else
+        echo "✗ $test_name - OUTPUT MISMATCH"
+        FAIL=$((FAIL + 1))
+        if [ "${SHOW_DIFF}" = "1" ]; then
+            diff -u "$expected_file" "${base_name}.out" | head -15 | sed 's/^/    /'
+            echo ""
+        fi
+    fi
+done
+
+echo ""
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+echo "Results: $PASS passed, $FAIL failed, $ERRORS errors"
+if [ $TOTAL -gt 0 ]; then
+    PERCENT=$((PASS * 100 / TOTAL))
+    echo "Success rate: ${PERCENT}% ($PASS/$TOTAL)"
+fi
+echo "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━"
+
+if [ $FAIL -gt 0 ] || [ $ERRORS -gt 0 ]; then
+    exit 1
+fi
+
+exit 0
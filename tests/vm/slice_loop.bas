@@ -0,0 +1,6 @@
+10 REM --slice runs the program to the end a slice at a time
+20 S=0
+30 FOR I=1 TO 1000
+40 S=S+I
+50 NEXT I
+60 PRINT S
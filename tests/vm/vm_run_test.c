@@ -0,0 +1,73 @@
+/* vm_run_test.c - Drives a program through the vm_run() host API */
+/*
+ * Usage: vm_run_test <program.abc> <budget> [input line...]
+ *
+ * Runs the program in slices of about <budget> instructions with
+ * host_input set, answering each VM_RUN_INPUT stop with the next input
+ * line through vm_provide_input(). The program's output is followed by
+ * a summary line naming how the run ended and whether it yielded for
+ * the budget, so the .expected file does not depend on how many slices
+ * the budget estimate happens to need.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "vm.h"
+#include "bytecode_file.h"
+
+int main(int argc, char **argv) {
+    CompiledProgram *prog;
+    VMState *vm;
+    VMRunStatus status;
+    unsigned long budget, yields = 0;
+    int next_input = 3, result = 0;
+
+    if (argc < 3 || (budget = strtoul(argv[2], NULL, 10)) == 0) {
+        fprintf(stderr, "Usage: %s <program.abc> <budget> [input line...]\n", argv[0]);
+        return 1;
+    }
+
+    prog = bytecode_file_load(argv[1]);
+    if (!prog) {
+        fprintf(stderr, "Failed to load bytecode file\n");
+        return 1;
+    }
+    vm = vm_init(prog);
+    if (!vm) {
+        fprintf(stderr, "VM initialization failed\n");
+        compiled_program_free(prog);
+        return 1;
+    }
+    vm->host_input = 1;
+
+    for (;;) {
+        status = vm_run(vm, budget);
+        if (status == VM_RUN_BUDGET) {
+            yields++;
+        } else if (status == VM_RUN_INPUT) {
+            /* Until it has its line, the INPUT does not resume */
+            if (vm_run(vm, budget) != VM_RUN_INPUT) {
+                printf("\nRESUMED WITHOUT INPUT\n");
+                result = 1;
+                break;
+            }
+            if (next_input >= argc) {
+                printf("\nOUT OF INPUT\n");
+                result = 1;
+                break;
+            }
+            vm_provide_input(vm, argv[next_input++]);
+        } else {
+            break;
+        }
+    }
+
+    if (status == VM_RUN_FINISHED) {
+        printf("FINISHED%s\n", yields ? " AFTER YIELDING" : "");
+    } else if (status == VM_RUN_ERROR) {
+        printf("ERROR\n");
+    }
+
+    vm_free(vm);
+    compiled_program_free(prog);
+    return result;
+}